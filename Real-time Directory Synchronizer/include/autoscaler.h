@@ -0,0 +1,55 @@
+#include <stdlib.h>
+
+#define AUTOSCALER_INTERVAL_MS 1000   // Time between two adjustments of the worker limit
+
+// This struct decides how many workers can run at the same time
+// The limit grows while jobs wait in the queue and every worker is busy, as long as the
+// devices of the monitored directories are not saturated. It shrinks when a device is
+// saturated and the throughput of every worker drops, or when workers stay idle.
+// Device utilisation is the share of time a device spent doing I/O, from /proc/diskstats
+typedef struct autoscaler *Autoscaler;
+
+// Statistics of last interval and current limit
+struct autoscaler_status {
+    int limit;              // Current maximum number of active workers
+    int min_limit;
+    int max_limit;
+    int automatic;          // 1 if limit is adjusted automatically, 0 if it was set from console
+    double utilisation;     // Highest utilisation of a tracked device (0-1), -1 if unknown
+    double throughput;      // Bytes copied per second by a busy worker, -1 if no job finished
+};
+
+// Initializes autoscaler with limit between min_limit and max_limit
+// Returns NULL if malloc fails
+Autoscaler autoscaler_init(int min_limit, int max_limit, int limit);
+
+// Adds the device that dir is stored on to the devices whose utilisation is tracked
+// Returns 0 on success, -1 if stat or malloc fails
+int autoscaler_add_device(Autoscaler autoscaler, char *dir);
+
+// Records a finished job that copied bytes in busy_ms milliseconds
+void autoscaler_job_done(Autoscaler autoscaler, long long bytes, long long busy_ms);
+
+// Returns milliseconds until the next adjustment is due
+int autoscaler_timeout(Autoscaler autoscaler);
+
+// Adjusts limit if an interval has passed since the last adjustment, based on the number of
+// queued jobs waiting for a worker and active workers
+// Returns 1 if the limit changed, 0 otherwise
+int autoscaler_update(Autoscaler autoscaler, size_t queue_depth, int active_workers);
+
+// Returns current limit
+int autoscaler_limit(Autoscaler autoscaler);
+
+// Sets a fixed limit and stops automatic adjustments
+// Returns 0 on success, -1 if limit is not between 1 and the maximum limit
+int autoscaler_set_limit(Autoscaler autoscaler, int limit);
+
+// Starts adjusting limit automatically again
+void autoscaler_set_auto(Autoscaler autoscaler);
+
+// Writes current limit and statistics of last interval to status
+void autoscaler_get_status(Autoscaler autoscaler, struct autoscaler_status *status);
+
+// Frees resources for autoscaler
+void autoscaler_destroy(Autoscaler autoscaler);
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+
+#define CONSOLE_MAX_CLIENTS 64       // Maximum number of consoles connected at the same time
+#define CONSOLE_REQUEST_SIZE 4096    // Maximum size of a request frame
+#define CONSOLE_OUTPUT_MAX (32 * 1024 * 1024)  // Maximum bytes of responses queued for a console that
+                                               // doesn't read them, enough for status of every pair
+
+// This struct accepts fss_console connections on a unix domain socket and keeps
+// the requests each console has sent until they can be executed
+// Every console connection gets a unique id, which is used to send a response to
+// a console after a job is finished, even if its file descriptor has been reused
+typedef struct console_server *ConsoleServer;
+
+// Creates a unix domain socket at path and listens for connections
+// Returns NULL if malloc or any socket function fails
+ConsoleServer console_server_init(char *path);
+
+// Returns file descriptor of listening socket
+int console_server_listen_fd(ConsoleServer server);
+
+// Accepts a pending connection
+// Returns file descriptor of new console, -1 if accept fails and -2 if there are
+// already CONSOLE_MAX_CLIENTS consoles connected
+int console_server_accept(ConsoleServer server);
+
+// Reads available bytes from console with file descriptor fd until its buffer is full
+// Returns 0 if all of them were read, 1 if the buffer is full and there may be more, which
+// are read after its requests are taken with console_server_next_request, and -1 if the
+// console has disconnected or failed, in which case it must be closed
+int console_server_read(ConsoleServer server, int fd);
+
+// Copies next complete request of console fd to buf of size nbytes and NULL terminates it
+// Returns 1 if a request was copied, 0 if there is no complete request and -1 if the console
+// sent an invalid frame, in which case it must be closed
+int console_server_next_request(ConsoleServer server, int fd, char *buf, size_t nbytes);
+
+// Sends buf of nbytes as a frame to console fd, or an empty frame if nbytes is 0, without blocking
+// What the socket doesn't take is queued and sent by console_server_flush once it has room
+// A console whose queue would grow over CONSOLE_OUTPUT_MAX or whose socket fails is marked as
+// failed: its output is dropped and console_server_next_failed returns it, so it can be closed
+void console_server_write(ConsoleServer server, int fd, char *buf, size_t nbytes);
+
+// Sends as much of the queued output of console fd as its socket takes without blocking
+// Returns 0 on success, -1 if the console has failed and must be closed
+int console_server_flush(ConsoleServer server, int fd);
+
+// Returns file descriptor of a console that has failed and must be closed, or -1 if there is none
+int console_server_next_failed(ConsoleServer server);
+
+// Returns id of console with file descriptor fd or 0 if it is not connected
+int console_server_client_id(ConsoleServer server, int fd);
+
+// Returns file descriptor of console with given id or -1 if it is not connected
+int console_server_client_fd(ConsoleServer server, int id);
+
+// Adds count jobs whose results must be sent to console id before its response ends
+void console_server_add_pending(ConsoleServer server, int id, int count);
+
+// Marks one pending job of console id as done
+// Returns number of jobs still pending, or -1 if console is not connected
+int console_server_done_pending(ConsoleServer server, int id);
+
+// Closes connection with console fd
+void console_server_close_client(ConsoleServer server, int fd);
+
+// Closes all connections, removes socket file and frees resources
+void console_server_destroy(ConsoleServer server);
@@ -0,0 +1,46 @@
+#include <sys/types.h>
+#include <time.h>
+
+#define DIR_SCANNER_BUF_SIZE (1024 * 1024)   // Bytes of directory entries read with one getdents64
+
+// Entry of a scanned directory
+struct dir_entry {
+    char *name;              // Points into the scanner's buffer, valid until the next call
+    unsigned char type;      // DT_REG, DT_DIR, etc. DT_UNKNOWN only if statx failed
+    long long size;          // Size and modification time of regular files, size is -1 if
+    struct timespec mtime;   // statx failed
+    mode_t mode;
+};
+
+// Entries of a directory, sorted by name
+struct dir_list {
+    struct dir_entry *entries;   // Names point into names
+    size_t count;
+    char *names;                 // NULL terminated names of all entries, in the order of entries
+};
+
+// This struct reads the entries of a directory in large batches with getdents64 and
+// fetches the status of regular files with statx relative to the directory, so that no
+// path of an entry has to be built
+typedef struct dir_scanner *DirScanner;
+
+// Initializes scanner of open directory dir_fd, which stays owned by the caller
+// Returns NULL if malloc fails
+DirScanner dir_scanner_init(int dir_fd);
+
+// Copies next entry of directory, except . and .., to entry
+// Entries removed after they were read are skipped
+// Returns 1 if an entry was copied, 0 if all entries have been read and -1 if getdents64 fails
+int dir_scanner_next(DirScanner scanner, struct dir_entry *entry);
+
+// Frees resources for scanner
+void dir_scanner_destroy(DirScanner scanner);
+
+// Reads all entries of open directory dir_fd to list and sorts them by name with strcmp, so that
+// the lists of two directories can be merged in one pass
+// If regular_only is 1, only regular files are kept
+// Returns 0 on success, -1 if malloc fails and -2 if getdents64 fails
+int dir_scanner_list(int dir_fd, int regular_only, struct dir_list *list);
+
+// Frees entries of list
+void dir_list_free(struct dir_list *list);
\ No newline at end of file
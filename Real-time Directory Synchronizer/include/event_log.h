@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#define EVENT_LOG_MAGIC "FSSEVT01"   // First 8 bytes of every event log file
+#define EVENT_LOG_ALIGN 8            // Every record starts at a multiple of this many bytes
+
+// Types of records
+enum event_type {
+    EVENT_START,   // The manager started appending to the file, path ids of earlier records no longer apply
+    EVENT_PATH,    // Path of a source or target directory, the text of the record, with id src_id
+    EVENT_JOB      // Result of a job for one target
+};
+
+// What the text of a job record is
+enum event_text {
+    EVENT_TEXT_DETAILS,   // Details of the job or its first error
+    EVENT_TEXT_FILE       // File of a job that succeeded
+};
+
+// Fixed part of every record, which is followed by text_len bytes of text and zeros up to the
+// next multiple of EVENT_LOG_ALIGN bytes. Fields are in the byte order of the host.
+// Directories are given by path ids, so their paths are only written once in PATH records
+struct event_record {
+    int64_t time_ns;       // CLOCK_REALTIME nanoseconds since the epoch
+    int64_t bytes;         // Bytes written to the target
+    uint32_t latency_us;   // Microseconds from the start of the worker to its exit
+    int32_t pid;           // Worker that ran the job
+    uint32_t src_id;       // Path id of the source directory, or id of the path of a PATH record
+    uint32_t tar_id;       // Path id of the target directory
+    uint16_t text_len;
+    uint8_t type;          // An enum event_type
+    uint8_t operation;     // An enum sync_operation
+    uint8_t status;        // An enum sync_status
+    uint8_t text_kind;     // An enum event_text
+    uint16_t errors;       // Errors of the job in the target
+};
+
+// This struct appends the results of jobs to a binary log file as fixed-width records
+// Records are copied to a buffer, which is written with one write when it is flushed or full,
+// so logging an event costs a copy instead of formatting a line of text
+// Directories must be the paths interned by the file monitor, whose ids are found by pointer
+typedef struct event_log *EventLog;
+
+// Initializes event log that appends to fd, which belongs to it from now on
+// Writes EVENT_LOG_MAGIC if the file is empty and a START record
+// Returns NULL if malloc or writing fails
+EventLog event_log_init(int fd);
+
+// Adds record of a job for target tar_dir of src_dir, with text of kind text_kind
+// Returns 0 on success, -1 if malloc or writing fails
+int event_log_job(EventLog log, char *src_dir, char *tar_dir, int pid, int operation, int status, int errors, long long bytes, long long latency_us, int text_kind, char *text);
+
+// Writes records that are still in the buffer to the file
+// Returns 0 on success, -1 if writing fails, in which case the records are dropped
+int event_log_flush(EventLog log);
+
+// Flushes log, closes its file and frees its resources
+void event_log_destroy(EventLog log);
\ No newline at end of file
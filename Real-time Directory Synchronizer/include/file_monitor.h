@@ -3,38 +3,81 @@
 
 
 // This struct stores information about all added directories using struct sync_info_mem_store
+// Directories are found by source directory or watch descriptor in constant time
+// Source and target directories are stored once in a string pool, so pointers to them can be
+// kept by jobs instead of copies
 typedef struct file_monitor *FileMonitor;
 
+// Bytes of memory used by a file monitor
+struct file_monitor_memory {
+    size_t records;          // Blocks of struct sync_info_mem_store
+    size_t index;            // Hash tables of source directories and watch descriptors
+    size_t target_status;    // Status arrays of targets
+    size_t filters;          // Include and exclude patterns of directories
+    size_t paths;            // String pool of source and target directories
+    size_t num_of_paths;     // Number of distinct paths in string pool
+};
+
 // Initializes file monitor, returns NULL if malloc fails
 FileMonitor file_monitor_init(void);
 
 // Returns number of files monitored
 size_t file_monitor_size(FileMonitor monitor);
 
-// Adds file src_dir to monitor, with target tar_dir and inotify watch descriptor wd
+// Adds file src_dir to monitor, with targets tar_dirs, options of the pair and inotify watch descriptor wd
+// If src_dir is inactive, it becomes active with the new targets and options
+// The filter of options stays owned by the caller, monitor keeps a copy of it
 // Returns -1 if malloc fails, -2 if file is already monitored/active, and 0 otherwise
-int file_monitor_add(FileMonitor monitor, char *src_dir, char *tar_dir, int wd);
+int file_monitor_add(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options, int wd);
+
+// Replaces targets and options of src_dir, which may be active, with tar_dirs and options
+// Targets that stay keep their status and the filter of options stays owned by the caller
+// Returns -1 if malloc fails, in which case src_dir is unchanged, -2 if src_dir is not in monitor,
+// and 0 otherwise
+int file_monitor_update(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options);
 
-// Returns 1 if there is a job done in this directory, 0 if not, and -1 if this directory
-// is not in the monitor
+// Adds file src_dir to monitor without checking if it is already in it
+// Used when the caller has already checked all directories it adds
+// Returns -1 if malloc fails, 0 otherwise
+int file_monitor_add_new(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options, int wd);
+
+// Returns number of workers syncing this directory, and -1 if this directory is not in the monitor
 int file_monitor_is_working(FileMonitor monitor, char *src_dir);
 
-// Stops monitoring of src_dir
+// Stops monitoring of src_dir, which is no longer found by its watch descriptor
 // Returns 0 on success, -1 if src_dir is not in monitor
 int file_monitor_set_inactive(FileMonitor monitor, char *src_dir);
 
+// Changes inotify watch descriptor of src_dir to wd, -1 if it has no watch
+// Returns 0 on success, -1 if src_dir is not in monitor
+int file_monitor_set_wd(FileMonitor monitor, char *src_dir, int wd);
+
 // Returns a pointer to struct sync_info_mem_store of src_dir
 // If src_dir is set to NULL, returns pointer to struct sync_info_mem_store for directory
 // with watch file desctiptor wd
 // If requested entry is not in monitor, returns NULL
 struct sync_info_mem_store *file_monitor_get_info(FileMonitor monitor, char *src_dir, int wd);
 
-// Sets src_dir to working and changes necessary fields
+// Used to go through all directories in monitor in the order they were added
+// Returns the entry after info, or the first entry if info is NULL
+// Returns NULL if there are no more entries
+struct sync_info_mem_store *file_monitor_next(FileMonitor monitor, struct sync_info_mem_store *info);
+
+// Adds a worker with operation to the workers of src_dir and changes necessary fields
+// A job of the whole directory, e.g. a full sync, sets the barrier of src_dir until its worker is done
 // Returns 0 on success, -1 if src_dir is not in monitor
-int file_monitor_set_working(FileMonitor monitor, char *src_dir, pid_t worker_pid, char *operation);
+int file_monitor_set_working(FileMonitor monitor, char *src_dir, enum sync_operation operation);
+
+// Sets result of last job for target tar_dir of src_dir and adds errors to its error count
+// Returns 0 on success, -1 if src_dir or tar_dir is not in monitor
+int file_monitor_set_target_status(FileMonitor monitor, char *src_dir, char *tar_dir, enum sync_status status, int errors);
+
+// Removes a worker from the workers of src_dir and changes last_sync_time, in seconds since the epoch,
+// and error_count fields. The barrier is lifted once no worker is left.
+int file_monitor_set_not_working(FileMonitor monitor, char *src_dir, long long time, int errors);
 
-// Sets src_dir to not working and changes last_sync_time and error_count fields
-int file_monitor_set_not_working(FileMonitor monitor, char *src_dir, char *time, int errors);
+// Writes bytes of memory used by monitor to memory
+void file_monitor_memory(FileMonitor monitor, struct file_monitor_memory *memory);
 
 // Frees resources for file monitor
 void file_monitor_destroy(FileMonitor monitor);
\ No newline at end of file
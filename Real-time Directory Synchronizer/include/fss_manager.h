@@ -1,28 +1,48 @@
 #include "../include/file_monitor.h"
 #include "../include/job_queue.h"
 #include "../include/worker_management.h"
+#include "../include/console_server.h"
+#include "../include/event_log.h"
 
 #define FSS_WRITE_LOG 1      // Writes to log file
 #define FSS_WRITE_STDOUT 2   // Writes to stdout
-#define FSS_WRITE_FSS_OUT 4  // Writes to fss_out pipe
+#define FSS_WRITE_CONSOLE 4  // Writes a response frame to console
+#define FSS_WRITE_END 8      // Ends the response to console
 
-// Writes contents of buffer to log file, stdout or fss_out depending on write_inst
+// Writes contents of buffer to log file, stdout or console con_id depending on write_inst
 // Write inst is a bitwise OR of the above marcros
-// If write_inst indicates writing to fss_out and num_of_lines is not 0, this
-// number if written to fss_out before buffer
-// This way fss_console knows how many lines to read
-void fss_log_event(char *buffer, int log_fd, int fss_out_fd, int num_of_lines, int write_inst);
+// If write_inst includes FSS_WRITE_END, an empty frame is written to con_id after buffer
+// This way fss_console knows that the response to its command is complete
+// If con_id is -1, nothing is written to the console
+// Can be called by every thread of the manager, the frames of a thread reach the console in order
+void fss_log_event(char *buffer, int log_fd, int con_id, int write_inst);
 
-// Reads directories from config_file and adds syncing jobs to queue
-// Returns 0 for success, -1 if an error occurs
-int fss_read_config_file(FILE *config_file, int log_fd, JobQueue job_queue, FileMonitor file_monitor, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd);
+// Makes fss_manager_run log the results of jobs to event_log, as binary records, instead of
+// writing them to the log file as lines of text
+void fss_use_event_log(EventLog log);
+
+// Initializes num event-loop threads of the manager, which share the workers of pool. Every thread
+// monitors the directories that hash to it with its own file monitor, job queue and inotify instance,
+// and thread 0 also accepts the consoles of console_server
+// Returns 0 on success, -1 if malloc fails and the errors of worker_manager_init, or -6 if an eventfd
+// can't be created
+int fss_init_shards(int num, struct worker_pool *pool, ConsoleServer console_server);
+
+// Reads directories from config_file, starts monitoring them in their threads and queues their full
+// syncs, which fss_manager_run passes to the job queues as workers become available
+// The file is watched through config_name, and fss_manager_run applies its changes
+// Returns 0 for success, -1 if the file is invalid, there are not enough inotify watches
+// for its directories or an error occurs
+int fss_read_config_file(FILE *config_file, char *config_name, int log_fd, ConsoleServer console_server);
 
 // Main function that runs fss_manager
-// Handles job queue, inotify events and console commands
-void fss_manager_run(int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd);
+// Starts the other threads and runs thread 0, which handles console commands and returns once all
+// threads have shut down. Every thread handles its job queue and inotify events
+void fss_manager_run(int log_fd, FILE *config_file, ConsoleServer console_server);
 
 // If an irrecoverable error occurs, such as malloc failure, this function prints out
 // the message in buffer to the log file and stdout, prints out an abrupt shutdown message
 // and clears all resources. It does not call exit, instead the program that called the
-// function is responsible for exiting.
-void fss_abrupt_shutdown(char *buffer, size_t buf_size, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd, int num_of_lines);
\ No newline at end of file
+// function is responsible for exiting. Once the other threads have been started, it exits
+// without clearing anything, since they may still use it.
+void fss_abrupt_shutdown(char *buffer, size_t buf_size, int log_fd, FILE *config_file, ConsoleServer console_server);
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+
+#define HOT_WINDOW_DEFAULT 1000   // Default milliseconds a file must wait between two of its jobs
+
+// This struct keeps files that have changed recently, so that a file that changes all the time
+// doesn't keep the worker of its directory busy with copies of it
+// A file whose last job was queued less than a window ago is deferred: its job is only queued
+// when the window has passed, and the events that arrive until then are merged into it. Other
+// files of the directory are queued ahead of it in the meantime.
+// Directories and targets must be the paths interned by the file monitor
+typedef struct hot_files *HotFiles;
+
+// Initializes hot files, returns NULL if malloc fails
+HotFiles hot_files_init(void);
+
+// Checks event operation for file of src_dir, whose files wait window_ms milliseconds between jobs
+// Returns 0 if a job for the event should be queued now, which starts a new window for file,
+// 1 if the event was deferred or merged into the deferred job of file and -1 if malloc fails
+// A window of 0 queues every event
+int hot_files_check(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, long long window_ms);
+
+// Defers a job operation of file of src_dir for delay_ms milliseconds, e.g. to retry a job that failed
+// If file already has a deferred job, the job takes the retry in like an event and stays due when it was
+// Returns 0 on success, -1 if malloc fails
+int hot_files_retry(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, long long delay_ms);
+
+// Adds jobs of deferred files whose window has passed to queue
+// If all is 1, all deferred jobs are added, e.g. on shutdown
+// Returns number of jobs added, or -1 if malloc fails
+int hot_files_release(HotFiles hot, JobQueue queue, int all);
+
+// Returns milliseconds until the next deferred job is due, or -1 if there are none
+int hot_files_timeout(HotFiles hot);
+
+// Returns number of deferred files of src_dir, or of all directories if src_dir is NULL
+size_t hot_files_deferred(HotFiles hot, char *src_dir);
+
+// Forgets all files of src_dir and drops their deferred jobs
+void hot_files_remove_dir(HotFiles hot, char *src_dir);
+
+// Frees resources for hot files
+void hot_files_destroy(HotFiles hot);
\ No newline at end of file
@@ -2,15 +2,18 @@
 
 // Struct that stores information about a job
 // It stores:
-// - the four arguments that worker takes (source_directory, target_directory,filename, operation)
+// - the arguments that worker takes (source_directory, target_directories, filename, operation)
+//   Directories are interned by the file monitor and only file belongs to the job
 // - the process id of worker assigned to job (-1 if job hasn't been assigned to a worker yet)
-// - a boolean variable sync_job that indicates if this job was requested by a sync command in the
-//   console. This changes some messages that should be outputted.
+// - a variable sync_job that is set to the id of the console that requested this job with a sync
+//   command, or 0 if it wasn't requested by a console. This changes some messages that should be
+//   outputted.
 struct job_info {
     char *src_dir;
-    char *tar_dir;
+    char **tar_dirs;         // Target directories, a worker copies the source to all of them
+    int num_of_targets;
     char *file;
-    char *operation;
+    enum sync_operation operation;
     pid_t worker_pid;
     int sync_job;
 };
\ No newline at end of file
@@ -11,19 +11,35 @@ JobQueue job_queue_init(void);
 size_t job_queue_size(JobQueue queue);
 
 // Creates a job with given fields and adds it to the queue
+// file is copied, but src_dir and tar_dirs are not, so they must be the paths interned by the
+// file monitor, which stay valid as long as it does
 // Returns -1 if malloc fails, 0 otherwise
-int job_queue_enqueue(JobQueue queue, char *src_dir, char *tar_dir, char *file, char *operation, int sync_job);
+int job_queue_enqueue(JobQueue queue, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, int sync_job);
 
-// Removes a job from queue and copies its fields to job. Also allocates memory for fields in job.
-// Returns -1 if malloc fails, 0 otherwise
+// Removes a job from queue and moves its fields to job. File of job must be freed afterwards.
+// Returns 0
 // If queue is empty it sets all fields of job to NULL, then returns 0
 int job_queue_dequeue(JobQueue queue, struct job_info *job);
 
+// Moves all jobs of queue other to the end of queue, leaving other empty
+void job_queue_append(JobQueue queue, JobQueue other);
+
+// Moves up to count jobs from the front of queue other to the end of queue
+void job_queue_move(JobQueue queue, JobQueue other, size_t count);
+
+// Writes src_dir of every job in queue to dirs, which must have space for job_queue_size entries
+// Pointers remain valid until the jobs are removed from queue
+// Returns number of pointers written
+size_t job_queue_get_dirs(JobQueue queue, char **dirs);
+
 // Returns 1 if there is a job for dir in queue, otherwise returns 0
 int job_queue_dir_exists(JobQueue queue, char *dir);
 
 // Removes all jobs for dir from queue
 void job_queue_remove_dir(JobQueue queue, char *dir);
 
+// Returns bytes of memory used by queue and its jobs
+size_t job_queue_memory(JobQueue queue);
+
 // Frees resources for queue
 void job_queue_destroy(JobQueue queue);
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include <stdlib.h>
+
+// Header of a message, which must be the first member of the struct of every message sent to a mailbox
+struct mailbox_message {
+    struct mailbox_message *next;
+};
+
+// This struct passes messages from any number of threads to the one thread that owns it, without locks
+// A sender links its message in with one atomic exchange, and only the owner takes messages out, in
+// the order they were sent. The owner waits for the eventfd of the mailbox with epoll, which a sender
+// only writes to if the owner may have gone to sleep since it last took the messages out.
+typedef struct mailbox *Mailbox;
+
+// Initializes an empty mailbox, returns NULL if malloc or eventfd fails
+Mailbox mailbox_init(void);
+
+// Returns eventfd of mailbox, which is readable when messages have been sent
+int mailbox_fd(Mailbox mailbox);
+
+// Sends message to mailbox, the message belongs to the owner from now on
+// Can be called by any thread
+void mailbox_send(Mailbox mailbox, struct mailbox_message *message);
+
+// Clears the eventfd of mailbox after it was readable. Must be called by the owner before it takes
+// out the messages, so that a message sent while they are taken out wakes up the owner again
+void mailbox_clear(Mailbox mailbox);
+
+// Takes out the oldest message of mailbox, or returns NULL if there is none
+// Only called by the owner
+struct mailbox_message *mailbox_receive(Mailbox mailbox);
+
+// Frees mailbox and closes its eventfd, messages left in it must have been taken out
+void mailbox_destroy(Mailbox mailbox);
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include <stdlib.h>
+
+// This struct decides which files of a pair are synced with include and exclude glob patterns
+// matched against file names, e.g. "*.swp", "*~" or ".#*"
+// A file is synced if it matches no exclude pattern and, when there are include patterns, at
+// least one of them. Patterns are compiled once when they are added: the common forms of a
+// literal name, "abc*", "*abc" and "*abc*" are compared directly and only other patterns are
+// matched with fnmatch.
+typedef struct name_filter *NameFilter;
+
+// Initializes empty filter, which syncs every file
+// Returns NULL if malloc fails
+NameFilter name_filter_init(void);
+
+// Adds pattern, which includes matching files if include is 1 and excludes them otherwise
+// Returns 0 on success, -1 if malloc fails and -2 if pattern is empty
+int name_filter_add(NameFilter filter, char *pattern, int include);
+
+// Adds every pattern of list, whose patterns are separated by commas
+// Returns 0 on success, -1 if malloc fails and -2 if a pattern is empty
+int name_filter_add_list(NameFilter filter, char *list, int include);
+
+// Returns 1 if file name passes filter and should be synced, 0 if it is filtered out
+int name_filter_match(NameFilter filter, const char *name);
+
+// Returns number of patterns of filter
+int name_filter_size(NameFilter filter);
+
+// Returns pattern i of filter, in the order they were added, and sets include to its kind
+char *name_filter_pattern(NameFilter filter, int i, int *include);
+
+// Returns 1 if filters a and b, which may be NULL, have the same patterns in the same order, 0 otherwise
+int name_filter_equal(NameFilter a, NameFilter b);
+
+// Returns copy of filter, or NULL if malloc fails
+NameFilter name_filter_copy(NameFilter filter);
+
+// Returns bytes of memory used by filter
+size_t name_filter_memory(NameFilter filter);
+
+// Frees resources for filter, which may be NULL
+void name_filter_destroy(NameFilter filter);
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include "../include/dir_scanner.h"
+
+#define SNAPSHOT_DIR ".fss_snapshots"   // Directory of a target that has its snapshots
+#define SNAPSHOT_NAME_SIZE 32           // Size of a buffer for the name of a snapshot
+#define SNAPSHOT_KEEP_DEFAULT 24        // Default number of snapshots kept for every target
+
+// A snapshot of a target directory is a directory in SNAPSHOT_DIR of the target with a hard link
+// of every regular file the target had when it was taken, so it costs no data, only inodes' links.
+// It stays valid as long as the files of the target are never changed in place, which is why
+// workers of pairs with snapshots replace files instead of overwriting them.
+// Snapshots are named after the time they were taken, YYYYMMDD-HHMMSS.mmm, so sorting their
+// names sorts them from oldest to newest.
+
+// Writes name of a snapshot taken now to name of size nbytes
+// Every target of a job gets a snapshot with the same name, so they can be restored together
+void snapshot_name(char *name, size_t nbytes);
+
+// Takes snapshot name of target directory dir_fd
+// The snapshot is built under a hidden name and renamed into place when it is complete, so a
+// failed snapshot never shows up as a partial one
+// Returns number of files linked, or -1 if it fails, in which case errno is set
+int snapshot_create(int dir_fd, char *name);
+
+// Removes oldest snapshots of target directory dir_fd until at most keep are left
+// Returns number of snapshots removed, or -1 if the snapshots can't be listed
+int snapshot_prune(int dir_fd, int keep);
+
+// Reads snapshots of target directory dir_fd to list, oldest first
+// A target without snapshots has an empty list
+// Returns 0 on success, -1 if malloc fails and -2 if the snapshots can't be read
+int snapshot_list(int dir_fd, struct dir_list *list);
+
+// Opens snapshot name of target directory dir_fd
+// Returns file descriptor of the snapshot directory, or -1 if it doesn't exist or can't be opened
+int snapshot_open(int dir_fd, char *name);
+
+// Puts file name of snapshot snap_fd back into target directory dir_fd, replacing any file the
+// target has with that name in one step
+// Returns 0 on success and -1 on failure, with errno set
+int snapshot_restore_file(int snap_fd, int dir_fd, char *name);
+
+// Removes snapshot name of target directory dir_fd
+// Returns 0 on success and -1 on failure
+int snapshot_remove(int dir_fd, char *name);
\ No newline at end of file
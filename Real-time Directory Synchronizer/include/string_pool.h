@@ -0,0 +1,30 @@
+#include <stdlib.h>
+
+// This struct stores strings that don't change until it is destroyed, such as the paths of
+// monitored directories. Every distinct string is stored once, in large chunks of memory
+// instead of one allocation per string, so equal paths share memory and can be compared
+// by pointer.
+// Arrays of strings from the pool can be stored in it too
+typedef struct string_pool *StringPool;
+
+// Initializes string pool, returns NULL if malloc fails
+StringPool string_pool_init(void);
+
+// Returns the copy of str in pool, which is added if pool doesn't have it yet
+// The copy stays valid until pool is destroyed
+// Returns NULL if malloc fails
+char *string_pool_intern(StringPool pool, char *str);
+
+// Returns a copy of array of count strings, whose strings are interned in pool
+// The copy stays valid until pool is destroyed
+// Returns NULL if malloc fails
+char **string_pool_intern_array(StringPool pool, char **array, int count);
+
+// Returns number of distinct strings in pool
+size_t string_pool_size(StringPool pool);
+
+// Returns bytes of memory allocated by pool
+size_t string_pool_memory(StringPool pool);
+
+// Frees pool and all of its strings
+void string_pool_destroy(StringPool pool);
\ No newline at end of file
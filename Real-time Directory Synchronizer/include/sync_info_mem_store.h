@@ -1,15 +1,63 @@
 #include <sys/types.h>
+#include "../include/throttle.h"
+#include "../include/snapshot.h"
+#include "../include/name_filter.h"
+
+// Options of a pair of the config file, add-batch file or add command
+struct pair_options {
+    struct throttle_limits limits;   // Rate limits of the pair
+    int mirror;                      // 1 if full syncs also delete target files that are not in the source
+    int hot_window;                  // Milliseconds a file waits between two of its jobs, -1 for the default
+    int snapshot_interval;           // Minutes between snapshots of the targets, 0 for snapshots only
+                                     // before full syncs and -1 if the pair has no snapshots
+    int snapshot_keep;               // Snapshots kept for every target
+    int atomic;                      // 1 if files of the targets are replaced by complete copies
+    int durability;                  // How soon copies are on disk, an enum durability
+    NameFilter filter;               // Include and exclude patterns of files, NULL if every file is synced
+};
+
+#define PAIR_OPTIONS_DEFAULT {{0, 0}, 0, -1, -1, SNAPSHOT_KEEP_DEFAULT, 0, DURABILITY_NONE, NULL}   // Options of a pair without options
+
+// Struct with status of a target directory of a monitored directory
+struct target_status {
+    int error_count;
+    unsigned char last_status;   // Result of last job for this target, an enum sync_status
+};
 
 // Struct with info about monitored directory
+// Paths are interned in the string pool of the file monitor, so they are shared with the jobs
+// of the directory and stay valid until the file monitor is destroyed
 struct sync_info_mem_store {
     char *src_dir;
-    char *tar_dir;
+    char **tar_dirs;         // Every change of src_dir is copied to all target directories
+    struct target_status *target_status;  // Status of every target, in the same order as tar_dirs
+    struct throttle_bucket throttle;  // Rate limits of the pair and what its workers have taken
+    long long last_sync_time;         // Seconds since the epoch, 0 if never synced
+    long long last_snapshot_time;     // Seconds since the epoch of the last snapshot, 0 if none
+    long long filtered_events;        // Inotify events dropped by filter
+    NameFilter filter;       // Include and exclude patterns of files, NULL if every file is synced
+    int num_of_targets;
     int wd;                  // File descriptor for inotify watch
-    pid_t worker_pid;        // Pid of worker assigned for directory job, -1 if no worker is
-                             // currently working on this directory
-    char operation[9];       // Last operation performed (FULL, ADDED, MODIFIED, DELETED)
-    int active;              // 1 if directory is active, 0 other wise. A directory is active
+    int num_of_workers;      // Workers currently syncing files of this directory
+    int throttle_slot;       // Throttle slot whose bucket the workers of this directory share,
+                             // -1 if no worker is currently working on this directory
+    int error_count;         // Sum of errors of all targets
+    int timeouts;            // Workers of this directory killed by the watchdog in a row, each one
+                             // doubles the delay before their jobs are retried
+    int hot_window;          // Milliseconds a file waits between two of its jobs, -1 for the default
+    int snapshot_interval;   // Minutes between snapshots, 0 for snapshots only before full syncs
+                             // and -1 if the targets have no snapshots
+    int snapshot_keep;       // Snapshots kept for every target
+    unsigned int id;         // Position of directory in file monitor
+    unsigned int held_pass;  // Last pass over the job queue that held back a job of this directory
+    unsigned char operation; // Last operation performed, an enum sync_operation
+    unsigned char active;    // 1 if directory is active, 0 other wise. A directory is active
                              // if it is being monitored
-    char last_sync_time[18];
-    int error_count;
+    unsigned char mirror;    // 1 if full syncs also delete target files that are not in src_dir
+    unsigned char barrier;   // 1 while a full sync runs, which no other job of the directory runs with
+    unsigned char held_full; // 1 if a full sync was held back in pass held_pass, so later jobs wait for it
+    unsigned char snapshot_changed;  // 1 if a job has run since the last snapshot
+    unsigned char atomic;    // 1 if files of the targets are replaced by complete copies instead of overwritten
+    unsigned char durability;  // How soon copies are on disk, an enum durability
+    unsigned char config;    // 1 if the pair comes from the config file, so a reload of the file can change it
 };
\ No newline at end of file
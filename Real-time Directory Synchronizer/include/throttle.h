@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <signal.h>
+
+#define THROTTLE_INTERVAL_MS 1000   // Time between two measurements of the rates
+
+// Limits of a token bucket, 0 means unlimited
+struct throttle_limits {
+    long long bytes_per_sec;
+    long long files_per_sec;
+};
+
+// Rates measured in the last interval
+struct throttle_rates {
+    double bytes_per_sec;
+    double files_per_sec;
+};
+
+// Token buckets of a pair, kept by the manager while no worker syncs the pair
+// A bucket is the time until which everything taken from it so far is paid for, so it is
+// empty while that time is in the future
+struct throttle_bucket {
+    struct throttle_limits limits;
+    long long bytes_paid_ns;      // CLOCK_MONOTONIC time in nanoseconds, 0 if nothing is owed
+    long long files_paid_ns;
+};
+
+// This struct limits the bytes and files per second that workers copy with token buckets
+// There is a global bucket shared by all workers and a bucket for every worker slot, which is
+// loaded with the limits of a pair while it has workers. All workers of the pair take from the
+// same slot bucket, so it limits the pair however many of them run.
+// Every worker slot also has a progress counter of its own worker, which tells the manager
+// that the worker is still moving while other workers of its pair take from the same bucket.
+// The buckets live in a shared memory file that workers inherit and map, so limits changed
+// by the manager apply immediately to running workers. Buckets are updated with atomic
+// operations only, so a worker that is killed can't leave them locked.
+typedef struct throttle *Throttle;
+
+// Creates buckets and progress counters for num_of_slots worker slots, all unlimited. Used by the manager.
+// Returns NULL if malloc, memfd_create or mmap fails
+Throttle throttle_init(int num_of_slots);
+
+// Maps the buckets of shared memory file fd, to throttle a worker with the bucket of slot and count
+// its progress with the counter of worker slot worker. Used by workers.
+// Returns NULL if malloc or mmap fails, or slot or worker doesn't exist
+Throttle throttle_attach(int fd, int slot, int worker);
+
+// Maps the buckets of throttle again, for another thread of the manager that measures the rates
+// of the slots of its own workers. The handle must be destroyed before throttle.
+// Returns NULL if malloc or mmap fails
+Throttle throttle_share(Throttle throttle);
+
+// Returns file descriptor of the shared memory file, which workers must inherit
+int throttle_fd(Throttle throttle);
+
+// Sets limits of global bucket. What was taken with the old limits is forgotten.
+void throttle_set_global(Throttle throttle, struct throttle_limits limits);
+
+// Returns limits of global bucket
+struct throttle_limits throttle_get_global(Throttle throttle);
+
+// Loads bucket of a pair into slot, before the first worker for the pair starts
+void throttle_load_slot(Throttle throttle, int slot, struct throttle_bucket *bucket);
+
+// Saves what the workers of slot have taken from its bucket to bucket of their pair, after the last exits
+void throttle_save_slot(Throttle throttle, int slot, struct throttle_bucket *bucket);
+
+// Sets limits of slot while its workers run. What was taken with the old limits is forgotten.
+void throttle_set_slot(Throttle throttle, int slot, struct throttle_limits limits);
+
+// Takes bytes and files from the global bucket and the bucket of the attached slot and
+// sleeps until both buckets allow them. A bucket can hold up to one second of its limit.
+// Taking and every step of the wait count as progress of the worker.
+// If stop is not NULL, the wait ends early once *stop is set, e.g. by a signal handler
+// Returns 0 after waiting, or -1 if the wait was stopped
+int throttle_consume(Throttle throttle, long long bytes, long long files, volatile sig_atomic_t *stop);
+
+// Counts progress of the attached worker that doesn't take from the buckets, e.g. a file it
+// found unchanged
+void throttle_progress(Throttle throttle);
+
+// Returns progress counter of worker slot worker, which only ever grows
+long long throttle_worker_progress(Throttle throttle, int worker);
+
+// Measures the rates of every bucket if an interval has passed since the last measurement
+void throttle_update(Throttle throttle);
+
+// Returns rates of global bucket in the last interval
+struct throttle_rates throttle_global_rates(Throttle throttle);
+
+// Returns rates of bucket of slot in the last interval
+struct throttle_rates throttle_slot_rates(Throttle throttle, int slot);
+
+// Parses rate str, a number optionally followed by K, M or G (powers of 1024), "0" or "none"
+// for unlimited
+// Returns 0 on success, -1 if str is not a valid rate
+int throttle_parse_rate(char *str, long long *rate);
+
+// Parses options "bytes=<rate>" and "files=<rate>" separated by spaces in str into limits
+// Limits that aren't given are left unchanged
+// Returns number of options parsed or -1 if an option is invalid
+int throttle_parse_limits(char *str, struct throttle_limits *limits);
+
+// Unmaps buckets, closes shared memory file if it was created by throttle_init and frees resources
+void throttle_destroy(Throttle throttle);
\ No newline at end of file
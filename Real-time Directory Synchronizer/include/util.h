@@ -1,6 +1,43 @@
+#include <sys/types.h>
 #define DATETIME_SZ 20
+#define MAX_TARGETS 16   // Maximum number of target directories of a source directory
+#define COPY_PARALLEL_THRESHOLD (256LL * 1024 * 1024)  // Files at least this large are copied by several threads
+#define COPY_THREADS 4   // Number of threads that copy a large file, each one a range of the file
 
-enum file_management_error {SUCCESS, OPEN_FAILED, READ_FAILED, WRITE_FAILED};
+#define COPY_REPLACE 1   // Flag of file_copy: targets are replaced by new files instead of being overwritten
+#define COPY_SYNC 2      // Flag of file_copy: every target is on disk before file_copy returns
+
+enum file_management_error {SUCCESS, OPEN_FAILED, READ_FAILED, WRITE_FAILED, METADATA_FAILED, CANCELLED};
+
+// Operations of jobs, which are passed to worker by name
+// SNAPSHOT and RESTORE take and restore snapshots of the targets of a pair
+enum sync_operation {OP_FULL, OP_MIRROR, OP_ADDED, OP_MODIFIED, OP_DELETED, OP_ATTRIB, OP_SNAPSHOT, OP_RESTORE, OP_NONE};
+
+// Results of the last job of a target, TIMEOUT if its worker was killed for making no progress
+enum sync_status {SYNC_NONE, SYNC_SUCCESS, SYNC_PARTIAL, SYNC_ERROR, SYNC_CANCELLED, SYNC_TIMEOUT};
+
+// How soon copied files of a pair are on disk: left to the kernel, synced after every file or
+// synced once after all files of a worker
+enum durability {DURABILITY_NONE, DURABILITY_FILE, DURABILITY_BATCH};
+
+// Returns name of durability, e.g. "batch"
+char *durability_name(enum durability durability);
+
+// Returns durability with name, or -1 if name is not a durability
+int durability_parse(char *name);
+
+// Returns name of operation, e.g. "FULL"
+char *sync_operation_name(enum sync_operation operation);
+
+// Returns 1 if operation works on the whole directory instead of a single file, i.e. it is a
+// full or mirror sync, a snapshot or a restore, 0 otherwise
+int sync_operation_whole_dir(enum sync_operation operation);
+
+// Returns name of status, e.g. "SUCCESS", or "None" for SYNC_NONE
+char *sync_status_name(enum sync_status status);
+
+// Returns status with name, or SYNC_ERROR if name is not a status
+enum sync_status sync_status_parse(char *name);
 
 // Performs string concatenation of dir + "/" + file
 // Returns pointer to concatenated string
@@ -8,10 +45,59 @@ enum file_management_error {SUCCESS, OPEN_FAILED, READ_FAILED, WRITE_FAILED};
 // Returns NULL if memory allocation fails
 char *file_name_concat(char *dir, char *file);
 
-// Copies contents of file src to file tar, creates tar if it doesn't exist
-// Returns SUCCESS or the type of error occured
-// err_file is set to 0 if the error was in src and 1 if the error was in tar
-enum file_management_error file_copy(char *src, char *tar, int *err_file);
+// Sizes of a copied file
+struct copy_stats {
+    long long logical_bytes;   // Size of file
+    long long physical_bytes;  // Bytes of data actually read and written to every target, holes excluded
+};
+
+// Function called with the number of bytes of every block before it is written, e.g. to limit the rate of a copy
+// Returns 0 to go on with the copy, anything else cancels it
+typedef int (*copy_throttle)(long long bytes);
+
+// Function called with the size of the source once it is open, before anything is copied
+typedef void (*copy_opened)(long long size);
+
+// Copies contents of file name of directory src_dir_fd to the file with the same name in every
+// directory of tar_dir_fds, which has num_of_targets directories
+// Only regular files can be copied
+// Only the data extents of the source are copied, found with lseek SEEK_DATA and SEEK_HOLE, so holes of
+// sparse files stay holes in targets. Targets are then truncated to the size of the source.
+// Files of at least COPY_PARALLEL_THRESHOLD bytes are split into COPY_THREADS ranges, which are
+// copied at the same time by different threads with pread and pwrite
+// Space of targets is preallocated with fallocate, unless the source has holes
+// Source is read only once and each block is written to all targets
+// Creates targets that don't exist
+// Mode, ownership, timestamps and extended attributes of the source are copied to every target
+// tar_errs[i] is set to SUCCESS or the type of error occured in the target of tar_dir_fds[i]. A target
+// with an error is skipped for the rest of the copy, but the other targets are still copied
+// Sizes of the copy are written to stats
+// If opened is not NULL, it is called with the size of the source once it is open
+// If throttle is not NULL, it is called before every block is written
+// If throttle cancels the copy, the partially written targets are removed and CANCELLED is returned
+// If flags has COPY_REPLACE, every target is written to a new file that takes the place of the old
+// one only once it is complete, so other hard links of the old file, e.g. in snapshots, keep their
+// contents, and a failed or cancelled copy leaves the old file as it was
+// If flags has COPY_SYNC, the data of every target and its entry in the target directory are
+// written to disk before the copy of the target succeeds
+// Returns SUCCESS or the type of error occured in the source. If the source fails, tar_errs are set
+// to the same error for every target that was not already failed
+enum file_management_error file_copy(int src_dir_fd, char *name, int *tar_dir_fds, int num_of_targets, enum file_management_error *tar_errs, struct copy_stats *stats, copy_opened opened, copy_throttle throttle, int flags);
+
+// Copies mode, ownership, timestamps and extended attributes of file name of directory src_dir_fd
+// to the file with the same name in every directory of tar_dir_fds, which has num_of_targets
+// directories, without touching their data
+// Ownership is only copied if the process is allowed to change it
+// tar_errs[i] is set to SUCCESS or the type of error occured in the target of tar_dir_fds[i]
+// Returns SUCCESS or OPEN_FAILED if the source can't be opened, in which case every tar_errs[i] is OPEN_FAILED
+enum file_management_error file_copy_metadata(int src_dir_fd, char *name, int *tar_dir_fds, int num_of_targets, enum file_management_error *tar_errs);
+
+// Copies array of count strings
+// Returns NULL if memory allocation fails
+char **string_array_copy(char **array, int count);
+
+// Frees array of count strings
+void string_array_free(char **array, int count);
 
 // Reads from fd and writes to buf until EOF is reached or until nbytes have been read
 // Not affected by signal interrupts
@@ -27,7 +113,29 @@ ssize_t read_line(int fd, char *buf, ssize_t nbytes);
 // Returns number of bytes written or -1 in case of error
 ssize_t write_bytes(int fd, char *buf, ssize_t nbytes);
 
-// Write date and time into buffer in format "%Y-%d-%m %X"
+// Writes all nbytes of buf to fd at offset, without changing the file offset
+// Not affected by signal interrupts.
+// Returns number of bytes written or -1 in case of error
+ssize_t pwrite_bytes(int fd, char *buf, size_t nbytes, off_t offset);
+
+// Writes nbytes of buf to fd as a frame, i.e. the length of buf as a decimal number and a
+// newline character, followed by the bytes of buf
+// An empty frame marks the end of a response
+// Returns number of bytes written or -1 in case of error
+ssize_t write_frame(int fd, char *buf, ssize_t nbytes);
+
+// Reads a frame from fd to buf and terminates it with a NULL character
+// If the frame is larger than nbytes-1 bytes, the rest of it is discarded
+// Returns length of frame or -1 in case of error
+ssize_t read_frame(int fd, char *buf, ssize_t nbytes);
+
+// Write date and time t, in seconds since the epoch, into buffer in format "%Y-%d-%m %X"
+// Buffer must be at least 20 characters long
+// In case of error, "----Unknown time----" is written into buffer
+// Returns 0 for success, -1 for failure
+int format_date_time(long long t, char *buffer, size_t size);
+
+// Write current date and time into buffer in format "%Y-%d-%m %X"
 // Buffer must be at least 20 characters long
 // In case of error, "----Unknown time----" is written into buffer
 // Returns 0 for success, -1 for failure
@@ -1,60 +1,276 @@
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <pthread.h>
 #include "../include/int_queue.h"
+#include "../include/autoscaler.h"
+
+#define WORKER_EXEC_FAILED 127   // Exit code of a worker whose program could not be loaded
+#define WORKER_SHARDS_MAX 64     // Maximum number of worker managers that share a pool, one bit each in
+                                 // the mask of the managers waiting for workers
+
+// Options of a pair that change how its workers write the targets and how long they may take
+struct worker_options {
+    int snapshot_keep;   // Snapshots kept for every target, 0 if the pair has no snapshots
+    int atomic;          // 1 if files are replaced by complete copies instead of being overwritten
+    int durability;      // An enum durability
+    struct name_filter *filter;  // Patterns of the files a full sync or mirror skips, NULL if none
+    long long timeout_ms;        // Milliseconds the worker may go without progress before it is killed,
+                                 // 0 for no limit
+    long long max_bytes;         // Bytes of files after which the worker hands back the jobs it hasn't
+                                 // started with a DEFERRED report, 0 for no limit
+};
+
+// Types of events returned by worker_manager_wait
+enum worker_event {
+    WORKER_EVENT_CONSOLE,        // A console is connecting
+    WORKER_EVENT_CONSOLE_CLIENT, // A connected console has sent data or disconnected
+    WORKER_EVENT_INOTIFY,        // Inotify events are available
+    WORKER_EVENT_OUTPUT,         // A worker has written to its pipe
+    WORKER_EVENT_EXIT,           // A worker has exited
+    WORKER_EVENT_MAILBOX,        // Another thread has sent messages to the mailbox of the manager
+    WORKER_EVENT_WAKE            // Workers of the pool have become free
+};
+
+// This struct is the budget of workers shared by the worker managers of the event-loop threads
+// Every manager has worker_limit slots of its own, but together they run no more workers than the
+// limit of the autoscaler. Before a pass over its job queue a manager takes workers from the budget
+// with atomic operations, and returns the ones it didn't start after it. A manager that got fewer
+// than it wanted sets its bit in waiting and is woken up through its eventfd once a worker exits
+// or the limit is raised. Only the autoscaler is guarded by a lock.
+struct worker_pool {
+    Autoscaler autoscaler;        // Decides how many workers can run at the same time
+    pthread_mutex_t lock;         // Guards autoscaler
+    Throttle throttle;            // Token buckets of the worker slots of all managers
+    int worker_limit;             // Worker slots of every manager, the autoscaler never goes above it
+    int num_of_shards;            // Number of managers
+    int limit;                    // Current limit of the autoscaler
+    int active;                   // Workers running or taken for a pass by a manager
+    int running;                  // Workers running
+    int stalled;                  // Workers killed by the watchdog that haven't exited yet
+    unsigned long long waiting;   // Bit of every manager that waits for workers to become free
+    size_t *waiting_jobs;         // Jobs every manager left in its queue in its last pass
+    int *wake_fds;                // Eventfd of every manager, written to wake it up
+};
+
+// Pipe and process of a worker slot
+struct worker_slot {
+    int pipe_fd;                  // Read end of pipe with worker's stdout, -1 when closed
+    int pid_fd;                   // Process file descriptor, readable when worker exits, -1 if slot is
+                                  // unused or worker has been reaped
+    char *output;                 // Everything worker has written so far, without its SIZE lines
+    size_t output_len;
+    size_t output_size;
+    size_t output_pos;            // Start of next line that hasn't been read by worker_manager_read_line
+    size_t output_scan;           // Start of next line that hasn't been checked for a SIZE line
+    int exit_status;              // Wait status of worker, set when it's reaped
+    int throttle_slot;            // Throttle slot whose bucket the worker takes from, shared with the
+                                  // other workers of its pair
+    struct job_info *jobs;        // Jobs of the pair the worker syncs in one run, the first is also
+                                  // in worker_jobs and shares its file
+    int num_of_jobs;
+    long long timeout_ms;         // Milliseconds the worker may go without progress, 0 for no limit
+    long long progress_ms;        // CLOCK_MONOTONIC milliseconds of the last progress of the worker
+    long long progress_count;     // Progress counter of the worker's slot in the throttle at progress_ms
+    long long size_ms;            // Milliseconds the size of the file the worker copies adds to timeout_ms
+    long long killed_ms;          // Time the watchdog killed the worker, 0 if it hasn't. A killed worker
+                                  // that hasn't exited yet, e.g. because it waits for a hung mount, is stalled
+};
 
 // This struct is responsible for:
 // - Storing information for currently active workers
 // - Setting up workers for jobs
-// - Storing necessary open files for polling, i.e. console input, inotify instance and worker pipes
+// - Waiting for events of the console socket, inotify instance, worker pipes and processes and
+//   connected consoles with epoll, so only ready files are looked at
 struct worker_manager {
-    int worker_limit;             // Maximum number of active workers
+    int worker_limit;             // Maximum number of worker slots, the autoscaler never goes above it
     int active_workers;           // Number of currently active workers - this is the same as slot queue size
     struct job_info *worker_jobs; // Worker and job information, such as command line arguments and pid
-    size_t pfds_size;             // Size of pfds array
-    struct pollfd *pfds;          // Array of file descriptors to keep track on
+    struct worker_slot *slots;    // Pipe and process of every worker, indexed like worker_jobs
+    struct timespec *start_times; // Time every active worker started, indexed like worker_jobs
+    struct worker_pool *pool;     // Budget of workers shared with the other managers
+    int shard;                    // Index of manager in pool
+    int slot_base;                // Slots of manager in the throttle start at this index
+    int taken;                    // Workers taken from pool for this pass that haven't started
+    int wake_fd;                  // Eventfd that is written when workers of the pool become free
+    Throttle throttle;            // Token buckets that limit the rate of workers, one per pair with workers
+    int console_fd;               // Socket that accepts console connections, -1 if not waited for
+    int inotify_fd;
+    int epoll_fd;
+    struct epoll_event *events;   // Events returned by last worker_manager_wait
+    int max_events;
     IntQueue slot_queue;          // Queue of next available worker slot
+    int worker_fd;                // Worker executable, opened at startup so that the working directory
+                                  // and later changes to its path don't matter
+    char worker_path[32];         // Path through which worker_fd is executed
 };
 
-// Initializes manager
-// Returns -1 if malloc fails and -2 if inotify_init fails
-int worker_manager_init(struct worker_manager *manager, int worker_limit, int console_fd);
+// Initializes pool for num_of_shards managers with worker_limit slots each, of which between min_limit
+// and worker_limit can be used at the same time by all of them depending on the load. Initially limit
+// slots can be used.
+// Returns -1 if malloc fails and -4 if the shared memory of the token buckets can't be created
+int worker_pool_init(struct worker_pool *pool, int min_limit, int worker_limit, int limit, int num_of_shards);
+
+// Returns current limit of workers that can run at the same time
+int worker_pool_limit(struct worker_pool *pool);
+
+// Returns number of running workers of all managers
+int worker_pool_running(struct worker_pool *pool);
+
+// Returns number of workers of all managers that the watchdog killed and haven't exited yet
+int worker_pool_stalled(struct worker_pool *pool);
+
+// Adjusts the limit if it's time to, given the jobs the managers left in their queues because no
+// worker was available, whose total is written to *waiting_jobs
+// Returns 1 if the limit changed, 0 otherwise
+int worker_pool_autoscale(struct worker_pool *pool, size_t *waiting_jobs);
+
+// Returns milliseconds until the next adjustment of the limit
+int worker_pool_autoscale_timeout(struct worker_pool *pool);
+
+// Sets a fixed limit, returns 0 on success, -1 if limit is not between 1 and the worker limit
+int worker_pool_set_limit(struct worker_pool *pool, int limit);
+
+// Starts adjusting the limit automatically again
+void worker_pool_set_auto(struct worker_pool *pool);
+
+// Writes current limit and statistics of the autoscaler to status
+void worker_pool_status(struct worker_pool *pool, struct autoscaler_status *status);
+
+// Frees resources for pool, after its managers have been destroyed
+void worker_pool_destroy(struct worker_pool *pool);
+
+// Initializes manager shard of pool, whose worker slots are numbered from shard * worker_limit in
+// the throttle
+// Returns -1 if malloc fails, -2 if inotify_init fails, -3 if epoll_create fails, -4 if the
+// shared memory of the token buckets can't be mapped, -5 if the worker executable can't be opened
+// and -6 if eventfd fails
+// console_fd is the socket that accepts console connections, -1 if this manager doesn't accept them
+int worker_manager_init(struct worker_manager *manager, struct worker_pool *pool, int shard, int console_fd);
 
-// Returns the number of available workers
+// Adds the eventfd of the mailbox of the thread of manager to the files that are waited for
+// Returns 0 on success, -1 on error
+int worker_manager_add_mailbox(struct worker_manager *manager, int fd);
+
+// Takes up to wanted workers from the budget of the pool for a pass over the job queue, no more
+// than manager has free slots. If it gets fewer, the manager is woken up when workers become free.
+// Returns number of workers taken
+int worker_manager_take_workers(struct worker_manager *manager, size_t wanted);
+
+// Returns the workers taken for this pass that haven't started to the pool, and records the number
+// of jobs left in the queue because no worker was available for the autoscaler
+void worker_manager_return_workers(struct worker_manager *manager, size_t waiting_jobs);
+
+// Clears the eventfd of manager after a WORKER_EVENT_WAKE
+void worker_manager_clear_wake(struct worker_manager *manager);
+
+// Returns the number of workers taken for this pass that haven't started
 int worker_manager_available_workers(struct worker_manager manager);
 
 int worker_manager_active_workers(struct worker_manager manager);
 
 // Adds an inotify watch for dir, returns file descriptor or -1 in case of error
+// A directory that is already watched keeps the events of its watch, which is returned
 int worker_manager_add_watch(struct worker_manager *manager, char *dir);
 
+// Adds an inotify watch for directory dir that reports files that are written or moved to it,
+// added to the events of a watch the directory already has
+// Returns watch descriptor or -1 in case of error
+int worker_manager_watch_writes(struct worker_manager *manager, char *dir);
+
+// Returns maximum number of inotify watches of the user, or -1 if it can't be read
+long worker_manager_watch_limit(void);
+
+// Adds devices of src_dir and its targets to the devices the autoscaler of the pool tracks
+// Returns 0 on success, -1 if a device couldn't be added
+int worker_manager_track_devices(struct worker_manager *manager, char *src_dir, char **tar_dirs, int num_of_targets);
+
 // Removes inotify watch wd, returns 0 on success, -1 on error
 int worker_manager_remove_watch(struct worker_manager *manager, int wd);
 
-// Assigns a worker to job from struct job
-// Sets up pipe communication and executes worker child
+// Assigns a worker to num_of_jobs jobs of the same pair, which it syncs one after another in one run
+// Only jobs of single files can share a worker, a job of the whole directory is the only job of its worker
+// On success, jobs and their files belong to the worker slot and are freed by worker_manager_free_worker
+// worker_jobs of the slot gets the first job, and every job gets the pid of the worker
+// Sets up pipe communication, spawns worker child and opens a process file descriptor for it
+// The worker takes from the throttle slot *throttle_slot, which the running workers of the job's pair
+// share. If it is -1, bucket of the pair is loaded into a throttle slot that no worker uses and
+// *throttle_slot is set to it. The bucket must be saved back with throttle_save_slot when the last
+// worker of the pair exits.
+// The worker writes the targets as options of the pair say
+// If worker can't be executed, the spawn fails
 // On success, returns pid of worker child. On error, returns one of the following:
 // ERROR CODES:
 // -1: malloc failed
 // -2: pipe failed
-// -3: fork failed
-// -4: dup2 failed
-// -5: exec failed
-pid_t worker_manager_setup_worker(struct worker_manager *manager, struct job_info job);
+// -3: posix_spawn failed
+// -4: pidfd_open failed
+// -5: epoll_ctl failed
+// A worker taken from the pool for this pass is used up
+pid_t worker_manager_setup_worker(struct worker_manager *manager, struct job_info *jobs, int num_of_jobs, struct throttle_bucket *bucket, int *throttle_slot, struct worker_options options);
+
+// Kills workers that have made no progress for longer than their timeout with SIGKILL
+// A worker makes progress when it writes to its pipe and whenever the progress counter of its
+// slot in the throttle grows, which every worker counts on its own. The timeout of a worker that
+// copies a file whose size it reported is longer by the time the file takes at TIMEOUT_MIN_RATE.
+// Progress is checked at least every WATCHDOG_CHECK_MS. Workers are only killed once.
+// Slots of the killed workers are stored in killed, which has room for every slot, and *timeout
+// is lowered to the milliseconds until the next worker would be overdue if that is sooner
+// Returns number of workers killed
+int worker_manager_watchdog(struct worker_manager *manager, int *killed, int *timeout);
+
+// Returns slot of active worker pid, or -1 if there is no such worker
+int worker_manager_find_worker(struct worker_manager *manager, pid_t pid);
+
+// Returns 1 if one of the jobs of an active worker syncs file of src_dir, 0 otherwise
+int worker_manager_file_busy(struct worker_manager *manager, char *src_dir, char *file);
+
+// Sends SIGTERM to worker at index, which makes it remove the file it is copying, skip the rest
+// of its job and write a CANCELLED report. Its slot is freed like any other when it exits.
+// Returns 0 on success, -1 if the signal can't be sent and -2 if index is not a running worker
+int worker_manager_cancel_worker(struct worker_manager *manager, int index);
+
+// Waits up to timeout milliseconds for events, -1 means forever
+// Returns number of events, or -1 in case of error
+int worker_manager_wait(struct worker_manager *manager, int timeout);
+
+// Returns type of event e of last wait
+enum worker_event worker_manager_event_type(struct worker_manager *manager, int e);
+
+// Returns worker slot of event e of last wait, or file descriptor if it's a console client event
+int worker_manager_event_value(struct worker_manager *manager, int e);
+
+// Reads everything worker at index has written so far, new output is progress of the worker
+// A line "SIZE: <bytes>" sets the size of the file the worker copies and is taken out of the output
+// Returns 0 on success, -1 if malloc fails and -2 if index is not an active worker
+int worker_manager_read_output(struct worker_manager *manager, int index);
+
+// Reaps worker at index after it has exited, reads the rest of its output and sets its exit status
+// Returns 0 on success, -1 if malloc or waitid fails and -2 if index is not an active worker or
+// has already been reaped
+int worker_manager_reap_worker(struct worker_manager *manager, int index);
+
+// Copies next line of output of worker at index to buf, until a newline character or nbytes-1
+// characters, and terminates it with a NULL character
+// Returns length of line or -1 if there are no more lines
+ssize_t worker_manager_read_line(struct worker_manager *manager, int index, char *buf, size_t nbytes);
+
+// Records that the worker at index copied bytes, used by the autoscaler to measure throughput
+void worker_manager_job_done(struct worker_manager *manager, int index, long long bytes);
 
 // Makes worker slot at index available after job is done, frees up resources and
-// closes pipe communication 
+// closes pipe communication and process file descriptor
+// The worker is returned to the pool, and managers waiting for workers are woken up
 int worker_manager_free_worker(struct worker_manager *manager, int index);
 
-// Returns 1 if index is console file descriptor's index in pfds array, otherwise
-// returns 0
-int worker_manager_index_is_console(struct worker_manager manager, int index);
+// Returns bytes of memory used by the jobs and output buffers of the worker slots
+size_t worker_manager_memory(struct worker_manager *manager);
 
-// Returns 1 if index is inotify instance file descriptor index in pfds array,
-// otherwise returns 0
-int worker_manager_index_is_inotify(struct worker_manager manager, int index);
+// Adds connected console fd to the files that are waited for, returns 0 on success, -1 on error
+int worker_manager_add_console(struct worker_manager *manager, int fd);
 
-// Returns 1 if index is a worker pipe file descriptor index in pfds array,
-// otherwise returns 0
-int worker_manager_index_is_worker(struct worker_manager manager, int index);
+// Stops waiting for connected console fd
+void worker_manager_remove_console(struct worker_manager *manager, int fd);
 
-// Frees up resources for manager
+// Frees up resources for manager, but not its pool
 void worker_manager_destroy(struct worker_manager *manager);
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "../include/autoscaler.h"
+
+#define DISKSTATS_PATH "/proc/diskstats"
+#define SATURATED 0.9          // Utilisation above which a device is considered saturated
+#define THROUGHPUT_DROP 0.9    // Throughput of a worker must drop below this share of the
+                               // previous interval to shrink because of saturation
+#define IDLE_INTERVALS 5       // Intervals with idle workers and an empty queue before shrinking
+
+// Device whose utilisation is tracked
+struct device {
+    unsigned int major;
+    unsigned int minor;
+    unsigned long long io_ticks;  // Milliseconds spent doing I/O at last update
+    int found;                    // 1 if device was found in /proc/diskstats at last update
+};
+
+struct autoscaler {
+    int limit;
+    int min_limit;
+    int max_limit;
+    int automatic;
+
+    struct device *devices;
+    int num_of_devices;
+
+    struct timespec last_update;
+    long long bytes;               // Bytes copied by jobs finished in this interval
+    long long busy_ms;             // Time spent by jobs finished in this interval
+    int idle_intervals;
+
+    double utilisation;            // Statistics of last interval
+    double throughput;
+};
+
+long long autoscaler_elapsed_ms(struct timespec *since);
+double autoscaler_read_utilisation(Autoscaler autoscaler, long long elapsed_ms);
+
+Autoscaler autoscaler_init(int min_limit, int max_limit, int limit) {
+    Autoscaler autoscaler = malloc(sizeof(struct autoscaler));
+    if (autoscaler == NULL) return NULL;
+
+    autoscaler->min_limit = min_limit;
+    autoscaler->max_limit = max_limit;
+    autoscaler->limit = limit < min_limit? min_limit: limit > max_limit? max_limit: limit;
+    autoscaler->automatic = 1;
+
+    autoscaler->devices = NULL;
+    autoscaler->num_of_devices = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &autoscaler->last_update);
+    autoscaler->bytes = 0;
+    autoscaler->busy_ms = 0;
+    autoscaler->idle_intervals = 0;
+
+    autoscaler->utilisation = -1;
+    autoscaler->throughput = -1;
+
+    return autoscaler;
+}
+
+int autoscaler_add_device(Autoscaler autoscaler, char *dir) {
+    struct stat st;
+    if (stat(dir, &st) < 0) return -1;
+
+    unsigned int dev_major = major(st.st_dev), dev_minor = minor(st.st_dev);
+
+    // Check if device is already tracked
+    for (int d = 0; d < autoscaler->num_of_devices; d++) {
+        if (autoscaler->devices[d].major == dev_major && autoscaler->devices[d].minor == dev_minor)
+            return 0;
+    }
+
+    struct device *new_devices = realloc(autoscaler->devices, (autoscaler->num_of_devices+1) * sizeof(struct device));
+    if (new_devices == NULL) return -1;
+
+    autoscaler->devices = new_devices;
+
+    struct device *device = &autoscaler->devices[autoscaler->num_of_devices++];
+    device->major = dev_major;
+    device->minor = dev_minor;
+    device->io_ticks = 0;
+    device->found = 0;
+
+    return 0;
+}
+
+void autoscaler_job_done(Autoscaler autoscaler, long long bytes, long long busy_ms) {
+    autoscaler->bytes += bytes;
+    autoscaler->busy_ms += busy_ms;
+}
+
+int autoscaler_timeout(Autoscaler autoscaler) {
+    long long remaining = AUTOSCALER_INTERVAL_MS - autoscaler_elapsed_ms(&autoscaler->last_update);
+    return remaining < 0? 0: remaining;
+}
+
+int autoscaler_update(Autoscaler autoscaler, size_t queue_depth, int active_workers) {
+    long long elapsed_ms = autoscaler_elapsed_ms(&autoscaler->last_update);
+    if (elapsed_ms < AUTOSCALER_INTERVAL_MS) return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &autoscaler->last_update);
+
+    // Statistics of this interval
+    double prev_throughput = autoscaler->throughput;
+
+    autoscaler->utilisation = autoscaler_read_utilisation(autoscaler, elapsed_ms);
+
+    if (autoscaler->busy_ms > 0)
+        autoscaler->throughput = autoscaler->bytes * 1000.0 / autoscaler->busy_ms;
+
+    autoscaler->bytes = 0;
+    autoscaler->busy_ms = 0;
+
+    if (!autoscaler->automatic) return 0;
+
+    int old_limit = autoscaler->limit;
+    int saturated = autoscaler->utilisation >= SATURATED;
+
+    // Jobs are waiting for a worker and devices can take more work
+    if (queue_depth > 0 && active_workers >= autoscaler->limit && !saturated) {
+        // Grow faster if the queue can fill the new slots
+        int step = queue_depth >= (size_t) autoscaler->limit? autoscaler->limit / 2: 1;
+        autoscaler->limit += step > 0? step: 1;
+        autoscaler->idle_intervals = 0;
+
+    // A device is saturated and every worker copies slower than before, so workers only
+    // compete with each other
+    } else if (saturated && prev_throughput > 0 && autoscaler->throughput < prev_throughput * THROUGHPUT_DROP) {
+        autoscaler->limit--;
+        autoscaler->idle_intervals = 0;
+
+    // Nothing to do and some workers are idle
+    } else if (queue_depth == 0 && active_workers < autoscaler->limit) {
+        if (++autoscaler->idle_intervals >= IDLE_INTERVALS) {
+            autoscaler->limit--;
+            autoscaler->idle_intervals = 0;
+        }
+
+    } else {
+        autoscaler->idle_intervals = 0;
+    }
+
+    if (autoscaler->limit > autoscaler->max_limit) autoscaler->limit = autoscaler->max_limit;
+    if (autoscaler->limit < autoscaler->min_limit) autoscaler->limit = autoscaler->min_limit;
+
+    return autoscaler->limit != old_limit;
+}
+
+int autoscaler_limit(Autoscaler autoscaler) {
+    return autoscaler->limit;
+}
+
+int autoscaler_set_limit(Autoscaler autoscaler, int limit) {
+    if (limit < 1 || limit > autoscaler->max_limit) return -1;
+
+    autoscaler->limit = limit;
+    autoscaler->automatic = 0;
+    return 0;
+}
+
+void autoscaler_set_auto(Autoscaler autoscaler) {
+    autoscaler->automatic = 1;
+    autoscaler->idle_intervals = 0;
+
+    if (autoscaler->limit < autoscaler->min_limit) autoscaler->limit = autoscaler->min_limit;
+}
+
+void autoscaler_get_status(Autoscaler autoscaler, struct autoscaler_status *status) {
+    status->limit = autoscaler->limit;
+    status->min_limit = autoscaler->min_limit;
+    status->max_limit = autoscaler->max_limit;
+    status->automatic = autoscaler->automatic;
+    status->utilisation = autoscaler->utilisation;
+    status->throughput = autoscaler->throughput;
+}
+
+void autoscaler_destroy(Autoscaler autoscaler) {
+    free(autoscaler->devices);
+    free(autoscaler);
+}
+
+// Returns milliseconds passed since time since
+long long autoscaler_elapsed_ms(struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1000LL + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Reads I/O time of all tracked devices from /proc/diskstats
+// Returns highest utilisation over the last elapsed_ms, or -1 if no device was found
+// twice in a row, e.g. for file systems without a block device
+double autoscaler_read_utilisation(Autoscaler autoscaler, long long elapsed_ms) {
+    FILE *diskstats = fopen(DISKSTATS_PATH, "r");
+    if (diskstats == NULL) return -1;
+
+    double utilisation = -1;
+    char line[256];
+
+    while (fgets(line, sizeof(line), diskstats)) {
+        unsigned int dev_major, dev_minor;
+        unsigned long long io_ticks;
+
+        // Fields: major minor name, then 9 counters, the last of which is time spent doing I/O
+        if (sscanf(line, "%u %u %*s %*u %*u %*u %*u %*u %*u %*u %*u %*u %llu", &dev_major, &dev_minor, &io_ticks) != 3)
+            continue;
+
+        for (int d = 0; d < autoscaler->num_of_devices; d++) {
+            struct device *device = &autoscaler->devices[d];
+            if (device->major != dev_major || device->minor != dev_minor) continue;
+
+            if (device->found && elapsed_ms > 0) {
+                double device_util = (double) (io_ticks - device->io_ticks) / elapsed_ms;
+                if (device_util > 1) device_util = 1;
+                if (device_util > utilisation) utilisation = device_util;
+            }
+
+            device->io_ticks = io_ticks;
+            device->found = 1;
+        }
+    }
+
+    fclose(diskstats);
+    return utilisation;
+}
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../include/console_server.h"
+
+#define FRAME_HEADER_SIZE 16    // Maximum length of frame header "<length>\n"
+#define OUTPUT_SIZE_DEFAULT 4096  // Initial size of the queue of responses of a console
+
+// Connected console
+struct console_client {
+    int fd;                             // -1 if this position is unused
+    int id;
+    char buffer[CONSOLE_REQUEST_SIZE + FRAME_HEADER_SIZE];  // Bytes received but not yet executed
+    size_t buf_len;
+    int pending;                        // Jobs whose results haven't been sent yet
+    char *output;                       // Frames the socket didn't take yet, NULL if there are none
+    size_t output_len;
+    size_t output_size;
+    int failed;                         // 1 if the console stopped reading or its socket failed,
+                                        // its output is dropped until it is closed
+};
+
+struct console_server {
+    int listen_fd;
+    char *path;
+    int next_id;
+    int num_failed;                     // Consoles that have failed but aren't closed yet
+    struct console_client clients[CONSOLE_MAX_CLIENTS];
+};
+
+struct console_client *console_server_find(ConsoleServer server, int fd);
+int console_server_queue(struct console_client *client, char *buf, size_t nbytes);
+void console_server_fail(ConsoleServer server, struct console_client *client);
+
+ConsoleServer console_server_init(char *path) {
+    ConsoleServer server = malloc(sizeof(struct console_server));
+    if (server == NULL) return NULL;
+
+    server->path = malloc((strlen(path)+1) * sizeof(char));
+    if (server->path == NULL) {
+        free(server); return NULL;
+    }
+    strcpy(server->path, path);
+
+    server->next_id = 1;
+    server->num_failed = 0;
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        server->clients[i].fd = -1;
+
+    // Create socket
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        free(server->path); free(server);
+        return NULL;
+    }
+
+    // Bind socket to path
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path)-1);
+
+    unlink(path);
+
+    if (bind(server->listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(server->listen_fd, SOMAXCONN) < 0) {
+        int err = errno;
+        close(server->listen_fd); free(server->path); free(server);
+        errno = err;
+        return NULL;
+    }
+
+    return server;
+}
+
+int console_server_listen_fd(ConsoleServer server) {
+    return server->listen_fd;
+}
+
+int console_server_accept(ConsoleServer server) {
+    // Responses are queued when the socket is full, so a console that doesn't read them can't block the manager
+    int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) return -1;
+
+    // Find empty position
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd == -1) {
+            server->clients[i].fd = fd;
+            server->clients[i].id = server->next_id++;
+            server->clients[i].buf_len = 0;
+            server->clients[i].pending = 0;
+            server->clients[i].output = NULL;
+            server->clients[i].output_len = server->clients[i].output_size = 0;
+            server->clients[i].failed = 0;
+            return fd;
+        }
+    }
+
+    close(fd);
+    return -2;
+}
+
+int console_server_read(ConsoleServer server, int fd) {
+    struct console_client *client = console_server_find(server, fd);
+    if (client == NULL || client->failed) return -1;
+
+    while (1) {
+        size_t space = sizeof(client->buffer) - client->buf_len;
+
+        // A full buffer holds a whole request or an invalid frame
+        if (space == 0) return 1;
+
+        ssize_t bytes = recv(fd, client->buffer + client->buf_len, space, 0);
+
+        if (bytes == 0) return -1;
+
+        if (bytes < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+
+        client->buf_len += bytes;
+    }
+}
+
+int console_server_next_request(ConsoleServer server, int fd, char *buf, size_t nbytes) {
+    struct console_client *client = console_server_find(server, fd);
+    if (client == NULL) return 0;
+
+    // Header is the length of the request in decimal digits followed by a newline
+    size_t header_len = 0, frame_len = 0;
+
+    while (header_len < client->buf_len && client->buffer[header_len] >= '0' && client->buffer[header_len] <= '9') {
+        frame_len = 10 * frame_len + (client->buffer[header_len++] - '0');
+        if (frame_len > CONSOLE_REQUEST_SIZE) return -1;
+    }
+
+    if (header_len == client->buf_len)
+        return header_len < FRAME_HEADER_SIZE? 0: -1;
+
+    if (header_len == 0 || client->buffer[header_len] != '\n')
+        return -1;
+
+    header_len++;
+
+    // Check if whole frame has been received
+    if (client->buf_len < header_len + frame_len) return 0;
+
+    // Copy request
+    size_t copy_len = frame_len < nbytes-1? frame_len: nbytes-1;
+    memcpy(buf, client->buffer + header_len, copy_len);
+    buf[copy_len] = '\0';
+
+    // Remove frame from buffer
+    client->buf_len -= header_len + frame_len;
+    memmove(client->buffer, client->buffer + header_len + frame_len, client->buf_len);
+
+    return 1;
+}
+
+void console_server_write(ConsoleServer server, int fd, char *buf, size_t nbytes) {
+    struct console_client *client = console_server_find(server, fd);
+    if (client == NULL || client->failed) return;
+
+    char header[FRAME_HEADER_SIZE];
+    int header_len = snprintf(header, sizeof(header), "%zu\n", nbytes);
+
+    if (client->output_len + header_len + nbytes > CONSOLE_OUTPUT_MAX || console_server_queue(client, header, header_len) < 0 || console_server_queue(client, buf, nbytes) < 0) {
+        console_server_fail(server, client);
+        return;
+    }
+
+    console_server_flush(server, fd);
+}
+
+int console_server_flush(ConsoleServer server, int fd) {
+    struct console_client *client = console_server_find(server, fd);
+    if (client == NULL || client->failed) return -1;
+
+    size_t sent = 0;
+
+    while (sent < client->output_len) {
+        ssize_t bytes = send(fd, client->output + sent, client->output_len - sent, MSG_NOSIGNAL);
+
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+        if (bytes < 0) {
+            console_server_fail(server, client);
+            return -1;
+        }
+
+        sent += bytes;
+    }
+
+    // Keep what the socket didn't take, the memory of a console that has caught up is freed
+    client->output_len -= sent;
+    memmove(client->output, client->output + sent, client->output_len);
+
+    if (client->output_len == 0) {
+        free(client->output);
+        client->output = NULL;
+        client->output_size = 0;
+    }
+
+    return 0;
+}
+
+int console_server_next_failed(ConsoleServer server) {
+    if (server->num_failed == 0) return -1;
+
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd != -1 && server->clients[i].failed)
+            return server->clients[i].fd;
+    }
+
+    return -1;
+}
+
+int console_server_client_id(ConsoleServer server, int fd) {
+    struct console_client *client = console_server_find(server, fd);
+    return client == NULL? 0: client->id;
+}
+
+int console_server_client_fd(ConsoleServer server, int id) {
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd != -1 && server->clients[i].id == id)
+            return server->clients[i].fd;
+    }
+
+    return -1;
+}
+
+void console_server_add_pending(ConsoleServer server, int id, int count) {
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd != -1 && server->clients[i].id == id)
+            server->clients[i].pending += count;
+    }
+}
+
+int console_server_done_pending(ConsoleServer server, int id) {
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd != -1 && server->clients[i].id == id)
+            return --server->clients[i].pending;
+    }
+
+    return -1;
+}
+
+void console_server_close_client(ConsoleServer server, int fd) {
+    struct console_client *client = console_server_find(server, fd);
+    if (client == NULL) return;
+
+    if (client->failed) server->num_failed--;
+
+    close(client->fd);
+    client->fd = -1;
+    free(client->output);
+}
+
+void console_server_destroy(ConsoleServer server) {
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd != -1) {
+            // Last responses are sent only if the socket has room for them
+            console_server_flush(server, server->clients[i].fd);
+            close(server->clients[i].fd);
+            free(server->clients[i].output);
+        }
+    }
+
+    close(server->listen_fd);
+    unlink(server->path);
+
+    free(server->path);
+    free(server);
+}
+
+// Returns console with file descriptor fd or NULL if it is not connected
+struct console_client *console_server_find(ConsoleServer server, int fd) {
+    if (fd < 0) return NULL;
+
+    for (int i = 0; i < CONSOLE_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd == fd)
+            return &server->clients[i];
+    }
+
+    return NULL;
+}
+
+// Appends nbytes of buf to the output of client
+// Returns 0 on success, -1 if malloc fails
+int console_server_queue(struct console_client *client, char *buf, size_t nbytes) {
+    if (client->output_len + nbytes > client->output_size) {
+        size_t size = client->output_size == 0? OUTPUT_SIZE_DEFAULT: client->output_size;
+        while (size < client->output_len + nbytes) size *= 2;
+
+        char *output = realloc(client->output, size);
+        if (output == NULL) return -1;
+
+        client->output = output;
+        client->output_size = size;
+    }
+
+    if (nbytes > 0) memcpy(client->output + client->output_len, buf, nbytes);
+    client->output_len += nbytes;
+    return 0;
+}
+
+// Drops output of client, which must be closed
+void console_server_fail(ConsoleServer server, struct console_client *client) {
+    free(client->output);
+    client->output = NULL;
+    client->output_len = client->output_size = 0;
+    client->failed = 1;
+    server->num_failed++;
+}
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../include/dir_scanner.h"
+
+// Entry returned by getdents64, which has no wrapper in older C libraries
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct dir_scanner {
+    int dir_fd;
+    char *buffer;
+    long len;                // Bytes returned by last getdents64
+    long pos;                // Position of next entry in buffer
+};
+
+int dir_list_compare(const void *a, const void *b);
+
+DirScanner dir_scanner_init(int dir_fd) {
+    DirScanner scanner = malloc(sizeof(struct dir_scanner));
+    if (scanner == NULL) return NULL;
+
+    scanner->buffer = malloc(DIR_SCANNER_BUF_SIZE);
+    if (scanner->buffer == NULL) {
+        free(scanner); return NULL;
+    }
+
+    scanner->dir_fd = dir_fd;
+    scanner->len = 0;
+    scanner->pos = 0;
+
+    return scanner;
+}
+
+int dir_scanner_next(DirScanner scanner, struct dir_entry *entry) {
+    while (1) {
+        // Read next batch of entries
+        if (scanner->pos >= scanner->len) {
+            scanner->len = syscall(SYS_getdents64, scanner->dir_fd, scanner->buffer, DIR_SCANNER_BUF_SIZE);
+            scanner->pos = 0;
+
+            if (scanner->len < 0 && errno == EINTR) continue;
+            if (scanner->len < 0) return -1;
+            if (scanner->len == 0) return 0;
+        }
+
+        struct linux_dirent64 *dirent = (struct linux_dirent64 *) (scanner->buffer + scanner->pos);
+        scanner->pos += dirent->d_reclen;
+
+        if (dirent->d_ino == 0 || !strcmp(dirent->d_name, ".") || !strcmp(dirent->d_name, ".."))
+            continue;
+
+        entry->name = dirent->d_name;
+        entry->type = dirent->d_type;
+        entry->size = -1;
+
+        // Only regular files need their status, and entries whose type the file system doesn't report
+        if (entry->type != DT_REG && entry->type != DT_UNKNOWN)
+            return 1;
+
+        struct statx stx;
+
+        if (statx(scanner->dir_fd, entry->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &stx) < 0) {
+            // Entry was removed after it was read
+            if (errno == ENOENT) continue;
+            return 1;
+        }
+
+        entry->type = IFTODT(stx.stx_mode);
+        entry->mode = stx.stx_mode & 07777;
+        entry->size = stx.stx_size;
+        entry->mtime.tv_sec = stx.stx_mtime.tv_sec;
+        entry->mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+
+        return 1;
+    }
+}
+
+void dir_scanner_destroy(DirScanner scanner) {
+    free(scanner->buffer);
+    free(scanner);
+}
+
+int dir_scanner_list(int dir_fd, int regular_only, struct dir_list *list) {
+    DirScanner scanner = dir_scanner_init(dir_fd);
+    if (scanner == NULL) return -1;
+
+    size_t entries_size = 1024, names_size = 16384, names_len = 0;
+
+    list->count = 0;
+    list->entries = malloc(entries_size * sizeof(struct dir_entry));
+    list->names = malloc(names_size);
+
+    if (list->entries == NULL || list->names == NULL) {
+        dir_list_free(list); dir_scanner_destroy(scanner);
+        return -1;
+    }
+
+    struct dir_entry entry;
+    int result;
+
+    while ((result = dir_scanner_next(scanner, &entry)) == 1) {
+        if (regular_only && entry.type != DT_REG) continue;
+
+        size_t name_len = strlen(entry.name) + 1;
+
+        // Resize arrays if needed
+        if (list->count == entries_size) {
+            struct dir_entry *new_entries = realloc(list->entries, entries_size * 2 * sizeof(struct dir_entry));
+            if (new_entries == NULL) break;
+
+            list->entries = new_entries;
+            entries_size *= 2;
+        }
+
+        if (names_len + name_len > names_size) {
+            char *new_names = realloc(list->names, names_size * 2);
+            if (new_names == NULL) break;
+
+            list->names = new_names;
+            names_size *= 2;
+        }
+
+        // Names are copied, because the buffer of the scanner is reused
+        memcpy(list->names + names_len, entry.name, name_len);
+        names_len += name_len;
+
+        list->entries[list->count++] = entry;
+    }
+
+    dir_scanner_destroy(scanner);
+
+    if (result != 0) {
+        dir_list_free(list);
+        return result == 1? -1: -2;
+    }
+
+    // Point every entry to its name, only now that the names won't be moved anymore
+    char *name = list->names;
+
+    for (size_t i = 0; i < list->count; i++) {
+        list->entries[i].name = name;
+        name += strlen(name) + 1;
+    }
+
+    qsort(list->entries, list->count, sizeof(struct dir_entry), dir_list_compare);
+    return 0;
+}
+
+void dir_list_free(struct dir_list *list) {
+    free(list->entries);
+    free(list->names);
+
+    list->entries = NULL;
+    list->names = NULL;
+    list->count = 0;
+}
+
+// Compares entries by name
+int dir_list_compare(const void *a, const void *b) {
+    return strcmp(((struct dir_entry *) a)->name, ((struct dir_entry *) b)->name);
+}
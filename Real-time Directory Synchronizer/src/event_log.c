@@ -0,0 +1,193 @@
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../include/util.h"
+#include "../include/event_log.h"
+
+#define EVENT_BUF_SIZE 65536    // Bytes of records kept before they are written
+#define PATHS_DEFAULT 64        // Initial number of slots of the table of path ids
+
+struct event_log {
+    int fd;
+    char buffer[EVENT_BUF_SIZE];
+    size_t buf_len;
+    char **paths;               // Open addressing table of paths that have an id, by pointer
+    uint32_t *ids;
+    size_t num_of_slots;
+    uint32_t num_of_paths;
+};
+
+int event_log_add(EventLog log, struct event_record *record, char *text, size_t text_len);
+long long event_log_path_id(EventLog log, char *path);
+size_t event_log_slot(char *path, size_t num_of_slots);
+int event_log_grow(EventLog log);
+
+EventLog event_log_init(int fd) {
+    EventLog log = malloc(sizeof(struct event_log));
+    if (log == NULL) return NULL;
+
+    log->paths = calloc(PATHS_DEFAULT, sizeof(char *));
+    log->ids = malloc(PATHS_DEFAULT * sizeof(uint32_t));
+
+    if (log->paths == NULL || log->ids == NULL) {
+        free(log->paths); free(log->ids); free(log);
+        return NULL;
+    }
+
+    log->fd = fd;
+    log->buf_len = 0;
+    log->num_of_slots = PATHS_DEFAULT;
+    log->num_of_paths = 0;
+
+    if (lseek(fd, 0, SEEK_END) == 0) {
+        memcpy(log->buffer, EVENT_LOG_MAGIC, EVENT_LOG_ALIGN);
+        log->buf_len = EVENT_LOG_ALIGN;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct event_record start = {0};
+    start.time_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    start.pid = getpid();
+    start.type = EVENT_START;
+
+    if (event_log_add(log, &start, NULL, 0) < 0 || event_log_flush(log) < 0) {
+        free(log->paths); free(log->ids); free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+int event_log_job(EventLog log, char *src_dir, char *tar_dir, int pid, int operation, int status, int errors, long long bytes, long long latency_us, int text_kind, char *text) {
+    long long src_id = event_log_path_id(log, src_dir);
+    long long tar_id = event_log_path_id(log, tar_dir);
+
+    if (src_id < 0 || tar_id < 0)
+        return -1;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct event_record record;
+    record.time_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+    record.bytes = bytes;
+    record.latency_us = latency_us > UINT32_MAX? UINT32_MAX: latency_us;
+    record.pid = pid;
+    record.src_id = src_id;
+    record.tar_id = tar_id;
+    record.type = EVENT_JOB;
+    record.operation = operation;
+    record.status = status;
+    record.text_kind = text_kind;
+    record.errors = errors > UINT16_MAX? UINT16_MAX: errors;
+
+    return event_log_add(log, &record, text, strlen(text));
+}
+
+int event_log_flush(EventLog log) {
+    if (log->buf_len == 0) return 0;
+
+    int result = write_bytes(log->fd, log->buffer, log->buf_len) < 0? -1: 0;
+
+    log->buf_len = 0;
+    return result;
+}
+
+void event_log_destroy(EventLog log) {
+    event_log_flush(log);
+    close(log->fd);
+
+    free(log->paths);
+    free(log->ids);
+    free(log);
+}
+
+// Copies record with text of text_len bytes to the buffer of log, which is flushed first if
+// it has no space for it
+// Returns 0 on success, -1 if writing fails
+int event_log_add(EventLog log, struct event_record *record, char *text, size_t text_len) {
+    if (text_len > UINT16_MAX) text_len = UINT16_MAX;
+    if (text_len > EVENT_BUF_SIZE - sizeof(struct event_record)) text_len = EVENT_BUF_SIZE - sizeof(struct event_record);
+
+    size_t padded = (text_len + EVENT_LOG_ALIGN - 1) / EVENT_LOG_ALIGN * EVENT_LOG_ALIGN;
+    size_t size = sizeof(struct event_record) + padded;
+
+    if (log->buf_len + size > EVENT_BUF_SIZE && event_log_flush(log) < 0)
+        return -1;
+
+    record->text_len = text_len;
+    char *pos = log->buffer + log->buf_len;
+
+    memcpy(pos, record, sizeof(struct event_record));
+    memcpy(pos + sizeof(struct event_record), text, text_len);
+    memset(pos + sizeof(struct event_record) + text_len, 0, padded - text_len);
+
+    log->buf_len += size;
+    return 0;
+}
+
+// Returns id of path, which gets the next id and a PATH record if it doesn't have one yet
+// Returns -1 if malloc or writing fails
+long long event_log_path_id(EventLog log, char *path) {
+    size_t slot = event_log_slot(path, log->num_of_slots);
+
+    while (log->paths[slot] != NULL) {
+        if (log->paths[slot] == path)
+            return log->ids[slot];
+
+        slot = (slot + 1) % log->num_of_slots;
+    }
+
+    // Keep the table at most half full
+    if (2 * (log->num_of_paths + 1) > log->num_of_slots) {
+        if (event_log_grow(log) < 0) return -1;
+        return event_log_path_id(log, path);
+    }
+
+    struct event_record record = {0};
+    record.src_id = log->num_of_paths;
+    record.type = EVENT_PATH;
+
+    if (event_log_add(log, &record, path, strlen(path)) < 0)
+        return -1;
+
+    log->paths[slot] = path;
+    log->ids[slot] = log->num_of_paths;
+    return log->num_of_paths++;
+}
+
+// Doubles the slots of the table of path ids
+// Returns 0 on success, -1 if malloc fails
+int event_log_grow(EventLog log) {
+    size_t num_of_slots = 2 * log->num_of_slots;
+    char **paths = calloc(num_of_slots, sizeof(char *));
+    uint32_t *ids = malloc(num_of_slots * sizeof(uint32_t));
+
+    if (paths == NULL || ids == NULL) {
+        free(paths); free(ids);
+        return -1;
+    }
+
+    for (size_t s = 0; s < log->num_of_slots; s++) {
+        if (log->paths[s] == NULL) continue;
+
+        size_t slot = event_log_slot(log->paths[s], num_of_slots);
+        while (paths[slot] != NULL) slot = (slot + 1) % num_of_slots;
+
+        paths[slot] = log->paths[s];
+        ids[slot] = log->ids[s];
+    }
+
+    free(log->paths); free(log->ids);
+    log->paths = paths;
+    log->ids = ids;
+    log->num_of_slots = num_of_slots;
+    return 0;
+}
+
+// Returns slot of path in a table of num_of_slots slots, by its address
+size_t event_log_slot(char *path, size_t num_of_slots) {
+    return (uintptr_t) path * 11400714819323198485ULL % num_of_slots;
+}
@@ -1,28 +1,64 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include "../include/util.h"
+#include "../include/string_pool.h"
 #include "../include/file_monitor.h"
 
-typedef struct node *Node;
-
-struct node {
-    struct sync_info_mem_store info;
-    Node next;
-};
-
-struct file_monitor { // File monitor is a linked list
-    Node head;
-    Node tail;
+#define BUCKETS_DEFAULT 64       // Initial number of buckets of the hash tables
+#define RECORDS_PER_BLOCK 1024   // Number of directories in a block of records
+#define NO_RECORD ((unsigned int) -1)   // End of a bucket of a hash table
+
+// Directories are kept in blocks of records in the order they were added, so that going through
+// all of them reads memory in order. Blocks never move, so pointers to records stay valid.
+// Directories are also in two hash tables, so that a directory can be found by its source
+// directory or by its watch descriptor. The tables are arrays of record positions, separate from
+// the records, so that a lookup only reads the records it compares.
+struct file_monitor {
+    struct sync_info_mem_store **blocks;
+    size_t num_of_blocks;
     size_t size;
+    size_t capacity;             // Number of positions of the arrays below
+    unsigned int *hashes;        // Hash of source directory of every position
+    int *wds;                    // Watch descriptor every position is in the watch table with, -1 if it's not
+    unsigned int *name_next;     // Next position in the same bucket of by_name
+    unsigned int *wd_next;       // Next position in the same bucket of by_wd
+    unsigned int *by_name;       // First position of every bucket
+    unsigned int *by_wd;         // Only has active directories
+    size_t num_of_buckets;
+    size_t status_memory;        // Bytes of target status arrays
+    size_t filter_memory;        // Bytes of filters
+    StringPool paths;            // Source and target directories
 };
 
+struct sync_info_mem_store *file_monitor_record(FileMonitor monitor, unsigned int id);
+unsigned int file_monitor_hash(char *src_dir);
+void file_monitor_index_wd(FileMonitor monitor, unsigned int id, int wd);
+void file_monitor_unindex_wd(FileMonitor monitor, unsigned int id);
+int file_monitor_grow(FileMonitor monitor);
+int file_monitor_resize(FileMonitor monitor);
+int file_monitor_copy_filter(NameFilter filter, NameFilter *copy);
+int file_monitor_set_pair(FileMonitor monitor, struct sync_info_mem_store *info, char **tar_dirs, int num_of_targets, struct pair_options options, int keep_status);
+
 FileMonitor file_monitor_init(void) {
-    FileMonitor monitor = malloc(sizeof(struct file_monitor));
+    FileMonitor monitor = calloc(1, sizeof(struct file_monitor));
 
     if (monitor == NULL)
         return NULL;
 
-    monitor->head = monitor->tail = NULL;
-    monitor->size = 0;
+    monitor->num_of_buckets = BUCKETS_DEFAULT;
+    monitor->by_name = malloc(BUCKETS_DEFAULT * sizeof(unsigned int));
+    monitor->by_wd = malloc(BUCKETS_DEFAULT * sizeof(unsigned int));
+    monitor->paths = string_pool_init();
+
+    if (monitor->by_name == NULL || monitor->by_wd == NULL || monitor->paths == NULL) {
+        if (monitor->paths != NULL) string_pool_destroy(monitor->paths);
+        free(monitor->by_name); free(monitor->by_wd); free(monitor);
+        return NULL;
+    }
+
+    memset(monitor->by_name, 0xff, BUCKETS_DEFAULT * sizeof(unsigned int));
+    memset(monitor->by_wd, 0xff, BUCKETS_DEFAULT * sizeof(unsigned int));
     return monitor;
 }
 
@@ -30,7 +66,78 @@ size_t file_monitor_size(FileMonitor monitor) {
     return monitor->size;
 }
 
-int file_monitor_add(FileMonitor monitor, char *src_dir, char *tar_dir, int wd) {
+// Replaces targets of info with tar_dirs, interned in the string pool of monitor
+// Returns -1 if malloc fails, 0 otherwise
+int file_monitor_set_targets(FileMonitor monitor, struct sync_info_mem_store *info, char **tar_dirs, int num_of_targets) {
+    char **new_tar_dirs = string_pool_intern_array(monitor->paths, tar_dirs, num_of_targets);
+    if (new_tar_dirs == NULL) return -1;
+
+    struct target_status *new_status = calloc(num_of_targets, sizeof(struct target_status));
+    if (new_status == NULL) return -1;
+
+    info->tar_dirs = new_tar_dirs;
+    info->num_of_targets = num_of_targets;
+    info->target_status = new_status;
+    monitor->status_memory += num_of_targets * sizeof(struct target_status);
+    return 0;
+}
+
+// Replaces targets, filter and options of info except its rate limits, the old target directories
+// stay in the string pool for the jobs that use them
+// If keep_status is 1, targets that are in both the old and the new targets keep their status
+// Returns -1 if malloc fails, in which case info is unchanged, 0 otherwise
+int file_monitor_set_pair(FileMonitor monitor, struct sync_info_mem_store *info, char **tar_dirs, int num_of_targets, struct pair_options options, int keep_status) {
+    struct target_status *old_status = info->target_status;
+    char **old_tar_dirs = info->tar_dirs;
+    int old_num_of_targets = info->num_of_targets;
+    NameFilter filter;
+
+    if (file_monitor_copy_filter(options.filter, &filter) < 0)
+        return -1;
+
+    if (file_monitor_set_targets(monitor, info, tar_dirs, num_of_targets) < 0) {
+        name_filter_destroy(filter);
+        return -1;
+    }
+
+    // Interned paths are equal only if they are the same pointer
+    for (int t = 0; keep_status && t < num_of_targets; t++) {
+        for (int o = 0; o < old_num_of_targets; o++) {
+            if (info->tar_dirs[t] == old_tar_dirs[o])
+                info->target_status[t] = old_status[o];
+        }
+    }
+
+    if (info->filter != NULL) {
+        monitor->filter_memory -= name_filter_memory(info->filter);
+        name_filter_destroy(info->filter);
+    }
+    info->filter = filter;
+    if (filter != NULL) monitor->filter_memory += name_filter_memory(filter);
+
+    free(old_status);
+    monitor->status_memory -= old_num_of_targets * sizeof(struct target_status);
+
+    info->mirror = options.mirror;
+    info->hot_window = options.hot_window;
+    info->snapshot_interval = options.snapshot_interval;
+    info->snapshot_keep = options.snapshot_keep;
+    info->atomic = options.atomic;
+    info->durability = options.durability;
+    return 0;
+}
+
+// Sets copy to a copy of filter, or to NULL if filter is NULL
+// Returns -1 if malloc fails, 0 otherwise
+int file_monitor_copy_filter(NameFilter filter, NameFilter *copy) {
+    *copy = NULL;
+    if (filter == NULL) return 0;
+
+    *copy = name_filter_copy(filter);
+    return *copy == NULL? -1: 0;
+}
+
+int file_monitor_add(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options, int wd) {
 
     struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
 
@@ -40,84 +147,109 @@ int file_monitor_add(FileMonitor monitor, char *src_dir, char *tar_dir, int wd)
         if (info->active)
             return -2;
 
+        // Update target directories and options
+        if (file_monitor_set_pair(monitor, info, tar_dirs, num_of_targets, options, 0) < 0)
+            return -1;
+
         // If it's inactive, start monitoring
         info->active = 1;
-        info->wd = wd;
-
-        // Update target directory
-        free(info->tar_dir);
-
-        info->tar_dir = malloc((strlen(tar_dir) + 1) * sizeof(char));
-        strcpy(info->tar_dir, tar_dir);
+        file_monitor_set_wd(monitor, src_dir, wd);
+        memset(&info->throttle, 0, sizeof(info->throttle));
+        info->throttle.limits = options.limits;
 
         return 0;
     } 
 
     // If file is not in monitor
+    return file_monitor_add_new(monitor, src_dir, tar_dirs, num_of_targets, options, wd);
+}
 
-    // Allocate memory for node
-    Node node = malloc(sizeof(struct node));
-    if (node == NULL) return -1;
+int file_monitor_update(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options) {
+    struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
+    if (info == NULL) return -2;
+
+    struct throttle_limits old_limits = info->throttle.limits;
 
-    // Allocate memory for src_dir and tar_dir
-    node->info.src_dir = malloc((strlen(src_dir) + 1) * sizeof(char));
+    if (file_monitor_set_pair(monitor, info, tar_dirs, num_of_targets, options, 1) < 0)
+        return -1;
 
-    if (node->info.src_dir == NULL) {
-        free(node); return -1;
+    // What the workers have taken is only forgotten if the limits change
+    if (old_limits.bytes_per_sec != options.limits.bytes_per_sec || old_limits.files_per_sec != options.limits.files_per_sec) {
+        memset(&info->throttle, 0, sizeof(info->throttle));
+        info->throttle.limits = options.limits;
     }
 
-    node->info.tar_dir = malloc((strlen(tar_dir) + 1) * sizeof(char));
+    return 0;
+}
+
+int file_monitor_add_new(FileMonitor monitor, char *src_dir, char **tar_dirs, int num_of_targets, struct pair_options options, int wd) {
 
-    if (node->info.tar_dir == NULL) {
-        free(node); free(node->info.src_dir);
+    // Make space for one more record, keeping at most one directory per bucket on average
+    if (monitor->size == monitor->capacity && file_monitor_grow(monitor) < 0)
         return -1;
-    }
 
-    // Add info
-    strcpy(node->info.src_dir, src_dir);
-    strcpy(node->info.tar_dir, tar_dir);
-
-    node->info.wd = wd;
-    node->info.worker_pid = -1;
-    node->info.active = 1;
-    node->info.last_sync_time[0] = '\0';
-    node->info.error_count = 0;
-    
-    node->next = NULL;
+    if (monitor->size >= monitor->num_of_buckets && file_monitor_resize(monitor) < 0)
+        return -1;
 
-    // Add node to list
-    if (monitor->size == 0) {
-        monitor->head = monitor->tail = node;
-    } else {
-        monitor->tail->next = node;
-        monitor->tail = monitor->tail->next;
+    unsigned int id = monitor->size;
+    struct sync_info_mem_store *info = file_monitor_record(monitor, id);
+
+    info->src_dir = string_pool_intern(monitor->paths, src_dir);
+
+    if (info->src_dir == NULL || file_monitor_copy_filter(options.filter, &info->filter) < 0)
+        return -1;
+
+    if (file_monitor_set_targets(monitor, info, tar_dirs, num_of_targets) < 0) {
+        name_filter_destroy(info->filter);
+        return -1;
     }
+    if (info->filter != NULL) monitor->filter_memory += name_filter_memory(info->filter);
+
+    // Add info
+    info->wd = wd;
+    info->num_of_workers = 0;
+    info->throttle_slot = -1;
+    info->barrier = 0;
+    info->held_pass = 0;
+    info->held_full = 0;
+    info->operation = OP_NONE;
+    info->active = 1;
+    info->last_sync_time = 0;
+    info->error_count = 0;
+    memset(&info->throttle, 0, sizeof(info->throttle));
+    info->throttle.limits = options.limits;
+    info->mirror = options.mirror;
+    info->hot_window = options.hot_window;
+    info->snapshot_interval = options.snapshot_interval;
+    info->snapshot_keep = options.snapshot_keep;
+    info->atomic = options.atomic;
+    info->durability = options.durability;
+    info->last_snapshot_time = 0;
+    info->filtered_events = 0;
+    info->timeouts = 0;
+    info->snapshot_changed = 1;
+    info->config = 0;
+    info->id = id;
+
+    // Add directory to hash tables
+    monitor->hashes[id] = file_monitor_hash(src_dir);
+    size_t bucket = monitor->hashes[id] % monitor->num_of_buckets;
+    monitor->name_next[id] = monitor->by_name[bucket];
+    monitor->by_name[bucket] = id;
+
+    monitor->wds[id] = -1;
+    file_monitor_index_wd(monitor, id, wd);
 
     monitor->size++;
     return 0;
 }
 
 int file_monitor_is_working(FileMonitor monitor, char *src_dir) {
-    if (monitor->size == 0)
-        return -1;
-
-    // Iterate over list
-    Node cur_node = monitor->head;
-
-    while (cur_node != NULL) {
-        if (!strcmp(cur_node->info.src_dir, src_dir)) {
-            // Check if there's a job in this directory
-            if (cur_node->info.worker_pid != -1) {
-                return 1;
-            } else {
-                return 0;
-            }
-        }
-
-        cur_node = cur_node->next;
-    }
+    struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
+    if (info == NULL) return -1;
 
-    return -1;
+    // Check if there are jobs in this directory
+    return info->num_of_workers;
 }
 
 int file_monitor_set_inactive(FileMonitor monitor, char *src_dir) {
@@ -127,71 +259,222 @@ int file_monitor_set_inactive(FileMonitor monitor, char *src_dir) {
     if (file_info == NULL) 
         return -1;
 
+    // Events of the removed watch that are still queued are not matched to the directory
+    file_monitor_unindex_wd(monitor, file_info->id);
     file_info->active = 0;
     return 0;
 }
 
-struct sync_info_mem_store *file_monitor_get_info(FileMonitor monitor, char *src_dir, int wd) {
-    if (monitor->size == 0)
-        return NULL;
+int file_monitor_set_wd(FileMonitor monitor, char *src_dir, int wd) {
+    struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
+    if (info == NULL) return -1;
 
-    Node cur_node = monitor->head;
+    file_monitor_unindex_wd(monitor, info->id);
+    info->wd = wd;
+    file_monitor_index_wd(monitor, info->id, wd);
 
+    return 0;
+}
+
+struct sync_info_mem_store *file_monitor_get_info(FileMonitor monitor, char *src_dir, int wd) {
     // Search for wd
     if (src_dir == NULL) {
-        while (cur_node != NULL) {
-            if (cur_node->info.wd == wd) {
-                return &cur_node->info;
-            }
-    
-            cur_node = cur_node->next;
+        if (wd < 0) return NULL;
+
+        for (unsigned int id = monitor->by_wd[wd % monitor->num_of_buckets]; id != NO_RECORD; id = monitor->wd_next[id]) {
+            if (monitor->wds[id] == wd)
+                return file_monitor_record(monitor, id);
         }
-    // Search for src_dir
+    // Search for src_dir, records are only read if their hash is the same
     } else {
-        while (cur_node != NULL) {
-            if (!strcmp(cur_node->info.src_dir, src_dir)) {
-                return &cur_node->info;
-            }
-    
-            cur_node = cur_node->next;
+        unsigned int hash = file_monitor_hash(src_dir);
+
+        for (unsigned int id = monitor->by_name[hash % monitor->num_of_buckets]; id != NO_RECORD; id = monitor->name_next[id]) {
+            if (monitor->hashes[id] != hash) continue;
+
+            struct sync_info_mem_store *info = file_monitor_record(monitor, id);
+            if (!strcmp(info->src_dir, src_dir))
+                return info;
         }
     }
 
     return NULL;
 }
 
-int file_monitor_set_working(FileMonitor monitor, char *src_dir, pid_t worker_pid, char *operation) {
+struct sync_info_mem_store *file_monitor_next(FileMonitor monitor, struct sync_info_mem_store *info) {
+    size_t id = info == NULL? 0: info->id + 1;
+    return id < monitor->size? file_monitor_record(monitor, id): NULL;
+}
+
+int file_monitor_set_working(FileMonitor monitor, char *src_dir, enum sync_operation operation) {
     struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
     if (info == NULL) return -1;
 
-    info->worker_pid = worker_pid;
-    strcpy(info->operation, operation);
+    info->num_of_workers++;
+    info->operation = operation;
+
+    if (sync_operation_whole_dir(operation))
+        info->barrier = 1;
 
     return 0;
 }
 
-int file_monitor_set_not_working(FileMonitor monitor, char *src_dir, char *time, int errors) {
+int file_monitor_set_target_status(FileMonitor monitor, char *src_dir, char *tar_dir, enum sync_status status, int errors) {
     struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
     if (info == NULL) return -1;
 
-    info->worker_pid = -1;
-    strcpy(info->last_sync_time, time);
+    for (int t = 0; t < info->num_of_targets; t++) {
+        if (!strcmp(info->tar_dirs[t], tar_dir)) {
+            info->target_status[t].last_status = status;
+            info->target_status[t].error_count += errors;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int file_monitor_set_not_working(FileMonitor monitor, char *src_dir, long long time, int errors) {
+    struct sync_info_mem_store *info = file_monitor_get_info(monitor, src_dir, 0);
+    if (info == NULL) return -1;
+
+    if (--info->num_of_workers == 0)
+        info->barrier = 0;
+
+    info->last_sync_time = time;
     info->error_count += errors;
 
     return 0;
 }
 
+void file_monitor_memory(FileMonitor monitor, struct file_monitor_memory *memory) {
+    memory->records = sizeof(struct file_monitor) + monitor->num_of_blocks * (sizeof(struct sync_info_mem_store *) + RECORDS_PER_BLOCK * sizeof(struct sync_info_mem_store));
+    memory->index = monitor->capacity * (2 * sizeof(unsigned int) + sizeof(int) + sizeof(unsigned int)) + 2 * monitor->num_of_buckets * sizeof(unsigned int);
+    memory->target_status = monitor->status_memory;
+    memory->filters = monitor->filter_memory;
+    memory->paths = string_pool_memory(monitor->paths);
+    memory->num_of_paths = string_pool_size(monitor->paths);
+}
+
 void file_monitor_destroy(FileMonitor monitor) {
-    Node cur_node = monitor->head;
+    for (size_t id = 0; id < monitor->size; id++) {
+        free(file_monitor_record(monitor, id)->target_status);
+        name_filter_destroy(file_monitor_record(monitor, id)->filter);
+    }
 
-    while (cur_node != NULL) {
-        Node next_node = cur_node->next;
+    for (size_t b = 0; b < monitor->num_of_blocks; b++)
+        free(monitor->blocks[b]);
 
-        free(cur_node->info.src_dir); free(cur_node->info.tar_dir);
-        free(cur_node);
+    free(monitor->blocks);
+    free(monitor->hashes); free(monitor->wds); free(monitor->name_next); free(monitor->wd_next);
+    free(monitor->by_name); free(monitor->by_wd);
+    string_pool_destroy(monitor->paths);
+    free(monitor);
+}
+
+// Returns record of directory at position id
+struct sync_info_mem_store *file_monitor_record(FileMonitor monitor, unsigned int id) {
+    return &monitor->blocks[id / RECORDS_PER_BLOCK][id % RECORDS_PER_BLOCK];
+}
 
-        cur_node = next_node;
+// Returns FNV-1a hash of src_dir
+unsigned int file_monitor_hash(char *src_dir) {
+    unsigned int hash = 2166136261U;
+
+    for (unsigned char *c = (unsigned char *) src_dir; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619U;
     }
 
-    free(monitor);
-}
\ No newline at end of file
+    return hash;
+}
+
+// Adds directory at position id to the watch descriptor table with wd, if it has a watch
+void file_monitor_index_wd(FileMonitor monitor, unsigned int id, int wd) {
+    if (wd < 0) return;
+
+    size_t bucket = wd % monitor->num_of_buckets;
+    monitor->wds[id] = wd;
+    monitor->wd_next[id] = monitor->by_wd[bucket];
+    monitor->by_wd[bucket] = id;
+}
+
+// Removes directory at position id from the watch descriptor table, if it is in it
+void file_monitor_unindex_wd(FileMonitor monitor, unsigned int id) {
+    if (monitor->wds[id] < 0) return;
+
+    for (unsigned int *link = &monitor->by_wd[monitor->wds[id] % monitor->num_of_buckets]; *link != NO_RECORD; link = &monitor->wd_next[*link]) {
+        if (*link == id) {
+            *link = monitor->wd_next[id];
+            break;
+        }
+    }
+
+    monitor->wds[id] = -1;
+}
+
+// Adds a block of records and makes the index arrays large enough for it
+// Returns -1 if malloc fails, 0 otherwise
+int file_monitor_grow(FileMonitor monitor) {
+    size_t capacity = monitor->capacity + RECORDS_PER_BLOCK;
+
+    struct sync_info_mem_store **blocks = realloc(monitor->blocks, (monitor->num_of_blocks + 1) * sizeof(struct sync_info_mem_store *));
+    if (blocks == NULL) return -1;
+    monitor->blocks = blocks;
+
+    // Arrays that are already larger keep their new size, they are only used up to capacity
+    unsigned int *hashes = realloc(monitor->hashes, capacity * sizeof(unsigned int));
+    if (hashes == NULL) return -1;
+    monitor->hashes = hashes;
+
+    int *wds = realloc(monitor->wds, capacity * sizeof(int));
+    if (wds == NULL) return -1;
+    monitor->wds = wds;
+
+    unsigned int *name_next = realloc(monitor->name_next, capacity * sizeof(unsigned int));
+    if (name_next == NULL) return -1;
+    monitor->name_next = name_next;
+
+    unsigned int *wd_next = realloc(monitor->wd_next, capacity * sizeof(unsigned int));
+    if (wd_next == NULL) return -1;
+    monitor->wd_next = wd_next;
+
+    monitor->blocks[monitor->num_of_blocks] = malloc(RECORDS_PER_BLOCK * sizeof(struct sync_info_mem_store));
+    if (monitor->blocks[monitor->num_of_blocks] == NULL) return -1;
+
+    monitor->num_of_blocks++;
+    monitor->capacity = capacity;
+    return 0;
+}
+
+// Doubles the number of buckets of both hash tables and adds all directories to them again
+// Returns -1 if malloc fails, 0 otherwise
+int file_monitor_resize(FileMonitor monitor) {
+    size_t num_of_buckets = monitor->num_of_buckets * 2;
+    unsigned int *by_name = malloc(num_of_buckets * sizeof(unsigned int));
+    unsigned int *by_wd = malloc(num_of_buckets * sizeof(unsigned int));
+
+    if (by_name == NULL || by_wd == NULL) {
+        free(by_name); free(by_wd);
+        return -1;
+    }
+
+    memset(by_name, 0xff, num_of_buckets * sizeof(unsigned int));
+    memset(by_wd, 0xff, num_of_buckets * sizeof(unsigned int));
+
+    free(monitor->by_name); free(monitor->by_wd);
+    monitor->by_name = by_name;
+    monitor->by_wd = by_wd;
+    monitor->num_of_buckets = num_of_buckets;
+
+    for (unsigned int id = 0; id < monitor->size; id++) {
+        size_t bucket = monitor->hashes[id] % num_of_buckets;
+        monitor->name_next[id] = by_name[bucket];
+        by_name[bucket] = id;
+
+        // Inactive directories keep their old watch descriptor, but are not in the table
+        file_monitor_index_wd(monitor, id, monitor->wds[id]);
+    }
+
+    return 0;
+}
@@ -1,17 +1,19 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <limits.h>
 #include "../include/util.h"
 
 #define BUF_SIZE 1024
 
-char *con_in = "fss_out";
-char *con_out = "fss_in";
+char *fss_socket = "fss_socket";
 
 extern char *optarg;
 
@@ -43,12 +45,21 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Open pipe communication
-    int con_in_fd = open(con_in, O_RDWR);
-    int con_out_fd = open(con_out, O_RDWR);
+    // Connect to manager
+    int man_sock = socket(AF_UNIX, SOCK_STREAM, 0);
 
-    if (con_in_fd < 0 || con_out_fd < 0) {
-        perror("Couldn't open pipes");
+    if (man_sock < 0) {
+        perror("Couldn't create socket");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, fss_socket, sizeof(address.sun_path)-1);
+
+    if (connect(man_sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        perror("Couldn't connect to manager");
         exit(EXIT_FAILURE);
     }
 
@@ -68,21 +79,57 @@ int main(int argc, char *argv[]) {
         // Get name of command
         char *com_name = strtok(command, tokenizer);
 
+        if (com_name == NULL) {
+            free(command); continue;
+        }
+
         // Check if command has correct format and print it to log file
         if (!strcmp(com_name, "add")) {
             char *src_dir = strtok(NULL, tokenizer);
             char *tar_dir = strtok(NULL, tokenizer);
 
-            if (src_dir == NULL || tar_dir == NULL || strtok(NULL, tokenizer) != NULL) {
-                fprintf(stderr, "Invalid command! Try: add <source> <target>\n");
+            if (src_dir == NULL || tar_dir == NULL) {
+                fprintf(stderr, "Invalid command! Try: add <source> <target> [<target> ...]\n");
                 free(command); continue;
             }
 
+            // Log every target of source
             get_date_time(datetime, sizeof(datetime));
-            fprintf(log_file, "[%s] Command add %s -> %s\n", datetime, src_dir, tar_dir);
+            fprintf(log_file, "[%s] Command add %s -> %s", datetime, src_dir, tar_dir);
+
+            while ((tar_dir = strtok(NULL, tokenizer)) != NULL)
+                fprintf(log_file, ", %s", tar_dir);
+
+            fprintf(log_file, "\n");
             fflush(log_file);
 
-        } else if (!strcmp(com_name, "status") || !strcmp(com_name, "cancel") || !strcmp(com_name, "sync")) {
+        } else if (!strcmp(com_name, "add-batch")) {
+            char *batch_file = strtok(NULL, tokenizer);
+
+            if (batch_file == NULL || strtok(NULL, tokenizer) != NULL) {
+                fprintf(stderr, "Invalid command! Try: add-batch <file>\n");
+                free(command); continue;
+            }
+
+            // Manager may run in a different directory, so send the absolute path
+            char batch_path[PATH_MAX];
+            if (realpath(batch_file, batch_path) == NULL) {
+                perror("Invalid batch file");
+                free(command); continue;
+            }
+
+            get_date_time(datetime, sizeof(datetime));
+            fprintf(log_file, "[%s] Command add-batch %s\n", datetime, batch_path);
+            fflush(log_file);
+
+            if (snprintf(buffer, BUF_SIZE, "add-batch %s\n", batch_path) >= BUF_SIZE) {
+                fprintf(stderr, "Invalid batch file: path is too long\n");
+                free(command); continue;
+            }
+
+            com_len = strlen(buffer);
+
+        } else if (!strcmp(com_name, "status") || !strcmp(com_name, "cancel") || !strcmp(com_name, "sync") || !strcmp(com_name, "snapshot") || !strcmp(com_name, "snapshots")) {
             char *dir = strtok(NULL, tokenizer);
 
             if (dir == NULL || strtok(NULL, tokenizer) != NULL) {
@@ -94,6 +141,63 @@ int main(int argc, char *argv[]) {
             fprintf(log_file, "[%s] Command %s %s\n", datetime, com_name, dir);
             fflush(log_file);
 
+        } else if (!strcmp(com_name, "restore")) {
+            char *dir = strtok(NULL, tokenizer);
+            char *name = strtok(NULL, tokenizer);
+
+            if (dir == NULL || name == NULL || strtok(NULL, tokenizer) != NULL) {
+                fprintf(stderr, "Invalid command! Try: restore <directory> <snapshot>\n");
+                free(command); continue;
+            }
+
+            get_date_time(datetime, sizeof(datetime));
+            fprintf(log_file, "[%s] Command restore %s %s\n", datetime, dir, name);
+            fflush(log_file);
+
+        } else if (!strcmp(com_name, "limit")) {
+            char *limit = strtok(NULL, tokenizer);
+
+            if (limit == NULL || strtok(NULL, tokenizer) != NULL) {
+                fprintf(stderr, "Invalid command! Try: limit <number of workers | auto>\n");
+                free(command); continue;
+            }
+
+            get_date_time(datetime, sizeof(datetime));
+            fprintf(log_file, "[%s] Command limit %s\n", datetime, limit);
+            fflush(log_file);
+
+        } else if (!strcmp(com_name, "throttle")) {
+            char *dir = strtok(NULL, tokenizer);
+            char *options[3];
+            int num_of_options = 0;
+
+            while (dir != NULL && num_of_options < 3 && (options[num_of_options] = strtok(NULL, tokenizer)) != NULL)
+                num_of_options++;
+
+            if (dir == NULL || num_of_options > 2) {
+                fprintf(stderr, "Invalid command! Try: throttle <directory | --global> [bytes=<rate>] [files=<rate>]\n");
+                free(command); continue;
+            }
+
+            get_date_time(datetime, sizeof(datetime));
+            fprintf(log_file, "[%s] Command throttle %s", datetime, dir);
+
+            for (int o = 0; o < num_of_options; o++)
+                fprintf(log_file, " %s", options[o]);
+
+            fprintf(log_file, "\n");
+            fflush(log_file);
+
+        } else if (!strcmp(com_name, "memory")) {
+            if (strtok(NULL, tokenizer) != NULL) {
+                fprintf(stderr, "Invalid command! Try: memory\n");
+                free(command); continue;
+            }
+
+            get_date_time(datetime, sizeof(datetime));
+            fprintf(log_file, "[%s] Command memory\n", datetime);
+            fflush(log_file);
+
         } else if (!strcmp(com_name, "shutdown")) {
             if (strtok(NULL, tokenizer) != NULL) {
                 fprintf(stderr, "Invalid command! Try: shutdown\n");
@@ -114,25 +218,29 @@ int main(int argc, char *argv[]) {
         free(command);
 
         // Write to manager
-        write_bytes(con_out_fd, buffer, com_len);
-
-        // Read result
-        read_line(con_in_fd, buffer, BUF_SIZE);
-        int num_of_lines = atoi(buffer);
+        if (write_frame(man_sock, buffer, com_len) < 0) {
+            perror("Couldn't send command");
+            break;
+        }
 
-        for (int i = 0; i < num_of_lines; i++) {
-            read_line(con_in_fd, buffer, BUF_SIZE);
+        // Read result until an empty frame is received
+        ssize_t frame_len;
+        while ((frame_len = read_frame(man_sock, buffer, BUF_SIZE)) > 0) {
             fprintf(stdout, "%s", buffer); fflush(stdout);
         }
 
+        if (frame_len < 0) {
+            fprintf(stderr, "Connection to manager lost\n");
+            break;
+        }
+
         // Shutdown
         if (shutdown) {
             break;
         }
     }
 
-    close(con_in_fd);
-    close(con_out_fd);
+    close(man_sock);
     fclose(log_file);
     exit(EXIT_SUCCESS);
 }
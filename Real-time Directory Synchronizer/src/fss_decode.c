@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/util.h"
+#include "../include/event_log.h"
+
+#define TEXT_SIZE 65536   // Longest text of a record, including its padding
+
+extern char *optarg;
+extern int optind;
+
+char text[TEXT_SIZE];
+char **paths = NULL;      // Paths of the records read so far, indexed by id
+size_t num_of_paths = 0;
+size_t paths_size = 0;
+
+// Function prototypes
+int set_path(uint32_t id, char *path);
+char *get_path(uint32_t id);
+void free_paths(void);
+void print_text(struct event_record *record);
+void print_json(struct event_record *record);
+void print_json_string(char *str);
+
+int main(int argc, char *argv[]) {
+    int json = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j")) != -1) {
+        switch(opt) {
+            case 'j':
+                json = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-j] <event_log>\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-j] <event_log>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *log_file = fopen(argv[optind], "r");
+
+    if (log_file == NULL) {
+        perror("Couldn't open event log");
+        exit(EXIT_FAILURE);
+    }
+
+    char magic[EVENT_LOG_ALIGN];
+
+    if (fread(magic, 1, EVENT_LOG_ALIGN, log_file) != EVENT_LOG_ALIGN || memcmp(magic, EVENT_LOG_MAGIC, EVENT_LOG_ALIGN)) {
+        fprintf(stderr, "%s is not an event log\n", argv[optind]);
+        fclose(log_file);
+        exit(EXIT_FAILURE);
+    }
+
+    // Read records one after another, the text of a record is printed before the next one is read
+    struct event_record record;
+    int result = EXIT_SUCCESS;
+
+    while (fread(&record, sizeof(record), 1, log_file) == 1) {
+        size_t padded = (record.text_len + EVENT_LOG_ALIGN - 1) / EVENT_LOG_ALIGN * EVENT_LOG_ALIGN;
+
+        if (fread(text, 1, padded, log_file) != padded) {
+            fprintf(stderr, "Event log ends in the middle of a record\n");
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        text[record.text_len] = '\0';
+
+        if (record.type == EVENT_START) {
+            free_paths();
+        } else if (record.type == EVENT_PATH) {
+            if (set_path(record.src_id, text) < 0) {
+                perror("malloc failed");
+                result = EXIT_FAILURE;
+                break;
+            }
+        } else if (record.type == EVENT_JOB) {
+            if (record.operation > OP_NONE || record.status > SYNC_TIMEOUT) {
+                fprintf(stderr, "Event log has an invalid record\n");
+                result = EXIT_FAILURE;
+                break;
+            }
+
+            if (json)
+                print_json(&record);
+            else
+                print_text(&record);
+        }
+    }
+
+    if (ferror(log_file)) {
+        perror("Couldn't read event log");
+        result = EXIT_FAILURE;
+    }
+
+    free_paths();
+    fclose(log_file);
+    exit(result);
+}
+
+// Sets path with id to a copy of path
+// Returns 0 on success, -1 if malloc fails
+int set_path(uint32_t id, char *path) {
+    if (id >= paths_size) {
+        size_t new_size = paths_size == 0? 64: paths_size;
+        while (new_size <= id) new_size *= 2;
+
+        char **new_paths = realloc(paths, new_size * sizeof(char *));
+        if (new_paths == NULL) return -1;
+
+        memset(new_paths + paths_size, 0, (new_size - paths_size) * sizeof(char *));
+        paths = new_paths;
+        paths_size = new_size;
+    }
+
+    free(paths[id]);
+    paths[id] = strdup(path);
+    if (paths[id] == NULL) return -1;
+
+    if (id >= num_of_paths) num_of_paths = id + 1;
+    return 0;
+}
+
+// Returns path with id, or "?" if there is no such path
+char *get_path(uint32_t id) {
+    return id < num_of_paths && paths[id] != NULL? paths[id]: "?";
+}
+
+// Frees all paths, whose ids are given again after a START record
+void free_paths(void) {
+    for (size_t p = 0; p < num_of_paths; p++)
+        free(paths[p]);
+
+    free(paths);
+    paths = NULL;
+    num_of_paths = paths_size = 0;
+}
+
+// Prints record like fss_manager writes a result to its log file
+void print_text(struct event_record *record) {
+    char datetime[DATETIME_SZ];
+    format_date_time(record->time_ns / 1000000000LL, datetime, sizeof(datetime));
+
+    printf("[%s] [%s] [%s] [%d] [%s] [%s] [%s%s]\n", datetime, get_path(record->src_id), get_path(record->tar_id), record->pid,
+        sync_operation_name(record->operation), sync_status_name(record->status), record->text_kind == EVENT_TEXT_FILE? "File: ": "", text);
+}
+
+// Prints record as a JSON object on one line
+void print_json(struct event_record *record) {
+    printf("{\"time_ns\": %lld, \"source\": ", (long long) record->time_ns);
+    print_json_string(get_path(record->src_id));
+    printf(", \"target\": ");
+    print_json_string(get_path(record->tar_id));
+    printf(", \"pid\": %d, \"operation\": \"%s\", \"status\": \"%s\", \"errors\": %u, \"bytes\": %lld, \"latency_us\": %u, \"%s\": ",
+        record->pid, sync_operation_name(record->operation), sync_status_name(record->status), record->errors,
+        (long long) record->bytes, record->latency_us, record->text_kind == EVENT_TEXT_FILE? "file": "details");
+    print_json_string(text);
+    printf("}\n");
+}
+
+// Prints str as a JSON string, with quotes, backslashes and control characters escaped
+void print_json_string(char *str) {
+    putchar('"');
+
+    for (unsigned char *c = (unsigned char *) str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            printf("\\%c", *c);
+        else if (*c < 0x20)
+            printf("\\u%04x", *c);
+        else
+            putchar(*c);
+    }
+
+    putchar('"');
+}
@@ -1,26 +1,243 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
-#include <poll.h>
 #include <sys/inotify.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <string.h>
-#include "../include/fss_manager.h"
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
 #include "../include/util.h"
+#include "../include/fss_manager.h"
+#include "../include/hot_files.h"
+#include "../include/mailbox.h"
 
-#define BUF_SIZE 1024
+#define EVENTS_BUF_SIZE 65536   // Bytes of inotify events read at once, about 2000 events of short names
 #define DIR_NAME_SIZE 256
-#define POLL_TIMEOUT -1
-
-char buffer[BUF_SIZE];
-char datetime[DATETIME_SZ];
-char src_dir_name[DIR_NAME_SIZE];
-char tar_dir_name[DIR_NAME_SIZE];
-
-int fss_add_monitored_file(char *src_dir_name, char *tar_dir_name, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd, int sync_job);
-int fss_sync_file(char *src_dir_name, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd);
-int fss_read_worker_report(struct worker_manager *worker_manager, int i, char *buffer, size_t buf_size);
-
-void fss_log_event(char *buffer, int log_fd, int fss_out_fd, int num_of_lines, int write_inst) {
+#define TAR_LIST_SIZE 4096   // Size of comma separated list of target directories
+#define BUF_SIZE (TAR_LIST_SIZE + 4096)   // A line with the longest list of targets fits with the rest of its text
+#define BATCH_FILES_DEFAULT 128                   // Maximum jobs of a worker that syncs several files
+#define BATCH_BYTES_DEFAULT (32LL * 1024 * 1024)  // Bytes after which a worker hands its other files back
+#define SNAPSHOT_CHECK_SECS 10                    // Seconds between checks for periodic snapshots that are due
+#define CONFIG_RETRY_SECS 1                       // Seconds between tries to watch the directory of the config file
+#define TIMEOUT_SECS_DEFAULT 60                   // Seconds a worker may go without progress
+#define TIMEOUT_DIR_FACTOR 10                     // A job of a whole directory may go this many times longer without progress
+#define RETRY_DELAY_MS 10000                      // Delay before jobs of a worker that timed out are retried, doubled with
+                                                  // every timeout of the directory in a row
+#define RETRY_DELAY_MAX_MS (10 * 60 * 1000)
+
+// Every event-loop thread has its own buffers
+__thread char buffer[BUF_SIZE];
+__thread char events_buffer[EVENTS_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+__thread char datetime[DATETIME_SZ];
+__thread char src_dir_name[DIR_NAME_SIZE];
+__thread char tar_list[TAR_LIST_SIZE];
+__thread char targets[TAR_LIST_SIZE];       // Target directories joined for log messages
+__thread char *tar_dir_names[MAX_TARGETS];
+
+__thread char command[CONSOLE_REQUEST_SIZE];
+
+// Event loop of one thread of the manager, which monitors the pairs whose source directories hash
+// to it with a file monitor, job queue, inotify instance and worker slots of its own. Thread 0 is
+// the main thread, which also serves the consoles, reloads the config file and adjusts the worker
+// limit. Threads only share the worker pool, the settings below and the event log, and pass
+// everything else, such as commands for their pairs and responses to consoles, as messages.
+struct fss_shard {
+    int index;
+    pthread_t thread;
+    FileMonitor file_monitor;
+    JobQueue job_queue;
+    JobQueue startup_queue;           // Full syncs of the pairs of the config file, which are moved
+                                      // to the job queue a few at a time
+    HotFiles hot_files;               // Files that changed recently, whose next jobs are deferred
+    struct worker_manager worker_manager;
+    int has_worker_manager;           // 1 once worker_manager is initialized
+    Mailbox mailbox;                  // Messages from the other threads
+    unsigned int dispatch_pass;       // Passes over the job queue so far, a directory whose held_pass
+                                      // is the current pass has had a job held back
+    long long next_snapshot_check;    // Seconds since the epoch
+    int shut_down;                    // Set once shutdown reached the thread, on thread 0 to the id of
+                                      // the console that sent it
+    size_t num_of_dirs;               // Directories of file monitor, read by the other threads
+};
+
+struct fss_shard *shards = NULL;
+int num_of_shards = 0;
+int shards_running = 0;               // 1 while threads other than thread 0 run
+int stopped_shards = 0;               // Threads that stopped after shutdown, counted by thread 0
+__thread struct fss_shard *current_shard = NULL;
+
+// Budget of workers of all threads
+struct worker_pool *worker_pool = NULL;
+
+// Log file, for the threads started by fss_manager_run
+int manager_log_fd = -1;
+
+// Connected consoles, responses are queued here so that a console that doesn't read them can't block the manager
+// Only used by thread 0, the other threads send their responses to it
+ConsoleServer consoles = NULL;
+
+// Path of the config file, its name in its directory and the inotify watch of the directory, -1 if
+// it isn't watched. The file is read again whenever it is written or moved to the directory
+// Only used by thread 0, the watch is in its inotify instance
+char *config_path = NULL;
+char *config_base = NULL;
+int config_wd = -1;
+long long config_retry = 0;   // Seconds since the epoch of the next try to watch the directory, 0 while it is watched
+
+// Binary log of the results of jobs, NULL if they are written to the log file
+// Records of all threads go to the same log, whose path ids are shared, so it is locked
+EventLog event_log = NULL;
+pthread_mutex_t event_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Settings of the config file below are written by thread 0 and read by every thread with atomic operations
+int hot_window_default = HOT_WINDOW_DEFAULT;   // Window of pairs without a hot option
+
+// Set once a pair has periodic snapshots, only then the loops wake up to check for snapshots that are due
+int periodic_snapshots = 0;
+
+// Limits of the jobs of single files that are given to one worker, set with a batch line of the config file
+// Sizes of files aren't known without a stat that could block on a hung mount, so the worker enforces the
+// byte limit and hands back the jobs it didn't start once the files it copied add up to it
+int batch_max_files = BATCH_FILES_DEFAULT;
+long long batch_max_bytes = BATCH_BYTES_DEFAULT;   // 0 means unlimited
+
+// Time a worker may go without progress before the watchdog kills it, set with a timeout line of the config file
+int timeout_secs = TIMEOUT_SECS_DEFAULT;           // 0 means workers are never killed
+
+// Entry of a batch file or the config file
+struct fss_batch_entry {
+    char *src_dir;
+    char **tar_dirs;
+    int num_of_targets;
+    struct pair_options options;
+    struct sync_info_mem_store *file_info;  // Entry in file monitor, NULL if not monitored
+    int duplicate;                          // 1 if src_dir appears earlier in the batch
+};
+
+// Global settings and pairs of the config file
+struct fss_config {
+    struct fss_batch_entry *pairs;
+    size_t num_of_pairs;
+    int hot_window;                  // Window of pairs without a hot option
+    int batch_files;                 // Limits of the jobs of single files that share a worker
+    long long batch_bytes;
+    int timeout_secs;                // Time workers may go without progress
+    struct throttle_limits limits;   // Global rate limits of all workers
+};
+
+// Jobs of single files of a pair, collected in a pass over the job queue to be synced by one worker
+struct fss_batch {
+    struct sync_info_mem_store *dir;
+    struct job_info *jobs;
+    int num_of_jobs;
+};
+
+// Commands that every thread runs for its own directories
+enum fss_relay_command {
+    FSS_RELAY_STATUS,
+    FSS_RELAY_SYNC,
+    FSS_RELAY_MEMORY,
+    FSS_RELAY_BATCH,
+    FSS_RELAY_RELOAD,
+    FSS_RELAY_SHUTDOWN
+};
+
+// Command that is passed from thread 0 to the last thread, each running it for its own directories
+// The last thread finishes the response, so the frames of all threads reach the console in order
+struct fss_relay {
+    enum fss_relay_command command;
+    int con_id;
+    int counts[5];                          // Results counted by the threads, depending on command
+    struct file_monitor_memory memory;      // Memory of the threads, for memory
+    size_t num_of_dirs;
+    size_t num_of_jobs;
+    size_t job_memory;
+    size_t worker_memory;
+    struct fss_batch_entry *entries;        // Pairs of a batch file or the config file
+    struct fss_batch_entry **sorted;        // Entries sorted by source directory, for add-batch
+    size_t num_of_entries;
+};
+
+// Types of messages between threads
+enum fss_message_type {
+    FSS_MESSAGE_COMMAND,   // Console command about a directory of the receiving thread
+    FSS_MESSAGE_RELAY,     // Relay to run for the directories of the receiving thread
+    FSS_MESSAGE_FRAME,     // Response to a console, sent to thread 0 with value the FSS_WRITE_CONSOLE
+                           // and FSS_WRITE_END bits
+    FSS_MESSAGE_PENDING,   // Value more jobs of a console are pending, sent to thread 0
+    FSS_MESSAGE_DONE,      // A pending job of a console is done, its result is text, sent to thread 0
+    FSS_MESSAGE_STOPPED    // Thread has stopped after shutdown, sent to thread 0
+};
+
+struct fss_message {
+    struct mailbox_message header;
+    enum fss_message_type type;
+    int con_id;
+    int value;
+    struct fss_relay *relay;
+    char text[];
+};
+
+int fss_add_monitored_file(char *src_dir_name, char **tar_dir_names, int num_of_targets, struct pair_options options, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, ConsoleServer console_server, int con_id);
+int fss_sync_file(char *src_dir_name, int log_fd, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int con_id);
+int fss_run_command(char *command, int con_id, int log_fd, FILE *config_file, ConsoleServer console_server);
+void fss_add_batch(char *batch_name, int con_id, int log_fd, FILE *config_file, ConsoleServer console_server);
+void fss_status_all(int con_id, int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server);
+void fss_memory(int con_id, int log_fd, FILE *config_file, ConsoleServer console_server);
+void fss_sync_all(int con_id, int log_fd, FILE *config_file, ConsoleServer console_server);
+void fss_report_sync_job(char *buffer, int log_fd, int con_id);
+void fss_add_pending(int con_id, int count);
+void fss_done_pending(char *text, int log_fd, int con_id);
+struct fss_shard *fss_shard_of(char *src_dir);
+size_t fss_total_dirs(void);
+struct fss_shard *fss_command_shard(char *command);
+int fss_execute_command(char *command, int con_id, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, ConsoleServer console_server);
+void fss_send(struct fss_shard *shard, enum fss_message_type type, int con_id, int value, struct fss_relay *relay, char *text);
+void fss_receive_messages(int log_fd, FILE *config_file, ConsoleServer console_server);
+struct fss_relay *fss_new_relay(enum fss_relay_command command, int con_id);
+void fss_run_relay(struct fss_relay *relay, int log_fd, FILE *config_file, ConsoleServer console_server);
+void fss_run_shard(struct fss_shard *s, int log_fd, FILE *config_file, ConsoleServer console_server);
+void *fss_shard_thread(void *arg);
+void fss_destroy_shards(void);
+int fss_batch_relay(struct fss_relay *relay, int log_fd);
+int fss_reload_relay(struct fss_relay *relay, int log_fd);
+void fss_memory_relay(struct fss_relay *relay, int log_fd);
+int fss_sync_relay(struct fss_relay *relay, int log_fd);
+void fss_write_stalled(struct worker_manager *worker_manager, char *buf, size_t nbytes);
+int fss_read_worker_report(struct worker_manager *worker_manager, int i, struct job_info *job, int target, char *status, long long *bytes, char *buffer, size_t buf_size);
+int fss_parse_targets(char *tar_list, char **tar_dirs);
+int fss_parse_pair_options(char *option_list, struct pair_options *options);
+void fss_free_entries(struct fss_batch_entry *entries, size_t num_of_entries);
+int fss_parse_config(FILE *config_file, struct fss_config *config);
+void fss_apply_config(struct fss_config *config, struct worker_manager *worker_manager);
+int fss_watch_config(int log_fd, struct worker_manager *worker_manager);
+int fss_retry_config(int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server, int *timeout);
+int fss_pair_changes(struct sync_info_mem_store *info, struct fss_batch_entry *pair);
+int fss_reload_config(int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server);
+void fss_cancel_dir(struct sync_info_mem_store *info, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager);
+char *fss_join_targets(char **tar_dirs, int num_of_targets, char *buf, size_t nbytes);
+void fss_write_status(struct sync_info_mem_store *info, struct worker_manager *worker_manager, char *buf, size_t nbytes);
+char *fss_format_limit(long long limit, char *unit, double scale, char *buf, size_t nbytes);
+void fss_set_throttle(char *dir, char *options, int con_id, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager);
+void fss_write_workers(struct worker_manager *worker_manager, char *buf, size_t nbytes);
+void fss_set_worker_limit(char *limit, int con_id, int log_fd);
+int fss_can_start(struct job_info *job, struct sync_info_mem_store *info, struct worker_manager *worker_manager, int batched);
+void fss_hold(struct sync_info_mem_store *info, int full_sync);
+int fss_start_jobs(struct job_info *jobs, int num_of_jobs, struct sync_info_mem_store *job_dir, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager);
+int fss_start_batch(struct fss_batch *batches, int *num_of_batches, int b, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager);
+long long fss_worker_timeout(enum sync_operation operation);
+void fss_watchdog(int log_fd, struct worker_manager *worker_manager, int *timeout);
+void fss_free_jobs(struct job_info *jobs, int num_of_jobs);
+void fss_free_batches(struct fss_batch *batches, int num_of_batches);
+int fss_queue_snapshots(FileMonitor file_monitor, JobQueue job_queue, int *timeout);
+void fss_snapshot(char *src_dir_name, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue);
+void fss_list_snapshots(char *src_dir_name, int con_id, int log_fd, FileMonitor file_monitor);
+void fss_restore(char *src_dir_name, char *name, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue);
+
+void fss_log_event(char *buffer, int log_fd, int con_id, int write_inst) {
 
     if (write_inst & FSS_WRITE_LOG)
         write_bytes(log_fd, buffer, strlen(buffer));
@@ -28,295 +245,681 @@ void fss_log_event(char *buffer, int log_fd, int fss_out_fd, int num_of_lines, i
     if (write_inst & FSS_WRITE_STDOUT)
         write_bytes(STDOUT_FILENO, buffer, strlen(buffer));
     
-    if (write_inst & FSS_WRITE_FSS_OUT) {
-        char num_of_lines_str[100];
-        snprintf(num_of_lines_str, 100, "%d\n", num_of_lines);  
+    if (con_id < 0 || !(write_inst & (FSS_WRITE_CONSOLE | FSS_WRITE_END)))
+        return;
+
+    // Consoles are served by thread 0, the other threads send their responses to it
+    if (current_shard != NULL && current_shard->index != 0) {
+        fss_send(&shards[0], FSS_MESSAGE_FRAME, con_id, write_inst & (FSS_WRITE_CONSOLE | FSS_WRITE_END), NULL, write_inst & FSS_WRITE_CONSOLE? buffer: "");
+        return;
+    }
+
+    // Console may have disconnected while its command ran
+    int con_fd = console_server_client_fd(consoles, con_id);
+    if (con_fd < 0)
+        return;
+
+    if (write_inst & FSS_WRITE_CONSOLE)
+        console_server_write(consoles, con_fd, buffer, strlen(buffer));
+
+    if (write_inst & FSS_WRITE_END)
+        console_server_write(consoles, con_fd, NULL, 0);
+}
+
+
+void fss_use_event_log(EventLog log) {
+    event_log = log;
+}
+
+int fss_init_shards(int num, struct worker_pool *pool, ConsoleServer console_server) {
+    worker_pool = pool;
+    shards = calloc(num, sizeof(struct fss_shard));
+    if (shards == NULL) return -1;
+
+    num_of_shards = num;
 
-        if (num_of_lines)
-            write_bytes(fss_out_fd, num_of_lines_str, strlen(num_of_lines_str));
+    for (int i = 0; i < num; i++) {
+        struct fss_shard *s = &shards[i];
+        s->index = i;
+        s->file_monitor = file_monitor_init();
+        s->job_queue = job_queue_init();
+        s->startup_queue = job_queue_init();
+        s->hot_files = hot_files_init();
 
-        write_bytes(fss_out_fd, buffer, strlen(buffer));
+        if (s->file_monitor == NULL || s->job_queue == NULL || s->startup_queue == NULL || s->hot_files == NULL)
+            return -1;
+
+        s->mailbox = mailbox_init();
+        if (s->mailbox == NULL) return -6;
+
+        // Only thread 0 accepts consoles
+        int err_check = worker_manager_init(&s->worker_manager, pool, i, i == 0? console_server_listen_fd(console_server): -1);
+        if (err_check < 0) return err_check;
+
+        s->has_worker_manager = 1;
+
+        if (worker_manager_add_mailbox(&s->worker_manager, mailbox_fd(s->mailbox)) < 0)
+            return -3;
     }
+
+    return 0;
 }
 
+int fss_read_config_file(FILE *config_file, char *config_name, int log_fd, ConsoleServer console_server) {
+    struct fss_config config;
 
-int fss_read_config_file(FILE *config_file, int log_fd, JobQueue job_queue, FileMonitor file_monitor, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd) {
-    // Read line by line
-    while (fgets(buffer, BUF_SIZE, config_file)) {
+    // Read the whole file first, so that an invalid line stops the manager before anything is started
+    int parse_check = fss_parse_config(config_file, &config);
 
-        // If line is parsed correctly
-        if (sscanf(buffer, " (%255[^,], %255[^)])", src_dir_name, tar_dir_name) == 2) {
-            // Check if file is being monitored already
-            struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+    if (parse_check < 0) {
+        get_date_time(datetime, sizeof(datetime));
 
-            if (file_info != NULL) {
-                get_date_time(datetime, sizeof(datetime));
-                snprintf(buffer, BUF_SIZE, "[%s] Already in queue: %s\n", datetime, src_dir_name);
-                fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT);
+        if (parse_check == -1)
+            snprintf(buffer, BUF_SIZE, "[%s] Invalid format in config file\n", datetime);
+        else
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
 
-            } // If not, start monitoring
-            else if (fss_add_monitored_file(src_dir_name, tar_dir_name, log_fd, config_file, file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 0) < 0)
-                continue;
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        return -1;
+    }
 
-        // If line is not parsed correctly, shut down
-        } else {
-            // Log invalid format
+    fss_apply_config(&config, &shards[0].worker_manager);
+    struct fss_batch_entry *pairs = config.pairs;
+    size_t num_of_pairs = config.num_of_pairs;
+
+    // Add pairs to the file monitors of their threads without watches, repeated directories hash to
+    // the same thread and are found by the hash table of its file monitor
+    size_t num_of_new = 0;
+
+    for (size_t p = 0; p < num_of_pairs; p++) {
+        struct fss_batch_entry *pair = &pairs[p];
+        FileMonitor file_monitor = fss_shard_of(pair->src_dir)->file_monitor;
+
+        if (file_monitor_get_info(file_monitor, pair->src_dir, 0) != NULL) {
             get_date_time(datetime, sizeof(datetime));
-            snprintf(buffer, BUF_SIZE, "[%s] Invalid format in config file\n", datetime);
-            fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+            snprintf(buffer, BUF_SIZE, "[%s] Already in queue: %s\n", datetime, pair->src_dir);
+            fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
+
+            pair->duplicate = 1;
+            continue;
+        }
+
+        if (file_monitor_add_new(file_monitor, pair->src_dir, pair->tar_dirs, pair->num_of_targets, pair->options, -1) < 0 || (pair->file_info = file_monitor_get_info(file_monitor, pair->src_dir, 0)) == NULL) {
+            fss_free_entries(pairs, num_of_pairs);
+
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+            fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+            return -1;
+        }
+
+        pair->file_info->config = 1;
+
+        num_of_new++;
+    }
+
+    // Check that every directory can get a watch before any watch is added
+    long watch_limit = worker_manager_watch_limit();
+
+    if (watch_limit >= 0 && (long) num_of_new > watch_limit) {
+        fss_free_entries(pairs, num_of_pairs);
+
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Config file has %zu directories, but only %ld inotify watches are allowed. Raise the limit with: sysctl fs.inotify.max_user_watches=%zu\n", datetime, num_of_new, watch_limit, 2 * num_of_new);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        return -1;
+    }
+
+    // Add all watches, a directory whose watch fails stays inactive and can be started with sync
+    for (size_t p = 0; p < num_of_pairs; p++) {
+        struct fss_batch_entry *pair = &pairs[p];
+        if (pair->duplicate) continue;
+
+        struct fss_shard *shard = fss_shard_of(pair->src_dir);
+        FileMonitor file_monitor = shard->file_monitor;
+        struct worker_manager *worker_manager = &shard->worker_manager;
+
+        fss_join_targets(pair->tar_dirs, pair->num_of_targets, targets, sizeof(targets));
+        int wd = worker_manager_add_watch(worker_manager, pair->src_dir);
+        get_date_time(datetime, sizeof(datetime));
+
+        if (wd < 0) {
+            if (errno == ENOSPC)
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: inotify watch limit reached, raise fs.inotify.max_user_watches\n", datetime, pair->src_dir, targets);
+            else
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, pair->src_dir, targets, strerror(errno));
+
+            fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
+            file_monitor_set_inactive(file_monitor, pair->src_dir);
+            continue;
+        }
+
+        file_monitor_set_wd(file_monitor, pair->src_dir, wd);
+        worker_manager_track_devices(worker_manager, pair->src_dir, pair->tar_dirs, pair->num_of_targets);
+
+        if (job_queue_enqueue(shard->startup_queue, pair->file_info->src_dir, pair->file_info->tar_dirs, pair->num_of_targets, "ALL", pair->options.mirror? OP_MIRROR: OP_FULL, 0) < 0) {
+            fss_free_entries(pairs, num_of_pairs);
+
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+            fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
             return -1;
         }
+
+        snprintf(buffer, BUF_SIZE, "[%s] Added directory: %s -> %s\n[%s] Monitoring started for %s\n", datetime, pair->src_dir, targets, datetime, pair->src_dir);
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
     }
 
+    fss_free_entries(pairs, num_of_pairs);
+
+    // Changes of the config file are applied while the manager runs
+    config_path = config_name;
+    fss_watch_config(log_fd, &shards[0].worker_manager);
     return 0;
 }
 
-void fss_manager_run(int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd) {
+void fss_manager_run(int log_fd, FILE *config_file, ConsoleServer console_server) {
+    consoles = console_server;
+    manager_log_fd = log_fd;
+    current_shard = &shards[0];
 
-    int shut_down = 0; // Shutdown flag - set to 1 when command shutdown is read from console
+    // Thread 0 is the main thread, the others are started here
+    for (int i = 1; i < num_of_shards; i++) {
+        int err = pthread_create(&shards[i].thread, NULL, fss_shard_thread, &shards[i]);
+
+        if (err != 0) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Starting thread failed: %s\n", datetime, strerror(err));
+            return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        }
+
+        shards_running = 1;
+    }
+
+    fss_run_shard(&shards[0], log_fd, config_file, console_server);
+}
+
+void *fss_shard_thread(void *arg) {
+    current_shard = arg;
+    fss_run_shard(current_shard, manager_log_fd, NULL, NULL);
+    return NULL;
+}
+
+// Runs the event loop of thread s until it stops after shutdown, only thread 0 has config_file and console_server
+void fss_run_shard(struct fss_shard *s, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    FileMonitor file_monitor = s->file_monitor;
+    JobQueue job_queue = s->job_queue;
+    struct worker_manager *worker_manager = &s->worker_manager;
 
     while (1) {
-        // For every job in the queue
+        // Close consoles that stopped reading their responses or whose sockets failed
+        int failed_fd;
+        while (console_server != NULL && (failed_fd = console_server_next_failed(console_server)) >= 0) {
+            worker_manager_remove_console(worker_manager, failed_fd);
+            console_server_close_client(console_server, failed_fd);
+        }
+
+        // Handle messages of the other threads, and publish the size of file monitor for their status
+        fss_receive_messages(log_fd, config_file, console_server);
+        __atomic_store_n(&s->num_of_dirs, file_monitor_size(file_monitor), __ATOMIC_RELAXED);
+
+        // Queue jobs of hot files whose window has passed, or all of them once shutting down
+        if (hot_files_release(s->hot_files, job_queue, s->shut_down != 0) < 0) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+            return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        }
+
+        // Admit full syncs of the config file as workers become free, so that a large config
+        // doesn't fill the job queue that every event and command has to wait behind
         size_t queue_size = job_queue_size(job_queue);
+        if (queue_size < (size_t) worker_manager->worker_limit)
+            job_queue_move(job_queue, s->startup_queue, worker_manager->worker_limit - queue_size);
+
+        // For every job in the queue
+        queue_size = job_queue_size(job_queue);
+        size_t waiting = 0;    // Jobs left in queue because no worker was available
+        s->dispatch_pass++;
+
+        // Take workers for this pass from the budget of all threads, no more than there are jobs
+        int available = worker_manager_take_workers(worker_manager, queue_size);
 
-        for (size_t s = 0; s < queue_size; s++) {
+        // Jobs of single files of a pair are collected in batches that are synced by one worker
+        // A batch is only as large as needed to spread the queued jobs over the available workers
+        int max_files = __atomic_load_n(&batch_max_files, __ATOMIC_RELAXED);
+        size_t batch_size = available == 0? 1: (queue_size + available - 1) / available;
+        if (batch_size > (size_t) max_files) batch_size = max_files;
 
-            // Stop if there are no available workers
-            if (worker_manager_available_workers(*worker_manager) == 0)
+        struct fss_batch batches[worker_manager->worker_limit];
+        int num_of_batches = 0;     // Every open batch takes one of the available workers
+
+        for (size_t n = 0; n < queue_size; n++) {
+
+            // Stop if there are no available workers, or if every available worker has a batch and
+            // enough jobs have been passed over while looking for more jobs of their pairs
+            if (worker_manager_available_workers(*worker_manager) == 0 || waiting >= batch_size) {
+                waiting += queue_size - n;
                 break;
+            }
 
             // Take a job out of queue
             struct job_info job;
             if (job_queue_dequeue(job_queue, &job) < 0) {
+                fss_free_batches(batches, num_of_batches);
                 get_date_time(datetime, sizeof(datetime));
                 snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+            }
+
+            struct sync_info_mem_store *job_dir = file_monitor_get_info(file_monitor, job.src_dir, 0);
+            int full_sync = sync_operation_whole_dir(job.operation) || job.sync_job;
+
+            int b = 0;
+            while (b < num_of_batches && batches[b].dir != job_dir) b++;
+
+            // If the job has to wait for a job of the same file or a full sync of its directory, or it
+            // needs a worker of its own and there is none left, put job back to queue
+            int can_start = fss_can_start(&job, job_dir, worker_manager, b < num_of_batches);
+
+            if (can_start && (full_sync || b == num_of_batches) && worker_manager_available_workers(*worker_manager) == num_of_batches) {
+                fss_hold(job_dir, full_sync);
+                can_start = 0;
+                waiting++;
             }
 
-            // If there is already a job performed for this directory, put job back to queue
-            if (file_monitor_is_working(file_monitor, job.src_dir)) {
-                if (job_queue_enqueue(job_queue, job.src_dir, job.tar_dir, job.file, job.operation, job.sync_job) < 0) {
+            if (!can_start) {
+                if (job_queue_enqueue(job_queue, job.src_dir, job.tar_dirs, job.num_of_targets, job.file, job.operation, job.sync_job) < 0) {
+                    free(job.file);
+                    fss_free_batches(batches, num_of_batches);
                     get_date_time(datetime, sizeof(datetime));
                     snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
                 }
 
-                free(job.src_dir); free(job.tar_dir); free(job.file); free(job.operation);
+                free(job.file);
                 continue;
             }
 
-            // Set up worker with job
-            pid_t worker_pid = worker_manager_setup_worker(worker_manager, job);
-
-            // If worker is not set up, check error
-            if (worker_pid < 0) {
+            // Full syncs run alone, jobs of single files are added to the batch of their pair
+            if (full_sync) {
+                batches[num_of_batches] = (struct fss_batch) {job_dir, malloc(sizeof(struct job_info)), 0};
+            } else if (b == num_of_batches) {
+                batches[num_of_batches] = (struct fss_batch) {job_dir, malloc(batch_size * sizeof(struct job_info)), 0};
+            }
 
+            if (b == num_of_batches && batches[num_of_batches++].jobs == NULL) {
+                free(job.file);
+                fss_free_batches(batches, num_of_batches);
                 get_date_time(datetime, sizeof(datetime));
+                snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+            }
 
-                if (worker_pid == -1) {
+            batches[b].jobs[batches[b].num_of_jobs++] = job;
+
+            // Start a batch once it's full, then the next jobs of the pair open a new one
+            if (full_sync || (size_t) batches[b].num_of_jobs == batch_size) {
+                if (fss_start_batch(batches, &num_of_batches, b, log_fd, file_monitor, worker_manager) < 0) {
+                    fss_free_batches(batches, num_of_batches);
+                    get_date_time(datetime, sizeof(datetime));
                     snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-                    free(job.src_dir); free(job.tar_dir); free(job.file); free(job.operation);
-                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
-                } else {
-                    switch (worker_pid) {
-                        case -2:
-                            snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Pipe failed: %s]\n", datetime, job.src_dir, job.tar_dir, job.operation, job.file, strerror(errno));
-                            break;
-                        case -3:
-                            snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Fork failed: %s]\n", datetime, job.src_dir, job.tar_dir, job.operation, job.file, strerror(errno));
-                            break;
-                        case -4:
-                            snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Dup2 failed: %s]\n", datetime, job.src_dir, job.tar_dir, job.operation, job.file, strerror(errno));
-                            break;
-                        case -5:
-                            snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Exec failed: %s]\n", datetime, job.src_dir, job.tar_dir, job.operation, job.file, strerror(errno));
-                            break;
-                        default:
-                            snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Couldn't set up worker]\n", datetime, job.src_dir, job.tar_dir, job.operation, job.file);
-                            break;
-                    }
+                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                }
+            }
+        }
+
+        // Start the batches that are not full
+        while (num_of_batches > 0) {
+            if (fss_start_batch(batches, &num_of_batches, num_of_batches - 1, log_fd, file_monitor, worker_manager) < 0) {
+                fss_free_batches(batches, num_of_batches);
+                get_date_time(datetime, sizeof(datetime));
+                snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+            }
+        }
 
-                    fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_LOG);
+        // Workers that weren't started go back to the budget
+        worker_manager_return_workers(worker_manager, waiting);
 
-                    if (job.sync_job) {
-                        snprintf(buffer, BUF_SIZE, "Sync failed %s -> %s\n", job.src_dir, job.tar_dir);
-                        fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-                    }
+        // Adjust number of workers that can run at the same time to the load of all threads
+        int old_limit = worker_pool_limit(worker_pool);
+        size_t pool_waiting;
 
-                }
-                
-                free(job.src_dir); free(job.tar_dir); free(job.file); free(job.operation);
-                continue;
+        if (s->index == 0 && worker_pool_autoscale(worker_pool, &pool_waiting)) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Worker limit changed from %d to %d (Waiting jobs: %zu)\n", datetime, old_limit, worker_pool_limit(worker_pool), pool_waiting);
+            fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG);
+        }
+
+        // Measure rates of workers for status
+        throttle_update(worker_manager->throttle);
+
+        // If shutdown command has been received and there are no more jobs in the queue, the other
+        // threads stop, and thread 0 once they all have
+        if (s->shut_down && job_queue_size(job_queue) == 0 && job_queue_size(s->startup_queue) == 0 && worker_manager_active_workers(*worker_manager) == 0) {
+            if (s->index != 0) {
+                fss_send(&shards[0], FSS_MESSAGE_STOPPED, -1, 0, NULL, "");
+                return;
             }
 
-            // Set directory to working and update info
-            file_monitor_set_working(file_monitor, job.src_dir, worker_pid, job.operation);
+            if (stopped_shards == num_of_shards - 1) {
+                int shutdown_id = s->shut_down;
+
+                for (int i = 1; i < num_of_shards; i++)
+                    pthread_join(shards[i].thread, NULL);
+
+                shards_running = 0;
+                fss_destroy_shards();
+                if (event_log != NULL) event_log_destroy(event_log);
 
-            // Free job resources
-            free(job.src_dir); free(job.tar_dir);
-            free(job.file); free(job.operation);
+                fclose(config_file);
+
+                get_date_time(datetime, sizeof(datetime));
+                snprintf(buffer, BUF_SIZE, "[%s] Manager shutdown complete.\n", datetime);
+                fss_log_event(buffer, log_fd, shutdown_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+
+                close(log_fd); console_server_destroy(console_server);
+                return;
+            }
         }
 
-        // If shutdown command has been received and there are no more jobs in the queue
-        if (shut_down && job_queue_size(job_queue) == 0 && worker_manager_active_workers(*worker_manager) == 0) {
-            worker_manager_destroy(worker_manager);
-            file_monitor_destroy(file_monitor);
-            job_queue_destroy(job_queue);
+        // Wait for events, waking up in time for the next adjustment of the worker limit and
+        // the next deferred job of a hot file
+        int num_of_events;
+        int timeout = s->index == 0? worker_pool_autoscale_timeout(worker_pool): -1;
+        int hot_timeout = hot_files_timeout(s->hot_files);
 
-            close(fss_in_fd); fclose(config_file);
+        if (hot_timeout >= 0 && (timeout < 0 || hot_timeout < timeout))
+            timeout = hot_timeout;
 
+        // Queue periodic snapshots that are due, also waking up in time for the next check
+        if (!s->shut_down && fss_queue_snapshots(file_monitor, job_queue, &timeout) < 0) {
             get_date_time(datetime, sizeof(datetime));
-            snprintf(buffer, BUF_SIZE, "[%s] Manager shutdown complete.\n", datetime);
-            fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+            return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        }
+
+        // Watch the directory of the config file again if it couldn't be, and apply the file once it is
+        if (s->index == 0 && !s->shut_down && fss_retry_config(log_fd, config_file, worker_manager, console_server, &timeout) < 0) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+            return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+        }
+
+        // Kill workers that have hung, also waking up in time for the next one that would be overdue
+        fss_watchdog(log_fd, worker_manager, &timeout);
+
+        // Records of the results of this pass are written with one write before the manager sleeps
+        int flush_check = 0;
+
+        if (event_log != NULL) {
+            pthread_mutex_lock(&event_log_lock);
+            flush_check = event_log_flush(event_log);
+            pthread_mutex_unlock(&event_log_lock);
+        }
 
-            close(log_fd); close(fss_out_fd);
-            return;
+        if (flush_check < 0) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Writing event log failed: %s\n", datetime, strerror(errno));
+            fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
         }
 
-        // Poll
-        while (poll(worker_manager->pfds, worker_manager->pfds_size, POLL_TIMEOUT) < 0) {
+        while ((num_of_events = worker_manager_wait(worker_manager, timeout)) < 0) {
             if (errno != EINTR) {
                 get_date_time(datetime, sizeof(datetime));
-                snprintf(buffer, BUF_SIZE, "[%s] Poll failed: %s\n", datetime, strerror(errno));
-                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+                snprintf(buffer, BUF_SIZE, "[%s] Epoll_wait failed: %s\n", datetime, strerror(errno));
+                return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
             }
         }
         
-        for (size_t i = 0; i < worker_manager->pfds_size; i++) {
-            // Skip fds that aren't ready
-            if (!(worker_manager->pfds[i].revents & POLLIN))
-                continue;
-
-            // If console is ready
-            if (worker_manager_index_is_console(*worker_manager, i) && !shut_down) {
-                // Read command from console
-                read_line(fss_in_fd, buffer, BUF_SIZE);
-
-                // Get command name
-                char *tokenizer = " \n\t";
-                char *com_name = strtok(buffer, tokenizer);
+        // Only files that are ready are returned
+        for (int e = 0; e < num_of_events; e++) {
+            enum worker_event event_type = worker_manager_event_type(worker_manager, e);
+            int i = worker_manager_event_value(worker_manager, e);
 
-                // Command: add
-                if (!strcmp(com_name, "add")) {
-                    // Get source and target names
-                    char *token = strtok(NULL, tokenizer);
-                    strcpy(src_dir_name, token);
+            // If another thread has sent messages, they are handled at the start of the next pass
+            if (event_type == WORKER_EVENT_MAILBOX) {
+                mailbox_clear(s->mailbox);
 
-                    token = strtok(NULL, tokenizer);
-                    strcpy(tar_dir_name, token);
+            // If workers have become free, the next pass takes them
+            } else if (event_type == WORKER_EVENT_WAKE) {
+                worker_manager_clear_wake(worker_manager);
 
-                    // Add file
-                    fss_add_monitored_file(src_dir_name, tar_dir_name, log_fd, config_file, file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
-        
-                // Command: status
-                } else if (!strcmp(com_name, "status")) {
-                    char *token = strtok(NULL, tokenizer);
-                    strcpy(src_dir_name, token);
+            // If a console is connecting
+            } else if (event_type == WORKER_EVENT_CONSOLE) {
+                int con_fd = console_server_accept(console_server);
 
+                if (con_fd == -2) {
                     get_date_time(datetime, sizeof(datetime));
-                    struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
-
-                    // If directory is not monitored
-                    if (file_info == NULL) {
-                        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
-                        fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+                    snprintf(buffer, BUF_SIZE, "[%s] Console connection refused: too many consoles\n", datetime);
+                    fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
+                } else if (con_fd >= 0 && worker_manager_add_console(worker_manager, con_fd) < 0) {
+                    console_server_close_client(console_server, con_fd);
+                }
 
-                    } else {
-                        snprintf(buffer, BUF_SIZE, "[%s] Status requested for %s\n", datetime, src_dir_name);
-                        fss_log_event(buffer, log_fd, fss_out_fd, 6, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+            // If a connected console is ready
+            } else if (event_type == WORKER_EVENT_CONSOLE_CLIENT) {
+                int con_fd = i;
+                int con_id = console_server_client_id(console_server, con_fd);
+
+                // Send queued responses the socket has room for
+                int read_check = console_server_flush(console_server, con_fd), request = 0;
+
+                // Read everything console has sent and execute all complete commands, a console that
+                // sends an invalid frame or stops reading its responses is closed
+                while (read_check >= 0 && request >= 0 && (read_check = console_server_read(console_server, con_fd)) >= 0) {
+                    while ((request = console_server_next_request(console_server, con_fd, command, sizeof(command))) == 1) {
+                        if (s->shut_down) {
+                            get_date_time(datetime, sizeof(datetime));
+                            snprintf(buffer, BUF_SIZE, "[%s] Manager is shutting down\n", datetime);
+                            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+                            continue;
+                        }
 
-                        snprintf(buffer, BUF_SIZE, "Directory: %s\nTarget: %s\nLast sync: %s\nErrors: %d\nStatus: %s\n", src_dir_name, file_info->tar_dir, file_info->last_sync_time, file_info->error_count, file_info->active? "Active": "Inactive");
-                        write_bytes(STDOUT_FILENO, buffer, strlen(buffer));
-                        write_bytes(fss_out_fd, buffer, strlen(buffer));
-                    }
+                        // The other threads get shutdown after the commands that were sent to them before it
+                        if (fss_run_command(command, con_id, log_fd, config_file, console_server)) {
+                            s->shut_down = con_id;
 
-                // Command: cancel
-                } else if (!strcmp(com_name, "cancel")) {
-                    char *token = strtok(NULL, tokenizer);
-                    strcpy(src_dir_name, token);
+                            if (num_of_shards > 1) {
+                                struct fss_relay *relay = fss_new_relay(FSS_RELAY_SHUTDOWN, -1);
 
-                    struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
-                    get_date_time(datetime, sizeof(datetime));
+                                if (relay == NULL) {
+                                    get_date_time(datetime, sizeof(datetime));
+                                    snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                                    fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                                }
 
-                    if (file_info == NULL || !file_info->active) {
-                        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
-                        fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-                    } else {
-                        if (worker_manager_remove_watch(worker_manager, file_info->wd) < 0) {
-                            snprintf(buffer, BUF_SIZE, "[%s] Couldn't cancel %s - failed to remove inotify watch: %s\n", datetime, src_dir_name, strerror(errno));
-                            fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+                                fss_send(&shards[1], FSS_MESSAGE_RELAY, -1, 0, relay, "");
+                            }
                         }
-                        
-                        file_monitor_set_inactive(file_monitor, src_dir_name);
-                        job_queue_remove_dir(job_queue, src_dir_name);
-
-                        snprintf(buffer, BUF_SIZE, "[%s] Monitoring stopped for %s\n", datetime, src_dir_name);
-                        fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT | FSS_WRITE_LOG);
                     }
 
-                // Command: sync
-                } else if (!strcmp(com_name, "sync")) {
-                    char *token = strtok(NULL, tokenizer);
-                    strcpy(src_dir_name, token);
-
-                    fss_sync_file(src_dir_name, log_fd, config_file, file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd);
+                    // All available bytes have been read
+                    if (read_check == 0) break;
                 }
-                else if (!strcmp(com_name, "shutdown")) {
-                    snprintf(buffer, BUF_SIZE, "[%s] Shutting down manager...\n[%s] Waiting for all active workers to finish.\n[%s] Processing remaining queued tasks.\n", datetime, datetime, datetime);
-                    fss_log_event(buffer, log_fd, fss_out_fd, 4, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-                    shut_down = 1;
+
+                if (read_check < 0 || request < 0) {
+                    worker_manager_remove_console(worker_manager, con_fd);
+                    console_server_close_client(console_server, con_fd);
                 }
 
             // If inotify is ready
-            } else if (worker_manager_index_is_inotify(*worker_manager, i) && !shut_down) {
+            } else if (event_type == WORKER_EVENT_INOTIFY) {
 
-                ssize_t bytes = read(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
+                // A large read takes in all events of a burst of changes with one wakeup of the loop
+                ssize_t bytes = read(worker_manager->inotify_fd, events_buffer, EVENTS_BUF_SIZE);
+
+                // Events that arrive during shutdown are discarded
+                if (s->shut_down)
+                    continue;
 
                 // Read all events
-                int j = 0;
+                int j = 0, reload = 0;
                 while (j < bytes) {
                     struct inotify_event *event;
 
-                    event = (struct inotify_event *) &buffer[j];
+                    event = (struct inotify_event *) &events_buffer[j];
+
+                    // Changes of the config file are applied once, after all events that were read. Its
+                    // directory may also be the source of a pair, whose events are still handled below,
+                    // and whose cancel removes the shared watch, which is then added again
+                    // Watch descriptors are numbered per inotify instance, the watch is in the one of thread 0
+                    if (s->index == 0 && config_wd >= 0 && event->wd == config_wd) {
+                        if (event->mask & IN_IGNORED) {
+                            config_wd = -1;
+                            fss_watch_config(log_fd, worker_manager);
+                        } else if (event->len > 0 && !strcmp(event->name, config_base)) {
+                            reload = 1;
+                        }
+                    }
 
                     // Find file with watch wd
                     struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, NULL, event->wd);
+                    enum sync_operation operation = OP_NONE;
                     int queue_check = 0;
+
+                    // Events of a watch removed by cancel may still arrive, they are dropped
+                    if (file_info == NULL) {
+                        j += sizeof(struct inotify_event) + event->len;
+                        continue;
+                    }
                     
-                    // Add job to queue
                     if (event->mask & IN_CREATE) {
-                        queue_check = job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dir, event->name, "ADDED", 0);
+                        operation = OP_ADDED;
                     } else if (event->mask & IN_MODIFY) {
-                        queue_check = job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dir, event->name, "MODIFIED", 0);
+                        operation = OP_MODIFIED;
                     } else if (event->mask & IN_DELETE) {
-                        queue_check = job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dir, event->name, "DELETED", 0);
-                    } 
+                        operation = OP_DELETED;
+                    } else if ((event->mask & IN_ATTRIB) && event->len > 0) {
+                        // Events without a name are about the watched directory itself
+                        operation = OP_ATTRIB;
+                    }
+
+                    // Files filtered out by the patterns of the pair are counted, but never queued
+                    if (operation != OP_NONE && file_info->filter != NULL && event->len > 0 && !name_filter_match(file_info->filter, event->name)) {
+                        file_info->filtered_events++;
+                        operation = OP_NONE;
+                    }
+
+                    // Add job to queue, unless the file had a job less than a window ago
+                    if (operation != OP_NONE) {
+                        int window = file_info->hot_window < 0? __atomic_load_n(&hot_window_default, __ATOMIC_RELAXED): file_info->hot_window;
+                        queue_check = hot_files_check(s->hot_files, file_info->src_dir, file_info->tar_dirs, file_info->num_of_targets, event->name, operation, window);
+
+                        if (queue_check == 0)
+                            queue_check = job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dirs, file_info->num_of_targets, event->name, operation, 0);
+                    }
 
                     if (queue_check < 0) {
                         get_date_time(datetime, sizeof(datetime));
                         snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-                        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+                        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
                     }
 
                     j += sizeof(struct inotify_event) + event->len;
                 }
 
+                if (reload && fss_reload_config(log_fd, config_file, worker_manager, console_server) < 0) {
+                    get_date_time(datetime, sizeof(datetime));
+                    snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                }
 
-            }
+            // If a worker has written its report, keep it until the worker exits
+            // Reading it as it arrives keeps a worker with a long report from blocking on a full pipe
+            } else if (event_type == WORKER_EVENT_OUTPUT) {
+                if (worker_manager_read_output(worker_manager, i) == -1) {
+                    get_date_time(datetime, sizeof(datetime));
+                    snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                }
+
+            // If a worker has exited
+            } else if (event_type == WORKER_EVENT_EXIT) {
+                int reap_check = worker_manager_reap_worker(worker_manager, i);
+
+                if (reap_check == -2)
+                    continue;
+
+                if (reap_check == -1) {
+                    get_date_time(datetime, sizeof(datetime));
+                    snprintf(buffer, BUF_SIZE, "[%s] Reaping worker %d failed: %s\n", datetime, worker_manager->worker_jobs[i].worker_pid, strerror(errno));
+                    return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                }
+
+                struct job_info *job = &worker_manager->worker_jobs[i];
+                struct sync_info_mem_store *job_dir = file_monitor_get_info(file_monitor, job->src_dir, 0);
+                int error_count = 0, retried = 0;
+                long long job_bytes = 0, bytes;
+                char status[12];
+
+                // Every worker of the directory that the watchdog kills in a row doubles the delay of the retries
+                job_dir->timeouts = worker_manager->slots[i].killed_ms != 0? job_dir->timeouts + 1: 0;
+                long long retry_ms = RETRY_DELAY_MS;
+
+                for (int r = 1; r < job_dir->timeouts && retry_ms < RETRY_DELAY_MAX_MS; r++)
+                    retry_ms *= 2;
+
+                if (retry_ms > RETRY_DELAY_MAX_MS) retry_ms = RETRY_DELAY_MAX_MS;
+
+                // Worker writes one report for every target of every job, in the order of the jobs and targets
+                for (int j = 0; j < worker_manager->slots[i].num_of_jobs; j++) {
+                    struct job_info *batch_job = &worker_manager->slots[i].jobs[j];
+                    int timed_out = 0, deferred = 0;
+
+                    for (int t = 0; t < job->num_of_targets; t++) {
+                        int target_errors = fss_read_worker_report(worker_manager, i, batch_job, t, status, &bytes, buffer, BUF_SIZE);
+
+                        // A job the worker handed back has no result yet
+                        if (!strcmp(status, "DEFERRED")) {
+                            deferred = 1;
+                            continue;
+                        }
+
+                        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG);
+                        file_monitor_set_target_status(file_monitor, job->src_dir, job->tar_dirs[t], sync_status_parse(status), target_errors);
+                        error_count += target_errors;
+                        job_bytes += bytes;
+                        timed_out |= !strcmp(status, "TIMEOUT");
+                    }
 
-            // If a worker is ready
-            else if (worker_manager_index_is_worker(*worker_manager, i)) {
-                int error_count = fss_read_worker_report(worker_manager, i, buffer, BUF_SIZE);
+                    // A job the worker didn't finish is synced again later, except snapshots, restores and
+                    // jobs of a directory that has been cancelled. Jobs handed back over the byte limit of
+                    // the worker are queued again right away
+                    if ((!timed_out && !deferred) || !job_dir->active || batch_job->operation == OP_SNAPSHOT || batch_job->operation == OP_RESTORE)
+                        continue;
 
-                fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_LOG);
+                    if (hot_files_retry(s->hot_files, batch_job->src_dir, batch_job->tar_dirs, batch_job->num_of_targets, batch_job->file, batch_job->operation, deferred? 0: retry_ms) < 0) {
+                        get_date_time(datetime, sizeof(datetime));
+                        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+                        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+                    }
+
+                    retried += timed_out;
+                }
+
+                if (retried > 0) {
+                    get_date_time(datetime, sizeof(datetime));
+                    snprintf(buffer, BUF_SIZE, "[%s] Retrying %d jobs of %s in %lld s (Timeouts in a row: %d)\n", datetime, retried, job->src_dir, retry_ms / 1000, job_dir->timeouts);
+                    fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+                }
 
-                if (worker_manager->worker_jobs[i].sync_job) {
-                    snprintf(buffer, BUF_SIZE, "Sync completed %s -> %s Errors: %d\n", worker_manager->worker_jobs[i].src_dir, worker_manager->worker_jobs[i].tar_dir, error_count);
-                    fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+                worker_manager_job_done(worker_manager, i, job_bytes);
+
+                if (job->sync_job) {
+                    char *completed = job->operation == OP_SNAPSHOT? "Snapshot": job->operation == OP_RESTORE? "Restore": "Sync";
+                    fss_join_targets(job->tar_dirs, job->num_of_targets, targets, sizeof(targets));
+                    snprintf(buffer, BUF_SIZE, "%s completed %s -> %s Errors: %d\n", completed, job->src_dir, targets, error_count);
+                    fss_report_sync_job(buffer, log_fd, worker_manager->worker_jobs[i].sync_job);
                 }
 
-                // Set directory to inactive
-                file_monitor_set_not_working(file_monitor, worker_manager->worker_jobs[i].src_dir, datetime, error_count);
+                // Remove worker from directory
+                file_monitor_set_not_working(file_monitor, job->src_dir, time(NULL), error_count);
+
+                // Keep what the workers took from the bucket of the pair for its next workers
+                if (job_dir->num_of_workers == 0) {
+                    throttle_save_slot(worker_manager->throttle, job_dir->throttle_slot, &job_dir->throttle);
+                    job_dir->throttle_slot = -1;
+                }
 
                 // Free up worker
                 worker_manager_free_worker(worker_manager, i);
@@ -325,31 +928,211 @@ void fss_manager_run(int log_fd, FILE *config_file, FileMonitor file_monitor, Jo
     }
 }
 
-void fss_abrupt_shutdown(char *buffer, size_t buf_size, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd, int num_of_lines) {
-    fss_log_event(buffer, log_fd, fss_out_fd, num_of_lines+2, FSS_WRITE_STDOUT);
+// Runs command sent by console con_id on thread 0, or sends it to the thread of the directory it is about
+// Returns 1 if command is shutdown, 0 otherwise
+int fss_run_command(char *command, int con_id, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    struct fss_shard *shard = fss_command_shard(command);
+
+    if (shard != current_shard) {
+        fss_send(shard, FSS_MESSAGE_COMMAND, con_id, 0, NULL, command);
+        return 0;
+    }
+
+    return fss_execute_command(command, con_id, log_fd, config_file, shard->file_monitor, shard->job_queue, &shard->worker_manager, console_server);
+}
+
+// Returns thread that runs command: the thread of its directory, or thread 0 if it has none
+struct fss_shard *fss_command_shard(char *command) {
+    char copy[CONSOLE_REQUEST_SIZE];
+    char *save_ptr;
+
+    snprintf(copy, sizeof(copy), "%s", command);
+    char *com_name = strtok_r(copy, " \n\t", &save_ptr);
+    char *dir = com_name == NULL? NULL: strtok_r(NULL, " \n\t", &save_ptr);
+
+    if (dir == NULL || num_of_shards == 1)
+        return &shards[0];
+
+    if (!strcmp(com_name, "add") || !strcmp(com_name, "cancel") || !strcmp(com_name, "snapshot") || !strcmp(com_name, "snapshots") || !strcmp(com_name, "restore"))
+        return fss_shard_of(dir);
+
+    // Status and sync of all directories and the global throttle are run by thread 0
+    if ((!strcmp(com_name, "status") || !strcmp(com_name, "sync") || !strcmp(com_name, "throttle")) && strcmp(dir, "--all") && strcmp(dir, "--global"))
+        return fss_shard_of(dir);
+
+    return &shards[0];
+}
+
+// Executes command sent by console con_id, which is about a directory of the current thread
+// Returns 1 if command is shutdown, 0 otherwise
+int fss_execute_command(char *command, int con_id, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, ConsoleServer console_server) {
+    // Get command name
+    char *tokenizer = " \n\t";
+    char *save_ptr;
+    char *com_name = strtok_r(command, tokenizer, &save_ptr);
+    char *token = com_name == NULL? NULL: strtok_r(NULL, tokenizer, &save_ptr);
+
+    get_date_time(datetime, sizeof(datetime));
+
+    // Shutdown and memory have no arguments, every other command needs at least one
+    // The first argument is copied to src_dir_name, except the file name of add-batch, so it has
+    // to fit like the source directories of the config file
+    if (com_name == NULL || (token == NULL && strcmp(com_name, "shutdown") && strcmp(com_name, "memory")) || (token != NULL && strlen(token) >= DIR_NAME_SIZE && strcmp(com_name, "add-batch"))) {
+        snprintf(buffer, BUF_SIZE, "[%s] Invalid command\n", datetime);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return 0;
+    }
+
+    // Command: add
+    if (!strcmp(com_name, "add")) {
+        // Get source and target names
+        strcpy(src_dir_name, token);
+
+        // Every other argument is a target directory
+        int num_of_targets = 0;
+
+        while ((token = strtok_r(NULL, tokenizer, &save_ptr)) != NULL && num_of_targets < MAX_TARGETS)
+            tar_dir_names[num_of_targets++] = token;
+
+        if (num_of_targets == 0 || token != NULL) {
+            snprintf(buffer, BUF_SIZE, "[%s] Invalid command\n", datetime);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+            return 0;
+        }
+
+        // Add file
+        struct pair_options options = PAIR_OPTIONS_DEFAULT;
+        fss_add_monitored_file(src_dir_name, tar_dir_names, num_of_targets, options, log_fd, config_file, file_monitor, job_queue, worker_manager, console_server, con_id);
+
+    // Command: add-batch
+    } else if (!strcmp(com_name, "add-batch")) {
+        fss_add_batch(token, con_id, log_fd, config_file, console_server);
+
+    // Command: status --all
+    } else if (!strcmp(com_name, "status") && !strcmp(token, "--all")) {
+        fss_status_all(con_id, log_fd, config_file, worker_manager, console_server);
+
+    // Command: status
+    } else if (!strcmp(com_name, "status")) {
+        strcpy(src_dir_name, token);
+
+        struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+
+        // If directory is not monitored
+        if (file_info == NULL) {
+            snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+
+        } else {
+            snprintf(buffer, BUF_SIZE, "[%s] Status requested for %s\n", datetime, src_dir_name);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+            fss_write_status(file_info, worker_manager, buffer, BUF_SIZE);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+            fss_write_workers(worker_manager, buffer, BUF_SIZE);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        }
+
+    // Command: cancel
+    } else if (!strcmp(com_name, "cancel")) {
+        strcpy(src_dir_name, token);
+
+        struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+
+        if (file_info == NULL || !file_info->active) {
+            snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        } else {
+            fss_cancel_dir(file_info, con_id, log_fd, file_monitor, job_queue, worker_manager);
+        }
+
+    // Command: sync --all
+    } else if (!strcmp(com_name, "sync") && !strcmp(token, "--all")) {
+        fss_sync_all(con_id, log_fd, config_file, console_server);
+
+    // Command: sync
+    } else if (!strcmp(com_name, "sync")) {
+        strcpy(src_dir_name, token);
+
+        fss_sync_file(src_dir_name, log_fd, file_monitor, job_queue, worker_manager, con_id);
+
+    // Command: snapshot
+    } else if (!strcmp(com_name, "snapshot")) {
+        strcpy(src_dir_name, token);
+        fss_snapshot(src_dir_name, con_id, log_fd, file_monitor, job_queue);
+
+    // Command: snapshots
+    } else if (!strcmp(com_name, "snapshots")) {
+        strcpy(src_dir_name, token);
+        fss_list_snapshots(src_dir_name, con_id, log_fd, file_monitor);
+
+    // Command: restore
+    } else if (!strcmp(com_name, "restore")) {
+        strcpy(src_dir_name, token);
+        char *name = strtok_r(NULL, tokenizer, &save_ptr);
+
+        if (name == NULL) {
+            snprintf(buffer, BUF_SIZE, "[%s] Invalid command\n", datetime);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        } else
+            fss_restore(src_dir_name, name, con_id, log_fd, file_monitor, job_queue);
+
+    // Command: limit
+    } else if (!strcmp(com_name, "limit")) {
+        fss_set_worker_limit(token, con_id, log_fd);
+
+    // Command: throttle
+    } else if (!strcmp(com_name, "throttle")) {
+        fss_set_throttle(token, strtok_r(NULL, "", &save_ptr), con_id, log_fd, file_monitor, worker_manager);
+
+    // Command: memory
+    } else if (!strcmp(com_name, "memory")) {
+        fss_memory(con_id, log_fd, config_file, console_server);
+
+    // Command: shutdown
+    // The response ends when shutdown is complete
+    } else if (!strcmp(com_name, "shutdown")) {
+        snprintf(buffer, BUF_SIZE, "[%s] Shutting down manager...\n[%s] Waiting for all active workers to finish.\n[%s] Processing remaining queued tasks.\n", datetime, datetime, datetime);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+        return 1;
+
+    } else {
+        snprintf(buffer, BUF_SIZE, "[%s] Invalid command\n", datetime);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+    }
+
+    return 0;
+}
+
+void fss_abrupt_shutdown(char *buffer, size_t buf_size, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
 
     get_date_time(datetime, DATETIME_SZ);
 
     snprintf(buffer, buf_size, "[%s] Shutting down abruptly.\n", datetime);
-    fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT);
+    fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
 
-    if (worker_manager != NULL) worker_manager_destroy(worker_manager);
-    if (file_monitor != NULL) file_monitor_destroy(file_monitor);
-    if (job_queue != NULL) job_queue_destroy(job_queue);
+    // The other threads may be using everything, so the process exits without freeing it
+    if (shards_running)
+        exit(EXIT_FAILURE);
 
-    if (fss_in_fd >= 0) close(fss_in_fd);
+    fss_destroy_shards();
+    if (event_log != NULL) event_log_destroy(event_log);
+
+    if (console_server != NULL) console_server_destroy(console_server);
     if (config_file != NULL) fclose(config_file);
 
     get_date_time(datetime, sizeof(datetime));
     snprintf(buffer, buf_size, "[%s] Manager shutdown complete.\n", datetime);
-    fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT);
+    fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
 
     close(log_fd); 
-    if (fss_out_fd >= 0) close(fss_out_fd);
 }
 
-// Begins monitoring of a file, returns 0 for success, -1 for failure
-int fss_add_monitored_file(char *src_dir_name, char *tar_dir_name, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd, int sync_job) {
+// Begins monitoring of a file with the options of its pair, returns 0 for success, -1 for failure
+// If con_id is not -1, the file was added by console con_id and the response is sent to it
+int fss_add_monitored_file(char *src_dir_name, char **tar_dir_names, int num_of_targets, struct pair_options options, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, ConsoleServer console_server, int con_id) {
 
     // Check if file is being monitored already
     struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
@@ -357,59 +1140,54 @@ int fss_add_monitored_file(char *src_dir_name, char *tar_dir_name, int log_fd, F
     if (file_info != NULL && file_info->active) {
         get_date_time(datetime, sizeof(datetime));
         snprintf(buffer, BUF_SIZE, "[%s] Already in queue: %s\n", datetime, src_dir_name);
-
-        if (sync_job)
-            fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-        else
-            fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
         return 0;
     }
     
+    fss_join_targets(tar_dir_names, num_of_targets, targets, sizeof(targets));
+
     // Add file watch to worker manager
     int wd = worker_manager_add_watch(worker_manager, src_dir_name);
 
     if (wd < 0) {
         get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, tar_dir_name, strerror(errno));
-        
-        if (sync_job)
-            fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-        else
-            fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT);
+        snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, targets, strerror(errno));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
         return -1;
     }
 
+    // Track devices of directories for autoscaling, a device that can't be found is only not tracked
+    worker_manager_track_devices(worker_manager, src_dir_name, tar_dir_names, num_of_targets);
+
     // Add to file monitor
-    if (file_monitor_add(file_monitor, src_dir_name, tar_dir_name, wd) < 0) {
+    if (file_monitor_add(file_monitor, src_dir_name, tar_dir_names, num_of_targets, options, wd) < 0) {
         get_date_time(datetime, sizeof(datetime));
         snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
         return -1;
     }
-    
 
-    // Add job to queue
-    if (job_queue_enqueue(job_queue, src_dir_name, tar_dir_name, "ALL", "FULL", 0) < 0) {
+    // Add job to queue, with the paths interned by file monitor
+    file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+
+    if (job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dirs, num_of_targets, "ALL", options.mirror? OP_MIRROR: OP_FULL, 0) < 0) {
         get_date_time(datetime, sizeof(datetime));
         snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, worker_manager, fss_in_fd, fss_out_fd, 1);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
         return -1;
     }
 
     // Write to log file
     get_date_time(datetime, sizeof(datetime));
-    snprintf(buffer, BUF_SIZE, "[%s] Added directory: %s -> %s\n[%s] Monitoring started for %s\n", datetime, src_dir_name, tar_dir_name, datetime, src_dir_name);
-    
-    if (sync_job)
-        fss_log_event(buffer, log_fd, fss_out_fd, 2, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
-    else
-        fss_log_event(buffer, log_fd, fss_out_fd, 2, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+    snprintf(buffer, BUF_SIZE, "[%s] Added directory: %s -> %s\n[%s] Monitoring started for %s\n", datetime, src_dir_name, targets, datetime, src_dir_name);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
 
     return 0;
 }
 
-// Begins a full sync job for src_dir_name
-int fss_sync_file(char *src_dir_name, int log_fd, FILE *config_file, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int fss_in_fd, int fss_out_fd) {
+// Begins a full sync job for src_dir_name, requested by console con_id
+// If the job is queued, the response to the console ends when the job is done
+int fss_sync_file(char *src_dir_name, int log_fd, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager, int con_id) {
     
     // Get file info
     struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
@@ -418,18 +1196,18 @@ int fss_sync_file(char *src_dir_name, int log_fd, FILE *config_file, FileMonitor
     // If file does not exist
     if (file_info == NULL) {
         snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
-        fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
 
     // If there is already a job performed or queued for this directory
-    } else if (file_info->worker_pid != -1 || job_queue_dir_exists(job_queue, src_dir_name)) {
+    } else if (file_info->num_of_workers > 0 || job_queue_dir_exists(job_queue, src_dir_name) || job_queue_dir_exists(current_shard->startup_queue, src_dir_name)) {
         snprintf(buffer, BUF_SIZE, "[%s] Sync already in progress %s\n", datetime, src_dir_name);
-        fss_log_event(buffer, log_fd, fss_out_fd, 1, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
 
     // Begin sync
     } else {
-        strcpy(tar_dir_name, file_info->tar_dir);
-        snprintf(buffer, BUF_SIZE, "[%s] Syncing directory: %s -> %s\n", datetime, src_dir_name, tar_dir_name);
-        fss_log_event(buffer, log_fd, fss_out_fd, 2, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+        fss_join_targets(file_info->tar_dirs, file_info->num_of_targets, targets, sizeof(targets));
+        snprintf(buffer, BUF_SIZE, "[%s] Syncing directory: %s -> %s\n", datetime, src_dir_name, targets);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
 
         // If file is not active
         if (!file_info->active) {
@@ -438,78 +1216,745 @@ int fss_sync_file(char *src_dir_name, int log_fd, FILE *config_file, FileMonitor
 
             if (wd < 0) {
                 get_date_time(datetime, sizeof(datetime));
-                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, tar_dir_name, strerror(errno));
-                fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, targets, strerror(errno));
+                fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
                 return -1;
             }
 
             // Add to file monitor
-            if (file_monitor_add(file_monitor, src_dir_name, tar_dir_name, wd) < 0) {
+            if (file_monitor_add(file_monitor, src_dir_name, file_info->tar_dirs, file_info->num_of_targets, (struct pair_options) {file_info->throttle.limits, file_info->mirror, file_info->hot_window, file_info->snapshot_interval, file_info->snapshot_keep, file_info->atomic, file_info->durability, file_info->filter}, wd) < 0) {
                 get_date_time(datetime, sizeof(datetime));
-                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, tar_dir_name, strerror(errno));
-                fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, targets, strerror(errno));
+                fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
                 return -1;
             }
         }
 
         // Add job to queue
-        if (job_queue_enqueue(job_queue, src_dir_name, tar_dir_name, "ALL", "FULL", 1) < 0) {
+        if (job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dirs, file_info->num_of_targets, "ALL", file_info->mirror? OP_MIRROR: OP_FULL, con_id) < 0) {
             get_date_time(datetime, sizeof(datetime));
-            snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, tar_dir_name, strerror(errno));
-            fss_log_event(buffer, log_fd, fss_out_fd, 0, FSS_WRITE_STDOUT | FSS_WRITE_FSS_OUT);
+            snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, src_dir_name, targets, strerror(errno));
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
             return -1;
         }
+
+        fss_add_pending(con_id, 1);
     }
 
     return 0;
 }
 
-// Reads and parses report from worker at index i of worker manager and writes logging message to buffer of buf_size
-int fss_read_worker_report(struct worker_manager *worker_manager, int i, char *buffer, size_t buf_size) {
+// Writes result of a sync job in buffer to stdout and console con_id
+// The response to the console ends after its last pending sync job
+void fss_report_sync_job(char *buffer, int log_fd, int con_id) {
+    fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
+    fss_done_pending(buffer, log_fd, con_id);
+}
+
+// Adds count jobs whose results must be sent to console con_id before its response ends
+void fss_add_pending(int con_id, int count) {
+    if (current_shard->index == 0)
+        console_server_add_pending(consoles, con_id, count);
+    else
+        fss_send(&shards[0], FSS_MESSAGE_PENDING, con_id, count, NULL, "");
+}
+
+// Sends text, the result of a pending job of console con_id, to it, which ends the response if it
+// was the last pending job. Empty text only ends the response
+void fss_done_pending(char *text, int log_fd, int con_id) {
+    if (current_shard->index != 0) {
+        fss_send(&shards[0], FSS_MESSAGE_DONE, con_id, 0, NULL, text);
+        return;
+    }
+
+    int write_inst = text[0] != '\0'? FSS_WRITE_CONSOLE: 0;
+    if (console_server_done_pending(consoles, con_id) == 0)
+        write_inst |= FSS_WRITE_END;
+
+    fss_log_event(text, log_fd, con_id, write_inst);
+}
+
+// Returns thread of the pairs with source directory src_dir, picked with the high bits of its FNV-1a
+// hash, since file monitor picks its buckets with the low bits of the same hash
+struct fss_shard *fss_shard_of(char *src_dir) {
+    unsigned int hash = 2166136261U;
+
+    for (unsigned char *c = (unsigned char *) src_dir; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619U;
+    }
+
+    return &shards[((unsigned long long) hash * num_of_shards) >> 32];
+}
+
+// Returns number of directories of all threads
+size_t fss_total_dirs(void) {
+    size_t total = 0;
+
+    for (int i = 0; i < num_of_shards; i++) {
+        if (&shards[i] == current_shard)
+            total += file_monitor_size(shards[i].file_monitor);
+        else
+            total += __atomic_load_n(&shards[i].num_of_dirs, __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
+
+// Sends message of type to thread shard, with console con_id, value, relay and a copy of text
+// Messages are only sent while the other threads run, so the manager exits if malloc fails
+void fss_send(struct fss_shard *shard, enum fss_message_type type, int con_id, int value, struct fss_relay *relay, char *text) {
+    size_t length = strlen(text);
+    struct fss_message *message = malloc(sizeof(struct fss_message) + length + 1);
+
+    if (message == NULL) {
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, manager_log_fd, NULL, NULL);
+    }
+
+    message->type = type;
+    message->con_id = con_id;
+    message->value = value;
+    message->relay = relay;
+    memcpy(message->text, text, length + 1);
+
+    mailbox_send(shard->mailbox, &message->header);
+}
+
+// Handles the messages the other threads have sent to the current thread
+void fss_receive_messages(int log_fd, FILE *config_file, ConsoleServer console_server) {
+    struct fss_shard *s = current_shard;
+    struct mailbox_message *header;
+
+    while ((header = mailbox_receive(s->mailbox)) != NULL) {
+        struct fss_message *message = (struct fss_message *) header;
+
+        switch (message->type) {
+            case FSS_MESSAGE_COMMAND:
+                fss_execute_command(message->text, message->con_id, log_fd, config_file, s->file_monitor, s->job_queue, &s->worker_manager, console_server);
+                break;
+            case FSS_MESSAGE_RELAY:
+                fss_run_relay(message->relay, log_fd, config_file, console_server);
+                break;
+            case FSS_MESSAGE_FRAME:
+                fss_log_event(message->text, log_fd, message->con_id, message->value);
+                break;
+            case FSS_MESSAGE_PENDING:
+                console_server_add_pending(console_server, message->con_id, message->value);
+                break;
+            case FSS_MESSAGE_DONE:
+                fss_done_pending(message->text, log_fd, message->con_id);
+                break;
+            case FSS_MESSAGE_STOPPED:
+                stopped_shards++;
+                break;
+        }
+
+        free(message);
+    }
+}
+
+// Returns new relay of command for console con_id, or NULL if malloc fails
+struct fss_relay *fss_new_relay(enum fss_relay_command command, int con_id) {
+    struct fss_relay *relay = calloc(1, sizeof(struct fss_relay));
+    if (relay == NULL) return NULL;
+
+    relay->command = command;
+    relay->con_id = con_id;
+    return relay;
+}
+
+// Runs relay for the directories of the current thread and passes it on to the next thread
+// The last thread finishes the response and frees relay
+void fss_run_relay(struct fss_relay *relay, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    struct fss_shard *s = current_shard;
+    int last = s->index == num_of_shards - 1;
+    int relay_check = 0;
+
+    switch (relay->command) {
+        case FSS_RELAY_STATUS:
+            // Thread 0 has written its stalled workers with the workers of all threads
+            if (s->index != 0) {
+                fss_write_stalled(&s->worker_manager, buffer, BUF_SIZE);
+                if (buffer[0] != '\0') fss_log_event(buffer, log_fd, relay->con_id, FSS_WRITE_CONSOLE);
+            }
+
+            for (struct sync_info_mem_store *info = file_monitor_next(s->file_monitor, NULL); info != NULL; info = file_monitor_next(s->file_monitor, info)) {
+                fss_write_status(info, &s->worker_manager, buffer, BUF_SIZE);
+                fss_log_event(buffer, log_fd, relay->con_id, FSS_WRITE_CONSOLE);
+            }
+
+            if (last) fss_log_event("", log_fd, relay->con_id, FSS_WRITE_END);
+            break;
+        case FSS_RELAY_SYNC:
+            relay_check = fss_sync_relay(relay, log_fd);
+
+            // Release the job that kept the response open until every thread has added its jobs
+            if (last && relay_check == 0) fss_done_pending("", log_fd, relay->con_id);
+            break;
+        case FSS_RELAY_MEMORY:
+            fss_memory_relay(relay, log_fd);
+            break;
+        case FSS_RELAY_BATCH:
+            relay_check = fss_batch_relay(relay, log_fd);
+            break;
+        case FSS_RELAY_RELOAD:
+            relay_check = fss_reload_relay(relay, log_fd);
+            break;
+        case FSS_RELAY_SHUTDOWN:
+            // Thread 0 has the console that sent shutdown
+            if (!s->shut_down) s->shut_down = 1;
+            break;
+    }
+
+    if (relay_check < 0) {
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    if (last)
+        free(relay);
+    else
+        fss_send(&shards[s->index + 1], FSS_MESSAGE_RELAY, relay->con_id, 0, relay, "");
+}
+
+// Frees everything of all threads and the worker pool, the threads must have stopped
+void fss_destroy_shards(void) {
+    for (int i = 0; i < num_of_shards; i++) {
+        struct fss_shard *s = &shards[i];
+
+        if (s->has_worker_manager) worker_manager_destroy(&s->worker_manager);
+        if (s->file_monitor != NULL) file_monitor_destroy(s->file_monitor);
+        if (s->job_queue != NULL) job_queue_destroy(s->job_queue);
+        if (s->startup_queue != NULL) job_queue_destroy(s->startup_queue);
+        if (s->hot_files != NULL) hot_files_destroy(s->hot_files);
+
+        if (s->mailbox != NULL) {
+            struct mailbox_message *message;
+            while ((message = mailbox_receive(s->mailbox)) != NULL)
+                free(message);
+
+            mailbox_destroy(s->mailbox);
+        }
+    }
+
+    free(shards);
+    shards = NULL;
+    current_shard = NULL;
+    num_of_shards = 0;
+
+    if (worker_pool != NULL) worker_pool_destroy(worker_pool);
+    worker_pool = NULL;
+}
+
+// Compares the strings that two char * point to, used to sort and search arrays of directories
+int fss_compare_dirs(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+// Compares the source directories of two batch entries that two struct fss_batch_entry * point to
+int fss_compare_batch_entries(const void *a, const void *b) {
+    struct fss_batch_entry *entry_a = *(struct fss_batch_entry * const *) a;
+    struct fss_batch_entry *entry_b = *(struct fss_batch_entry * const *) b;
+
+    int cmp = strcmp(entry_a->src_dir, entry_b->src_dir);
+    if (cmp) return cmp;
+
+    // Keep entries with the same directory in the order they appear in the batch
+    return (entry_a > entry_b) - (entry_a < entry_b);
+}
+
+// Compares only the source directories of two batch entries, used for binary search
+int fss_compare_batch_dirs(const void *a, const void *b) {
+    struct fss_batch_entry *entry_a = *(struct fss_batch_entry * const *) a;
+    struct fss_batch_entry *entry_b = *(struct fss_batch_entry * const *) b;
+
+    return strcmp(entry_a->src_dir, entry_b->src_dir);
+}
+
+// Adds all pairs of batch file batch_name, which has the same format as the config file
+// Thread 0 reads the file, then every thread scans its file monitor once for all pairs, adds the
+// watches of its pairs together and adds their FULL jobs to its queue at once. The result for every
+// pair is sent to console con_id as soon as it is known, grouped by thread.
+void fss_add_batch(char *batch_name, int con_id, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    FILE *batch_file = fopen(batch_name, "r");
+    get_date_time(datetime, sizeof(datetime));
+
+    if (batch_file == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Failed to open %s: %s\n", datetime, batch_name, strerror(errno));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Adding directories from %s\n", datetime, batch_name);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    size_t entries_size = 64;
+    size_t num_of_entries = 0;
+    struct fss_batch_entry *entries = malloc(entries_size * sizeof(struct fss_batch_entry));
+    struct fss_relay *relay = fss_new_relay(FSS_RELAY_BATCH, con_id);
+
+    if (entries == NULL || relay == NULL) {
+        free(entries); free(relay);
+        fclose(batch_file);
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    int invalid = 0;
+    int line_num = 0;
+
+    // Read all pairs
+    while (fgets(buffer, BUF_SIZE, batch_file)) {
+        line_num++;
+
+        int num_of_targets = -1;
+        int offset = 0;
+        struct pair_options options = PAIR_OPTIONS_DEFAULT;
+
+        if (sscanf(buffer, " (%255[^,], %4095[^)])%n", src_dir_name, tar_list, &offset) == 2 && offset > 0 && fss_parse_pair_options(buffer + offset, &options) == 0)
+            num_of_targets = fss_parse_targets(tar_list, tar_dir_names);
+
+        if (num_of_targets <= 0) {
+            snprintf(buffer, BUF_SIZE, "[%s] Invalid format in line %d of %s\n", datetime, line_num, batch_name);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+            name_filter_destroy(options.filter);
+            invalid++;
+            continue;
+        }
+
+        if (num_of_entries == entries_size) {
+            struct fss_batch_entry *new_entries = realloc(entries, 2 * entries_size * sizeof(struct fss_batch_entry));
+            if (new_entries == NULL) {
+                name_filter_destroy(options.filter);
+                break;
+            }
+
+            entries = new_entries;
+            entries_size *= 2;
+        }
+
+        struct fss_batch_entry *entry = &entries[num_of_entries];
+        entry->src_dir = malloc((strlen(src_dir_name)+1) * sizeof(char));
+        entry->tar_dirs = string_array_copy(tar_dir_names, num_of_targets);
+
+        if (entry->src_dir == NULL || entry->tar_dirs == NULL) {
+            free(entry->src_dir); string_array_free(entry->tar_dirs, num_of_targets);
+            name_filter_destroy(options.filter);
+            break;
+        }
+
+        strcpy(entry->src_dir, src_dir_name);
+        entry->num_of_targets = num_of_targets;
+        entry->options = options;
+        entry->file_info = NULL;
+        entry->duplicate = 0;
+        num_of_entries++;
+    }
+
+    int read_failed = !feof(batch_file);
+    fclose(batch_file);
+
+    // Sort entries by source directory, so that duplicates are next to each other and
+    // every directory of the file monitor can be found with a binary search
+    struct fss_batch_entry **sorted = malloc((num_of_entries+1) * sizeof(struct fss_batch_entry *));
+
+    if (read_failed || sorted == NULL) {
+        fss_free_entries(entries, num_of_entries);
+        free(sorted); free(relay);
+
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    for (size_t e = 0; e < num_of_entries; e++)
+        sorted[e] = &entries[e];
+
+    qsort(sorted, num_of_entries, sizeof(struct fss_batch_entry *), fss_compare_batch_entries);
+
+    for (size_t e = 1; e < num_of_entries; e++) {
+        if (!strcmp(sorted[e]->src_dir, sorted[e-1]->src_dir))
+            sorted[e]->duplicate = 1;
+    }
+
+    relay->entries = entries;
+    relay->sorted = sorted;
+    relay->num_of_entries = num_of_entries;
+    relay->counts[3] = invalid;
+
+    fss_run_relay(relay, log_fd, config_file, console_server);
+}
+
+// Adds the pairs of the batch file of relay whose source directories belong to the current thread
+// counts of relay are the pairs added, already monitored, failed and the invalid lines
+// Returns 0 on success, -1 if malloc fails
+int fss_batch_relay(struct fss_relay *relay, int log_fd) {
+    FileMonitor file_monitor = current_shard->file_monitor;
+    struct worker_manager *worker_manager = &current_shard->worker_manager;
+    struct fss_batch_entry *entries = relay->entries;
+    struct fss_batch_entry **sorted = relay->sorted;
+    size_t num_of_entries = relay->num_of_entries;
+    int con_id = relay->con_id;
+
+    JobQueue batch_queue = job_queue_init();
+    if (batch_queue == NULL) return -1;
+
+    // Find entries that are already in the file monitor
+    struct fss_batch_entry key;
+    struct fss_batch_entry *key_ptr = &key;
+
+    for (struct sync_info_mem_store *info = file_monitor_next(file_monitor, NULL); info != NULL; info = file_monitor_next(file_monitor, info)) {
+        key.src_dir = info->src_dir;
+        struct fss_batch_entry **found = bsearch(&key_ptr, sorted, num_of_entries, sizeof(struct fss_batch_entry *), fss_compare_batch_dirs);
+
+        if (found == NULL) continue;
+
+        // Mark all entries with this directory
+        for (struct fss_batch_entry **f = found; f >= sorted && !strcmp((*f)->src_dir, info->src_dir); f--)
+            (*f)->file_info = info;
+        for (struct fss_batch_entry **f = found+1; f < sorted + num_of_entries && !strcmp((*f)->src_dir, info->src_dir); f++)
+            (*f)->file_info = info;
+    }
+
+    // Start monitoring entries in the order they appear in the file
+    for (size_t e = 0; e < num_of_entries; e++) {
+        struct fss_batch_entry *entry = &entries[e];
+        if (fss_shard_of(entry->src_dir) != current_shard) continue;
+
+        get_date_time(datetime, sizeof(datetime));
+
+        if (entry->duplicate || (entry->file_info != NULL && entry->file_info->active)) {
+            snprintf(buffer, BUF_SIZE, "[%s] Already in queue: %s\n", datetime, entry->src_dir);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+            relay->counts[1]++;
+            continue;
+        }
+
+        fss_join_targets(entry->tar_dirs, entry->num_of_targets, targets, sizeof(targets));
+        int wd = worker_manager_add_watch(worker_manager, entry->src_dir);
+
+        if (wd < 0) {
+            snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, entry->src_dir, targets, strerror(errno));
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+            relay->counts[2]++;
+            continue;
+        }
+
+        worker_manager_track_devices(worker_manager, entry->src_dir, entry->tar_dirs, entry->num_of_targets);
+
+        // Inactive directories are found again by file monitor, new ones are added directly
+        int add_check;
+        if (entry->file_info != NULL)
+            add_check = file_monitor_add(file_monitor, entry->src_dir, entry->tar_dirs, entry->num_of_targets, entry->options, wd);
+        else
+            add_check = file_monitor_add_new(file_monitor, entry->src_dir, entry->tar_dirs, entry->num_of_targets, entry->options, wd);
+
+        // Jobs use the paths interned by file monitor
+        struct sync_info_mem_store *info = add_check < 0? NULL: file_monitor_get_info(file_monitor, entry->src_dir, 0);
+
+        if (info == NULL || job_queue_enqueue(batch_queue, info->src_dir, info->tar_dirs, entry->num_of_targets, "ALL", entry->options.mirror? OP_MIRROR: OP_FULL, 0) < 0) {
+            job_queue_destroy(batch_queue);
+            return -1;
+        }
+
+        snprintf(buffer, BUF_SIZE, "[%s] Added directory: %s -> %s\n[%s] Monitoring started for %s\n", datetime, entry->src_dir, targets, datetime, entry->src_dir);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+        relay->counts[0]++;
+    }
+
+    // Queue all FULL jobs at once
+    job_queue_append(current_shard->job_queue, batch_queue);
+    job_queue_destroy(batch_queue);
+
+    if (current_shard->index < num_of_shards - 1)
+        return 0;
+
+    fss_free_entries(entries, num_of_entries);
+    free(sorted);
+
+    get_date_time(datetime, sizeof(datetime));
+    snprintf(buffer, BUF_SIZE, "[%s] Batch complete: %d added, %d already monitored, %d failed, %d invalid lines\n", datetime, relay->counts[0], relay->counts[1], relay->counts[2], relay->counts[3]);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+    return 0;
+}
+
+// Sends status of every directory of all threads to console con_id, one frame per directory
+// Every thread sends the frames of its directories, see fss_run_relay
+void fss_status_all(int con_id, int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server) {
+    struct fss_relay *relay = fss_new_relay(FSS_RELAY_STATUS, con_id);
+    get_date_time(datetime, sizeof(datetime));
+
+    if (relay == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Status requested for all directories (%zu)\n", datetime, fss_total_dirs());
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    fss_write_workers(worker_manager, buffer, BUF_SIZE);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+
+    fss_run_relay(relay, log_fd, config_file, console_server);
+}
+
+// Sends bytes of memory used by the directories, queued jobs and workers of all threads to console con_id
+// Every thread adds its own, see fss_memory_relay
+void fss_memory(int con_id, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    struct fss_relay *relay = fss_new_relay(FSS_RELAY_MEMORY, con_id);
+
+    if (relay == NULL) {
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    fss_run_relay(relay, log_fd, config_file, console_server);
+}
+
+// Adds the memory of the current thread to relay, the last thread sends the total to the console of relay
+void fss_memory_relay(struct fss_relay *relay, int log_fd) {
+    struct fss_shard *s = current_shard;
+    struct file_monitor_memory memory;
+    file_monitor_memory(s->file_monitor, &memory);
+
+    relay->memory.records += memory.records;
+    relay->memory.index += memory.index;
+    relay->memory.target_status += memory.target_status;
+    relay->memory.paths += memory.paths;
+    relay->memory.num_of_paths += memory.num_of_paths;
+    relay->memory.filters += memory.filters;
+    relay->num_of_dirs += file_monitor_size(s->file_monitor);
+    relay->num_of_jobs += job_queue_size(s->job_queue) + job_queue_size(s->startup_queue);
+    relay->job_memory += job_queue_memory(s->job_queue) + job_queue_memory(s->startup_queue);
+    relay->worker_memory += worker_manager_memory(&s->worker_manager);
+
+    if (s->index < num_of_shards - 1)
+        return;
+
+    int con_id = relay->con_id;
+    memory = relay->memory;
+
+    size_t num_of_dirs = relay->num_of_dirs;
+    size_t total = memory.records + memory.index + memory.target_status + memory.paths + memory.filters;
+
+    // Resident set of the whole manager, in pages
+    long resident = -1;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if (statm != NULL) {
+        if (fscanf(statm, "%*d %ld", &resident) != 1) resident = -1;
+        fclose(statm);
+    }
+
+    get_date_time(datetime, sizeof(datetime));
+    int pos = snprintf(buffer, BUF_SIZE, "[%s] Memory requested for all directories (%zu)\n", datetime, num_of_dirs);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    pos = snprintf(buffer, BUF_SIZE, "Records: %zu bytes\nIndex: %zu bytes\nTarget status: %zu bytes\nPaths: %zu bytes (%zu distinct)\nFilters: %zu bytes\n",
+        memory.records, memory.index, memory.target_status, memory.paths, memory.num_of_paths, memory.filters);
+    pos += snprintf(buffer + pos, BUF_SIZE - pos, "Directories: %zu bytes, %.1f bytes per directory\n", total, num_of_dirs == 0? 0.0: (double) total / num_of_dirs);
+    pos += snprintf(buffer + pos, BUF_SIZE - pos, "Job queue: %zu jobs, %zu bytes\n", relay->num_of_jobs, relay->job_memory);
+    pos += snprintf(buffer + pos, BUF_SIZE - pos, "Workers: %zu bytes\n", relay->worker_memory);
+
+    if (resident >= 0)
+        snprintf(buffer + pos, BUF_SIZE - pos, "Resident set: %ld bytes\n", resident * sysconf(_SC_PAGESIZE));
+    else
+        snprintf(buffer + pos, BUF_SIZE - pos, "Resident set: Unknown\n");
+
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+}
+
+// Begins a full sync of every directory of all threads, requested by console con_id
+// Directories with a job in progress or queued are skipped
+// The response ends when all sync jobs are done. It is kept open by one more pending job until
+// every thread has added its jobs, see fss_sync_relay
+void fss_sync_all(int con_id, int log_fd, FILE *config_file, ConsoleServer console_server) {
+    struct fss_relay *relay = fss_new_relay(FSS_RELAY_SYNC, con_id);
+    get_date_time(datetime, sizeof(datetime));
+
+    if (relay == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
+        return fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Syncing all directories (%zu)\n", datetime, fss_total_dirs());
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    fss_add_pending(con_id, 1);
+    fss_run_relay(relay, log_fd, config_file, console_server);
+}
+
+// Begins a full sync of every directory of the current thread for the console of relay
+// Returns 0 on success, -1 if malloc fails
+int fss_sync_relay(struct fss_relay *relay, int log_fd) {
+    FileMonitor file_monitor = current_shard->file_monitor;
+    JobQueue job_queue = current_shard->job_queue;
+    JobQueue startup_queue = current_shard->startup_queue;
+    struct worker_manager *worker_manager = &current_shard->worker_manager;
+    int con_id = relay->con_id;
+
+    // Get directories with queued jobs, sorted for binary search
+    char **queued_dirs = malloc((job_queue_size(job_queue)+job_queue_size(startup_queue)+1) * sizeof(char *));
+    JobQueue sync_queue = job_queue_init();
+
+    if (queued_dirs == NULL || sync_queue == NULL) {
+        free(queued_dirs); if (sync_queue != NULL) job_queue_destroy(sync_queue);
+        return -1;
+    }
+
+    size_t num_of_queued = job_queue_get_dirs(job_queue, queued_dirs);
+    num_of_queued += job_queue_get_dirs(startup_queue, queued_dirs + num_of_queued);
+    qsort(queued_dirs, num_of_queued, sizeof(char *), fss_compare_dirs);
+
+    int syncing = 0;
+
+    for (struct sync_info_mem_store *info = file_monitor_next(file_monitor, NULL); info != NULL; info = file_monitor_next(file_monitor, info)) {
+        get_date_time(datetime, sizeof(datetime));
+        fss_join_targets(info->tar_dirs, info->num_of_targets, targets, sizeof(targets));
+
+        // If there is already a job performed or queued for this directory
+        if (info->num_of_workers > 0 || bsearch(&info->src_dir, queued_dirs, num_of_queued, sizeof(char *), fss_compare_dirs) != NULL) {
+            snprintf(buffer, BUF_SIZE, "[%s] Sync already in progress %s\n", datetime, info->src_dir);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+            continue;
+        }
+
+        // If directory is not active, start monitoring it again
+        if (!info->active) {
+            int wd = worker_manager_add_watch(worker_manager, info->src_dir);
+
+            if (wd < 0) {
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, info->src_dir, targets, strerror(errno));
+                fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+                continue;
+            }
+
+            info->active = 1;
+            file_monitor_set_wd(file_monitor, info->src_dir, wd);
+        }
+
+        if (job_queue_enqueue(sync_queue, info->src_dir, info->tar_dirs, info->num_of_targets, "ALL", info->mirror? OP_MIRROR: OP_FULL, con_id) < 0) {
+            free(queued_dirs); job_queue_destroy(sync_queue);
+            return -1;
+        }
+
+        snprintf(buffer, BUF_SIZE, "[%s] Syncing directory: %s -> %s\n", datetime, info->src_dir, targets);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_CONSOLE);
+        syncing++;
+    }
+
+    // Queue all FULL jobs at once
+    job_queue_append(job_queue, sync_queue);
+    job_queue_destroy(sync_queue);
+    free(queued_dirs);
+
+    // Response ends after the last job is done
+    if (syncing > 0)
+        fss_add_pending(con_id, syncing);
+
+    return 0;
+}
+
+// Reads and parses report for target of job, one of the jobs of worker at index i of worker manager,
+// and writes logging message to buffer of buf_size and status of report to status, which must have
+// space for 12 characters. Bytes copied to target are written to bytes.
+// Worker must have been reaped. If there is no valid report, the exit status of the worker
+// explains what happened, e.g. a crash, and counts as one error. The jobs a worker killed by the
+// watchdog didn't report have status TIMEOUT.
+// Returns number of errors in report
+int fss_read_worker_report(struct worker_manager *worker_manager, int i, struct job_info *job, int target, char *status, long long *bytes, char *buffer, size_t buf_size) {
+
     int report_ok = 1;  // Set to 0 if report does not follow format
-    char status[8];
     char details[100];
     char error[100];
 
     // Get report of worker
-    read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
-    if (strcmp(buffer, "EXEC_REPORT_START\n"))
+    if (worker_manager_read_line(worker_manager, i, buffer, buf_size) < 0 || strcmp(buffer, "EXEC_REPORT_START\n"))
         report_ok = 0;
 
     // Get status
     if (report_ok) {
-        read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
-
-        if (sscanf(buffer, "STATUS: %[^\n]", status) != 1)
+        if (worker_manager_read_line(worker_manager, i, buffer, buf_size) < 0 || sscanf(buffer, "STATUS: %11[^\n]", status) != 1)
             report_ok = 0;
-    } else {
-        strcpy(status, "Unknown");
     }
 
     // Get details
     if (report_ok) {
-        read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
-
-        if (sscanf(buffer, "DETAILS: %[^\n]", details) != 1) 
+        if (worker_manager_read_line(worker_manager, i, buffer, buf_size) < 0 || sscanf(buffer, "DETAILS: %99[^\n]", details) != 1)
             report_ok = 0;
-    } else {
-        strcpy(details, "Unknown");
     }
 
-    // Get first error if it exists and count errors
-    read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
+    // Get bytes written, which are not reported if worker failed
+    // The line also has the logical size of the files copied, which is only logged in details
+    *bytes = 0;
 
-    int error_count = 0;
+    if (report_ok && worker_manager_read_line(worker_manager, i, buffer, buf_size) < 0)
+        report_ok = 0;
 
-    if (!strcmp(buffer, "ERRORS:\n")) {
-        read_line(worker_manager->pfds[i].fd, error, 100);
-        error_count++;
+    if (report_ok && sscanf(buffer, "BYTES: %lld", bytes) == 1 && worker_manager_read_line(worker_manager, i, buffer, buf_size) < 0)
+        report_ok = 0;
+
+    // A job handed back by the worker has neither a result nor a record
+    if (report_ok && !strcmp(status, "DEFERRED")) {
+        buffer[0] = '\0';
+        return 0;
+    }
 
-        read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
+    // Get first error if it exists and count errors
+    int error_count = 0;
+
+    if (report_ok && !strcmp(buffer, "ERRORS:\n")) {
+        if (worker_manager_read_line(worker_manager, i, error, 100) >= 0) {
+            error[strcspn(error, "\n")] = '\0';
+            error_count++;
+        }
 
-        while(strcmp(buffer, "EXEC_REPORT_END\n")) {
+        while (worker_manager_read_line(worker_manager, i, buffer, buf_size) >= 0 && strcmp(buffer, "EXEC_REPORT_END\n"))
             error_count++;
-            read_line(worker_manager->pfds[i].fd, buffer, BUF_SIZE);
+    }
+
+    // If report is missing or incomplete, use exit status of worker
+    if (!report_ok) {
+        int exit_status = worker_manager->slots[i].exit_status;
+
+        strcpy(status, "ERROR");
+        error_count = 1;
+
+        // Worker was killed by the watchdog, or cancelled before it could handle SIGTERM
+        if (worker_manager->slots[i].killed_ms != 0) {
+            strcpy(status, "TIMEOUT");
+            snprintf(details, sizeof(details), "Worker killed after %lld s without progress", (worker_manager->slots[i].timeout_ms + worker_manager->slots[i].size_ms) / 1000);
+        } else if (WIFSIGNALED(exit_status) && WTERMSIG(exit_status) == SIGTERM) {
+            strcpy(status, "CANCELLED");
+            error_count = 0;
+            snprintf(details, sizeof(details), "Cancelled before any file was copied");
+        } else if (WIFSIGNALED(exit_status))
+            snprintf(details, sizeof(details), "Worker crashed: killed by signal %d (%s)", WTERMSIG(exit_status), strsignal(WTERMSIG(exit_status)));
+        else if (WEXITSTATUS(exit_status) == WORKER_EXEC_FAILED)
+            snprintf(details, sizeof(details), "Worker could not be executed");
+        else
+            snprintf(details, sizeof(details), "Worker exited with code %d without a report", WEXITSTATUS(exit_status));
+    }
+
+    // A record of the event log takes the place of the line of text
+    if (event_log != NULL) {
+        struct timespec now, *start = &worker_manager->start_times[i];
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long latency_us = (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+
+        int file_text = report_ok && !sync_operation_whole_dir(job->operation) && !strcmp(status, "SUCCESS");
+        char *text = !report_ok || sync_operation_whole_dir(job->operation) || (strcmp(status, "SUCCESS") && error_count == 0)? details: file_text? job->file: error+1;
+
+        pthread_mutex_lock(&event_log_lock);
+        int log_check = event_log_job(event_log, job->src_dir, job->tar_dirs[target], job->worker_pid, job->operation, sync_status_parse(status), error_count, *bytes, latency_us, file_text? EVENT_TEXT_FILE: EVENT_TEXT_DETAILS, text);
+        pthread_mutex_unlock(&event_log_lock);
+
+        if (log_check == 0) {
+            buffer[0] = '\0';
+            return error_count;
         }
     }
 
@@ -517,17 +1962,1005 @@ int fss_read_worker_report(struct worker_manager *worker_manager, int i, char *b
     get_date_time(datetime, sizeof(datetime));
 
     // Write to buffer
-    if (!strcmp(worker_manager->worker_jobs[i].operation, "FULL")) {
-        snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [%d] [%s] [%s] [%s]\n", 
-        datetime, worker_manager->worker_jobs[i].src_dir, worker_manager->worker_jobs[i].tar_dir, worker_manager->worker_jobs[i].worker_pid, worker_manager->worker_jobs[i].operation, status, details);
+    char *operation = sync_operation_name(job->operation);
+
+    if (!report_ok || sync_operation_whole_dir(job->operation) || (strcmp(status, "SUCCESS") && error_count == 0)) {
+        snprintf(buffer, buf_size, "[%s] [%s] [%s] [%d] [%s] [%s] [%s]\n", 
+        datetime, job->src_dir, job->tar_dirs[target], job->worker_pid, operation, status, details);
     } else if (!strcmp(status, "SUCCESS")) {
-        snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [%d] [%s] [%s] [File: %s]\n", 
-        datetime, worker_manager->worker_jobs[i].src_dir, worker_manager->worker_jobs[i].tar_dir, worker_manager->worker_jobs[i].worker_pid, worker_manager->worker_jobs[i].operation, status, worker_manager->worker_jobs[i].file);
+        snprintf(buffer, buf_size, "[%s] [%s] [%s] [%d] [%s] [%s] [File: %s]\n", 
+        datetime, job->src_dir, job->tar_dirs[target], job->worker_pid, operation, status, job->file);
     } else {
-        snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [%d] [%s] [%s] [%s]\n", 
-        datetime, worker_manager->worker_jobs[i].src_dir, worker_manager->worker_jobs[i].tar_dir, worker_manager->worker_jobs[i].worker_pid, worker_manager->worker_jobs[i].operation, status, error+1);    
+        snprintf(buffer, buf_size, "[%s] [%s] [%s] [%d] [%s] [%s] [%s]\n", 
+        datetime, job->src_dir, job->tar_dirs[target], job->worker_pid, operation, status, error+1);    
     }
 
     return error_count;
 }
 
+// Splits comma separated list of target directories tar_list to tar_dirs and removes spaces
+// around every target. Pointers of tar_dirs point inside tar_list.
+// Returns number of targets, or -1 if a target is empty, repeated or there are more than
+// MAX_TARGETS targets
+int fss_parse_targets(char *tar_list, char **tar_dirs) {
+    int num_of_targets = 0;
+    char *save_ptr;
+
+    for (char *token = strtok_r(tar_list, ",", &save_ptr); token != NULL; token = strtok_r(NULL, ",", &save_ptr)) {
+        // Remove spaces
+        while (*token == ' ' || *token == '\t') token++;
+
+        char *end = token + strlen(token);
+        while (end > token && (end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+
+        if (*token == '\0' || num_of_targets == MAX_TARGETS)
+            return -1;
+
+        for (int t = 0; t < num_of_targets; t++) {
+            if (!strcmp(tar_dirs[t], token))
+                return -1;
+        }
+
+        tar_dirs[num_of_targets++] = token;
+    }
+
+    return num_of_targets == 0? -1: num_of_targets;
+}
+
+// Reads the settings and pairs of config file to config, whose pairs are freed by the caller
+// Global settings that the file doesn't have get their defaults
+// Returns 0 on success, -1 if a line is invalid and -2 if malloc fails
+int fss_parse_config(FILE *config_file, struct fss_config *config) {
+    size_t pairs_size = 64;
+    config->pairs = malloc(pairs_size * sizeof(struct fss_batch_entry));
+    config->num_of_pairs = 0;
+    config->hot_window = HOT_WINDOW_DEFAULT;
+    config->batch_files = BATCH_FILES_DEFAULT;
+    config->batch_bytes = BATCH_BYTES_DEFAULT;
+    config->timeout_secs = TIMEOUT_SECS_DEFAULT;
+    config->limits = (struct throttle_limits) {0, 0};
+
+    if (config->pairs == NULL) return -2;
+
+    while (fgets(buffer, BUF_SIZE, config_file)) {
+
+        int num_of_targets = -1;
+        int offset = 0, hot_offset = 0, hot_window = -1, batch_offset = 0, batch_files = 0, timeout_offset = 0, timeout = -1;
+        struct throttle_limits limits = {0, 0};
+        struct pair_options options = PAIR_OPTIONS_DEFAULT;
+
+        // Global rate limits of all workers and window of pairs without a hot option
+        sscanf(buffer, " throttle %n", &offset);
+        sscanf(buffer, " hot %d %n", &hot_window, &hot_offset);
+
+        // Limits of the jobs of single files that share a worker
+        sscanf(buffer, " batch %d %n", &batch_files, &batch_offset);
+
+        // Time workers may go without progress before they are killed
+        sscanf(buffer, " timeout %d %n", &timeout, &timeout_offset);
+
+        if (hot_offset > 0 && buffer[hot_offset] == '\0' && hot_window >= 0) {
+            config->hot_window = hot_window;
+            continue;
+
+        } else if (batch_offset > 0 && batch_files > 0) {
+            char *bytes = buffer + batch_offset;
+            bytes[strcspn(bytes, " \t\n")] = '\0';
+
+            if (*bytes == '\0' || throttle_parse_rate(bytes, &config->batch_bytes) == 0) {
+                config->batch_files = batch_files;
+                continue;
+            }
+
+        } else if (timeout_offset > 0 && buffer[timeout_offset] == '\0' && timeout >= 0) {
+            config->timeout_secs = timeout;
+            continue;
+
+        } else if (offset > 0) {
+            if (throttle_parse_limits(buffer + offset, &limits) > 0) {
+                config->limits = limits;
+                continue;
+            }
+
+        // Get source directory, list of target directories and options of the pair
+        } else if (sscanf(buffer, " (%255[^,], %4095[^)])%n", src_dir_name, tar_list, &offset) == 2 && offset > 0) {
+            if (fss_parse_pair_options(buffer + offset, &options) == 0)
+                num_of_targets = fss_parse_targets(tar_list, tar_dir_names);
+        }
+
+        if (num_of_targets <= 0) {
+            fss_free_entries(config->pairs, config->num_of_pairs);
+            name_filter_destroy(options.filter);
+            return -1;
+        }
+
+        if (config->num_of_pairs == pairs_size) {
+            struct fss_batch_entry *new_pairs = realloc(config->pairs, 2 * pairs_size * sizeof(struct fss_batch_entry));
+            if (new_pairs == NULL) {
+                name_filter_destroy(options.filter);
+                break;
+            }
+
+            config->pairs = new_pairs;
+            pairs_size *= 2;
+        }
+
+        struct fss_batch_entry *pair = &config->pairs[config->num_of_pairs];
+        pair->src_dir = malloc((strlen(src_dir_name)+1) * sizeof(char));
+        pair->tar_dirs = string_array_copy(tar_dir_names, num_of_targets);
+
+        if (pair->src_dir == NULL || pair->tar_dirs == NULL) {
+            free(pair->src_dir); string_array_free(pair->tar_dirs, num_of_targets);
+            name_filter_destroy(options.filter);
+            break;
+        }
+
+        strcpy(pair->src_dir, src_dir_name);
+        pair->num_of_targets = num_of_targets;
+        pair->options = options;
+        pair->file_info = NULL;
+        pair->duplicate = 0;
+        config->num_of_pairs++;
+    }
+
+    if (!feof(config_file)) {
+        fss_free_entries(config->pairs, config->num_of_pairs);
+        return -2;
+    }
+
+    return 0;
+}
+
+// Makes the global settings of config the settings of the manager
+void fss_apply_config(struct fss_config *config, struct worker_manager *worker_manager) {
+    __atomic_store_n(&hot_window_default, config->hot_window, __ATOMIC_RELAXED);
+    __atomic_store_n(&batch_max_files, config->batch_files, __ATOMIC_RELAXED);
+    __atomic_store_n(&batch_max_bytes, config->batch_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&timeout_secs, config->timeout_secs, __ATOMIC_RELAXED);
+    throttle_set_global(worker_manager->throttle, config->limits);
+}
+
+// Watches the directory of config_path for files that are written or moved to it. This reports the
+// config file whether it is written in place or replaced, even by an editor that renames it away
+// and writes the new file later, when a watch of the file itself would already be gone.
+// A directory that can't be watched is tried again every CONFIG_RETRY_SECS seconds
+// Returns 0 if the directory is watched, -1 otherwise
+int fss_watch_config(int log_fd, struct worker_manager *worker_manager) {
+    char config_dir[PATH_MAX] = ".";
+    char *slash = strrchr(config_path, '/');
+
+    if (slash != NULL)
+        snprintf(config_dir, sizeof(config_dir), "%.*s", slash == config_path? 1: (int) (slash - config_path), config_path);
+
+    config_base = slash == NULL? config_path: slash + 1;
+    int wd = worker_manager_watch_writes(worker_manager, config_dir);
+
+    // Only the first try that fails is logged
+    if (wd < 0 && config_retry == 0) {
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Config file %s is not watched for changes, retrying: %s\n", datetime, config_path, strerror(errno));
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+    }
+
+    config_wd = wd;
+    config_retry = wd < 0? time(NULL) + CONFIG_RETRY_SECS: 0;
+
+    return wd < 0? -1: 0;
+}
+
+// Tries to watch the directory of the config file again once its retry is due, and reloads the file
+// if it is watched, since it may have changed in the meantime. *timeout is lowered to the
+// milliseconds until the next try if it is later.
+// Returns 0 on success, -1 if malloc fails
+int fss_retry_config(int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server, int *timeout) {
+    if (config_retry == 0) return 0;
+
+    long long now = time(NULL);
+
+    if (now >= config_retry && fss_watch_config(log_fd, worker_manager) == 0)
+        return fss_reload_config(log_fd, config_file, worker_manager, console_server);
+
+    int retry_timeout = (config_retry - now) * 1000;
+    if (*timeout < 0 || retry_timeout < *timeout)
+        *timeout = retry_timeout;
+
+    return 0;
+}
+
+// Returns 1 if the targets of pair differ from those of info, 2 if its targets are the same but
+// the files that are synced change, 3 if only its other options change and 0 if nothing changes
+int fss_pair_changes(struct sync_info_mem_store *info, struct fss_batch_entry *pair) {
+    if (info->num_of_targets != pair->num_of_targets)
+        return 1;
+
+    for (int t = 0; t < info->num_of_targets; t++) {
+        if (strcmp(info->tar_dirs[t], pair->tar_dirs[t]))
+            return 1;
+    }
+
+    struct pair_options *options = &pair->options;
+
+    if (info->mirror != options->mirror || !name_filter_equal(info->filter, options->filter))
+        return 2;
+
+    if (info->throttle.limits.bytes_per_sec != options->limits.bytes_per_sec || info->throttle.limits.files_per_sec != options->limits.files_per_sec ||
+        info->hot_window != options->hot_window || info->snapshot_interval != options->snapshot_interval ||
+        info->snapshot_keep != options->snapshot_keep || info->atomic != options->atomic || info->durability != options->durability)
+        return 3;
+
+    return 0;
+}
+
+// Reads the config file again and applies what changed since the pairs were added: pairs that are
+// new are added, pairs whose targets or options changed are updated and pairs of the config file
+// that were removed from it are cancelled. Pairs whose line hasn't changed keep running without
+// a new full sync, and pairs added with commands are left alone unless the file has them.
+// An invalid file is logged and changes nothing
+// Thread 0 reads the file and applies the global settings, then every thread applies the pairs of its
+// directories, see fss_reload_relay. config_file is the file the manager was started with
+// Returns 0 on success, -1 if malloc fails
+int fss_reload_config(int log_fd, FILE *config_file, struct worker_manager *worker_manager, ConsoleServer console_server) {
+    struct fss_config config;
+    FILE *file = fopen(config_path, "r");
+    int parse_check = file == NULL? -3: fss_parse_config(file, &config);
+    int err = errno;
+
+    if (file != NULL) fclose(file);
+
+    get_date_time(datetime, sizeof(datetime));
+
+    if (parse_check == -2)
+        return -1;
+
+    if (parse_check < 0) {
+        if (parse_check == -1)
+            snprintf(buffer, BUF_SIZE, "[%s] Invalid format in config file %s, nothing reloaded\n", datetime, config_path);
+        else
+            snprintf(buffer, BUF_SIZE, "[%s] Unable to reload config file %s: %s\n", datetime, config_path, strerror(err));
+
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+        return 0;
+    }
+
+    fss_apply_config(&config, worker_manager);
+    struct fss_relay *relay = fss_new_relay(FSS_RELAY_RELOAD, -1);
+
+    if (relay == NULL) {
+        fss_free_entries(config.pairs, config.num_of_pairs);
+        return -1;
+    }
+
+    relay->entries = config.pairs;
+    relay->num_of_entries = config.num_of_pairs;
+
+    fss_run_relay(relay, log_fd, config_file, console_server);
+    return 0;
+}
+
+// Applies the pairs of the config file of relay whose source directories belong to the current thread
+// counts of relay are the pairs added, updated, removed, unchanged and failed
+// Returns 0 on success, -1 if malloc fails
+int fss_reload_relay(struct fss_relay *relay, int log_fd) {
+    FileMonitor file_monitor = current_shard->file_monitor;
+    JobQueue job_queue = current_shard->job_queue;
+    struct worker_manager *worker_manager = &current_shard->worker_manager;
+    struct fss_batch_entry *pairs = relay->entries;
+    size_t num_of_pairs = relay->num_of_entries;
+    int *counts = relay->counts;
+
+    // Pairs of the old config file are marked with 2 until the new one has them
+    for (struct sync_info_mem_store *info = file_monitor_next(file_monitor, NULL); info != NULL; info = file_monitor_next(file_monitor, info)) {
+        if (info->config) info->config = 2;
+    }
+
+    for (size_t p = 0; p < num_of_pairs; p++) {
+        struct fss_batch_entry *pair = &pairs[p];
+        if (fss_shard_of(pair->src_dir) != current_shard) continue;
+
+        struct sync_info_mem_store *info = file_monitor_get_info(file_monitor, pair->src_dir, 0);
+        int changes = info == NULL? 1: fss_pair_changes(info, pair);
+
+        fss_join_targets(pair->tar_dirs, pair->num_of_targets, targets, sizeof(targets));
+        get_date_time(datetime, sizeof(datetime));
+
+        // A directory that is repeated in the file keeps its first line
+        if (info != NULL && info->config == 1) {
+            snprintf(buffer, BUF_SIZE, "[%s] Already in queue: %s\n", datetime, pair->src_dir);
+            fss_log_event(buffer, log_fd, -1, FSS_WRITE_STDOUT);
+            continue;
+        }
+
+        // A pair of the old file that was cancelled stays cancelled while its line is the same
+        if (info != NULL && changes == 0 && (info->active || info->config == 2)) {
+            info->config = 1;
+            counts[3]++;
+            continue;
+        }
+
+        if (info == NULL || !info->active) {
+            int wd = worker_manager_add_watch(worker_manager, pair->src_dir);
+            changes = 1;
+
+            if (wd < 0) {
+                snprintf(buffer, BUF_SIZE, "[%s] Unable to start monitoring %s -> %s: %s\n", datetime, pair->src_dir, targets, strerror(errno));
+                fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+                counts[4]++;
+                continue;
+            }
+
+            worker_manager_track_devices(worker_manager, pair->src_dir, pair->tar_dirs, pair->num_of_targets);
+
+            if (file_monitor_add(file_monitor, pair->src_dir, pair->tar_dirs, pair->num_of_targets, pair->options, wd) < 0)
+                return -1;
+
+            snprintf(buffer, BUF_SIZE, "[%s] Added directory: %s -> %s\n[%s] Monitoring started for %s\n", datetime, pair->src_dir, targets, datetime, pair->src_dir);
+            counts[0]++;
+        } else {
+            if (file_monitor_update(file_monitor, pair->src_dir, pair->tar_dirs, pair->num_of_targets, pair->options) < 0)
+                return -1;
+
+            // Workers that are syncing the directory get new limits immediately
+            if (info->throttle_slot >= 0)
+                throttle_set_slot(worker_manager->throttle, info->throttle_slot, info->throttle.limits);
+
+            snprintf(buffer, BUF_SIZE, "[%s] Updated directory: %s -> %s\n", datetime, pair->src_dir, targets);
+            counts[1]++;
+        }
+
+        info = file_monitor_get_info(file_monitor, pair->src_dir, 0);
+        info->config = 1;
+
+        if (pair->options.snapshot_interval > 0)
+            __atomic_store_n(&periodic_snapshots, 1, __ATOMIC_RELAXED);
+
+        // New pairs, new targets and new files to sync need a full sync, other options don't
+        if (changes == 1 || changes == 2) {
+            if (job_queue_enqueue(current_shard->startup_queue, info->src_dir, info->tar_dirs, info->num_of_targets, "ALL", info->mirror? OP_MIRROR: OP_FULL, 0) < 0)
+                return -1;
+        }
+
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+    }
+
+    // Pairs that are no longer in the file are cancelled
+    for (struct sync_info_mem_store *info = file_monitor_next(file_monitor, NULL); info != NULL; info = file_monitor_next(file_monitor, info)) {
+        if (info->config != 2) continue;
+
+        info->config = 0;
+        if (!info->active) continue;
+
+        fss_cancel_dir(info, -1, log_fd, file_monitor, job_queue, worker_manager);
+        counts[2]++;
+    }
+
+    if (current_shard->index < num_of_shards - 1)
+        return 0;
+
+    fss_free_entries(pairs, num_of_pairs);
+
+    get_date_time(datetime, sizeof(datetime));
+    snprintf(buffer, BUF_SIZE, "[%s] Config file reloaded: %d added, %d updated, %d removed, %d unchanged, %d failed\n", datetime, counts[0], counts[1], counts[2], counts[3], counts[4]);
+    fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+    return 0;
+}
+
+// Stops monitoring of active directory info, drops its queued jobs and cancels its workers
+// If con_id is not -1, the response is sent to console con_id
+void fss_cancel_dir(struct sync_info_mem_store *info, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue, struct worker_manager *worker_manager) {
+    char *src_dir = info->src_dir;
+    get_date_time(datetime, sizeof(datetime));
+
+    if (worker_manager_remove_watch(worker_manager, info->wd) < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Couldn't cancel %s - failed to remove inotify watch: %s\n", datetime, src_dir, strerror(errno));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+    }
+
+    file_monitor_set_inactive(file_monitor, src_dir);
+    job_queue_remove_dir(job_queue, src_dir);
+    job_queue_remove_dir(current_shard->startup_queue, src_dir);
+    hot_files_remove_dir(current_shard->hot_files, src_dir);
+
+    // Stop the jobs that are running for the directory, their CANCELLED reports are logged when they exit
+    for (int slot = 0; slot < worker_manager->worker_limit && info->num_of_workers > 0; slot++) {
+        struct job_info *job = &worker_manager->worker_jobs[slot];
+        if (job->worker_pid == -1 || strcmp(job->src_dir, src_dir)) continue;
+
+        if (worker_manager_cancel_worker(worker_manager, slot) == -1) {
+            snprintf(buffer, BUF_SIZE, "[%s] Couldn't cancel worker %d of %s: %s\n", datetime, job->worker_pid, src_dir, strerror(errno));
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_LOG);
+        } else {
+            snprintf(buffer, BUF_SIZE, "[%s] Cancelling worker %d of %s\n", datetime, job->worker_pid, src_dir);
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_LOG);
+        }
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Monitoring stopped for %s\n", datetime, src_dir);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_LOG | FSS_WRITE_END);
+}
+
+// Frees num_of_entries entries of a batch file or the config file and the array itself
+void fss_free_entries(struct fss_batch_entry *entries, size_t num_of_entries) {
+    for (size_t e = 0; e < num_of_entries; e++) {
+        free(entries[e].src_dir); string_array_free(entries[e].tar_dirs, entries[e].num_of_targets);
+        name_filter_destroy(entries[e].options.filter);
+    }
+
+    free(entries);
+}
+
+// Parses options that follow a pair in the config file or a batch file, separated by spaces:
+// rate limits "bytes=<rate>" and "files=<rate>", "mirror" for mirror mode, "hot=<ms>" for
+// the milliseconds a file waits between two of its jobs, "snapshot" or "snapshot=<minutes>" for
+// snapshots of the targets before every full sync and every <minutes>, "keep=<n>" for the
+// number of snapshots kept, "atomic" to replace target files by complete copies and
+// "durability=<none|file|batch>" for when copies are written to disk, "include=<patterns>" and
+// "exclude=<patterns>" for comma separated glob patterns of the file names that are synced
+// Options that aren't given keep their values in options
+// Returns 0 on success, -1 if an option is invalid or malloc fails, in which case the filter
+// of options is freed
+int fss_parse_pair_options(char *option_list, struct pair_options *options) {
+    char *save_ptr;
+
+    for (char *option = strtok_r(option_list, " \t\n", &save_ptr); option != NULL; option = strtok_r(NULL, " \t\n", &save_ptr)) {
+        int hot_window, interval, keep, len = 0;
+        char durability[8];
+
+        if (!strcmp(option, "mirror"))
+            options->mirror = 1;
+        else if (sscanf(option, "hot=%d%n", &hot_window, &len) == 1 && option[len] == '\0' && hot_window >= 0)
+            options->hot_window = hot_window;
+        else if (!strcmp(option, "snapshot"))
+            options->snapshot_interval = 0;
+        else if (sscanf(option, "snapshot=%d%n", &interval, &len) == 1 && option[len] == '\0' && interval > 0) {
+            options->snapshot_interval = interval;
+            __atomic_store_n(&periodic_snapshots, 1, __ATOMIC_RELAXED);
+        } else if (sscanf(option, "keep=%d%n", &keep, &len) == 1 && option[len] == '\0' && keep > 0)
+            options->snapshot_keep = keep;
+        else if (!strcmp(option, "atomic"))
+            options->atomic = 1;
+        else if (sscanf(option, "durability=%7s%n", durability, &len) == 1 && option[len] == '\0' && durability_parse(durability) >= 0)
+            options->durability = durability_parse(durability);
+        else if (!strncmp(option, "include=", 8) || !strncmp(option, "exclude=", 8)) {
+            if (options->filter == NULL && (options->filter = name_filter_init()) == NULL)
+                return -1;
+
+            if (name_filter_add_list(options->filter, option + 8, option[0] == 'i') < 0) {
+                name_filter_destroy(options->filter);
+                options->filter = NULL;
+                return -1;
+            }
+        } else if (throttle_parse_limits(option, &options->limits) != 1) {
+            name_filter_destroy(options->filter);
+            options->filter = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Writes target directories separated by ", " to buf of size nbytes
+// Returns buf
+char *fss_join_targets(char **tar_dirs, int num_of_targets, char *buf, size_t nbytes) {
+    size_t pos = 0;
+    buf[0] = '\0';
+
+    for (int t = 0; t < num_of_targets && pos < nbytes; t++)
+        pos += snprintf(buf + pos, nbytes - pos, t == 0? "%s": ", %s", tar_dirs[t]);
+
+    return buf;
+}
+
+// Writes status of monitored directory info to buf of size nbytes, with one line for every target
+void fss_write_status(struct sync_info_mem_store *info, struct worker_manager *worker_manager, char *buf, size_t nbytes) {
+    size_t pos = snprintf(buf, nbytes, "Directory: %s\n", info->src_dir);
+
+    for (int t = 0; t < info->num_of_targets && pos < nbytes; t++) {
+        struct target_status *target = &info->target_status[t];
+        pos += snprintf(buf + pos, nbytes - pos, "Target: %s (Last result: %s, Errors: %d)\n", info->tar_dirs[t], sync_status_name(target->last_status), target->error_count);
+    }
+
+    char last_sync[DATETIME_SZ] = "";
+    if (info->last_sync_time != 0)
+        format_date_time(info->last_sync_time, last_sync, sizeof(last_sync));
+
+    if (pos < nbytes)
+        pos += snprintf(buf + pos, nbytes - pos, "Last sync: %s\nErrors: %d\nStatus: %s%s\n", last_sync, info->error_count, info->active? "Active": "Inactive", info->mirror? " (mirror)": "");
+
+    if (pos < nbytes)
+        pos += snprintf(buf + pos, nbytes - pos, "Hot files: %zu deferred, window %d ms\n", hot_files_deferred(current_shard->hot_files, info->src_dir), info->hot_window < 0? __atomic_load_n(&hot_window_default, __ATOMIC_RELAXED): info->hot_window);
+
+    if (pos < nbytes && info->snapshot_interval >= 0) {
+        char last_snapshot[DATETIME_SZ] = "None";
+        if (info->last_snapshot_time != 0)
+            format_date_time(info->last_snapshot_time, last_snapshot, sizeof(last_snapshot));
+
+        if (info->snapshot_interval > 0)
+            pos += snprintf(buf + pos, nbytes - pos, "Snapshots: every %d min and before full syncs, keep %d, last %s\n", info->snapshot_interval, info->snapshot_keep, last_snapshot);
+        else
+            pos += snprintf(buf + pos, nbytes - pos, "Snapshots: before full syncs, keep %d, last %s\n", info->snapshot_keep, last_snapshot);
+    }
+
+    if (pos < nbytes && (info->atomic || info->durability != DURABILITY_NONE))
+        pos += snprintf(buf + pos, nbytes - pos, "Writes: %s, durability %s\n", info->atomic || info->snapshot_interval >= 0? "atomic": "in place", durability_name(info->durability));
+
+    if (pos < nbytes && info->filter != NULL)
+        pos += snprintf(buf + pos, nbytes - pos, "Filter: %d patterns, %lld events filtered\n", name_filter_size(info->filter), info->filtered_events);
+
+    if (pos < nbytes)
+        pos += snprintf(buf + pos, nbytes - pos, "Workers: %d%s\n", info->num_of_workers, info->barrier? " (full sync)": "");
+
+    if (pos < nbytes && info->timeouts > 0)
+        pos += snprintf(buf + pos, nbytes - pos, "Timeouts: %d in a row\n", info->timeouts);
+
+    // Rates of the workers syncing the directory, if there are any
+    struct throttle_rates rates = {0, 0};
+
+    if (info->throttle_slot >= 0)
+        rates = throttle_slot_rates(worker_manager->throttle, info->throttle_slot);
+
+    char byte_limit[32], file_limit[32];
+    fss_format_limit(info->throttle.limits.bytes_per_sec, "MB/s", 1024 * 1024, byte_limit, sizeof(byte_limit));
+    fss_format_limit(info->throttle.limits.files_per_sec, "files/s", 1, file_limit, sizeof(file_limit));
+
+    if (pos < nbytes)
+        snprintf(buf + pos, nbytes - pos, "Rate: %.2f MB/s of %s, %.1f files/s of %s\n", rates.bytes_per_sec / (1024 * 1024), byte_limit, rates.files_per_sec, file_limit);
+}
+
+// Writes number of active workers of all threads, current worker limit and statistics of the autoscaler
+// to buf of size nbytes, followed by the stalled workers of this thread
+void fss_write_workers(struct worker_manager *worker_manager, char *buf, size_t nbytes) {
+    struct autoscaler_status status;
+    worker_pool_status(worker_pool, &status);
+
+    char mode[32];
+    if (status.automatic)
+        snprintf(mode, sizeof(mode), "Automatic %d-%d", status.min_limit, status.max_limit);
+    else
+        snprintf(mode, sizeof(mode), "Fixed");
+
+    char utilisation[16];
+    if (status.utilisation < 0)
+        snprintf(utilisation, sizeof(utilisation), "Unknown");
+    else
+        snprintf(utilisation, sizeof(utilisation), "%.0f%%", status.utilisation * 100);
+
+    char throughput[32];
+    if (status.throughput < 0)
+        snprintf(throughput, sizeof(throughput), "Unknown");
+    else
+        snprintf(throughput, sizeof(throughput), "%.2f MB/s", status.throughput / (1024 * 1024));
+
+    struct throttle_rates rates = throttle_global_rates(worker_manager->throttle);
+    struct throttle_limits limits = throttle_get_global(worker_manager->throttle);
+
+    char byte_limit[32], file_limit[32];
+    fss_format_limit(limits.bytes_per_sec, "MB/s", 1024 * 1024, byte_limit, sizeof(byte_limit));
+    fss_format_limit(limits.files_per_sec, "files/s", 1, file_limit, sizeof(file_limit));
+
+    char timeout[48];
+    int secs = __atomic_load_n(&timeout_secs, __ATOMIC_RELAXED);
+
+    if (secs == 0)
+        snprintf(timeout, sizeof(timeout), "off");
+    else
+        snprintf(timeout, sizeof(timeout), "%d s", secs);
+
+    // Workers that were killed but haven't exited hold their slots until they do
+    size_t pos = snprintf(buf, nbytes, "Workers: %d active, limit %d (%s)\nDevice utilisation: %s\nThroughput per worker: %s\nGlobal rate: %.2f MB/s of %s, %.1f files/s of %s\nWatchdog: timeout %s, %d stalled\n",
+        worker_pool_running(worker_pool), status.limit, mode, utilisation, throughput,
+        rates.bytes_per_sec / (1024 * 1024), byte_limit, rates.files_per_sec, file_limit, timeout, worker_pool_stalled(worker_pool));
+
+    if (pos < nbytes)
+        fss_write_stalled(worker_manager, buf + pos, nbytes - pos);
+}
+
+// Writes a line for every worker of worker manager that was killed but hasn't exited to buf of size nbytes
+void fss_write_stalled(struct worker_manager *worker_manager, char *buf, size_t nbytes) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    size_t pos = 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < worker_manager->worker_limit && pos < nbytes; i++) {
+        struct job_info *job = &worker_manager->worker_jobs[i];
+        long long killed_ms = worker_manager->slots[i].killed_ms;
+
+        if (job->worker_pid == -1 || killed_ms == 0) continue;
+
+        long long killed_secs = (now.tv_sec * 1000LL + now.tv_nsec / 1000000 - killed_ms) / 1000;
+        pos += snprintf(buf + pos, nbytes - pos, "Stalled: worker %d of %s, killed %lld s ago (%s %s)\n", job->worker_pid, job->src_dir, killed_secs, sync_operation_name(job->operation), job->file);
+    }
+}
+
+// Sets worker limit to limit, which is a number or "auto" to adjust it automatically,
+// requested by console con_id
+void fss_set_worker_limit(char *limit, int con_id, int log_fd) {
+    get_date_time(datetime, sizeof(datetime));
+
+    if (!strcmp(limit, "auto")) {
+        worker_pool_set_auto(worker_pool);
+        snprintf(buffer, BUF_SIZE, "[%s] Worker limit is adjusted automatically, currently %d\n", datetime, worker_pool_limit(worker_pool));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    char *end;
+    long new_limit = strtol(limit, &end, 10);
+
+    if (*end != '\0' || new_limit > INT_MAX || worker_pool_set_limit(worker_pool, new_limit) < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Invalid worker limit %s, must be auto or between 1 and %d\n", datetime, limit, worker_pool->worker_limit);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Worker limit set to %ld\n", datetime, new_limit);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+}
+
+// Writes limit, divided by scale and followed by unit, or "unlimited" if limit is 0, to buf of size nbytes
+char *fss_format_limit(long long limit, char *unit, double scale, char *buf, size_t nbytes) {
+    if (limit == 0)
+        snprintf(buf, nbytes, "unlimited");
+    else if (scale == 1)
+        snprintf(buf, nbytes, "%lld %s", limit, unit);
+    else
+        snprintf(buf, nbytes, "%.2f %s", limit / scale, unit);
+
+    return buf;
+}
+
+// Sets rate limits of dir, or global limits if dir is "--global", from options "bytes=<rate>"
+// and "files=<rate>", requested by console con_id
+// Limits that aren't in options are unchanged. Without options, the current limits are sent.
+// Running workers get the new limits immediately
+void fss_set_throttle(char *dir, char *options, int con_id, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager) {
+    get_date_time(datetime, sizeof(datetime));
+
+    int global = !strcmp(dir, "--global");
+    struct sync_info_mem_store *file_info = global? NULL: file_monitor_get_info(file_monitor, dir, 0);
+
+    if (!global && file_info == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, dir);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    struct throttle_limits limits = global? throttle_get_global(worker_manager->throttle): file_info->throttle.limits;
+    int num_of_options = options == NULL? 0: throttle_parse_limits(options, &limits);
+
+    if (num_of_options < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Invalid limits, use bytes=<rate>[K|M|G] and files=<rate>, 0 for unlimited\n", datetime);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (num_of_options > 0) {
+        if (global) {
+            throttle_set_global(worker_manager->throttle, limits);
+        } else {
+            // Workers that are syncing the directory get the limits immediately
+            memset(&file_info->throttle, 0, sizeof(file_info->throttle));
+            file_info->throttle.limits = limits;
+
+            if (file_info->throttle_slot >= 0)
+                throttle_set_slot(worker_manager->throttle, file_info->throttle_slot, limits);
+        }
+    }
+
+    char byte_limit[32], file_limit[32];
+    fss_format_limit(limits.bytes_per_sec, "MB/s", 1024 * 1024, byte_limit, sizeof(byte_limit));
+    fss_format_limit(limits.files_per_sec, "files/s", 1, file_limit, sizeof(file_limit));
+
+    snprintf(buffer, BUF_SIZE, "[%s] Throttle %s %s: %s, %s\n", datetime, num_of_options > 0? "set for": "of", global? "all workers": dir, byte_limit, file_limit);
+    fss_log_event(buffer, log_fd, con_id, (num_of_options > 0? FSS_WRITE_LOG | FSS_WRITE_STDOUT: 0) | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+}
+
+// Returns 1 if job of directory info can start now, 0 if it must wait in the queue
+// Jobs of different files of a directory run at the same time, while jobs of the same file run
+// in the order they were queued. A full sync waits for the jobs queued before it and runs alone.
+// A job that can't start holds back the later jobs it must not be overtaken by in this pass.
+// batched is 1 if jobs of the directory have been collected in a batch that hasn't started yet
+int fss_can_start(struct job_info *job, struct sync_info_mem_store *info, struct worker_manager *worker_manager, int batched) {
+    int held_before = info->held_pass == current_shard->dispatch_pass;
+    int full_sync = sync_operation_whole_dir(job->operation) || job->sync_job;
+    int can_start;
+
+    if (full_sync)
+        can_start = info->num_of_workers == 0 && !held_before && !batched;
+    else
+        can_start = !info->barrier && !(held_before && info->held_full) && (info->num_of_workers == 0 || !worker_manager_file_busy(worker_manager, job->src_dir, job->file));
+
+    if (!can_start)
+        fss_hold(info, full_sync);
+
+    return can_start;
+}
+
+// Marks that a job of directory info was held back in this pass, and if it is a full sync, that
+// the later jobs of the directory must wait for it
+void fss_hold(struct sync_info_mem_store *info, int full_sync) {
+    if (info->held_pass != current_shard->dispatch_pass) info->held_full = 0;
+    info->held_pass = current_shard->dispatch_pass;
+    info->held_full |= full_sync;
+}
+
+// Sets up a worker for num_of_jobs jobs of directory job_dir, which is throttled with the limits of
+// the pair and hands back the jobs it doesn't start once the files of a batch add up to its byte limit.
+// The jobs belong to the worker, or are logged and freed if it can't be set up.
+// Returns 0 on success or if the worker failed, -1 if malloc fails
+int fss_start_jobs(struct job_info *jobs, int num_of_jobs, struct sync_info_mem_store *job_dir, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager) {
+    int snapshot_keep = job_dir->snapshot_interval >= 0? job_dir->snapshot_keep: 0;
+    NameFilter filter = jobs[0].operation == OP_FULL || jobs[0].operation == OP_MIRROR? job_dir->filter: NULL;
+    long long max_bytes = num_of_jobs > 1? __atomic_load_n(&batch_max_bytes, __ATOMIC_RELAXED): 0;
+    struct worker_options options = {snapshot_keep, job_dir->atomic, job_dir->durability, filter, fss_worker_timeout(jobs[0].operation), max_bytes};
+    pid_t worker_pid = worker_manager_setup_worker(worker_manager, jobs, num_of_jobs, &job_dir->throttle, &job_dir->throttle_slot, options);
+
+    // Add worker to directory and update info with the operation of its last job
+    if (worker_pid >= 0) {
+        file_monitor_set_working(file_monitor, job_dir->src_dir, jobs[num_of_jobs-1].operation);
+
+        // Worker takes a snapshot before a full sync, which changes the targets after it like any other job
+        enum sync_operation operation = jobs[0].operation;
+        if (operation == OP_SNAPSHOT || (snapshot_keep > 0 && (operation == OP_FULL || operation == OP_MIRROR)))
+            job_dir->last_snapshot_time = time(NULL);
+
+        job_dir->snapshot_changed = operation != OP_SNAPSHOT;
+        return 0;
+    }
+
+    // If worker is not set up, check error
+    if (worker_pid == -1) {
+        fss_free_jobs(jobs, num_of_jobs);
+        return -1;
+    }
+
+    int err = errno;
+    get_date_time(datetime, sizeof(datetime));
+    fss_join_targets(jobs[0].tar_dirs, jobs[0].num_of_targets, targets, sizeof(targets));
+
+    // Every job is logged like a job that failed on its own
+    for (int j = 0; j < num_of_jobs; j++) {
+        struct job_info *job = &jobs[j];
+
+        switch (worker_pid) {
+            case -2:
+                snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Pipe failed: %s]\n", datetime, job->src_dir, targets, sync_operation_name(job->operation), job->file, strerror(err));
+                break;
+            case -3:
+                snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Spawn failed: %s]\n", datetime, job->src_dir, targets, sync_operation_name(job->operation), job->file, strerror(err));
+                break;
+            case -4:
+                snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Pidfd_open failed: %s]\n", datetime, job->src_dir, targets, sync_operation_name(job->operation), job->file, strerror(err));
+                break;
+            case -5:
+                snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Epoll_ctl failed: %s]\n", datetime, job->src_dir, targets, sync_operation_name(job->operation), job->file, strerror(err));
+                break;
+            default:
+                snprintf(buffer, BUF_SIZE, "[%s] [%s] [%s] [None] [%s] [ERROR] [File: %s - Couldn't set up worker]\n", datetime, job->src_dir, targets, sync_operation_name(job->operation), job->file);
+                break;
+        }
+
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG);
+
+        if (job->sync_job) {
+            snprintf(buffer, BUF_SIZE, "Sync failed %s -> %s\n", job->src_dir, targets);
+            fss_report_sync_job(buffer, log_fd, job->sync_job);
+        }
+    }
+
+    fss_free_jobs(jobs, num_of_jobs);
+    return 0;
+}
+
+// Starts batch b of the num_of_batches batches and removes it from batches
+// Returns 0 on success or if the worker failed, -1 if malloc fails
+int fss_start_batch(struct fss_batch *batches, int *num_of_batches, int b, int log_fd, FileMonitor file_monitor, struct worker_manager *worker_manager) {
+    struct fss_batch batch = batches[b];
+    batches[b] = batches[--*num_of_batches];
+
+    return fss_start_jobs(batch.jobs, batch.num_of_jobs, batch.dir, log_fd, file_monitor, worker_manager);
+}
+
+// Returns milliseconds a worker of operation may go without progress before the watchdog kills it,
+// or 0 if workers are never killed. Every report and everything its pair takes from its bucket restarts
+// the time, so a copy of a large file that keeps going is never killed.
+// A worker of a whole directory gets more time, since unchanged files aren't taken from the bucket.
+long long fss_worker_timeout(enum sync_operation operation) {
+    long long timeout_ms = __atomic_load_n(&timeout_secs, __ATOMIC_RELAXED) * 1000LL;
+    return sync_operation_whole_dir(operation)? timeout_ms * TIMEOUT_DIR_FACTOR: timeout_ms;
+}
+
+// Kills the workers the watchdog finds without progress and logs them, their jobs get a TIMEOUT
+// result and are retried once the workers exit
+// *timeout is lowered to the milliseconds until the next worker would be overdue if that is sooner
+void fss_watchdog(int log_fd, struct worker_manager *worker_manager, int *timeout) {
+    int killed[worker_manager->worker_limit];
+    int num_killed = worker_manager_watchdog(worker_manager, killed, timeout);
+
+    for (int k = 0; k < num_killed; k++) {
+        struct job_info *job = &worker_manager->worker_jobs[killed[k]];
+        struct worker_slot *slot = &worker_manager->slots[killed[k]];
+
+        get_date_time(datetime, sizeof(datetime));
+        snprintf(buffer, BUF_SIZE, "[%s] Worker %d of %s made no progress for %lld s, killed (Jobs: %d, first: %s %s)\n", datetime, job->worker_pid, job->src_dir, (slot->timeout_ms + slot->size_ms) / 1000, slot->num_of_jobs, sync_operation_name(job->operation), job->file);
+        fss_log_event(buffer, log_fd, -1, FSS_WRITE_LOG | FSS_WRITE_STDOUT);
+    }
+}
+
+// Frees num_of_jobs jobs and their files
+void fss_free_jobs(struct job_info *jobs, int num_of_jobs) {
+    for (int j = 0; j < num_of_jobs; j++)
+        free(jobs[j].file);
+
+    free(jobs);
+}
+
+// Frees the jobs of num_of_batches batches that haven't started
+void fss_free_batches(struct fss_batch *batches, int num_of_batches) {
+    for (int b = 0; b < num_of_batches; b++)
+        fss_free_jobs(batches[b].jobs, batches[b].num_of_jobs);
+}
+
+// Queues a snapshot of every active pair whose periodic snapshot is due and whose targets have
+// changed since its last snapshot. Pairs are only checked every SNAPSHOT_CHECK_SECS seconds, and
+// *timeout is lowered to the milliseconds until the next check if it is later.
+// Returns number of snapshots queued, or -1 if malloc fails
+int fss_queue_snapshots(FileMonitor file_monitor, JobQueue job_queue, int *timeout) {
+    if (!__atomic_load_n(&periodic_snapshots, __ATOMIC_RELAXED)) return 0;
+
+    long long now = time(NULL);
+    int queued = 0;
+    long long *next_snapshot_check = &current_shard->next_snapshot_check;
+
+    if (now >= *next_snapshot_check) {
+        *next_snapshot_check = now + SNAPSHOT_CHECK_SECS;
+
+        for (struct sync_info_mem_store *info = file_monitor_next(file_monitor, NULL); info != NULL; info = file_monitor_next(file_monitor, info)) {
+            if (!info->active || info->snapshot_interval <= 0 || !info->snapshot_changed || now < info->last_snapshot_time + info->snapshot_interval * 60LL)
+                continue;
+
+            if (job_queue_enqueue(job_queue, info->src_dir, info->tar_dirs, info->num_of_targets, "ALL", OP_SNAPSHOT, 0) < 0)
+                return -1;
+
+            // The snapshot isn't queued again while it waits for the jobs before it
+            info->last_snapshot_time = now;
+            queued++;
+        }
+    }
+
+    int check_timeout = (*next_snapshot_check - now) * 1000;
+    if (*timeout < 0 || check_timeout < *timeout)
+        *timeout = check_timeout;
+
+    return queued;
+}
+
+// Queues a snapshot of the targets of src_dir_name, requested by console con_id
+// The response to the console ends when the snapshot is done
+void fss_snapshot(char *src_dir_name, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue) {
+    struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+    get_date_time(datetime, sizeof(datetime));
+
+    if (file_info == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (file_info->snapshot_interval < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Snapshots are not enabled for %s\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dirs, file_info->num_of_targets, "ALL", OP_SNAPSHOT, con_id) < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Unable to take snapshot of %s: %s\n", datetime, src_dir_name, strerror(errno));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    fss_join_targets(file_info->tar_dirs, file_info->num_of_targets, targets, sizeof(targets));
+    snprintf(buffer, BUF_SIZE, "[%s] Taking snapshot: %s -> %s\n", datetime, src_dir_name, targets);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    fss_add_pending(con_id, 1);
+}
+
+// Sends the snapshots of every target of src_dir_name to console con_id, oldest first
+void fss_list_snapshots(char *src_dir_name, int con_id, int log_fd, FileMonitor file_monitor) {
+    struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+    get_date_time(datetime, sizeof(datetime));
+
+    if (file_info == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    snprintf(buffer, BUF_SIZE, "[%s] Snapshots of %s\n", datetime, src_dir_name);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+
+    for (int t = 0; t < file_info->num_of_targets; t++) {
+        int dir_fd = open(file_info->tar_dirs[t], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct dir_list list;
+        int list_check = dir_fd < 0? -2: snapshot_list(dir_fd, &list);
+
+        if (dir_fd >= 0) close(dir_fd);
+
+        if (list_check < 0) {
+            snprintf(buffer, BUF_SIZE, "Target: %s (Snapshots can't be read: %s)\n", file_info->tar_dirs[t], list_check == -1? "Memory allocation failed": strerror(errno));
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+            continue;
+        }
+
+        snprintf(buffer, BUF_SIZE, "Target: %s (%zu snapshots)\n", file_info->tar_dirs[t], list.count);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+
+        // Names are sent in frames of up to BUF_SIZE bytes
+        size_t pos = 0;
+
+        for (size_t i = 0; i < list.count; i++) {
+            if (pos + strlen(list.entries[i].name) + 4 > BUF_SIZE) {
+                fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+                pos = 0;
+            }
+
+            pos += snprintf(buffer + pos, BUF_SIZE - pos, "  %s\n", list.entries[i].name);
+        }
+
+        if (pos > 0)
+            fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE);
+
+        dir_list_free(&list);
+    }
+
+    fss_log_event("", log_fd, con_id, FSS_WRITE_END);
+}
+
+// Queues restore of snapshot name to every target of src_dir_name, requested by console con_id
+// The directory must have been cancelled and have no jobs left, so that no job syncs the targets
+// while they are restored. The response to the console ends when the restore is done.
+void fss_restore(char *src_dir_name, char *name, int con_id, int log_fd, FileMonitor file_monitor, JobQueue job_queue) {
+    struct sync_info_mem_store *file_info = file_monitor_get_info(file_monitor, src_dir_name, 0);
+    get_date_time(datetime, sizeof(datetime));
+
+    if (file_info == NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Directory not monitored: %s\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (file_info->snapshot_interval < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Snapshots are not enabled for %s\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    // Names of snapshots never have a slash or start with a dot
+    if (name[0] == '.' || strchr(name, '/') != NULL) {
+        snprintf(buffer, BUF_SIZE, "[%s] Invalid snapshot name: %s\n", datetime, name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (file_info->active || file_info->num_of_workers > 0 || job_queue_dir_exists(job_queue, src_dir_name) || job_queue_dir_exists(current_shard->startup_queue, src_dir_name)) {
+        snprintf(buffer, BUF_SIZE, "[%s] Cancel %s and wait for its jobs to finish before restoring it\n", datetime, src_dir_name);
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    if (job_queue_enqueue(job_queue, file_info->src_dir, file_info->tar_dirs, file_info->num_of_targets, name, OP_RESTORE, con_id) < 0) {
+        snprintf(buffer, BUF_SIZE, "[%s] Unable to restore %s: %s\n", datetime, src_dir_name, strerror(errno));
+        fss_log_event(buffer, log_fd, con_id, FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE | FSS_WRITE_END);
+        return;
+    }
+
+    fss_join_targets(file_info->tar_dirs, file_info->num_of_targets, targets, sizeof(targets));
+    snprintf(buffer, BUF_SIZE, "[%s] Restoring snapshot %s: %s -> %s\n", datetime, name, src_dir_name, targets);
+    fss_log_event(buffer, log_fd, con_id, FSS_WRITE_LOG | FSS_WRITE_STDOUT | FSS_WRITE_CONSOLE);
+
+    fss_add_pending(con_id, 1);
+}
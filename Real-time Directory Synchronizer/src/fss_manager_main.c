@@ -14,7 +14,10 @@
 #include "../include/util.h"
 #include "../include/fss_manager.h"
 
-#define WORKER_LIMIT_DEFAULT 5
+#define WORKER_LIMIT_DEFAULT 16   // Default maximum number of workers
+#define WORKER_MIN_DEFAULT 1      // Default minimum number of workers
+#define WORKER_START_DEFAULT 5    // Number of workers allowed at startup, before any adjustments
+#define SHARDS_DEFAULT_MAX 8      // Most event-loop threads started by default, one per online CPU
 #define BUF_SIZE 1024
 #define DIR_NAME_SIZE 256
 #define MIN_CONFIG_LINE_LENGTH 6
@@ -25,19 +28,19 @@
 
 extern char *optarg;
 
-char *fss_in = "fss_in";
-char *fss_out = "fss_out";
-
-void sigchld_handler(int signum);
+char *fss_socket = "fss_socket";
 
 int main(int argc, char *argv[]) {
     char *logfile_name = NULL;
     char *config_name = NULL;
+    char *event_log_name = NULL;
     int worker_limit = -1;
+    int worker_min = -1;
+    int num_of_shards = -1;
    
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "l:c:n:")) != -1) {
+    while ((opt = getopt(argc, argv, "l:c:n:m:e:s:")) != -1) {
         switch(opt) {
             case 'l':
                 logfile_name = optarg;
@@ -48,8 +51,17 @@ int main(int argc, char *argv[]) {
             case 'n':
                 worker_limit = atoi(optarg);
                 break;
+            case 'm':
+                worker_min = atoi(optarg);
+                break;
+            case 'e':
+                event_log_name = optarg;
+                break;
+            case 's':
+                num_of_shards = atoi(optarg);
+                break;
             default:
-                fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n <worker_limit>]\n", argv[0]);
+                fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n <worker_limit>] [-m <min_workers>] [-e <event_log>] [-s <threads>]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -58,8 +70,25 @@ int main(int argc, char *argv[]) {
         worker_limit = WORKER_LIMIT_DEFAULT;
     }
 
+    if (worker_min <= 0) {
+        worker_min = WORKER_MIN_DEFAULT;
+    }
+
+    if (worker_min > worker_limit) {
+        worker_min = worker_limit;
+    }
+
+    if (num_of_shards <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_of_shards = cpus <= 0? 1: cpus > SHARDS_DEFAULT_MAX? SHARDS_DEFAULT_MAX: cpus;
+    }
+
+    if (num_of_shards > WORKER_SHARDS_MAX) {
+        num_of_shards = WORKER_SHARDS_MAX;
+    }
+
     if (logfile_name == NULL || config_name == NULL) {
-        fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n <worker_limit>]\n", argv[0]);
+        fprintf(stderr, "Usage: %s -l <manager_logfile> -c <config_file> [-n <worker_limit>] [-m <min_workers>] [-e <event_log>] [-s <threads>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -80,100 +109,85 @@ int main(int argc, char *argv[]) {
     if (config_file == NULL) {
         get_date_time(datetime, sizeof(datetime));
         snprintf(buffer, BUF_SIZE, "[%s] Failed to open %s: %s\n", datetime, config_name, strerror(errno));
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, NULL,  NULL, NULL, NULL, -1, -1, 1);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, NULL, NULL);
         exit(EXIT_FAILURE);
     }
 
-    // Create named pipes for communication with console
-    unlink(fss_in); unlink(fss_out);
-    
-    if (mkfifo(fss_in, 0644) < 0) {
-        get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Named pipe \"%s\" failed: %s\n", datetime, fss_in, strerror(errno));
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  NULL, NULL, NULL, -1, -1, 1);
-        exit(EXIT_FAILURE);
-    }
+    // Create socket for communication with consoles
+    ConsoleServer console_server = console_server_init(fss_socket);
 
-    if (mkfifo(fss_out, 0644) < 0) {
+    if (console_server == NULL) {
         get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Named pipe \"%s\" failed: %s\n", datetime, fss_out, strerror(errno));
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  NULL, NULL, NULL, -1, -1, 1);
-        unlink(fss_in);
+        snprintf(buffer, BUF_SIZE, "[%s] Console socket \"%s\" failed: %s\n", datetime, fss_socket, strerror(errno));
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, NULL);
         exit(EXIT_FAILURE);
     }
 
-    int fss_in_fd = open(fss_in, O_RDWR);
+    // Workers are reaped by the manager through their process file descriptors, so SIGCHLD
+    // keeps its default action and no child is reaped before the manager reads its exit status
+    // A console that disconnects must not terminate the manager
+    signal(SIGPIPE, SIG_IGN);
 
-    if (fss_in_fd < 0) {
-        get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Open failed for named pipe \"%s\": %s\n", datetime, fss_in, strerror(errno));
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  NULL, NULL, NULL, -1, -1, 1);
-        unlink(fss_in); unlink(fss_out);
-        exit(EXIT_FAILURE);
-    }
+    // Initialize the budget of workers that all threads share
+    struct worker_pool worker_pool;
+    int err_check = worker_pool_init(&worker_pool, worker_min, worker_limit, WORKER_START_DEFAULT, num_of_shards);
 
-    int fss_out_fd = open(fss_out, O_RDWR);
-
-    if (fss_out_fd < 0) {
+    if (err_check < 0) {
         get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Open failed for named pipe \"%s\": %s\n", datetime, fss_out, strerror(errno));
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  NULL, NULL, NULL, fss_in_fd, -1, 1);
-        unlink(fss_in); unlink(fss_out);
-        exit(EXIT_FAILURE);
-    }
-
-    // Set signal handler
-    struct sigaction act;
-    act.sa_handler = sigchld_handler;
-    sigfillset(&(act.sa_mask));
-    act.sa_flags = SA_RESTART;
-    sigaction(SIGCHLD, &act, NULL);
-
-    // Initialize job queue
-    JobQueue job_queue = job_queue_init();
 
-    // Intialize file monitor
-    FileMonitor file_monitor = file_monitor_init();
+        if (err_check == -4)
+            snprintf(buffer, BUF_SIZE, "[%s] Shared memory for throttling failed: %s\n", datetime, strerror(errno));
+        else
+            snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
 
-    if (job_queue == NULL || file_monitor == NULL) {
-        get_date_time(datetime, sizeof(datetime));
-        snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, NULL, fss_in_fd, fss_out_fd, 1);
-        unlink(fss_in); unlink(fss_out);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
         exit(EXIT_FAILURE);
     }
 
-    // Initialize worker manager
-    struct worker_manager worker_manager;
-    int err_check = worker_manager_init(&worker_manager, worker_limit, fss_in_fd);
+    // Initialize the file monitor, job queue and worker manager of every thread
+    err_check = fss_init_shards(num_of_shards, &worker_pool, console_server);
 
     if (err_check < 0) {
         get_date_time(datetime, sizeof(datetime));
 
         if (err_check == -2)
             snprintf(buffer, BUF_SIZE, "[%s] inotify_init failed: %s\n", datetime, strerror(errno));
+        else if (err_check == -3)
+            snprintf(buffer, BUF_SIZE, "[%s] epoll failed: %s\n", datetime, strerror(errno));
+        else if (err_check == -4)
+            snprintf(buffer, BUF_SIZE, "[%s] Shared memory for throttling failed: %s\n", datetime, strerror(errno));
+        else if (err_check == -5)
+            snprintf(buffer, BUF_SIZE, "[%s] Unable to open worker executable: %s\n", datetime, strerror(errno));
+        else if (err_check == -6)
+            snprintf(buffer, BUF_SIZE, "[%s] Eventfd failed: %s\n", datetime, strerror(errno));
         else
             snprintf(buffer, BUF_SIZE, "[%s] Memory allocation failed\n", datetime);
 
-        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file,  file_monitor, job_queue, NULL, fss_in_fd, fss_out_fd, 1);
-        unlink(fss_in); unlink(fss_out);
+        fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
         exit(EXIT_FAILURE);
     }
 
+    // Open binary log of the results of jobs, which is appended to
+    if (event_log_name != NULL) {
+        int event_log_fd = open(event_log_name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        EventLog event_log = event_log_fd < 0? NULL: event_log_init(event_log_fd);
+
+        if (event_log == NULL) {
+            get_date_time(datetime, sizeof(datetime));
+            snprintf(buffer, BUF_SIZE, "[%s] Failed to open event log %s: %s\n", datetime, event_log_name, strerror(errno));
+            if (event_log_fd >= 0) close(event_log_fd);
+            fss_abrupt_shutdown(buffer, BUF_SIZE, log_fd, config_file, console_server);
+            exit(EXIT_FAILURE);
+        }
+
+        fss_use_event_log(event_log);
+    }
+
     // Get directory pairs from config file and start monitoring them
-    if (fss_read_config_file(config_file, log_fd, job_queue, file_monitor, &worker_manager, fss_in_fd, fss_out_fd) < 0) {
-        unlink(fss_in); unlink(fss_out);
+    if (fss_read_config_file(config_file, config_name, log_fd, console_server) < 0) {
         exit(EXIT_FAILURE);
     }
 
     // Run manager
-    fss_manager_run(log_fd, config_file, file_monitor, job_queue, &worker_manager, fss_in_fd, fss_out_fd);
-    
-    unlink(fss_in);
-    unlink(fss_out);
-}
-
-// Handler for SIGCHLD
-void sigchld_handler(int signum) {
-    while (waitpid(-1, NULL, WNOHANG) > 0);
+    fss_manager_run(log_fd, config_file, console_server);
 }
\ No newline at end of file
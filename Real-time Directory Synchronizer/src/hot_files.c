@@ -0,0 +1,388 @@
+#include <string.h>
+#include <time.h>
+#include "../include/util.h"
+#include "../include/job_queue.h"
+#include "../include/hot_files.h"
+
+#define BUCKETS_DEFAULT 64    // Initial number of buckets of the hash table
+#define PRUNE_MIN 1024        // Files are never pruned while there are fewer than this
+
+// A file that had a job queued recently
+struct hot_file {
+    char *src_dir;
+    char **tar_dirs;
+    int num_of_targets;
+    char *file;
+    long long window_ms;
+    long long last_ms;        // Time the last job of the file was queued
+    long long due_ms;         // Time the deferred job is queued, 0 if no job is deferred
+    enum sync_operation operation;  // Operation of deferred job
+    struct hot_file *next;    // Next file in the same bucket
+};
+
+// Files are found by directory and name with a hash table
+// Deferred files are also kept in a binary min-heap by due time, so that the next due job is
+// found without going through all deferred files every time the manager waits for events
+struct hot_files {
+    struct hot_file **table;
+    size_t num_of_buckets;
+    size_t size;
+    struct hot_file **deferred;
+    size_t num_of_deferred;
+    size_t deferred_size;
+    size_t prune_at;          // Size at which files whose window has passed are removed
+};
+
+long long hot_files_now(void);
+size_t hot_files_hash(char *src_dir, char *file);
+struct hot_file *hot_files_find(HotFiles hot, char *src_dir, char *file);
+struct hot_file *hot_files_add(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, long long window_ms, long long now);
+int hot_files_defer(HotFiles hot, struct hot_file *entry, enum sync_operation operation);
+void hot_files_undefer(HotFiles hot, size_t index);
+void hot_files_sift_up(HotFiles hot, size_t index);
+void hot_files_sift_down(HotFiles hot, size_t index);
+int hot_files_resize(HotFiles hot);
+void hot_files_prune(HotFiles hot, long long now);
+
+HotFiles hot_files_init(void) {
+    HotFiles hot = malloc(sizeof(struct hot_files));
+    if (hot == NULL) return NULL;
+
+    hot->table = calloc(BUCKETS_DEFAULT, sizeof(struct hot_file *));
+
+    if (hot->table == NULL) {
+        free(hot); return NULL;
+    }
+
+    hot->num_of_buckets = BUCKETS_DEFAULT;
+    hot->size = 0;
+    hot->deferred = NULL;
+    hot->num_of_deferred = hot->deferred_size = 0;
+    hot->prune_at = PRUNE_MIN;
+    return hot;
+}
+
+int hot_files_check(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, long long window_ms) {
+    if (window_ms <= 0) return 0;
+
+    long long now = hot_files_now();
+    struct hot_file *entry = hot_files_find(hot, src_dir, file);
+
+    if (entry != NULL) {
+        // A deferred job takes the event in
+        if (entry->due_ms != 0) {
+            // A copy of the data also copies metadata, anything else is replaced by the newer event
+            if (!(operation == OP_ATTRIB && (entry->operation == OP_ADDED || entry->operation == OP_MODIFIED)))
+                entry->operation = operation;
+
+            return 1;
+        }
+
+        // File had a job less than a window ago
+        if (now < entry->last_ms + entry->window_ms) {
+            entry->window_ms = window_ms;
+            entry->due_ms = entry->last_ms + window_ms;
+            return hot_files_defer(hot, entry, operation) < 0? -1: 1;
+        }
+
+        entry->last_ms = now;
+        entry->window_ms = window_ms;
+        return 0;
+    }
+
+    // Start the window of file
+    return hot_files_add(hot, src_dir, tar_dirs, num_of_targets, file, window_ms, now) == NULL? -1: 0;
+}
+
+int hot_files_retry(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, long long delay_ms) {
+    long long now = hot_files_now();
+    struct hot_file *entry = hot_files_find(hot, src_dir, file);
+
+    if (entry == NULL) {
+        entry = hot_files_add(hot, src_dir, tar_dirs, num_of_targets, file, 0, now);
+        if (entry == NULL) return -1;
+    }
+
+    // A deferred job of a later event syncs the file anyway, it only has to copy data if the retry does
+    if (entry->due_ms != 0) {
+        if (entry->operation == OP_ATTRIB && (operation == OP_ADDED || operation == OP_MODIFIED))
+            entry->operation = operation;
+
+        return 0;
+    }
+
+    entry->due_ms = now + delay_ms;
+    return hot_files_defer(hot, entry, operation);
+}
+
+int hot_files_release(HotFiles hot, JobQueue queue, int all) {
+    if (hot->num_of_deferred == 0) return 0;
+
+    long long now = hot_files_now();
+    int released = 0;
+
+    // Jobs are released in order of due time, so the first job that isn't due ends the release
+    while (hot->num_of_deferred > 0 && (all || hot->deferred[0]->due_ms <= now)) {
+        struct hot_file *entry = hot->deferred[0];
+
+        if (job_queue_enqueue(queue, entry->src_dir, entry->tar_dirs, entry->num_of_targets, entry->file, entry->operation, 0) < 0)
+            return -1;
+
+        // The released job starts the next window of the file
+        entry->last_ms = now;
+        hot_files_undefer(hot, 0);
+        released++;
+    }
+
+    return released;
+}
+
+int hot_files_timeout(HotFiles hot) {
+    if (hot->num_of_deferred == 0) return -1;
+
+    long long timeout = hot->deferred[0]->due_ms - hot_files_now();
+    return timeout < 0? 0: timeout;
+}
+
+size_t hot_files_deferred(HotFiles hot, char *src_dir) {
+    if (src_dir == NULL) return hot->num_of_deferred;
+
+    size_t count = 0;
+    for (size_t d = 0; d < hot->num_of_deferred; d++) {
+        if (!strcmp(hot->deferred[d]->src_dir, src_dir))
+            count++;
+    }
+
+    return count;
+}
+
+void hot_files_remove_dir(HotFiles hot, char *src_dir) {
+    size_t kept = 0;
+
+    // Keep deferred files of other directories and restore the heap order among them
+    for (size_t d = 0; d < hot->num_of_deferred; d++) {
+        if (!strcmp(hot->deferred[d]->src_dir, src_dir))
+            hot->deferred[d]->due_ms = 0;
+        else
+            hot->deferred[kept++] = hot->deferred[d];
+    }
+
+    hot->num_of_deferred = kept;
+    for (size_t d = kept / 2; d > 0; d--)
+        hot_files_sift_down(hot, d - 1);
+
+    for (size_t b = 0; b < hot->num_of_buckets; b++) {
+        struct hot_file **link = &hot->table[b];
+
+        while (*link != NULL) {
+            struct hot_file *entry = *link;
+
+            if (!strcmp(entry->src_dir, src_dir)) {
+                *link = entry->next;
+                free(entry->file); free(entry);
+                hot->size--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+void hot_files_destroy(HotFiles hot) {
+    for (size_t b = 0; b < hot->num_of_buckets; b++) {
+        struct hot_file *entry = hot->table[b];
+
+        while (entry != NULL) {
+            struct hot_file *next = entry->next;
+            free(entry->file); free(entry);
+            entry = next;
+        }
+    }
+
+    free(hot->table);
+    free(hot->deferred);
+    free(hot);
+}
+
+// Returns CLOCK_MONOTONIC time in milliseconds
+long long hot_files_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Returns FNV-1a hash of src_dir and file
+size_t hot_files_hash(char *src_dir, char *file) {
+    size_t hash = 14695981039346656037ULL;
+
+    for (unsigned char *c = (unsigned char *) src_dir; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= '/';
+    hash *= 1099511628211ULL;
+
+    for (unsigned char *c = (unsigned char *) file; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Returns entry of file of src_dir, or NULL if it had no job recently
+struct hot_file *hot_files_find(HotFiles hot, char *src_dir, char *file) {
+    for (struct hot_file *entry = hot->table[hot_files_hash(src_dir, file) % hot->num_of_buckets]; entry != NULL; entry = entry->next) {
+        if (!strcmp(entry->file, file) && !strcmp(entry->src_dir, src_dir))
+            return entry;
+    }
+
+    return NULL;
+}
+
+// Adds file of src_dir, whose window of window_ms starts at time now, to the hash table
+// Returns the new entry, or NULL if malloc fails
+struct hot_file *hot_files_add(HotFiles hot, char *src_dir, char **tar_dirs, int num_of_targets, char *file, long long window_ms, long long now) {
+    // Remove files that have been quiet for a whole window before the table grows
+    if (hot->size >= hot->prune_at) {
+        hot_files_prune(hot, now);
+        hot->prune_at = 2 * hot->size > PRUNE_MIN? 2 * hot->size: PRUNE_MIN;
+    }
+
+    if (hot->size >= hot->num_of_buckets && hot_files_resize(hot) < 0)
+        return NULL;
+
+    struct hot_file *entry = malloc(sizeof(struct hot_file));
+    if (entry == NULL) return NULL;
+
+    entry->file = malloc((strlen(file)+1) * sizeof(char));
+
+    if (entry->file == NULL) {
+        free(entry); return NULL;
+    }
+
+    strcpy(entry->file, file);
+    entry->src_dir = src_dir;
+    entry->tar_dirs = tar_dirs;
+    entry->num_of_targets = num_of_targets;
+    entry->window_ms = window_ms;
+    entry->last_ms = now;
+    entry->due_ms = 0;
+
+    size_t bucket = hot_files_hash(src_dir, file) % hot->num_of_buckets;
+    entry->next = hot->table[bucket];
+    hot->table[bucket] = entry;
+    hot->size++;
+
+    return entry;
+}
+
+// Adds entry, whose due time is set, to deferred files with operation
+// Returns -1 if malloc fails, 0 otherwise
+int hot_files_defer(HotFiles hot, struct hot_file *entry, enum sync_operation operation) {
+    if (hot->num_of_deferred == hot->deferred_size) {
+        size_t size = hot->deferred_size == 0? 16: 2 * hot->deferred_size;
+        struct hot_file **deferred = realloc(hot->deferred, size * sizeof(struct hot_file *));
+
+        if (deferred == NULL) {
+            entry->due_ms = 0;
+            return -1;
+        }
+
+        hot->deferred = deferred;
+        hot->deferred_size = size;
+    }
+
+    entry->operation = operation;
+    hot->deferred[hot->num_of_deferred++] = entry;
+    hot_files_sift_up(hot, hot->num_of_deferred - 1);
+    return 0;
+}
+
+// Removes deferred file at index of the heap, the last deferred file takes its place
+void hot_files_undefer(HotFiles hot, size_t index) {
+    hot->deferred[index]->due_ms = 0;
+
+    if (index == --hot->num_of_deferred) return;
+
+    hot->deferred[index] = hot->deferred[hot->num_of_deferred];
+    hot_files_sift_down(hot, index);
+    hot_files_sift_up(hot, index);
+}
+
+// Moves deferred file at index towards the root while it is due before its parent
+void hot_files_sift_up(HotFiles hot, size_t index) {
+    struct hot_file *entry = hot->deferred[index];
+
+    while (index > 0 && entry->due_ms < hot->deferred[(index-1) / 2]->due_ms) {
+        hot->deferred[index] = hot->deferred[(index-1) / 2];
+        index = (index-1) / 2;
+    }
+
+    hot->deferred[index] = entry;
+}
+
+// Moves deferred file at index away from the root while a child is due before it
+void hot_files_sift_down(HotFiles hot, size_t index) {
+    struct hot_file *entry = hot->deferred[index];
+
+    while (2*index + 1 < hot->num_of_deferred) {
+        size_t child = 2*index + 1;
+
+        if (child + 1 < hot->num_of_deferred && hot->deferred[child+1]->due_ms < hot->deferred[child]->due_ms)
+            child++;
+
+        if (hot->deferred[child]->due_ms >= entry->due_ms) break;
+
+        hot->deferred[index] = hot->deferred[child];
+        index = child;
+    }
+
+    hot->deferred[index] = entry;
+}
+
+// Doubles the number of buckets of the hash table and adds all files to it again
+// Returns -1 if malloc fails, 0 otherwise
+int hot_files_resize(HotFiles hot) {
+    size_t num_of_buckets = 2 * hot->num_of_buckets;
+    struct hot_file **table = calloc(num_of_buckets, sizeof(struct hot_file *));
+    if (table == NULL) return -1;
+
+    for (size_t b = 0; b < hot->num_of_buckets; b++) {
+        struct hot_file *entry = hot->table[b];
+
+        while (entry != NULL) {
+            struct hot_file *next = entry->next;
+            size_t bucket = hot_files_hash(entry->src_dir, entry->file) % num_of_buckets;
+
+            entry->next = table[bucket];
+            table[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(hot->table);
+    hot->table = table;
+    hot->num_of_buckets = num_of_buckets;
+    return 0;
+}
+
+// Removes files without a deferred job whose window has passed at time now
+void hot_files_prune(HotFiles hot, long long now) {
+    for (size_t b = 0; b < hot->num_of_buckets; b++) {
+        struct hot_file **link = &hot->table[b];
+
+        while (*link != NULL) {
+            struct hot_file *entry = *link;
+
+            if (entry->due_ms == 0 && now >= entry->last_ms + entry->window_ms) {
+                *link = entry->next;
+                free(entry->file); free(entry);
+                hot->size--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
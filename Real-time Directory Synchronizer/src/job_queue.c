@@ -1,4 +1,5 @@
 #include <string.h>
+#include "../include/util.h"
 #include "../include/job_queue.h"
 
 typedef struct node *Node;
@@ -29,47 +30,25 @@ size_t job_queue_size(JobQueue queue) {
     return queue->size;
 }
 
-int job_queue_enqueue(JobQueue queue, char *src_dir, char *tar_dir, char *file, char *operation, int sync_job) {
+int job_queue_enqueue(JobQueue queue, char *src_dir, char **tar_dirs, int num_of_targets, char *file, enum sync_operation operation, int sync_job) {
 
     // Allocate memory for node
     Node node = malloc(sizeof(struct node));
     if (node == NULL) return -1;
 
-    node->job.src_dir = malloc((strlen(src_dir)+1) * sizeof(char));
-
-    if (node->job.src_dir == NULL) {
-        free(node); return -1;
-    }
-
-    node->job.tar_dir = malloc((strlen(tar_dir)+1) * sizeof(char));
-
-    if (node->job.tar_dir == NULL) {
-        free(node->job.src_dir); free(node);
-        return -1;
-    }
-
-    
     node->job.file = malloc((strlen(file)+1) * sizeof(char));
 
     if (node->job.file == NULL) {
-        free(node->job.src_dir); free(node->job.tar_dir);
-        free(node);
-        return -1;
-    }
-
-    node->job.operation = malloc((strlen(operation)+1) * sizeof(char));
-
-    if (node->job.operation == NULL) {
-        free(node->job.src_dir); free(node->job.tar_dir); free(node->job.file);
-        free(node); 
-        return -1;
+        free(node); return -1;
     }
 
-    strcpy(node->job.src_dir, src_dir);
-    strcpy(node->job.tar_dir, tar_dir);
+    // Directories belong to the file monitor, so only pointers to them are kept
+    node->job.src_dir = src_dir;
+    node->job.tar_dirs = tar_dirs;
+    node->job.operation = operation;
     strcpy(node->job.file, file);
-    strcpy(node->job.operation, operation);
 
+    node->job.num_of_targets = num_of_targets;
     node->job.worker_pid = -1;
     node->job.sync_job = sync_job;
     node->next = NULL;
@@ -91,8 +70,9 @@ int job_queue_dequeue(JobQueue queue, struct job_info *job) {
     if (queue->size == 0) {
         job->file = NULL;
         job->src_dir = NULL;
-        job->tar_dir = NULL;
-        job->operation = NULL;
+        job->tar_dirs = NULL;
+        job->num_of_targets = 0;
+        job->operation = OP_NONE;
         job->worker_pid = 0;
         job->sync_job = 0;
         return 0;
@@ -102,47 +82,64 @@ int job_queue_dequeue(JobQueue queue, struct job_info *job) {
     queue->head = queue->head->next;
     queue->size--;
 
-    // Allocate memory for job
     if (queue->size == 0) queue->tail = NULL;
 
-    job->file = malloc((strlen(old_head->job.file)+1) * sizeof(char));
+    // Move job info, its memory now belongs to job
+    *job = old_head->job;
 
-    if (job->file == NULL) {
-        return -1;
-    }
+    free(old_head);
+    return 0;
+}
 
-    job->src_dir = malloc((strlen(old_head->job.src_dir)+1) * sizeof(char));
+void job_queue_append(JobQueue queue, JobQueue other) {
+    if (other->size == 0)
+        return;
 
-    if (job->src_dir == NULL) {
-        free(job->file); return -1;
+    if (queue->size == 0) {
+        queue->head = other->head;
+    } else {
+        queue->tail->next = other->head;
     }
 
-    job->tar_dir = malloc((strlen(old_head->job.tar_dir)+1) * sizeof(char));
+    queue->tail = other->tail;
+    queue->size += other->size;
 
-    if (job->tar_dir == NULL) {
-        free(job->file); free(job->src_dir);
-        return -1;
-    }
+    other->head = other->tail = NULL;
+    other->size = 0;
+}
+
+void job_queue_move(JobQueue queue, JobQueue other, size_t count) {
+    if (count > other->size) count = other->size;
+    if (count == 0) return;
 
-    job->operation = malloc((strlen(old_head->job.operation)+1) * sizeof(char));
+    // Find last job that is moved
+    Node last = other->head;
+    for (size_t i = 1; i < count; i++)
+        last = last->next;
 
-    if (job->operation == NULL) {
-        free(job->file); free(job->src_dir); free(job->tar_dir);
-        return -1;
+    if (queue->size == 0) {
+        queue->head = other->head;
+    } else {
+        queue->tail->next = other->head;
     }
 
-    // Copy job info
-    strcpy(job->file, old_head->job.file);
-    strcpy(job->src_dir, old_head->job.src_dir);
-    strcpy(job->tar_dir, old_head->job.tar_dir);
-    strcpy(job->operation, old_head->job.operation);
-    job->worker_pid = old_head->job.worker_pid;
-    job->sync_job = old_head->job.sync_job;
+    queue->tail = last;
+    queue->size += count;
 
-    // Free old memory
-    free(old_head->job.file); free(old_head->job.src_dir); free(old_head->job.tar_dir); free(old_head->job.operation);
-    free(old_head);
-    return 0;
+    other->head = last->next;
+    other->size -= count;
+    if (other->size == 0) other->tail = NULL;
+
+    last->next = NULL;
+}
+
+size_t job_queue_get_dirs(JobQueue queue, char **dirs) {
+    size_t count = 0;
+
+    for (Node cur_node = queue->head; cur_node != NULL; cur_node = cur_node->next)
+        dirs[count++] = cur_node->job.src_dir;
+
+    return count;
 }
 
 int job_queue_dir_exists(JobQueue queue, char *dir) {
@@ -168,7 +165,7 @@ void job_queue_remove_dir(JobQueue queue, char *dir) {
     while (!strcmp(queue->head->job.src_dir, dir)) {
         queue->head = queue->head->next;
 
-        free(cur_node->job.file); free(cur_node->job.src_dir); free(cur_node->job.tar_dir); free(cur_node->job.operation);
+        free(cur_node->job.file);
         free(cur_node);
 
         queue->size--;
@@ -188,14 +185,14 @@ void job_queue_remove_dir(JobQueue queue, char *dir) {
         if (!strcmp(cur_node->job.src_dir, dir)) {
             prev_node->next = cur_node->next;
 
-            free(cur_node->job.file); free(cur_node->job.src_dir); free(cur_node->job.tar_dir); free(cur_node->job.operation);
+            free(cur_node->job.file);
             free(cur_node);
 
             queue->size--;
             cur_node = prev_node->next;
 
             if (cur_node == NULL) {
-                queue->tail = NULL;
+                queue->tail = prev_node;
             }
 
         } else {
@@ -204,6 +201,15 @@ void job_queue_remove_dir(JobQueue queue, char *dir) {
     }
 }
 
+size_t job_queue_memory(JobQueue queue) {
+    size_t memory = sizeof(struct job_queue);
+
+    for (Node cur_node = queue->head; cur_node != NULL; cur_node = cur_node->next)
+        memory += sizeof(struct node) + strlen(cur_node->job.file) + 1;
+
+    return memory;
+}
+
 void job_queue_destroy(JobQueue queue) {
 
     Node node = queue->head;
@@ -211,7 +217,7 @@ void job_queue_destroy(JobQueue queue) {
     for (size_t i = 0; i < queue->size; i++) {
         Node next_node = node->next;
 
-        free(node->job.file); free(node->job.src_dir); free(node->job.tar_dir); free(node->job.operation);
+        free(node->job.file);
         free(node);
 
         node = next_node;
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include "../include/util.h"
+#include "../include/mailbox.h"
+
+// Messages are a linked list from the oldest to the newest. Senders exchange the newest message,
+// then link it to the one before it, and the owner takes messages from the oldest end. The stub
+// stays in the list while it is empty, so a sender never has to touch the oldest end.
+struct mailbox {
+    struct mailbox_message *newest;   // Exchanged by senders
+    struct mailbox_message *oldest;   // Only used by the owner
+    struct mailbox_message stub;
+    int fd;
+    int signalled;                    // 1 if the eventfd was written since the owner last cleared it
+};
+
+void mailbox_push(Mailbox mailbox, struct mailbox_message *message);
+
+Mailbox mailbox_init(void) {
+    Mailbox mailbox = malloc(sizeof(struct mailbox));
+    if (mailbox == NULL) return NULL;
+
+    mailbox->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (mailbox->fd < 0) {
+        int err = errno;
+        free(mailbox);
+        errno = err;
+        return NULL;
+    }
+
+    mailbox->stub.next = NULL;
+    mailbox->newest = &mailbox->stub;
+    mailbox->oldest = &mailbox->stub;
+    mailbox->signalled = 0;
+
+    return mailbox;
+}
+
+int mailbox_fd(Mailbox mailbox) {
+    return mailbox->fd;
+}
+
+void mailbox_send(Mailbox mailbox, struct mailbox_message *message) {
+    mailbox_push(mailbox, message);
+
+    // Only the first message since the owner cleared the eventfd writes it, the owner takes out
+    // every message that was linked before it cleared the eventfd
+    if (!__atomic_exchange_n(&mailbox->signalled, 1, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        write_bytes(mailbox->fd, (char *) &one, sizeof(one));
+    }
+}
+
+void mailbox_clear(Mailbox mailbox) {
+    uint64_t count;
+
+    while (read(mailbox->fd, &count, sizeof(count)) < 0 && errno == EINTR);
+    __atomic_store_n(&mailbox->signalled, 0, __ATOMIC_SEQ_CST);
+}
+
+struct mailbox_message *mailbox_receive(Mailbox mailbox) {
+    struct mailbox_message *oldest = mailbox->oldest;
+    struct mailbox_message *next = __atomic_load_n(&oldest->next, __ATOMIC_ACQUIRE);
+
+    // Skip the stub
+    if (oldest == &mailbox->stub) {
+        if (next == NULL) return NULL;
+
+        mailbox->oldest = next;
+        oldest = next;
+        next = __atomic_load_n(&oldest->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL) {
+        mailbox->oldest = next;
+        return oldest;
+    }
+
+    // A sender has exchanged a newer message but not linked it yet, it is taken out once it is
+    // linked, and the sender writes the eventfd after that if it has been cleared
+    if (oldest != __atomic_load_n(&mailbox->newest, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    // The last message can only be taken out once another one follows it, so put the stub back
+    mailbox_push(mailbox, &mailbox->stub);
+    next = __atomic_load_n(&oldest->next, __ATOMIC_ACQUIRE);
+
+    if (next != NULL) {
+        mailbox->oldest = next;
+        return oldest;
+    }
+
+    return NULL;
+}
+
+void mailbox_destroy(Mailbox mailbox) {
+    close(mailbox->fd);
+    free(mailbox);
+}
+
+// Links message in as the newest message of mailbox
+void mailbox_push(Mailbox mailbox, struct mailbox_message *message) {
+    __atomic_store_n(&message->next, NULL, __ATOMIC_RELAXED);
+
+    struct mailbox_message *previous = __atomic_exchange_n(&mailbox->newest, message, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&previous->next, message, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "../include/name_filter.h"
+
+#define NAME_FILTER_SIZE_DEFAULT 4
+
+// Forms of patterns that are matched without fnmatch
+enum name_rule_type {RULE_LITERAL, RULE_PREFIX, RULE_SUFFIX, RULE_CONTAINS, RULE_ANY, RULE_GLOB};
+
+struct name_rule {
+    char *pattern;
+    char *part;              // Literal part of a pattern that is not a glob, points into pattern
+    size_t part_len;
+    unsigned char type;      // An enum name_rule_type
+    unsigned char include;
+};
+
+struct name_filter {
+    struct name_rule *rules;
+    int size;
+    int capacity;
+    int num_of_includes;
+};
+
+void name_filter_compile(struct name_rule *rule);
+int name_filter_rule_match(struct name_rule *rule, const char *name, size_t name_len);
+
+NameFilter name_filter_init(void) {
+    NameFilter filter = malloc(sizeof(struct name_filter));
+    if (filter == NULL) return NULL;
+
+    filter->rules = malloc(NAME_FILTER_SIZE_DEFAULT * sizeof(struct name_rule));
+    if (filter->rules == NULL) {
+        free(filter); return NULL;
+    }
+
+    filter->size = 0;
+    filter->capacity = NAME_FILTER_SIZE_DEFAULT;
+    filter->num_of_includes = 0;
+    return filter;
+}
+
+int name_filter_add(NameFilter filter, char *pattern, int include) {
+    if (pattern[0] == '\0') return -2;
+
+    if (filter->size == filter->capacity) {
+        struct name_rule *new_rules = realloc(filter->rules, 2 * filter->capacity * sizeof(struct name_rule));
+        if (new_rules == NULL) return -1;
+
+        filter->rules = new_rules;
+        filter->capacity *= 2;
+    }
+
+    struct name_rule *rule = &filter->rules[filter->size];
+    rule->pattern = malloc(strlen(pattern) + 1);
+    if (rule->pattern == NULL) return -1;
+
+    strcpy(rule->pattern, pattern);
+    rule->include = include != 0;
+    name_filter_compile(rule);
+
+    filter->size++;
+    filter->num_of_includes += rule->include;
+    return 0;
+}
+
+int name_filter_add_list(NameFilter filter, char *list, int include) {
+    char *start = list;
+
+    while (1) {
+        size_t len = strcspn(start, ",");
+        char pattern[len + 1];
+
+        memcpy(pattern, start, len);
+        pattern[len] = '\0';
+
+        int result = name_filter_add(filter, pattern, include);
+        if (result < 0) return result;
+
+        if (start[len] == '\0') return 0;
+        start += len + 1;
+    }
+}
+
+int name_filter_match(NameFilter filter, const char *name) {
+    size_t name_len = strlen(name);
+    int included = filter->num_of_includes == 0;
+
+    for (int r = 0; r < filter->size; r++) {
+        struct name_rule *rule = &filter->rules[r];
+
+        // Only includes that could still change the result are matched
+        if (rule->include && included) continue;
+
+        if (name_filter_rule_match(rule, name, name_len)) {
+            if (!rule->include) return 0;
+            included = 1;
+        }
+    }
+
+    return included;
+}
+
+int name_filter_size(NameFilter filter) {
+    return filter->size;
+}
+
+char *name_filter_pattern(NameFilter filter, int i, int *include) {
+    *include = filter->rules[i].include;
+    return filter->rules[i].pattern;
+}
+
+int name_filter_equal(NameFilter a, NameFilter b) {
+    int size_a = a == NULL? 0: a->size, size_b = b == NULL? 0: b->size;
+    if (size_a != size_b) return 0;
+
+    for (int r = 0; r < size_a; r++) {
+        if (a->rules[r].include != b->rules[r].include || strcmp(a->rules[r].pattern, b->rules[r].pattern))
+            return 0;
+    }
+
+    return 1;
+}
+
+NameFilter name_filter_copy(NameFilter filter) {
+    NameFilter copy = name_filter_init();
+    if (copy == NULL) return NULL;
+
+    for (int r = 0; r < filter->size; r++) {
+        if (name_filter_add(copy, filter->rules[r].pattern, filter->rules[r].include) < 0) {
+            name_filter_destroy(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+size_t name_filter_memory(NameFilter filter) {
+    size_t memory = sizeof(struct name_filter) + filter->capacity * sizeof(struct name_rule);
+
+    for (int r = 0; r < filter->size; r++)
+        memory += strlen(filter->rules[r].pattern) + 1;
+
+    return memory;
+}
+
+void name_filter_destroy(NameFilter filter) {
+    if (filter == NULL) return;
+
+    for (int r = 0; r < filter->size; r++)
+        free(filter->rules[r].pattern);
+
+    free(filter->rules);
+    free(filter);
+}
+
+// Finds the form of the pattern of rule and its literal part
+void name_filter_compile(struct name_rule *rule) {
+    char *pattern = rule->pattern;
+    size_t len = strlen(pattern);
+
+    // Position of the first special character, ignoring a leading and a trailing star
+    int leading = pattern[0] == '*';
+    int trailing = len > (size_t) leading && pattern[len-1] == '*';
+    size_t part_len = len - leading - trailing;
+
+    rule->part = pattern + leading;
+    rule->part_len = part_len;
+
+    if (strcspn(rule->part, "*?[\\") < part_len)
+        rule->type = RULE_GLOB;
+    else if (part_len == 0)
+        rule->type = RULE_ANY;
+    else if (leading && trailing)
+        rule->type = RULE_CONTAINS;
+    else if (leading)
+        rule->type = RULE_SUFFIX;
+    else if (trailing)
+        rule->type = RULE_PREFIX;
+    else
+        rule->type = RULE_LITERAL;
+}
+
+// Returns 1 if file name of length name_len matches pattern of rule
+int name_filter_rule_match(struct name_rule *rule, const char *name, size_t name_len) {
+    switch (rule->type) {
+        case RULE_LITERAL:
+            return name_len == rule->part_len && !memcmp(name, rule->part, name_len);
+        case RULE_PREFIX:
+            return name_len >= rule->part_len && !memcmp(name, rule->part, rule->part_len);
+        case RULE_SUFFIX:
+            return name_len >= rule->part_len && !memcmp(name + name_len - rule->part_len, rule->part, rule->part_len);
+        case RULE_CONTAINS:
+            return memmem(name, name_len, rule->part, rule->part_len) != NULL;
+        case RULE_ANY:
+            return 1;
+        default:
+            return fnmatch(rule->pattern, name, 0) == 0;
+    }
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../include/snapshot.h"
+
+int snapshot_open_dir(int dir_fd, int create);
+int snapshot_remove_at(int snaps_fd, char *name);
+
+void snapshot_name(char *name, size_t nbytes) {
+    struct timespec now;
+    struct tm tm;
+    char date[20];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    localtime_r(&now.tv_sec, &tm);
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+    snprintf(name, nbytes, "%s.%03ld", date, now.tv_nsec / 1000000);
+}
+
+int snapshot_create(int dir_fd, char *name) {
+    int snaps_fd = snapshot_open_dir(dir_fd, 1);
+    if (snaps_fd < 0) return -1;
+
+    char tmp_name[SNAPSHOT_NAME_SIZE + 1];
+    snprintf(tmp_name, sizeof(tmp_name), ".%s", name);
+
+    // A hidden snapshot left behind by a worker that was killed is replaced
+    snapshot_remove_at(snaps_fd, tmp_name);
+
+    if (mkdirat(snaps_fd, tmp_name, 0700) < 0) {
+        int err = errno;
+        close(snaps_fd);
+        errno = err;
+        return -1;
+    }
+
+    int tmp_fd = openat(snaps_fd, tmp_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct dir_list list;
+    int list_check = tmp_fd < 0? -2: dir_scanner_list(dir_fd, 1, &list);
+
+    if (list_check < 0) {
+        int err = list_check == -1? ENOMEM: errno;
+        if (tmp_fd >= 0) close(tmp_fd);
+        unlinkat(snaps_fd, tmp_name, AT_REMOVEDIR);
+        close(snaps_fd);
+        errno = err;
+        return -1;
+    }
+
+    // Link every regular file, files removed since the directory was read are skipped
+    int linked = 0, err = 0;
+
+    for (size_t i = 0; i < list.count; i++) {
+        if (linkat(dir_fd, list.entries[i].name, tmp_fd, list.entries[i].name, 0) == 0) {
+            linked++;
+        } else if (errno != ENOENT) {
+            err = errno;
+            break;
+        }
+    }
+
+    dir_list_free(&list);
+    close(tmp_fd);
+
+    // Snapshots of the same millisecond are never replaced
+    if (err == 0 && renameat2(snaps_fd, tmp_name, snaps_fd, name, RENAME_NOREPLACE) < 0)
+        err = errno;
+
+    if (err != 0) {
+        snapshot_remove_at(snaps_fd, tmp_name);
+        close(snaps_fd);
+        errno = err;
+        return -1;
+    }
+
+    close(snaps_fd);
+    return linked;
+}
+
+int snapshot_prune(int dir_fd, int keep) {
+    struct dir_list list;
+    if (snapshot_list(dir_fd, &list) < 0) return -1;
+
+    int removed = 0;
+    if (list.count > (size_t) keep) {
+        int snaps_fd = snapshot_open_dir(dir_fd, 0);
+
+        for (size_t i = 0; snaps_fd >= 0 && i < list.count - keep; i++) {
+            if (snapshot_remove_at(snaps_fd, list.entries[i].name) == 0)
+                removed++;
+        }
+
+        if (snaps_fd >= 0) close(snaps_fd);
+    }
+
+    dir_list_free(&list);
+    return removed;
+}
+
+int snapshot_list(int dir_fd, struct dir_list *list) {
+    list->entries = NULL;
+    list->names = NULL;
+    list->count = 0;
+
+    int snaps_fd = snapshot_open_dir(dir_fd, 0);
+    if (snaps_fd < 0) return errno == ENOENT? 0: -2;
+
+    int result = dir_scanner_list(snaps_fd, 0, list);
+    close(snaps_fd);
+    if (result < 0) return result;
+
+    // Keep only snapshots, hidden ones are still being built or were left by a failure
+    size_t count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].type == DT_DIR && list->entries[i].name[0] != '.')
+            list->entries[count++] = list->entries[i];
+    }
+
+    list->count = count;
+    return 0;
+}
+
+int snapshot_open(int dir_fd, char *name) {
+    int snaps_fd = snapshot_open_dir(dir_fd, 0);
+    if (snaps_fd < 0) return -1;
+
+    int fd = openat(snaps_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    int err = errno;
+    close(snaps_fd);
+    errno = err;
+    return fd;
+}
+
+int snapshot_restore_file(int snap_fd, int dir_fd, char *name) {
+    char tmp_name[32];
+    snprintf(tmp_name, sizeof(tmp_name), ".fss-restore-%d", getpid());
+
+    unlinkat(dir_fd, tmp_name, 0);
+    if (linkat(snap_fd, name, dir_fd, tmp_name, 0) < 0)
+        return -1;
+
+    if (renameat(dir_fd, tmp_name, dir_fd, name) < 0) {
+        int err = errno;
+        unlinkat(dir_fd, tmp_name, 0);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+int snapshot_remove(int dir_fd, char *name) {
+    int snaps_fd = snapshot_open_dir(dir_fd, 0);
+    if (snaps_fd < 0) return -1;
+
+    int result = snapshot_remove_at(snaps_fd, name);
+    close(snaps_fd);
+    return result;
+}
+
+// Opens SNAPSHOT_DIR of target directory dir_fd, which is created first if create is 1
+// Returns file descriptor or -1 in case of error
+int snapshot_open_dir(int dir_fd, int create) {
+    if (create && mkdirat(dir_fd, SNAPSHOT_DIR, 0700) < 0 && errno != EEXIST)
+        return -1;
+
+    return openat(dir_fd, SNAPSHOT_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+// Removes snapshot name of snapshot directory snaps_fd with all its links
+// Returns 0 on success and -1 on failure
+int snapshot_remove_at(int snaps_fd, char *name) {
+    int fd = openat(snaps_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct dir_list list;
+    if (dir_scanner_list(fd, 0, &list) == 0) {
+        for (size_t i = 0; i < list.count; i++)
+            unlinkat(fd, list.entries[i].name, 0);
+
+        dir_list_free(&list);
+    }
+
+    close(fd);
+    return unlinkat(snaps_fd, name, AT_REMOVEDIR);
+}
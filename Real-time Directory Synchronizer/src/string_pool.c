@@ -0,0 +1,173 @@
+#include <string.h>
+#include "../include/string_pool.h"
+
+#define CHUNK_SIZE (64 * 1024)   // Size of chunks strings are stored in
+#define BUCKETS_DEFAULT 256      // Initial number of buckets of the hash table
+
+// Memory that strings are stored in one after the other
+struct chunk {
+    struct chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+// Strings are found with an open addressing hash table of pointers into the chunks
+struct string_pool {
+    struct chunk *chunks;    // Chunk that is being filled, followed by the full ones
+    char **table;
+    size_t num_of_buckets;
+    size_t size;
+    size_t memory;
+};
+
+size_t string_pool_hash(char *str);
+void *string_pool_alloc(StringPool pool, size_t nbytes, size_t align);
+int string_pool_resize(StringPool pool);
+
+StringPool string_pool_init(void) {
+    StringPool pool = malloc(sizeof(struct string_pool));
+    if (pool == NULL) return NULL;
+
+    pool->table = calloc(BUCKETS_DEFAULT, sizeof(char *));
+
+    if (pool->table == NULL) {
+        free(pool); return NULL;
+    }
+
+    pool->chunks = NULL;
+    pool->num_of_buckets = BUCKETS_DEFAULT;
+    pool->size = 0;
+    pool->memory = sizeof(struct string_pool) + BUCKETS_DEFAULT * sizeof(char *);
+    return pool;
+}
+
+char *string_pool_intern(StringPool pool, char *str) {
+    // Keep table at most half full, so that probe sequences stay short
+    if (2 * (pool->size + 1) > pool->num_of_buckets && string_pool_resize(pool) < 0)
+        return NULL;
+
+    size_t bucket = string_pool_hash(str) & (pool->num_of_buckets - 1);
+
+    while (pool->table[bucket] != NULL) {
+        if (!strcmp(pool->table[bucket], str))
+            return pool->table[bucket];
+
+        bucket = (bucket + 1) & (pool->num_of_buckets - 1);
+    }
+
+    size_t len = strlen(str) + 1;
+    char *copy = string_pool_alloc(pool, len, 1);
+    if (copy == NULL) return NULL;
+
+    memcpy(copy, str, len);
+    pool->table[bucket] = copy;
+    pool->size++;
+
+    return copy;
+}
+
+char **string_pool_intern_array(StringPool pool, char **array, int count) {
+    char **copy = string_pool_alloc(pool, count * sizeof(char *), sizeof(char *));
+    if (copy == NULL) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        copy[i] = string_pool_intern(pool, array[i]);
+        if (copy[i] == NULL) return NULL;
+    }
+
+    return copy;
+}
+
+size_t string_pool_size(StringPool pool) {
+    return pool->size;
+}
+
+size_t string_pool_memory(StringPool pool) {
+    return pool->memory;
+}
+
+void string_pool_destroy(StringPool pool) {
+    struct chunk *chunk = pool->chunks;
+
+    while (chunk != NULL) {
+        struct chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(pool->table);
+    free(pool);
+}
+
+// Returns FNV-1a hash of str
+size_t string_pool_hash(char *str) {
+    size_t hash = 14695981039346656037ULL;
+
+    for (unsigned char *c = (unsigned char *) str; *c; c++) {
+        hash ^= *c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Returns nbytes of memory from the chunks, aligned to align bytes
+// A new chunk is allocated if the current one doesn't have enough space left
+// Returns NULL if malloc fails
+void *string_pool_alloc(StringPool pool, size_t nbytes, size_t align) {
+    struct chunk *chunk = pool->chunks;
+
+    if (chunk != NULL) {
+        size_t start = (chunk->used + align - 1) & ~(align - 1);
+
+        if (start + nbytes <= chunk->size) {
+            chunk->used = start + nbytes;
+            return chunk->data + start;
+        }
+    }
+
+    // Strings longer than a chunk get a chunk of their own
+    size_t size = nbytes > CHUNK_SIZE? nbytes: CHUNK_SIZE;
+    chunk = malloc(sizeof(struct chunk) + size);
+    if (chunk == NULL) return NULL;
+
+    chunk->size = size;
+    chunk->used = nbytes;
+    pool->memory += sizeof(struct chunk) + size;
+
+    // A chunk of its own goes after the current one, which still has space
+    if (size > CHUNK_SIZE && pool->chunks != NULL) {
+        chunk->next = pool->chunks->next;
+        pool->chunks->next = chunk;
+    } else {
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+    }
+
+    return chunk->data;
+}
+
+// Doubles the number of buckets of the hash table and adds all strings to it again
+// Returns -1 if malloc fails, 0 otherwise
+int string_pool_resize(StringPool pool) {
+    size_t num_of_buckets = pool->num_of_buckets * 2;
+    char **table = calloc(num_of_buckets, sizeof(char *));
+    if (table == NULL) return -1;
+
+    for (size_t b = 0; b < pool->num_of_buckets; b++) {
+        if (pool->table[b] == NULL) continue;
+
+        size_t bucket = string_pool_hash(pool->table[b]) & (num_of_buckets - 1);
+        while (table[bucket] != NULL)
+            bucket = (bucket + 1) & (num_of_buckets - 1);
+
+        table[bucket] = pool->table[b];
+    }
+
+    free(pool->table);
+    pool->table = table;
+    pool->memory += (num_of_buckets - pool->num_of_buckets) * sizeof(char *);
+    pool->num_of_buckets = num_of_buckets;
+    return 0;
+}
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/throttle.h"
+
+#define NSEC_PER_SEC 1000000000LL
+#define BURST_NS NSEC_PER_SEC        // A bucket can hold one second of its limit
+#define MAX_SLEEP_NS 100000000LL     // Sleeping workers check for changed limits this often
+
+// Bucket in shared memory, with the totals taken from it to measure rates
+struct throttle_shared_bucket {
+    struct throttle_bucket bucket;
+    long long bytes_taken;
+    long long files_taken;
+};
+
+// Contents of shared memory file, the progress counters of the worker slots follow the buckets
+struct throttle_shared {
+    int num_of_slots;
+    struct throttle_shared_bucket global;
+    struct throttle_shared_bucket slots[];
+};
+
+struct throttle {
+    struct throttle_shared *shared;
+    size_t size;
+    int fd;
+    int owner;                     // 1 if shared memory was created by this process
+    int slot;                      // Slot of worker, -1 in the manager
+    long long *progress;           // Progress counters of the worker slots, in shared memory
+    int worker;                    // Worker slot of worker, -1 in the manager
+
+    // Measurements of the manager, global bucket is at index num_of_slots
+    long long *last_bytes;         // Totals at last measurement
+    long long *last_files;
+    struct throttle_rates *rates;
+    struct timespec last_update;
+};
+
+long long throttle_now_ns(void);
+long long throttle_take(long long *paid_ns, long long limit, long long amount, long long now);
+long long throttle_owed_ns(long long *paid_ns, long long limit, long long now);
+void throttle_store_limits(struct throttle_shared_bucket *shared_bucket, struct throttle_limits limits);
+
+Throttle throttle_init(int num_of_slots) {
+    Throttle throttle = malloc(sizeof(struct throttle));
+    if (throttle == NULL) return NULL;
+
+    throttle->size = sizeof(struct throttle_shared) + num_of_slots * (sizeof(struct throttle_shared_bucket) + sizeof(long long));
+    throttle->owner = 1;
+    throttle->slot = -1;
+    throttle->worker = -1;
+
+    throttle->last_bytes = calloc(num_of_slots + 1, sizeof(long long));
+    throttle->last_files = calloc(num_of_slots + 1, sizeof(long long));
+    throttle->rates = calloc(num_of_slots + 1, sizeof(struct throttle_rates));
+
+    if (throttle->last_bytes == NULL || throttle->last_files == NULL || throttle->rates == NULL) {
+        free(throttle->last_bytes); free(throttle->last_files); free(throttle->rates); free(throttle);
+        return NULL;
+    }
+
+    // Create shared memory, which is zero filled, so every bucket is unlimited and empty
+    throttle->fd = memfd_create("fss_throttle", MFD_CLOEXEC);
+    throttle->shared = MAP_FAILED;
+
+    if (throttle->fd >= 0 && ftruncate(throttle->fd, throttle->size) == 0)
+        throttle->shared = mmap(NULL, throttle->size, PROT_READ | PROT_WRITE, MAP_SHARED, throttle->fd, 0);
+
+    if (throttle->shared == MAP_FAILED) {
+        int err = errno;
+        if (throttle->fd >= 0) close(throttle->fd);
+        free(throttle->last_bytes); free(throttle->last_files); free(throttle->rates); free(throttle);
+        errno = err;
+        return NULL;
+    }
+
+    throttle->shared->num_of_slots = num_of_slots;
+    throttle->progress = (long long *) &throttle->shared->slots[num_of_slots];
+    clock_gettime(CLOCK_MONOTONIC, &throttle->last_update);
+
+    return throttle;
+}
+
+Throttle throttle_attach(int fd, int slot, int worker) {
+    struct stat fd_stat;
+    if (fstat(fd, &fd_stat) < 0 || (size_t) fd_stat.st_size < sizeof(struct throttle_shared)) return NULL;
+
+    Throttle throttle = malloc(sizeof(struct throttle));
+    if (throttle == NULL) return NULL;
+
+    throttle->size = fd_stat.st_size;
+    throttle->fd = fd;
+    throttle->owner = 0;
+    throttle->slot = slot;
+    throttle->worker = worker;
+    throttle->last_bytes = NULL;
+    throttle->last_files = NULL;
+    throttle->rates = NULL;
+
+    throttle->shared = mmap(NULL, throttle->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    // The file must hold the progress counters of all slots, which follow the buckets
+    int num_of_slots = throttle->shared == MAP_FAILED? 0: throttle->shared->num_of_slots;
+    size_t size = sizeof(struct throttle_shared) + num_of_slots * (sizeof(struct throttle_shared_bucket) + sizeof(long long));
+
+    if (throttle->shared == MAP_FAILED || slot < 0 || slot >= num_of_slots || worker < 0 || worker >= num_of_slots || throttle->size < size) {
+        if (throttle->shared != MAP_FAILED) munmap(throttle->shared, throttle->size);
+        free(throttle);
+        return NULL;
+    }
+
+    throttle->progress = (long long *) &throttle->shared->slots[num_of_slots];
+
+    return throttle;
+}
+
+Throttle throttle_share(Throttle throttle) {
+    int num_of_slots = throttle->shared->num_of_slots;
+
+    Throttle shared = malloc(sizeof(struct throttle));
+    if (shared == NULL) return NULL;
+
+    shared->size = throttle->size;
+    shared->fd = throttle->fd;
+    shared->owner = 0;
+    shared->slot = -1;
+    shared->worker = -1;
+
+    shared->last_bytes = calloc(num_of_slots + 1, sizeof(long long));
+    shared->last_files = calloc(num_of_slots + 1, sizeof(long long));
+    shared->rates = calloc(num_of_slots + 1, sizeof(struct throttle_rates));
+    shared->shared = MAP_FAILED;
+
+    if (shared->last_bytes != NULL && shared->last_files != NULL && shared->rates != NULL)
+        shared->shared = mmap(NULL, shared->size, PROT_READ | PROT_WRITE, MAP_SHARED, shared->fd, 0);
+
+    if (shared->shared == MAP_FAILED) {
+        int err = errno;
+        free(shared->last_bytes); free(shared->last_files); free(shared->rates); free(shared);
+        errno = err;
+        return NULL;
+    }
+
+    shared->progress = (long long *) &shared->shared->slots[num_of_slots];
+    shared->last_update = throttle->last_update;
+
+    // Start measuring from the totals taken so far
+    for (int i = 0; i <= num_of_slots; i++) {
+        struct throttle_shared_bucket *bucket = i == num_of_slots? &shared->shared->global: &shared->shared->slots[i];
+        shared->last_bytes[i] = __atomic_load_n(&bucket->bytes_taken, __ATOMIC_RELAXED);
+        shared->last_files[i] = __atomic_load_n(&bucket->files_taken, __ATOMIC_RELAXED);
+    }
+
+    return shared;
+}
+
+int throttle_fd(Throttle throttle) {
+    return throttle->fd;
+}
+
+void throttle_set_global(Throttle throttle, struct throttle_limits limits) {
+    throttle_store_limits(&throttle->shared->global, limits);
+}
+
+struct throttle_limits throttle_get_global(Throttle throttle) {
+    struct throttle_limits limits;
+    limits.bytes_per_sec = __atomic_load_n(&throttle->shared->global.bucket.limits.bytes_per_sec, __ATOMIC_RELAXED);
+    limits.files_per_sec = __atomic_load_n(&throttle->shared->global.bucket.limits.files_per_sec, __ATOMIC_RELAXED);
+    return limits;
+}
+
+void throttle_load_slot(Throttle throttle, int slot, struct throttle_bucket *bucket) {
+    struct throttle_bucket *slot_bucket = &throttle->shared->slots[slot].bucket;
+
+    // No worker runs in slot yet
+    *slot_bucket = *bucket;
+}
+
+void throttle_save_slot(Throttle throttle, int slot, struct throttle_bucket *bucket) {
+    struct throttle_bucket *slot_bucket = &throttle->shared->slots[slot].bucket;
+
+    bucket->bytes_paid_ns = __atomic_load_n(&slot_bucket->bytes_paid_ns, __ATOMIC_RELAXED);
+    bucket->files_paid_ns = __atomic_load_n(&slot_bucket->files_paid_ns, __ATOMIC_RELAXED);
+}
+
+void throttle_set_slot(Throttle throttle, int slot, struct throttle_limits limits) {
+    throttle_store_limits(&throttle->shared->slots[slot], limits);
+}
+
+int throttle_consume(Throttle throttle, long long bytes, long long files, volatile sig_atomic_t *stop) {
+    struct throttle_shared_bucket *buckets[2] = {&throttle->shared->global, &throttle->shared->slots[throttle->slot]};
+    long long now = throttle_now_ns();
+
+    // Take from both buckets at once, so the worker waits for the one that is emptier
+    for (int b = 0; b < 2; b++) {
+        struct throttle_bucket *bucket = &buckets[b]->bucket;
+
+        throttle_take(&bucket->bytes_paid_ns, __atomic_load_n(&bucket->limits.bytes_per_sec, __ATOMIC_RELAXED), bytes, now);
+        throttle_take(&bucket->files_paid_ns, __atomic_load_n(&bucket->limits.files_per_sec, __ATOMIC_RELAXED), files, now);
+
+        __atomic_add_fetch(&buckets[b]->bytes_taken, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&buckets[b]->files_taken, files, __ATOMIC_RELAXED);
+    }
+
+    // Sleep in steps, so that raised limits and stop take effect while waiting
+    // A worker that waits for its buckets isn't hung, every step is progress
+    while (1) {
+        throttle_progress(throttle);
+        if (stop != NULL && *stop) return -1;
+
+        long long owed = 0;
+
+        for (int b = 0; b < 2; b++) {
+            struct throttle_bucket *bucket = &buckets[b]->bucket;
+            long long bytes_owed = throttle_owed_ns(&bucket->bytes_paid_ns, __atomic_load_n(&bucket->limits.bytes_per_sec, __ATOMIC_RELAXED), now);
+            long long files_owed = throttle_owed_ns(&bucket->files_paid_ns, __atomic_load_n(&bucket->limits.files_per_sec, __ATOMIC_RELAXED), now);
+
+            if (bytes_owed > owed) owed = bytes_owed;
+            if (files_owed > owed) owed = files_owed;
+        }
+
+        if (owed == 0) return 0;
+        if (owed > MAX_SLEEP_NS) owed = MAX_SLEEP_NS;
+
+        struct timespec sleep_time = {owed / NSEC_PER_SEC, owed % NSEC_PER_SEC};
+        nanosleep(&sleep_time, NULL);
+
+        now = throttle_now_ns();
+    }
+}
+
+void throttle_progress(Throttle throttle) {
+    __atomic_add_fetch(&throttle->progress[throttle->worker], 1, __ATOMIC_RELAXED);
+}
+
+long long throttle_worker_progress(Throttle throttle, int worker) {
+    return __atomic_load_n(&throttle->progress[worker], __ATOMIC_RELAXED);
+}
+
+void throttle_update(Throttle throttle) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long elapsed_ms = (now.tv_sec - throttle->last_update.tv_sec) * 1000LL + (now.tv_nsec - throttle->last_update.tv_nsec) / 1000000;
+    if (elapsed_ms < THROTTLE_INTERVAL_MS) return;
+
+    int num_of_slots = throttle->shared->num_of_slots;
+
+    for (int i = 0; i <= num_of_slots; i++) {
+        struct throttle_shared_bucket *bucket = i == num_of_slots? &throttle->shared->global: &throttle->shared->slots[i];
+        long long bytes = __atomic_load_n(&bucket->bytes_taken, __ATOMIC_RELAXED);
+        long long files = __atomic_load_n(&bucket->files_taken, __ATOMIC_RELAXED);
+
+        throttle->rates[i].bytes_per_sec = (bytes - throttle->last_bytes[i]) * 1000.0 / elapsed_ms;
+        throttle->rates[i].files_per_sec = (files - throttle->last_files[i]) * 1000.0 / elapsed_ms;
+
+        throttle->last_bytes[i] = bytes;
+        throttle->last_files[i] = files;
+    }
+
+    throttle->last_update = now;
+}
+
+struct throttle_rates throttle_global_rates(Throttle throttle) {
+    return throttle->rates[throttle->shared->num_of_slots];
+}
+
+struct throttle_rates throttle_slot_rates(Throttle throttle, int slot) {
+    return throttle->rates[slot];
+}
+
+int throttle_parse_rate(char *str, long long *rate) {
+    if (!strcmp(str, "none")) {
+        *rate = 0;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    long long value = strtoll(str, &end, 10);
+
+    if (end == str || value < 0 || errno) return -1;
+
+    long long multiplier = 1;
+    switch (*end) {
+        case 'K': case 'k': multiplier = 1024LL; end++; break;
+        case 'M': case 'm': multiplier = 1024LL * 1024; end++; break;
+        case 'G': case 'g': multiplier = 1024LL * 1024 * 1024; end++; break;
+    }
+
+    if (*end != '\0' || value > LLONG_MAX / multiplier) return -1;
+
+    *rate = value * multiplier;
+    return 0;
+}
+
+int throttle_parse_limits(char *str, struct throttle_limits *limits) {
+    struct throttle_limits parsed = *limits;
+    int count = 0;
+    char *saveptr;
+
+    for (char *option = strtok_r(str, " \t\n", &saveptr); option != NULL; option = strtok_r(NULL, " \t\n", &saveptr)) {
+        if (!strncmp(option, "bytes=", 6) && throttle_parse_rate(option + 6, &parsed.bytes_per_sec) == 0)
+            count++;
+        else if (!strncmp(option, "files=", 6) && throttle_parse_rate(option + 6, &parsed.files_per_sec) == 0)
+            count++;
+        else
+            return -1;
+    }
+
+    *limits = parsed;
+    return count;
+}
+
+void throttle_destroy(Throttle throttle) {
+    munmap(throttle->shared, throttle->size);
+
+    if (throttle->owner) close(throttle->fd);
+
+    // Measurements are NULL in workers
+    free(throttle->last_bytes); free(throttle->last_files); free(throttle->rates);
+    free(throttle);
+}
+
+// Returns CLOCK_MONOTONIC time in nanoseconds, which is the same for every process
+long long throttle_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+// Takes amount from bucket paid_ns with limit per second at time now, by moving the time it
+// is paid for. Idle time refills the bucket up to now, so that an idle bucket holds BURST_NS.
+// Returns nanoseconds until the bucket has paid for amount
+long long throttle_take(long long *paid_ns, long long limit, long long amount, long long now) {
+    if (limit <= 0 || amount <= 0) return 0;
+
+    long long cost = (double) amount * NSEC_PER_SEC / limit;
+    long long old_paid = __atomic_load_n(paid_ns, __ATOMIC_RELAXED);
+    long long new_paid;
+
+    do {
+        new_paid = (old_paid > now? old_paid: now) + cost;
+    } while (!__atomic_compare_exchange_n(paid_ns, &old_paid, new_paid, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return throttle_owed_ns(paid_ns, limit, now);
+}
+
+// Returns nanoseconds that bucket paid_ns with limit per second must wait at time now, before
+// what was taken from it is allowed
+long long throttle_owed_ns(long long *paid_ns, long long limit, long long now) {
+    if (limit <= 0) return 0;
+
+    long long owed = __atomic_load_n(paid_ns, __ATOMIC_RELAXED) - BURST_NS - now;
+    return owed > 0? owed: 0;
+}
+
+// Sets limits of shared_bucket and forgets what was taken from it with the old limits
+void throttle_store_limits(struct throttle_shared_bucket *shared_bucket, struct throttle_limits limits) {
+    struct throttle_bucket *bucket = &shared_bucket->bucket;
+
+    __atomic_store_n(&bucket->limits.bytes_per_sec, limits.bytes_per_sec, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->limits.files_per_sec, limits.files_per_sec, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->bytes_paid_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->files_paid_ns, 0, __ATOMIC_RELAXED);
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -5,9 +6,44 @@
 #include <stdio.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <pthread.h>
 #include "../include/util.h"
 
 #define BUF_SIZE 1024
+#define COPY_BUF_SIZE 65536
+#define XATTR_NAMES_SIZE 65536   // Maximum size of the list of extended attribute names of a file
+#define XATTR_VALUE_SIZE 65536   // Maximum size of the value of an extended attribute
+
+// State of a copy, shared by the threads that copy its ranges
+struct file_copy_state {
+    int src_fd;
+    int *tar_fds;
+    int num_of_targets;
+    enum file_management_error *tar_errs;
+    int tars_left;                 // Targets that haven't failed
+    int read_failed;
+    int cancelled;                 // Set when throttle cancels the copy
+    long long physical_bytes;
+    copy_throttle throttle;
+};
+
+// Range of bytes of the source file copied by one thread
+struct file_copy_range {
+    struct file_copy_state *state;
+    off_t start;
+    off_t end;
+};
+
+void file_copy_range(struct file_copy_range *range);
+void *file_copy_range_thread(void *range);
+int file_metadata_apply(int src_fd, struct stat *src_stat, int tar_fd);
+int file_xattrs_copy(int src_fd, int tar_fd);
+int file_open_source(int dir_fd, char *name, struct stat *src_stat);
+int file_open_target(int dir_fd, char *name, int flags);
+int file_open_replacement(int dir_fd, char *tmp_name, size_t nbytes, int t);
+int file_replace_target(int dir_fd, int fd, char *tmp_name, char *name);
 
 
 char *file_name_concat(char *dir, char *file) {
@@ -24,45 +60,440 @@ char *file_name_concat(char *dir, char *file) {
     return final;
 }
 
-enum file_management_error file_copy(char *src, char *tar, int *err_file) {
-    // Open source and target files
-    int src_fd = open(src, O_RDONLY);
+enum file_management_error file_copy(int src_dir_fd, char *name, int *tar_dir_fds, int num_of_targets, enum file_management_error *tar_errs, struct copy_stats *stats, copy_opened opened, copy_throttle throttle, int flags) {
+    int tar_fds[MAX_TARGETS];
+    char tmp_names[MAX_TARGETS][32];   // Names of replacements that were created with a name
+    int tars_left = 0;
+
+    stats->logical_bytes = 0;
+    stats->physical_bytes = 0;
+
+    // Open source file and get its size
+    struct stat src_stat;
+    int src_fd = file_open_source(src_dir_fd, name, &src_stat);
 
     if (src_fd < 0) {
-        *err_file = 0; return OPEN_FAILED;
+        for (int t = 0; t < num_of_targets; t++) tar_errs[t] = OPEN_FAILED;
+        return OPEN_FAILED;
+    }
+
+    if (opened != NULL) opened(src_stat.st_size);
+
+    // A source with fewer blocks than its size has holes, which preallocation would fill
+    int sparse = (long long) src_stat.st_blocks * 512 < src_stat.st_size;
+
+    // Open target files and preallocate their space, so that ranges written in parallel
+    // end up contiguous and a full disk is found before anything is copied
+    for (int t = 0; t < num_of_targets; t++) {
+        if (flags & COPY_REPLACE)
+            tar_fds[t] = file_open_replacement(tar_dir_fds[t], tmp_names[t], sizeof(tmp_names[t]), t);
+        else
+            tar_fds[t] = file_open_target(tar_dir_fds[t], name, O_WRONLY | O_CREAT | O_TRUNC);
+
+        tar_errs[t] = tar_fds[t] < 0? OPEN_FAILED: SUCCESS;
+
+        if (tar_fds[t] >= 0 && !sparse && src_stat.st_size > 0 && fallocate(tar_fds[t], 0, 0, src_stat.st_size) < 0 && errno == ENOSPC)
+            tar_errs[t] = WRITE_FAILED;
+
+        if (tar_errs[t] == SUCCESS) tars_left++;
+    }
+
+    struct file_copy_state state = {src_fd, tar_fds, num_of_targets, tar_errs, tars_left, 0, 0, 0, throttle};
+
+    // Large files are split into ranges that are copied by threads at the same time,
+    // so that the device gets several requests at once
+    int num_of_ranges = src_stat.st_size >= COPY_PARALLEL_THRESHOLD? COPY_THREADS: 1;
+    struct file_copy_range ranges[COPY_THREADS];
+    pthread_t threads[COPY_THREADS];
+    int started[COPY_THREADS];
+
+    for (int r = 0; r < num_of_ranges; r++) {
+        ranges[r].state = &state;
+        ranges[r].start = src_stat.st_size / num_of_ranges * r;
+        ranges[r].end = r == num_of_ranges - 1? src_stat.st_size: src_stat.st_size / num_of_ranges * (r+1);
+        started[r] = 0;
+    }
+
+    for (int r = 1; r < num_of_ranges; r++)
+        started[r] = pthread_create(&threads[r], NULL, file_copy_range_thread, &ranges[r]) == 0;
+
+    // First range is copied by this thread, as well as any range whose thread couldn't be started
+    for (int r = 0; r < num_of_ranges; r++) {
+        if (!started[r])
+            file_copy_range(&ranges[r]);
+    }
+
+    for (int r = 1; r < num_of_ranges; r++) {
+        if (started[r])
+            pthread_join(threads[r], NULL);
+    }
+
+    int read_failed = state.read_failed;
+
+    // A cancelled copy leaves no partial file behind, targets were truncated when they were opened
+    // and replacements are dropped, which keeps the old files
+    if (state.cancelled && !read_failed) {
+        close(src_fd);
+
+        for (int t = 0; t < num_of_targets; t++) {
+            if (tar_fds[t] < 0) continue;
+
+            close(tar_fds[t]);
+            if (!(flags & COPY_REPLACE))
+                unlinkat(tar_dir_fds[t], name, 0);
+            else if (tmp_names[t][0] != '\0')
+                unlinkat(tar_dir_fds[t], tmp_names[t], 0);
+            tar_errs[t] = CANCELLED;
+        }
+
+        stats->physical_bytes = state.physical_bytes;
+        return CANCELLED;
     }
 
-    int tar_fd = open(tar, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    // Set size of targets, which also creates any hole at the end of the file
+    for (int t = 0; t < num_of_targets && !read_failed; t++) {
+        if (tar_errs[t] != SUCCESS) continue;
 
-    if (tar_fd < 0) {
-        *err_file = 1; return OPEN_FAILED;
+        if (ftruncate(tar_fds[t], src_stat.st_size) < 0)
+            tar_errs[t] = WRITE_FAILED;
     }
 
-    // Initialize buffer 
-    char buffer[BUF_SIZE];
+    // Copy metadata last, so that the modification time isn't changed by the writes
+    for (int t = 0; t < num_of_targets && !read_failed; t++) {
+        if (tar_errs[t] != SUCCESS) continue;
+
+        if (file_metadata_apply(src_fd, &src_stat, tar_fds[t]) < 0)
+            tar_errs[t] = METADATA_FAILED;
+    }
 
-    // Copy data
-    ssize_t nread, nwrite;
-    while ((nread = read_eof(src_fd, buffer, BUF_SIZE)) > 0) {
-        nwrite = write_bytes(tar_fd, buffer, nread);
-        if (nwrite < 0) break;
+    // Data must be on disk before a replacement takes the place of the old file, so that a crash
+    // never leaves an empty file under the name
+    for (int t = 0; t < num_of_targets && !read_failed && (flags & COPY_SYNC); t++) {
+        if (tar_errs[t] == SUCCESS && fdatasync(tar_fds[t]) < 0)
+            tar_errs[t] = WRITE_FAILED;
     }
 
-    if (nread < 0) {
-        *err_file = 0; return READ_FAILED;
+    // Complete replacements take the place of the targets, the others are dropped
+    for (int t = 0; t < num_of_targets && (flags & COPY_REPLACE); t++) {
+        if (tar_fds[t] < 0) continue;
+
+        if (tar_errs[t] == SUCCESS && !read_failed) {
+            if (file_replace_target(tar_dir_fds[t], tar_fds[t], tmp_names[t], name) < 0)
+                tar_errs[t] = WRITE_FAILED;
+        } else if (tmp_names[t][0] != '\0') {
+            unlinkat(tar_dir_fds[t], tmp_names[t], 0);
+        }
     }
 
-    if (nwrite < 0) {
-        *err_file = 1; return WRITE_FAILED;
+    // The name of a new or replaced file is only on disk once its directory is
+    for (int t = 0; t < num_of_targets && !read_failed && (flags & COPY_SYNC); t++) {
+        if (tar_errs[t] == SUCCESS && fsync(tar_dir_fds[t]) < 0)
+            tar_errs[t] = WRITE_FAILED;
     }
 
+    stats->logical_bytes = src_stat.st_size;
+    stats->physical_bytes = state.physical_bytes;
+
     // Close files
     close(src_fd);
-    close(tar_fd);
 
+    for (int t = 0; t < num_of_targets; t++) {
+        if (tar_fds[t] >= 0) close(tar_fds[t]);
+    }
+
+    if (read_failed) {
+        for (int t = 0; t < num_of_targets; t++) {
+            if (tar_errs[t] == SUCCESS) tar_errs[t] = READ_FAILED;
+        }
+
+        return READ_FAILED;
+    }
+
+    return SUCCESS;
+}
+
+// Copies data extents of range to every target that hasn't failed
+// Only the data extents are copied, holes are left unwritten in targets
+// Ranges of the same file can be copied by different threads at the same time, so the
+// shared state is only changed with atomic operations
+void file_copy_range(struct file_copy_range *range) {
+    struct file_copy_state *state = range->state;
+    char *buffer = malloc(COPY_BUF_SIZE);
+
+    if (buffer == NULL) {
+        __atomic_store_n(&state->read_failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    off_t data, hole = range->start;
+
+    while (hole < range->end && __atomic_load_n(&state->tars_left, __ATOMIC_RELAXED) > 0 && !__atomic_load_n(&state->read_failed, __ATOMIC_RELAXED)
+        && !__atomic_load_n(&state->cancelled, __ATOMIC_RELAXED)) {
+        // Find next extent with data
+        data = lseek(state->src_fd, hole, SEEK_DATA);
+
+        if (data < 0) {
+            // No more data, the rest of the file is a hole
+            if (errno == ENXIO) break;
+
+            // File system can't find holes, copy the rest of the range
+            if (errno != EINVAL) {
+                __atomic_store_n(&state->read_failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            data = hole;
+            hole = range->end;
+        } else {
+            // Data of the next range is copied by its own thread
+            if (data >= range->end) break;
+
+            hole = lseek(state->src_fd, data, SEEK_HOLE);
+            if (hole < 0 || hole > range->end) hole = range->end;
+        }
+
+        // Copy extent
+        for (off_t pos = data; pos < hole; ) {
+            size_t count = hole - pos < COPY_BUF_SIZE? hole - pos: COPY_BUF_SIZE;
+            ssize_t nread = pread(state->src_fd, buffer, count, pos);
+
+            if (nread < 0 && errno == EINTR) continue;
+
+            // File was truncated while being copied, targets get the size it had when the copy started
+            if (nread == 0) {
+                hole = range->end;
+                break;
+            }
+
+            if (nread < 0) {
+                __atomic_store_n(&state->read_failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            if (state->throttle != NULL && state->throttle(nread)) {
+                __atomic_store_n(&state->cancelled, 1, __ATOMIC_RELAXED);
+                break;
+            }
+
+            for (int t = 0; t < state->num_of_targets; t++) {
+                if (__atomic_load_n(&state->tar_errs[t], __ATOMIC_RELAXED) != SUCCESS) continue;
+
+                if (pwrite_bytes(state->tar_fds[t], buffer, nread, pos) < 0) {
+                    __atomic_store_n(&state->tar_errs[t], WRITE_FAILED, __ATOMIC_RELAXED);
+                    __atomic_sub_fetch(&state->tars_left, 1, __ATOMIC_RELAXED);
+                }
+            }
+
+            pos += nread;
+            __atomic_add_fetch(&state->physical_bytes, nread, __ATOMIC_RELAXED);
+        }
+    }
+
+    free(buffer);
+}
+
+// Start routine of threads that copy a range of a file
+void *file_copy_range_thread(void *range) {
+    file_copy_range(range);
+    return NULL;
+}
+
+enum file_management_error file_copy_metadata(int src_dir_fd, char *name, int *tar_dir_fds, int num_of_targets, enum file_management_error *tar_errs) {
+    struct stat src_stat;
+    int src_fd = file_open_source(src_dir_fd, name, &src_stat);
+
+    if (src_fd < 0) {
+        for (int t = 0; t < num_of_targets; t++) tar_errs[t] = OPEN_FAILED;
+        return OPEN_FAILED;
+    }
+
+    // Metadata can be changed through a read only file descriptor, so the data of targets is never touched
+    for (int t = 0; t < num_of_targets; t++) {
+        int tar_fd = file_open_target(tar_dir_fds[t], name, O_RDONLY);
+
+        if (tar_fd < 0) {
+            tar_errs[t] = OPEN_FAILED;
+            continue;
+        }
+
+        tar_errs[t] = file_metadata_apply(src_fd, &src_stat, tar_fd) < 0? METADATA_FAILED: SUCCESS;
+        close(tar_fd);
+    }
+
+    close(src_fd);
     return SUCCESS;
 }
 
+// Copies ownership, extended attributes, mode and timestamps of src_fd, whose status is src_stat, to tar_fd
+// Ownership is copied first, because changing it clears set-user-ID bits and file capabilities
+// If the owner can't be changed because the process isn't privileged, the target keeps its owner
+// Returns 0 for success, -1 for failure
+int file_metadata_apply(int src_fd, struct stat *src_stat, int tar_fd) {
+    if (fchown(tar_fd, src_stat->st_uid, src_stat->st_gid) < 0 && errno != EPERM)
+        return -1;
+
+    if (file_xattrs_copy(src_fd, tar_fd) < 0)
+        return -1;
+
+    if (fchmod(tar_fd, src_stat->st_mode & 07777) < 0)
+        return -1;
+
+    struct timespec times[2] = {src_stat->st_atim, src_stat->st_mtim};
+    if (futimens(tar_fd, times) < 0)
+        return -1;
+
+    return 0;
+}
+
+// Sets extended attributes of tar_fd to the ones of src_fd, removing the ones src_fd doesn't have
+// Attributes the process isn't allowed to set, e.g. trusted.* without privileges, are skipped
+// Returns 0 for success, also if the file systems don't support extended attributes, -1 for failure
+int file_xattrs_copy(int src_fd, int tar_fd) {
+    char src_names[XATTR_NAMES_SIZE];
+    char tar_names[XATTR_NAMES_SIZE];
+    char value[XATTR_VALUE_SIZE];
+
+    ssize_t src_len = flistxattr(src_fd, src_names, sizeof(src_names));
+    if (src_len < 0) {
+        if (errno != ENOTSUP) return -1;
+        src_len = 0;
+    }
+
+    // Remove attributes the source doesn't have
+    ssize_t tar_len = flistxattr(tar_fd, tar_names, sizeof(tar_names));
+    if (tar_len < 0)
+        return errno == ENOTSUP? 0: -1;
+
+    for (char *name = tar_names; name < tar_names + tar_len; name += strlen(name) + 1) {
+        int found = 0;
+
+        for (char *src_name = src_names; src_name < src_names + src_len && !found; src_name += strlen(src_name) + 1)
+            found = !strcmp(name, src_name);
+
+        if (!found && fremovexattr(tar_fd, name) < 0 && errno != EPERM && errno != ENODATA)
+            return -1;
+    }
+
+    // Copy attributes of source
+    for (char *name = src_names; name < src_names + src_len; name += strlen(name) + 1) {
+        ssize_t value_len = fgetxattr(src_fd, name, value, sizeof(value));
+
+        if (value_len < 0) {
+            // Attribute was removed after it was listed
+            if (errno == ENODATA) continue;
+            return -1;
+        }
+
+        if (fsetxattr(tar_fd, name, value, value_len, 0) < 0) {
+            if (errno == ENOTSUP) return 0;
+            if (errno != EPERM) return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Opens regular file name of directory dir_fd for reading and writes its status to src_stat
+// Opening doesn't block, even if name is a FIFO
+// Returns file descriptor or -1 in case of error, with errno set to EISDIR or EINVAL if name
+// is not a regular file
+int file_open_source(int dir_fd, char *name, struct stat *src_stat) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (fstat(fd, src_stat) < 0 || !S_ISREG(src_stat->st_mode)) {
+        int err = S_ISDIR(src_stat->st_mode)? EISDIR: errno? errno: EINVAL;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+// Opens target file name of directory dir_fd with flags
+// A read only target, e.g. one that got the mode of a read only source, is made writable by
+// its owner and opened again. Its mode is restored when metadata is copied.
+// Returns file descriptor or -1 in case of error
+int file_open_target(int dir_fd, char *name, int flags) {
+    int fd = openat(dir_fd, name, flags | O_CLOEXEC, 0600);
+
+    if (fd < 0 && errno == EACCES && fchmodat(dir_fd, name, S_IRUSR | S_IWUSR, 0) == 0)
+        fd = openat(dir_fd, name, flags | O_CLOEXEC, 0600);
+
+    return fd;
+}
+
+// Opens a new file in directory dir_fd, the replacement of target t of a copy
+// The file is created without a name with O_TMPFILE, so nothing is left behind if the worker stops.
+// If the file system doesn't support it, the file is created with a name that is unique to the
+// worker and t, which is written to tmp_name of size nbytes. Otherwise tmp_name is empty.
+// Returns file descriptor or -1 in case of error
+int file_open_replacement(int dir_fd, char *tmp_name, size_t nbytes, int t) {
+    tmp_name[0] = '\0';
+
+    int fd = openat(dir_fd, ".", O_WRONLY | O_TMPFILE | O_CLOEXEC, 0600);
+    if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR)) return fd;
+
+    snprintf(tmp_name, nbytes, ".fss-tmp-%d-%d", getpid(), t);
+    unlinkat(dir_fd, tmp_name, 0);
+    fd = openat(dir_fd, tmp_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+
+    if (fd < 0) tmp_name[0] = '\0';
+    return fd;
+}
+
+// Gives replacement fd of directory dir_fd the name of target name, which it replaces in one step
+// A replacement without a name is first linked to a temporary name, which is written to tmp_name
+// Returns 0 for success, -1 for failure, in which case no temporary file is left
+int file_replace_target(int dir_fd, int fd, char *tmp_name, char *name) {
+    if (tmp_name[0] == '\0') {
+        char fd_path[32];
+        snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+        snprintf(tmp_name, 32, ".fss-tmp-%d", getpid());
+
+        unlinkat(dir_fd, tmp_name, 0);
+        if (linkat(AT_FDCWD, fd_path, dir_fd, tmp_name, AT_SYMLINK_FOLLOW) < 0)
+            return -1;
+    }
+
+    if (renameat(dir_fd, tmp_name, dir_fd, name) < 0) {
+        int err = errno;
+        unlinkat(dir_fd, tmp_name, 0);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+char **string_array_copy(char **array, int count) {
+    char **copy = malloc(count * sizeof(char *));
+    if (copy == NULL) return NULL;
+
+    for (int i = 0; i < count; i++) {
+        copy[i] = malloc((strlen(array[i])+1) * sizeof(char));
+
+        if (copy[i] == NULL) {
+            string_array_free(copy, i);
+            return NULL;
+        }
+
+        strcpy(copy[i], array[i]);
+    }
+
+    return copy;
+}
+
+void string_array_free(char **array, int count) {
+    if (array == NULL) return;
+
+    for (int i = 0; i < count; i++)
+        free(array[i]);
+
+    free(array);
+}
+
 ssize_t read_eof(int fd, char *buf, ssize_t nbytes)
 {
     ssize_t bytes_read = 0;  // Bytes read so far
@@ -95,7 +526,7 @@ ssize_t read_line(int fd, char *buf, ssize_t nbytes) {
         bytes = read(fd, buf + i, 1); // Read one character
 
         if (bytes <= 0) {
-            if (errno != EINTR)
+            if (bytes == 0 || errno != EINTR)
                 return -1;
             
             i--;
@@ -135,21 +566,86 @@ ssize_t write_bytes(int fd, char *buf, ssize_t nbytes)
     return bytes_written;
 }
 
+ssize_t pwrite_bytes(int fd, char *buf, size_t nbytes, off_t offset) {
+    size_t bytes_written = 0;
+
+    while (bytes_written < nbytes) {
+        ssize_t bytes = pwrite(fd, buf + bytes_written, nbytes - bytes_written, offset + bytes_written);
+
+        if (bytes < 0) {
+            if (errno != EINTR)
+                return -1;
+
+            continue;
+        }
+
+        bytes_written += bytes;
+    }
+
+    return bytes_written;
+}
+
+ssize_t write_frame(int fd, char *buf, ssize_t nbytes) {
+    char header[32];
+    snprintf(header, sizeof(header), "%zd\n", nbytes);
+
+    if (write_bytes(fd, header, strlen(header)) < 0)
+        return -1;
+
+    if (nbytes > 0 && write_bytes(fd, buf, nbytes) < 0)
+        return -1;
+
+    return nbytes;
+}
+
+ssize_t read_frame(int fd, char *buf, ssize_t nbytes) {
+    char header[32];
+
+    // Read length of frame
+    if (read_line(fd, header, sizeof(header)) < 0)
+        return -1;
+
+    ssize_t frame_len = atol(header);
+    ssize_t copy_len = frame_len < nbytes-1? frame_len: nbytes-1;
+
+    if (read_eof(fd, buf, copy_len) != copy_len)
+        return -1;
+
+    buf[copy_len] = '\0';
+
+    // Discard rest of frame
+    char discard[BUF_SIZE];
+    ssize_t left = frame_len - copy_len;
+
+    while (left > 0) {
+        ssize_t bytes = read_eof(fd, discard, left < BUF_SIZE? left: BUF_SIZE);
+        if (bytes <= 0) return -1;
+        left -= bytes;
+    }
+
+    return frame_len;
+}
+
 int get_date_time(char *buffer, size_t size) {
-    time_t t = time(NULL);
+    return format_date_time(time(NULL), buffer, size);
+}
+
+int format_date_time(long long t, char *buffer, size_t size) {
+    time_t seconds = t;
 
-    if (t < 0 || size < 20) {
+    if (seconds < 0 || size < 20) {
         strcpy(buffer, "----Unknown time----");
         return -1;
     }
 
-    struct tm *tmp = localtime(&t);
-    if (tmp == NULL) {
+    // The threads of the manager format times at the same time
+    struct tm tm;
+    if (localtime_r(&seconds, &tm) == NULL) {
         strcpy(buffer, "----Unknown time----");
         return -1;
     }
 
-    if (strftime(buffer, size, "%Y-%d-%m %X", tmp) == 0) {
+    if (strftime(buffer, size, "%Y-%d-%m %X", &tm) == 0) {
         strcpy(buffer, "----Unknown time----");
         return -1;
     }
@@ -157,5 +653,39 @@ int get_date_time(char *buffer, size_t size) {
     return 0;
 }
 
+char *sync_operation_name(enum sync_operation operation) {
+    static char *names[] = {"FULL", "MIRROR", "ADDED", "MODIFIED", "DELETED", "ATTRIB", "SNAPSHOT", "RESTORE", "NONE"};
+    return names[operation];
+}
 
+int sync_operation_whole_dir(enum sync_operation operation) {
+    return operation == OP_FULL || operation == OP_MIRROR || operation == OP_SNAPSHOT || operation == OP_RESTORE;
+}
 
+char *durability_name(enum durability durability) {
+    static char *names[] = {"none", "file", "batch"};
+    return names[durability];
+}
+
+int durability_parse(char *name) {
+    for (enum durability durability = DURABILITY_NONE; durability <= DURABILITY_BATCH; durability++) {
+        if (!strcmp(durability_name(durability), name))
+            return durability;
+    }
+
+    return -1;
+}
+
+char *sync_status_name(enum sync_status status) {
+    static char *names[] = {"None", "SUCCESS", "PARTIAL", "ERROR", "CANCELLED", "TIMEOUT"};
+    return names[status];
+}
+
+enum sync_status sync_status_parse(char *name) {
+    for (enum sync_status status = SYNC_SUCCESS; status <= SYNC_TIMEOUT; status++) {
+        if (!strcmp(sync_status_name(status), name))
+            return status;
+    }
+
+    return SYNC_ERROR;
+}
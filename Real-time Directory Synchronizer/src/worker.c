@@ -1,299 +1,421 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <signal.h>
 #include "../include/util.h"
+#include "../include/throttle.h"
+#include "../include/snapshot.h"
+#include "../include/name_filter.h"
 
 #define ERR_BUF_SIZE_DEFAULT 4096
 #define BUF_SIZE 1024
+#define SIZE_REPORT_MIN (1024 * 1024)   // Smaller files add less than a second to the timeout of the
+                                        // worker and their size isn't reported
 
 // Struct used for error reporting
 struct error_buffer {
     char *buffer;
     int size;        // Current size of buffer - buffer is reallocated if needed
     int pos;         // Last written byte of buffer
-} error_buffer;
+};
+
+// Struct with the results of the job for one target directory
+// A separate report is written for every target, in the order the targets were given
+struct target_report {
+    char *tar_dir;
+    struct error_buffer error_buffer;
+    int files_processed;
+    int files_failed;
+    int files_unchanged;      // Files of FULL that were skipped because the target was up to date
+    int files_deleted;        // Files of MIRROR deleted because they are not in the source
+    long long bytes_copied;   // Bytes of data written to this target, holes of sparse files excluded
+    long long bytes_logical;  // Total size of files copied successfully to this target
+    char details[128];        // Details of a snapshot or a restore, empty for other jobs
+    int failed;      // Set to 1 if target can't be used at all, e.g. if it can't be opened
+};
+
+struct target_report reports[MAX_TARGETS];
+int num_of_targets = 1;
+
+Throttle throttle = NULL;    // Limits rate of copies, NULL if the worker isn't throttled
+int snapshot_keep = 0;       // Snapshots kept for every target, 0 if the pair has no snapshots
+int copy_flags = 0;          // Flags of every file_copy, set by the options of the pair
+enum durability durability = DURABILITY_NONE;
+int targets_changed = 0;     // Set once a job has changed a target
+NameFilter filter = NULL;    // Patterns of the files full syncs and mirrors skip, NULL if none
+long long max_bytes = 0;     // Bytes of files after which the jobs that are left are handed back, 0 for no limit
+volatile sig_atomic_t cancelled = 0;   // Set by SIGTERM, when the manager cancels the job
+
+extern char *optarg;
+extern int optind;
 
 // Function prototypes
-int write_to_err_buf(struct error_buffer error_buffer, char *file, char *func);
-void report_status_success(int files_processed);
+int write_to_err_buf(struct error_buffer *error_buffer, char *file, char *func);
+int write_to_err_buf_at(struct error_buffer *error_buffer, char *dir, char *file, char *func);
+void report_file_error(struct target_report *report, enum file_management_error err_num, char *dir, char *file);
+void report_status_success(int files_processed, int files_unchanged, int files_deleted, long long bytes_copied, long long bytes_logical);
 void report_status_error(struct error_buffer error_buffer);
-void report_status_partial(struct error_buffer error_buffer, int files_processed, int files_failed);
+void report_status_partial(struct error_buffer error_buffer, int files_processed, int files_failed, int files_deleted, long long bytes_copied, long long bytes_logical);
+void report_status_cancelled(struct error_buffer error_buffer, int files_processed, int files_failed, long long bytes_copied, long long bytes_logical);
+void report_status_snapshot(char *details);
+void report_status_deferred(void);
 void report_irrecoverable_error(char *error, int use_errno);
-
+void free_reports(void);
+void run_job(char *op_str, char *filename, char *src_dir_name, int src_dir_fd, int *fds, int *tar_indexes, int num_of_fds);
+int write_reports(void);
+void reset_reports(void);
+void cancel_job(int sig);
+int throttle_bytes(long long bytes);
+int throttle_file(void);
+void count_progress(void);
+void report_size(long long size);
+void report_copy(enum file_management_error src_err, enum file_management_error *tar_errs, int *indexes, int count, char *src_dir_name, char *file, struct copy_stats *stats);
+int delete_target_file(struct target_report *report, int tar_dir_fd, char *file);
+int target_file_unchanged(int tar_dir_fd, struct dir_entry *entry);
+int same_file(struct dir_entry *src, struct dir_entry *tar);
+int take_snapshots(int *fds, int *tar_indexes, int num_of_fds, int details);
+void restore_snapshot(char *name, int tar_dir_fd, struct target_report *report);
+int file_has_links(int tar_dir_fd, char *file);
+void sync_targets(int *fds, int *tar_indexes, int num_of_fds);
+int file_filtered(char *file);
+
+// Usage: worker [-t <extra_target>]... [-r <fd>:<slot>:<worker_slot>] [-s <keep>] [-a] [-d <durability>] [-b <bytes>] <source_dir> <target_dir> <filename> <operation> [<filename> <operation>]...
+// Operation is FULL, MIRROR, ADDED, MODIFIED, ATTRIB, DELETED, SNAPSHOT or RESTORE, filename is
+// ignored for FULL, MIRROR and SNAPSHOT and is the name of the snapshot for RESTORE
+// Every filename and operation is a job, the jobs are run in the order they are given and each one
+// writes a report for every target, so several files of a pair are synced by one worker
+// Every -t option adds a target directory that gets the same changes as target_dir
+// The -r option gives the shared memory file of the manager's token buckets and the slot whose
+// bucket this worker shares with the other workers of its pair, its limits are applied to every copy.
+// Every file or block taken from the bucket and every file looked at counts as progress of the worker
+// in the counter of its worker slot, which the watchdog of the manager checks
+// Before a file of at least SIZE_REPORT_MIN bytes is copied, a line "SIZE: <bytes>" is written, which
+// gives the worker more time for its copy
+// The -s option is given for pairs with snapshots: targets are snapshotted before every FULL and
+// MIRROR, only the newest keep snapshots of a target are kept and files are replaced instead of
+// being changed in place, so that the snapshots keep their contents
+// The -a option replaces files the same way, so that readers of a target never see a partial file
+// The -d option is file to write every file to disk before its job succeeds, or batch to write all
+// changes to disk with one syncfs of every file system of the targets before the last reports
+// The -b option hands back the jobs that are left once the files copied add up to bytes, with a
+// DEFERRED report for every target, so that the manager can give them to another worker
+// SIGTERM cancels the jobs: the file being copied is removed from the targets and no other file
+// is synced, then a CANCELLED report is written for every target of every job that is left
 int main(int argc, char *argv[]) {
 
-    // Initialize error buffer
-    error_buffer.size = ERR_BUF_SIZE_DEFAULT;
-    error_buffer.pos = 0;
-    error_buffer.buffer = malloc(error_buffer.size * sizeof(char));
-
-    if (error_buffer.buffer == NULL) {
-        report_irrecoverable_error("malloc failed", 1);
-        exit(EXIT_FAILURE);
+    // Handle cancelling, system calls are restarted so that only the copy loop notices it
+    struct sigaction cancel_action;
+    memset(&cancel_action, 0, sizeof(cancel_action));
+    cancel_action.sa_handler = cancel_job;
+    cancel_action.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &cancel_action, NULL);
+
+    // Parse extra targets
+    char *extra_targets[MAX_TARGETS];
+    int num_of_extra_targets = 0;
+
+    int opt, throttle_fd, throttle_slot, worker_slot;
+    while ((opt = getopt(argc, argv, "t:r:s:ad:i:x:b:")) != -1) {
+        if (opt == 't' && num_of_extra_targets < MAX_TARGETS-1) {
+            extra_targets[num_of_extra_targets++] = optarg;
+        } else if (opt == 'r' && sscanf(optarg, "%d:%d:%d", &throttle_fd, &throttle_slot, &worker_slot) == 3) {
+            // Copies are not throttled if the buckets can't be mapped
+            throttle = throttle_attach(throttle_fd, throttle_slot, worker_slot);
+        } else if (opt == 's' && (snapshot_keep = atoi(optarg)) > 0) {
+            copy_flags |= COPY_REPLACE;
+        } else if (opt == 'a') {
+            copy_flags |= COPY_REPLACE;
+        } else if (opt == 'd' && (int) (durability = durability_parse(optarg)) >= 0) {
+            if (durability == DURABILITY_FILE) copy_flags |= COPY_SYNC;
+        } else if (opt == 'b') {
+            max_bytes = atoll(optarg);
+        } else if (opt == 'i' || opt == 'x') {
+            if ((filter == NULL && (filter = name_filter_init()) == NULL) || name_filter_add(filter, optarg, opt == 'i') == -1) {
+                report_irrecoverable_error("malloc failed", 1);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            report_irrecoverable_error("Invalid option", 0);
+            exit(EXIT_FAILURE);
+        }
     }
 
     // Check argument count
-    if (argc != 5) {
+    if (argc - optind < 4 || (argc - optind) % 2) {
         report_irrecoverable_error("Wrong number of arguments", 0);
-        free(error_buffer.buffer);
         exit(EXIT_FAILURE);
     }
 
     // Get arguments
-    char *src_dir_name = argv[1];
-    char *tar_dir_name = argv[2];
-    char *op_str = argv[4];
-    char *filename = !strcmp(op_str, "FULL")? "ALL": argv[3];
-
-    int files_processed = 0;
-    int files_failed = 0;
+    char *src_dir_name = argv[optind];
 
-    enum file_management_error err_num; // Used for error handling when copying files
-    int err_file;                       // Indicates which file error occured in - 0 for source, 1 for target
+    num_of_targets = 1 + num_of_extra_targets;
+    reports[0].tar_dir = argv[optind+1];
 
-    // OPERATION: FULL
-    if (!strcmp(op_str, "FULL")) {
+    for (int t = 1; t < num_of_targets; t++)
+        reports[t].tar_dir = extra_targets[t-1];
 
-        // Open source and target directories
-        DIR *src_dir = opendir(src_dir_name); 
+    // Initialize reports
+    for (int t = 0; t < num_of_targets; t++) {
+        reports[t].failed = 0;
+        reports[t].error_buffer.size = ERR_BUF_SIZE_DEFAULT;
+        reports[t].error_buffer.buffer = malloc(ERR_BUF_SIZE_DEFAULT * sizeof(char));
 
-        if (src_dir == NULL) {
-            write_to_err_buf(error_buffer, src_dir_name, "opendir failed");
-            report_status_error(error_buffer); free(error_buffer.buffer);
+        if (reports[t].error_buffer.buffer == NULL) {
+            report_irrecoverable_error("malloc failed", 1);
             exit(EXIT_FAILURE);
         }
+    }
 
-        DIR *tar_dir = opendir(tar_dir_name);
+    reset_reports();
 
-        if (tar_dir == NULL) {
-            write_to_err_buf(error_buffer, tar_dir_name, "opendir failed");
-            report_status_error(error_buffer); free(error_buffer.buffer);
-            closedir(src_dir);
-            exit(EXIT_FAILURE);
-        }
+    // Open source and target directories, every file is then opened relative to them
+    int src_dir_fd = open(src_dir_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-        // Go through directory
-        struct dirent *src_dir_ent;
-        while (1) {
-            errno = 0;
-            src_dir_ent = readdir(src_dir);
-            
-            if (src_dir_ent == NULL) {
-                if (!errno) break; // All entities have been read
-
-                write_to_err_buf(error_buffer, src_dir_name, "readdir failed");
-                report_status_error(error_buffer); free(error_buffer.buffer);
-                exit(EXIT_FAILURE);
-            }
+    if (src_dir_fd < 0) {
+        for (int t = 0; t < num_of_targets; t++)
+            write_to_err_buf(&reports[t].error_buffer, src_dir_name, "opendir failed");
 
-            // Skip unnecessary files
-            if (src_dir_ent->d_ino == 0 || !strcmp(src_dir_ent->d_name, ".") || !strcmp(src_dir_ent->d_name, "..")) continue;
+        for (int j = optind + 2; j < argc; j += 2) {
+            for (int t = 0; t < num_of_targets; t++)
+                report_status_error(reports[t].error_buffer);
+        }
 
-            // Create name of source file
-            char *src_file_name = file_name_concat(src_dir_name, src_dir_ent->d_name);
-            
-            if (src_file_name == NULL) {
-                report_irrecoverable_error("malloc failed", 1); 
-                free(error_buffer.buffer);
-                closedir(src_dir); closedir(tar_dir);
-                exit(EXIT_FAILURE);
-            }
+        free_reports();
+        exit(EXIT_FAILURE);
+    }
 
-            // Create name of new file in target directory
-            char *tar_file_name = file_name_concat(tar_dir_name, src_dir_ent->d_name);
+    int tar_dir_fds[MAX_TARGETS];
 
-            if (tar_file_name == NULL) {
-                report_irrecoverable_error("malloc failed", 1); 
-                free(error_buffer.buffer); free(src_file_name);
-                closedir(src_dir); closedir(tar_dir);
-                exit(EXIT_FAILURE);
-            }
+    for (int t = 0; t < num_of_targets; t++) {
+        tar_dir_fds[t] = open(reports[t].tar_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-            // Copy source to target
-            err_num = file_copy(src_file_name, tar_file_name, &err_file);
+        if (tar_dir_fds[t] < 0) {
+            write_to_err_buf(&reports[t].error_buffer, reports[t].tar_dir, "opendir failed");
+            reports[t].failed = 1;
+        }
+    }
 
-            if (err_num == SUCCESS) {
-                free(src_file_name); free(tar_file_name);
-                files_processed++;
-                continue;
-            }
-            
-            // Check error
-            int check_alloc;
-            switch (err_num) {
-                case OPEN_FAILED:
-                    check_alloc = write_to_err_buf(error_buffer, err_num? tar_file_name: src_file_name, "open failed");
-                    break;
-                case READ_FAILED:
-                    check_alloc = write_to_err_buf(error_buffer, src_file_name, "read failed");
-                    break;
-                case WRITE_FAILED:
-                    check_alloc = write_to_err_buf(error_buffer, tar_file_name, "write failed");
-                    break;
-                default:
-                    check_alloc = write_to_err_buf(error_buffer, err_num? tar_file_name: src_file_name, "unknown failure");
-                    break;
-            }
+    // Directories of targets that haven't failed
+    int fds[MAX_TARGETS];
+    int tar_indexes[MAX_TARGETS];      // Index of report for each directory in fds
+    int num_of_fds = 0;
 
-            if (check_alloc < 0) {
-                report_irrecoverable_error("malloc failed", 1);
-                closedir(src_dir); closedir(tar_dir);
-                free(src_file_name); free(tar_file_name);
-            }
+    for (int t = 0; t < num_of_targets; t++) {
+        if (reports[t].failed) continue;
 
-            free(src_file_name); free(tar_file_name);
-            files_failed++;
-        }
+        fds[num_of_fds] = tar_dir_fds[t];
+        tar_indexes[num_of_fds++] = t;
+    }
 
-        closedir(src_dir); closedir(tar_dir);
+    // Run every job and write its reports before the next one starts, jobs after a cancel are skipped
+    // and jobs after the byte limit are handed back
+    int exit_status = EXIT_SUCCESS, deferred = 0;
+    long long copied_bytes = 0;
 
-    // OPERATION: ADDED or OPERATION: MODIFIED
-    } else if (!strcmp(op_str, "ADDED") || !strcmp(op_str, "MODIFIED")) {
-        // Create name of source file
-        char *src_file_name = file_name_concat(src_dir_name, filename);
-            
-        if (src_file_name == NULL) {
-            report_irrecoverable_error("malloc failed", 1);
-            free(error_buffer.buffer);
-            exit(EXIT_FAILURE);
+    for (int j = optind + 2; j < argc; j += 2) {
+        char *op_str = argv[j+1];
+        char *filename = !strcmp(op_str, "FULL") || !strcmp(op_str, "MIRROR") || !strcmp(op_str, "SNAPSHOT")? "ALL": argv[j];
+
+        if (deferred && !cancelled) {
+            for (int t = 0; t < num_of_targets; t++)
+                report_status_deferred();
+            continue;
         }
 
-        // Create name of file in target directory
-        char *tar_file_name = file_name_concat(tar_dir_name, filename);
+        if (!cancelled)
+            run_job(op_str, filename, src_dir_name, src_dir_fd, fds, tar_indexes, num_of_fds);
 
-        if (tar_file_name == NULL) {
-            report_irrecoverable_error("malloc failed", 1);
-            free(error_buffer.buffer); free(src_file_name);
-            exit(EXIT_FAILURE);
-        }
+        // Size of the file of the job counts once, however many targets it was copied to
+        long long job_bytes = 0;
 
-        // Copy source to target
-        err_num = file_copy(src_file_name, tar_file_name, &err_file);
-
-        if (err_num == SUCCESS) {
-            files_processed++;
-            free(src_file_name); free(tar_file_name);
-        } else { // Check error
-            switch (err_num) {
-                case OPEN_FAILED:
-                    write_to_err_buf(error_buffer, err_num? tar_file_name: src_file_name, "open failed");
-                    break;
-                case READ_FAILED:
-                    write_to_err_buf(error_buffer, src_file_name, "read failed");
-                    break;
-                case WRITE_FAILED:
-                    write_to_err_buf(error_buffer, tar_file_name, "write failed");
-                    break;
-                default:
-                    write_to_err_buf(error_buffer, err_num? tar_file_name: src_file_name, "unknown failure");
-                    break;
-            }
-            free(src_file_name); free(tar_file_name);
-            report_status_error(error_buffer); free(error_buffer.buffer);
-            exit(EXIT_FAILURE);
+        for (int t = 0; t < num_of_targets; t++) {
+            targets_changed |= reports[t].files_processed > 0 || reports[t].files_deleted > 0;
+            if (reports[t].bytes_logical > job_bytes) job_bytes = reports[t].bytes_logical;
         }
 
-    } else if (!strcmp(op_str, "DELETED")) {
-        // Create name of file in target directory
-        char *tar_file_name = file_name_concat(tar_dir_name, filename);
+        copied_bytes += job_bytes;
+        deferred = max_bytes > 0 && copied_bytes >= max_bytes;
 
-        if (tar_file_name == NULL) {
-            write_to_err_buf(error_buffer, filename, "malloc failed");
-            report_status_error(error_buffer); free(error_buffer.buffer);
-            exit(EXIT_FAILURE);
-        }
+        // Changes of every job are written to disk together, any error is reported with the last job that runs
+        if (durability == DURABILITY_BATCH && targets_changed && (j + 2 >= argc || deferred))
+            sync_targets(fds, tar_indexes, num_of_fds);
 
-        // Delete file
-        if (unlink(tar_file_name) < 0) {
-            write_to_err_buf(error_buffer, tar_file_name, "unlink failed");
-            report_status_error(error_buffer); free(error_buffer.buffer);
-            free(tar_file_name);
-            exit(EXIT_FAILURE);
-        }
-        
-        free(tar_file_name);
-        files_processed++;
-    }
+        if (write_reports() != EXIT_SUCCESS)
+            exit_status = EXIT_FAILURE;
 
-    if (!files_failed) {
-        report_status_success(files_processed);
-        free(error_buffer.buffer);
-        exit(EXIT_SUCCESS);
+        reset_reports();
     }
 
-    if (!files_processed) {
-        report_status_error(error_buffer);
-        free(error_buffer.buffer);
-        exit(EXIT_FAILURE);
+    close(src_dir_fd);
+
+    for (int t = 0; t < num_of_targets; t++) {
+        if (tar_dir_fds[t] >= 0) close(tar_dir_fds[t]);
     }
 
-    report_status_partial(error_buffer, files_processed, files_failed);
-    free(error_buffer.buffer);
-    exit(EXIT_SUCCESS);
+    free_reports();
+    if (throttle != NULL) throttle_destroy(throttle);
+    exit(exit_status);
 }
 
 // Writes a line to error_buffer indicating an error while using func for file
 // The line follows the format: -File: <file> - <func>: <error>
 // <error> is taken from errno
-int write_to_err_buf(struct error_buffer error_buffer, char *file, char *func) {
+int write_to_err_buf(struct error_buffer *error_buffer, char *file, char *func) {
     char *error_str = strerror(errno);
     int error_mes_len = 14+strlen(file)+strlen(error_str)+strlen(func);
 
     // Resize buffer if needed
-    while (error_mes_len > error_buffer.size-error_buffer.pos) {
-        error_buffer.buffer = realloc(error_buffer.buffer, error_buffer.size * 1.5 * sizeof(char));
-        if (error_buffer.buffer == NULL) {
+    while (error_mes_len > error_buffer->size-error_buffer->pos) {
+        char *new_buffer = realloc(error_buffer->buffer, error_buffer->size * 2 * sizeof(char));
+        if (new_buffer == NULL) {
             return -1;
         }
+
+        error_buffer->buffer = new_buffer;
+        error_buffer->size *= 2;
     }
-    
+
     // Write to buffer
-    snprintf(error_buffer.buffer + error_buffer.pos, error_mes_len, "-File: %s - %s: %s\n", file, func, error_str);
+    snprintf(error_buffer->buffer + error_buffer->pos, error_mes_len, "-File: %s - %s: %s\n", file, func, error_str);
 
     // Move positition
-    error_buffer.pos += error_mes_len-1;
+    error_buffer->pos += error_mes_len-1;
     return 0;
 }
 
-// Write successful report to stdout
-void report_status_success(int files_processed) {
-    char *report = "EXEC_REPORT_START\nSTATUS: SUCCESS\nDETAILS: %d files copied\nEXEC_REPORT_END\n";
+// Same as write_to_err_buf for file of directory dir
+// The path of the file is only built here, so that it is not needed unless an error occurs
+int write_to_err_buf_at(struct error_buffer *error_buffer, char *dir, char *file, char *func) {
+    int err = errno;
+    char *path = file_name_concat(dir, file);
+    if (path == NULL) return -1;
+
+    errno = err;
+    int result = write_to_err_buf(error_buffer, path, func);
+
+    free(path);
+    return result;
+}
+
+// Adds error err_num that occured in file of directory dir while copying a file to report
+void report_file_error(struct target_report *report, enum file_management_error err_num, char *dir, char *file) {
+    int check_alloc;
+
+    switch (err_num) {
+        case OPEN_FAILED:
+            check_alloc = write_to_err_buf_at(&report->error_buffer, dir, file, "open failed");
+            break;
+        case READ_FAILED:
+            check_alloc = write_to_err_buf_at(&report->error_buffer, dir, file, "read failed");
+            break;
+        case WRITE_FAILED:
+            check_alloc = write_to_err_buf_at(&report->error_buffer, dir, file, "write failed");
+            break;
+        case METADATA_FAILED:
+            check_alloc = write_to_err_buf_at(&report->error_buffer, dir, file, "metadata update failed");
+            break;
+        default:
+            check_alloc = write_to_err_buf_at(&report->error_buffer, dir, file, "unknown failure");
+            break;
+    }
+
+    if (check_alloc < 0) {
+        report_irrecoverable_error("malloc failed", 1);
+        exit(EXIT_FAILURE);
+    }
+
+    report->files_failed++;
+}
 
-    int buffer_len = strlen(report) + 100;
+// Write successful report to stdout
+// Bytes line has the bytes written, followed by the total size of the files copied
+// Files that were already up to date or deleted by MIRROR are only mentioned if there are any
+void report_status_success(int files_processed, int files_unchanged, int files_deleted, long long bytes_copied, long long bytes_logical) {
+    char *report = "EXEC_REPORT_START\nSTATUS: SUCCESS\nDETAILS: %d files copied%s%s, %lld of %lld bytes written\nBYTES: %lld %lld\nEXEC_REPORT_END\n";
+
+    char unchanged[40] = "", deleted[40] = "";
+    if (files_unchanged > 0)
+        snprintf(unchanged, sizeof(unchanged), ", %d unchanged", files_unchanged);
+    if (files_deleted > 0)
+        snprintf(deleted, sizeof(deleted), ", %d deleted", files_deleted);
+
+    int buffer_len = strlen(report) + 180;
     char buffer[buffer_len];
 
-    snprintf(buffer, buffer_len, report, files_processed);
+    snprintf(buffer, buffer_len, report, files_processed, unchanged, deleted, bytes_copied, bytes_logical, bytes_copied, bytes_logical);
+    write_bytes(STDOUT_FILENO, buffer, strlen(buffer));
+}
+
+// Write successful report of a snapshot or a restore to stdout, whose details line is details
+void report_status_snapshot(char *details) {
+    char buffer[300];
+
+    snprintf(buffer, sizeof(buffer), "EXEC_REPORT_START\nSTATUS: SUCCESS\nDETAILS: %s\nBYTES: 0 0\nEXEC_REPORT_END\n", details);
     write_bytes(STDOUT_FILENO, buffer, strlen(buffer));
 }
 
+// Write report of a job that is handed back to the manager without being started to stdout
+void report_status_deferred(void) {
+    char *report = "EXEC_REPORT_START\nSTATUS: DEFERRED\nDETAILS: Byte limit of worker reached\nEXEC_REPORT_END\n";
+    write_bytes(STDOUT_FILENO, report, strlen(report));
+}
+
 // Write error report to stdout
 void report_status_error(struct error_buffer error_buffer) {
     char *report_start = "EXEC_REPORT_START\nSTATUS: ERROR\nDETAILS: 0 files copied\nERRORS:\n";
     char *report_end = "EXEC_REPORT_END\n";
 
     write_bytes(STDOUT_FILENO, report_start, strlen(report_start));
-    write_bytes(STDOUT_FILENO, error_buffer.buffer, strlen(error_buffer.buffer));
+    write_bytes(STDOUT_FILENO, error_buffer.buffer, error_buffer.pos);
     write_bytes(STDOUT_FILENO, report_end, strlen(report_end));
 }
 
 // Write partial report to stdout
-void report_status_partial(struct error_buffer error_buffer, int files_processed, int files_failed) {
-    char report_start[200];
-    snprintf(report_start, 200, "EXEC_REPORT_START\nSTATUS: PARTIAL\nDETAILS: %d files copied, %d files skipped\nERRORS:\n", files_processed, files_failed);
+void report_status_partial(struct error_buffer error_buffer, int files_processed, int files_failed, int files_deleted, long long bytes_copied, long long bytes_logical) {
+    char deleted[40] = "";
+    if (files_deleted > 0)
+        snprintf(deleted, sizeof(deleted), ", %d deleted", files_deleted);
+
+    char report_start[250];
+    snprintf(report_start, 250, "EXEC_REPORT_START\nSTATUS: PARTIAL\nDETAILS: %d files copied%s, %d files skipped, %lld of %lld bytes written\nBYTES: %lld %lld\nERRORS:\n",
+        files_processed, deleted, files_failed, bytes_copied, bytes_logical, bytes_copied, bytes_logical);
 
     char *report_end = "EXEC_REPORT_END\n";
 
     write_bytes(STDOUT_FILENO, report_start, strlen(report_start));
-    write_bytes(STDOUT_FILENO, error_buffer.buffer, strlen(error_buffer.buffer));
+    write_bytes(STDOUT_FILENO, error_buffer.buffer, error_buffer.pos);
     write_bytes(STDOUT_FILENO, report_end, strlen(report_end));
 }
 
-// Write irrecoverable error report to stdout
+// Write report of cancelled job to stdout
+// Files synced before the job was cancelled are kept, errors are only listed if there are any
+void report_status_cancelled(struct error_buffer error_buffer, int files_processed, int files_failed, long long bytes_copied, long long bytes_logical) {
+    char report_start[250];
+    snprintf(report_start, 250, "EXEC_REPORT_START\nSTATUS: CANCELLED\nDETAILS: Cancelled after %d files copied, %d files skipped, %lld of %lld bytes written\nBYTES: %lld %lld\n",
+        files_processed, files_failed, bytes_copied, bytes_logical, bytes_copied, bytes_logical);
+
+    char *errors = "ERRORS:\n";
+    char *report_end = "EXEC_REPORT_END\n";
+
+    write_bytes(STDOUT_FILENO, report_start, strlen(report_start));
+
+    if (error_buffer.pos > 0) {
+        write_bytes(STDOUT_FILENO, errors, strlen(errors));
+        write_bytes(STDOUT_FILENO, error_buffer.buffer, error_buffer.pos);
+    }
+
+    write_bytes(STDOUT_FILENO, report_end, strlen(report_end));
+}
+
+// Write irrecoverable error report to stdout, once for every target
 // This happens when the worker fails unexpectedly because of a function call
 // and has to be stopped immediately
 // It is only used when malloc fails or when the number of arguments is wrong
@@ -309,9 +431,550 @@ void report_irrecoverable_error(char *issue, int use_errno) {
     if (use_errno)
         snprintf(message, 200, "%s: %s\n", issue, error);
     else
-        strcpy(message, issue);
+        snprintf(message, 200, "%s\n", issue);
 
-    write_bytes(STDOUT_FILENO, report_start, strlen(report_start));
-    write_bytes(STDOUT_FILENO, message, strlen(message));
-    write_bytes(STDOUT_FILENO, report_end, strlen(report_end));
-}
\ No newline at end of file
+    for (int t = 0; t < num_of_targets; t++) {
+        write_bytes(STDOUT_FILENO, report_start, strlen(report_start));
+        write_bytes(STDOUT_FILENO, message, strlen(message));
+        write_bytes(STDOUT_FILENO, report_end, strlen(report_end));
+    }
+}
+
+// Runs operation op_str for filename of the source, which is ALL for FULL and MIRROR, and adds
+// its results to the reports of the targets in fds, whose reports are at tar_indexes
+void run_job(char *op_str, char *filename, char *src_dir_name, int src_dir_fd, int *fds, int *tar_indexes, int num_of_fds) {
+    enum file_management_error tar_errs[MAX_TARGETS];
+    struct copy_stats stats;
+
+    // Targets whose snapshot fails are not synced, so a full sync never overwrites files that
+    // would be lost without a snapshot
+    int snap_fds[MAX_TARGETS], snap_indexes[MAX_TARGETS];
+    if (snapshot_keep > 0 && (!strcmp(op_str, "FULL") || !strcmp(op_str, "MIRROR"))) {
+        memcpy(snap_fds, fds, num_of_fds * sizeof(int));
+        memcpy(snap_indexes, tar_indexes, num_of_fds * sizeof(int));
+
+        num_of_fds = take_snapshots(snap_fds, snap_indexes, num_of_fds, 0);
+        fds = snap_fds;
+        tar_indexes = snap_indexes;
+    }
+
+    // OPERATION: FULL
+    if (!strcmp(op_str, "FULL") && num_of_fds > 0) {
+        DirScanner scanner = dir_scanner_init(src_dir_fd);
+
+        if (scanner == NULL) {
+            report_irrecoverable_error("malloc failed", 1);
+            exit(EXIT_FAILURE);
+        }
+
+        // Go through directory
+        struct dir_entry entry;
+        int scan_result;
+
+        while (!cancelled && (scan_result = dir_scanner_next(scanner, &entry)) == 1) {
+            count_progress();
+
+            // Directories, symbolic links, sockets etc. and files filtered out by the pair are not synced
+            if (entry.type != DT_REG || file_filtered(entry.name)) continue;
+
+            // Copy only to targets whose file differs from the source
+            int num_of_copies = 0;
+            int copy_fds[MAX_TARGETS];
+            int copy_indexes[MAX_TARGETS];
+
+            for (int f = 0; f < num_of_fds; f++) {
+                if (target_file_unchanged(fds[f], &entry)) {
+                    reports[tar_indexes[f]].files_unchanged++;
+                    continue;
+                }
+
+                copy_fds[num_of_copies] = fds[f];
+                copy_indexes[num_of_copies++] = tar_indexes[f];
+            }
+
+            if (num_of_copies == 0) continue;
+
+            // Copy source to targets, unless the job was cancelled while waiting
+            if (throttle_file()) break;
+            enum file_management_error src_err = file_copy(src_dir_fd, entry.name, copy_fds, num_of_copies, tar_errs, &stats, report_size, throttle_bytes, copy_flags);
+            report_copy(src_err, tar_errs, copy_indexes, num_of_copies, src_dir_name, entry.name, &stats);
+        }
+
+        if (!cancelled && scan_result < 0) {
+            for (int t = 0; t < num_of_targets; t++) {
+                write_to_err_buf(&reports[t].error_buffer, src_dir_name, "getdents64 failed");
+                reports[t].failed = 1;
+            }
+        }
+
+        dir_scanner_destroy(scanner);
+
+    // OPERATION: MIRROR
+    // Like FULL, but files of the targets that are not in the source are deleted
+    // The sorted lists of the source and of every target are merged, which finds the files a
+    // target is missing, has changed or has extra in one pass
+    } else if (!strcmp(op_str, "MIRROR") && num_of_fds > 0) {
+        struct dir_list src_list, tar_list;
+        int list_check = dir_scanner_list(src_dir_fd, 1, &src_list);
+
+        if (list_check == -1) {
+            report_irrecoverable_error("malloc failed", 1);
+            exit(EXIT_FAILURE);
+        }
+
+        // Nothing is deleted if the source can't be listed
+        if (list_check == -2) {
+            for (int t = 0; t < num_of_targets; t++) {
+                write_to_err_buf(&reports[t].error_buffer, src_dir_name, "getdents64 failed");
+                reports[t].failed = 1;
+            }
+        } else {
+            // Bit f of a source file is set if it must be copied to the target of fds[f]
+            unsigned int *copy_masks = calloc(src_list.count + 1, sizeof(unsigned int));
+
+            if (copy_masks == NULL) {
+                report_irrecoverable_error("malloc failed", 1);
+                exit(EXIT_FAILURE);
+            }
+
+            for (int f = 0; f < num_of_fds && !cancelled; f++) {
+                struct target_report *report = &reports[tar_indexes[f]];
+                list_check = dir_scanner_list(fds[f], 0, &tar_list);
+
+                if (list_check == -1) {
+                    report_irrecoverable_error("malloc failed", 1);
+                    exit(EXIT_FAILURE);
+                }
+
+                if (list_check == -2) {
+                    write_to_err_buf(&report->error_buffer, report->tar_dir, "getdents64 failed");
+                    report->failed = 1;
+                    continue;
+                }
+
+                size_t s = 0, t = 0;
+
+                while ((s < src_list.count || t < tar_list.count) && !cancelled) {
+                    count_progress();
+                    int cmp = s == src_list.count? 1: t == tar_list.count? -1: strcmp(src_list.entries[s].name, tar_list.entries[t].name);
+
+                    // Filtered files are neither copied nor deleted
+                    if (cmp < 0) {
+                        // File is missing from target
+                        if (!file_filtered(src_list.entries[s].name))
+                            copy_masks[s] |= 1u << f;
+                        s++;
+                    } else if (cmp > 0) {
+                        // File is not in the source, directories are left alone since they are never synced
+                        if (tar_list.entries[t].type != DT_DIR && !file_filtered(tar_list.entries[t].name) && !throttle_file() && delete_target_file(report, fds[f], tar_list.entries[t].name) == 0)
+                            report->files_deleted++;
+                        t++;
+                    } else if (file_filtered(src_list.entries[s].name)) {
+                        s++; t++;
+                    } else {
+                        if (same_file(&src_list.entries[s], &tar_list.entries[t]))
+                            report->files_unchanged++;
+                        else
+                            copy_masks[s] |= 1u << f;
+                        s++; t++;
+                    }
+                }
+
+                dir_list_free(&tar_list);
+            }
+
+            // Copy every source file to the targets that need it, reading it only once
+            for (size_t s = 0; s < src_list.count && !cancelled; s++) {
+                int num_of_copies = 0;
+                int copy_fds[MAX_TARGETS];
+                int copy_indexes[MAX_TARGETS];
+
+                for (int f = 0; f < num_of_fds; f++) {
+                    if (!(copy_masks[s] & (1u << f))) continue;
+
+                    copy_fds[num_of_copies] = fds[f];
+                    copy_indexes[num_of_copies++] = tar_indexes[f];
+                }
+
+                if (num_of_copies == 0) continue;
+
+                if (throttle_file()) break;
+                enum file_management_error src_err = file_copy(src_dir_fd, src_list.entries[s].name, copy_fds, num_of_copies, tar_errs, &stats, report_size, throttle_bytes, copy_flags);
+                report_copy(src_err, tar_errs, copy_indexes, num_of_copies, src_dir_name, src_list.entries[s].name, &stats);
+            }
+
+            free(copy_masks);
+            dir_list_free(&src_list);
+        }
+
+    // OPERATION: ADDED or OPERATION: MODIFIED
+    } else if ((!strcmp(op_str, "ADDED") || !strcmp(op_str, "MODIFIED")) && num_of_fds > 0) {
+        // Copy source to targets, unless the job was cancelled while waiting, since a copy that is
+        // cancelled after it has opened the targets removes them
+        if (!throttle_file()) {
+            enum file_management_error src_err = file_copy(src_dir_fd, filename, fds, num_of_fds, tar_errs, &stats, report_size, throttle_bytes, copy_flags);
+            report_copy(src_err, tar_errs, tar_indexes, num_of_fds, src_dir_name, filename, &stats);
+        }
+
+    // OPERATION: ATTRIB
+    // Only metadata of the file has changed, so its data is not copied
+    // Like DELETED, it is finished even if the job is cancelled once it has started, since no data has to be copied
+    // A target file that is linked in a snapshot is replaced by a copy instead, since changing its
+    // metadata would change the snapshot too
+    } else if (!strcmp(op_str, "ATTRIB") && num_of_fds > 0) {
+        int meta_fds[MAX_TARGETS], meta_indexes[MAX_TARGETS], num_of_meta = 0;
+        int copy_fds[MAX_TARGETS], copy_indexes[MAX_TARGETS], num_of_copies = 0;
+
+        for (int f = 0; f < num_of_fds; f++) {
+            if (snapshot_keep > 0 && file_has_links(fds[f], filename)) {
+                copy_fds[num_of_copies] = fds[f];
+                copy_indexes[num_of_copies++] = tar_indexes[f];
+            } else {
+                meta_fds[num_of_meta] = fds[f];
+                meta_indexes[num_of_meta++] = tar_indexes[f];
+            }
+        }
+
+        // Nothing is changed if the job was cancelled while waiting
+        if (throttle_file()) return;
+
+        // Copy metadata of source to targets
+        if (num_of_meta > 0) {
+            enum file_management_error src_err = file_copy_metadata(src_dir_fd, filename, meta_fds, num_of_meta, tar_errs);
+
+            for (int f = 0; f < num_of_meta; f++) {
+                struct target_report *report = &reports[meta_indexes[f]];
+
+                if (tar_errs[f] == SUCCESS)
+                    report->files_processed++;
+                else
+                    report_file_error(report, tar_errs[f], src_err != SUCCESS? src_dir_name: report->tar_dir, filename);
+            }
+        }
+
+        if (num_of_copies > 0) {
+            enum file_management_error src_err = file_copy(src_dir_fd, filename, copy_fds, num_of_copies, tar_errs, &stats, report_size, throttle_bytes, copy_flags);
+            report_copy(src_err, tar_errs, copy_indexes, num_of_copies, src_dir_name, filename, &stats);
+        }
+
+    } else if (!strcmp(op_str, "DELETED") && num_of_fds > 0) {
+        if (throttle_file()) return;
+
+        for (int f = 0; f < num_of_fds; f++) {
+            if (delete_target_file(&reports[tar_indexes[f]], fds[f], filename) == 0)
+                reports[tar_indexes[f]].files_processed++;
+        }
+
+    // OPERATION: SNAPSHOT
+    } else if (!strcmp(op_str, "SNAPSHOT") && num_of_fds > 0) {
+        if (!throttle_file())
+            take_snapshots(fds, tar_indexes, num_of_fds, 1);
+
+    // OPERATION: RESTORE
+    // The manager only restores a directory that it doesn't sync, so the targets don't change
+    } else if (!strcmp(op_str, "RESTORE") && num_of_fds > 0) {
+        for (int f = 0; f < num_of_fds && !cancelled; f++)
+            restore_snapshot(filename, fds[f], &reports[tar_indexes[f]]);
+    }
+}
+
+// Writes a report for every target with the results of the last job
+// Returns EXIT_FAILURE if the job failed or was cancelled for a target, EXIT_SUCCESS otherwise
+int write_reports(void) {
+    int exit_status = EXIT_SUCCESS;
+
+    for (int t = 0; t < num_of_targets; t++) {
+        if (cancelled) {
+            report_status_cancelled(reports[t].error_buffer, reports[t].files_processed, reports[t].files_failed, reports[t].bytes_copied, reports[t].bytes_logical);
+            exit_status = EXIT_FAILURE;
+        } else if (!reports[t].files_failed && !reports[t].failed && reports[t].details[0] != '\0') {
+            report_status_snapshot(reports[t].details);
+        } else if (!reports[t].files_failed && !reports[t].failed) {
+            report_status_success(reports[t].files_processed, reports[t].files_unchanged, reports[t].files_deleted, reports[t].bytes_copied, reports[t].bytes_logical);
+        } else if (!reports[t].files_processed) {
+            report_status_error(reports[t].error_buffer);
+            exit_status = EXIT_FAILURE;
+        } else {
+            report_status_partial(reports[t].error_buffer, reports[t].files_processed, reports[t].files_failed, reports[t].files_deleted, reports[t].bytes_copied, reports[t].bytes_logical);
+        }
+    }
+
+    return exit_status;
+}
+
+// Clears the results of the reports for the next job
+// Targets that failed for the whole worker keep their error, since every job reports it
+void reset_reports(void) {
+    for (int t = 0; t < num_of_targets; t++) {
+        reports[t].files_processed = 0;
+        reports[t].files_failed = 0;
+        reports[t].files_unchanged = 0;
+        reports[t].files_deleted = 0;
+        reports[t].bytes_copied = 0;
+        reports[t].bytes_logical = 0;
+        reports[t].details[0] = '\0';
+
+        if (!reports[t].failed) {
+            reports[t].error_buffer.pos = 0;
+            reports[t].error_buffer.buffer[0] = '\0';
+        }
+    }
+}
+
+// Free error buffers of all reports
+void free_reports(void) {
+    for (int t = 0; t < num_of_targets; t++)
+        free(reports[t].error_buffer.buffer);
+}
+
+// Handler of SIGTERM, the job stops at the next block that is copied
+void cancel_job(int sig) {
+    (void) sig;
+    cancelled = 1;
+}
+
+// Waits until the token buckets allow bytes to be written
+// Returns 1 if the job has been cancelled, which cancels the copy
+int throttle_bytes(long long bytes) {
+    if (throttle != NULL && !cancelled)
+        throttle_consume(throttle, bytes, 0, &cancelled);
+
+    return cancelled;
+}
+
+// Waits until the token buckets allow another file to be synced
+// Returns 1 if the job has been cancelled
+int throttle_file(void) {
+    if (throttle != NULL && !cancelled)
+        throttle_consume(throttle, 0, 1, &cancelled);
+
+    return cancelled;
+}
+
+// Counts progress of the worker that doesn't take from the buckets, e.g. a file that is unchanged
+void count_progress(void) {
+    if (throttle != NULL) throttle_progress(throttle);
+}
+
+// Reports size of a file that is about to be copied, so that the manager gives the copy more time
+// A file that is written to disk before it succeeds can take long without a block to show for it
+void report_size(long long size) {
+    if (size < SIZE_REPORT_MIN) return;
+
+    char line[32];
+    snprintf(line, sizeof(line), "SIZE: %lld\n", size);
+    write_bytes(STDOUT_FILENO, line, strlen(line));
+}
+
+// Adds result of a copy of file to count targets, whose reports are given by indexes
+// A cancelled copy is neither a success nor a failure
+void report_copy(enum file_management_error src_err, enum file_management_error *tar_errs, int *indexes, int count, char *src_dir_name, char *file, struct copy_stats *stats) {
+    if (src_err == CANCELLED) return;
+
+    for (int f = 0; f < count; f++) {
+        struct target_report *report = &reports[indexes[f]];
+
+        if (tar_errs[f] == SUCCESS) {
+            report->files_processed++;
+            report->bytes_copied += stats->physical_bytes;
+            report->bytes_logical += stats->logical_bytes;
+        } else
+            report_file_error(report, tar_errs[f], src_err != SUCCESS? src_dir_name: report->tar_dir, file);
+    }
+}
+
+// Deletes file of target directory tar_dir_fd, an error is added to report if it fails
+// Returns 0 on success, -1 if the file couldn't be deleted
+// With file durability, the file is only deleted once its directory is on disk
+int delete_target_file(struct target_report *report, int tar_dir_fd, char *file) {
+    char *func = "unlink failed";
+
+    if (unlinkat(tar_dir_fd, file, 0) == 0) {
+        if (durability != DURABILITY_FILE || fsync(tar_dir_fd) == 0) return 0;
+        func = "fsync failed";
+    }
+
+    if (write_to_err_buf_at(&report->error_buffer, report->tar_dir, file, func) < 0) {
+        report_irrecoverable_error("malloc failed", 1);
+        exit(EXIT_FAILURE);
+    }
+
+    report->files_failed++;
+    return -1;
+}
+
+// Returns 1 if the file of entry in target directory tar_dir_fd is the same as the source
+int target_file_unchanged(int tar_dir_fd, struct dir_entry *entry) {
+    struct statx tar_stat;
+    if (statx(tar_dir_fd, entry->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &tar_stat) < 0)
+        return 0;
+
+    struct dir_entry tar_entry = {entry->name, IFTODT(tar_stat.stx_mode), tar_stat.stx_size, {tar_stat.stx_mtime.tv_sec, tar_stat.stx_mtime.tv_nsec}, tar_stat.stx_mode & 07777};
+    return same_file(entry, &tar_entry);
+}
+
+// Returns 1 if target file tar has the same size, modification time and mode as source file src,
+// which means it was synced and hasn't changed since then
+// The timestamps are reliable because every copy sets them to those of the source
+int same_file(struct dir_entry *src, struct dir_entry *tar) {
+    return src->size >= 0 && tar->type == DT_REG && tar->size == src->size && tar->mode == src->mode
+        && tar->mtime.tv_sec == src->mtime.tv_sec && tar->mtime.tv_nsec == src->mtime.tv_nsec;
+}
+
+// Takes a snapshot of every target in fds, whose reports are at tar_indexes, and removes their
+// oldest snapshots so that snapshot_keep are left
+// If details is 1, the snapshot is the result of the job and is written to the details of the report
+// Targets whose snapshot failed get an error and are removed from fds and tar_indexes
+// Returns number of targets left in fds
+int take_snapshots(int *fds, int *tar_indexes, int num_of_fds, int details) {
+    int num_left = 0;
+    char name[SNAPSHOT_NAME_SIZE];
+    snapshot_name(name, sizeof(name));
+
+    for (int f = 0; f < num_of_fds; f++) {
+        struct target_report *report = &reports[tar_indexes[f]];
+        int linked = snapshot_create(fds[f], name);
+
+        if (linked < 0) {
+            if (write_to_err_buf_at(&report->error_buffer, report->tar_dir, SNAPSHOT_DIR, "snapshot failed") < 0) {
+                report_irrecoverable_error("malloc failed", 1);
+                exit(EXIT_FAILURE);
+            }
+
+            report->files_failed++;
+            continue;
+        }
+
+        snapshot_prune(fds[f], snapshot_keep);
+
+        if (details)
+            snprintf(report->details, sizeof(report->details), "Snapshot %s taken, %d files linked", name, linked);
+
+        fds[num_left] = fds[f];
+        tar_indexes[num_left++] = tar_indexes[f];
+    }
+
+    return num_left;
+}
+
+// Restores snapshot name of target tar_dir_fd, whose report is report
+// Files of the snapshot replace those of the target, unless they are still the same file, and
+// regular files that are not in the snapshot are deleted, directories are left alone
+void restore_snapshot(char *name, int tar_dir_fd, struct target_report *report) {
+    int snap_fd = snapshot_open(tar_dir_fd, name);
+
+    if (snap_fd < 0) {
+        if (write_to_err_buf_at(&report->error_buffer, report->tar_dir, name, "snapshot open failed") < 0) {
+            report_irrecoverable_error("malloc failed", 1);
+            exit(EXIT_FAILURE);
+        }
+
+        report->files_failed++;
+        return;
+    }
+
+    struct dir_list snap_list, tar_list;
+    int snap_check = dir_scanner_list(snap_fd, 1, &snap_list);
+    int tar_check = snap_check < 0? -2: dir_scanner_list(tar_dir_fd, 0, &tar_list);
+
+    if (snap_check == -1 || tar_check == -1) {
+        report_irrecoverable_error("malloc failed", 1);
+        exit(EXIT_FAILURE);
+    }
+
+    if (snap_check == -2 || tar_check == -2) {
+        write_to_err_buf(&report->error_buffer, report->tar_dir, "getdents64 failed");
+        report->files_failed++;
+
+        if (snap_check == 0) dir_list_free(&snap_list);
+        close(snap_fd);
+        return;
+    }
+
+    size_t s = 0, t = 0;
+
+    while ((s < snap_list.count || t < tar_list.count) && !cancelled) {
+        count_progress();
+        int cmp = s == snap_list.count? 1: t == tar_list.count? -1: strcmp(snap_list.entries[s].name, tar_list.entries[t].name);
+
+        if (cmp > 0) {
+            // File was created after the snapshot
+            if (tar_list.entries[t].type == DT_REG && !throttle_file() && delete_target_file(report, tar_dir_fd, tar_list.entries[t].name) == 0)
+                report->files_deleted++;
+            t++;
+            continue;
+        }
+
+        char *file = snap_list.entries[s].name;
+        struct stat snap_stat, tar_stat;
+
+        // A file that hasn't been replaced since the snapshot is still the same inode
+        if (cmp == 0 && fstatat(snap_fd, file, &snap_stat, AT_SYMLINK_NOFOLLOW) == 0 && fstatat(tar_dir_fd, file, &tar_stat, AT_SYMLINK_NOFOLLOW) == 0
+            && snap_stat.st_ino == tar_stat.st_ino && snap_stat.st_dev == tar_stat.st_dev) {
+            report->files_unchanged++;
+        } else if (!throttle_file()) {
+            if (snapshot_restore_file(snap_fd, tar_dir_fd, file) == 0)
+                report->files_processed++;
+            else
+                report_file_error(report, WRITE_FAILED, report->tar_dir, file);
+        }
+
+        s++;
+        if (cmp == 0) t++;
+    }
+
+    snprintf(report->details, sizeof(report->details), "Snapshot %s restored, %d files restored, %d unchanged, %d deleted",
+        name, report->files_processed, report->files_unchanged, report->files_deleted);
+
+    dir_list_free(&snap_list);
+    dir_list_free(&tar_list);
+    close(snap_fd);
+}
+
+// Returns 1 if file of target directory tar_dir_fd has more than one link, e.g. one in a snapshot
+int file_has_links(int tar_dir_fd, char *file) {
+    struct stat tar_stat;
+    return fstatat(tar_dir_fd, file, &tar_stat, AT_SYMLINK_NOFOLLOW) == 0 && tar_stat.st_nlink > 1;
+}
+
+// Writes changes of the targets in fds, whose reports are at tar_indexes, to disk with one syncfs
+// for every file system, an error is added to the reports of its targets if it fails
+void sync_targets(int *fds, int *tar_indexes, int num_of_fds) {
+    dev_t devs[MAX_TARGETS];
+    int errs[MAX_TARGETS];       // Error of syncfs of every file system, 0 if it succeeded
+    int num_of_devs = 0;
+
+    for (int f = 0; f < num_of_fds; f++) {
+        struct target_report *report = &reports[tar_indexes[f]];
+        struct stat dir_stat;
+        int err = fstat(fds[f], &dir_stat) < 0? errno: 0;
+
+        // Every file system is synced once, its targets share the result
+        if (err == 0) {
+            int d = 0;
+            while (d < num_of_devs && devs[d] != dir_stat.st_dev) d++;
+
+            if (d == num_of_devs) {
+                devs[num_of_devs] = dir_stat.st_dev;
+                errs[num_of_devs++] = syncfs(fds[f]) < 0? errno: 0;
+            }
+
+            err = errs[d];
+        }
+
+        if (err != 0) {
+            errno = err;
+            if (write_to_err_buf(&report->error_buffer, report->tar_dir, "syncfs failed") < 0) {
+                report_irrecoverable_error("malloc failed", 1);
+                exit(EXIT_FAILURE);
+            }
+
+            report->files_failed++;
+        }
+    }
+}
+
+// Returns 1 if file is filtered out by the patterns of the pair, 0 if it is synced
+int file_filtered(char *file) {
+    return filter != NULL && !name_filter_match(filter, file);
+}
@@ -1,81 +1,299 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include "../include/util.h"
 #include "../include/job_info.h"
 #include "../include/int_queue.h"
+#include "../include/throttle.h"
 #include "../include/worker_management.h"
+#include "../include/console_server.h"
+#include "../include/name_filter.h"
 #include <stdio.h>
 #include <sys/inotify.h>
 
 #define READ_END 0       // Read and write ends of pipe
 #define WRITE_END 1
-#define POLL_TIMEOUT -1  // Poll timeout (-1 means infinite)
 
-#define CONSOLE_INDEX 0  // Index of fss_in pipe in pfds array
-#define INOTIFY_INDEX 1  // Index of inotify instance in pfds array
-                         // Rest of indexes is dedicated to worker pipes
+#define OUTPUT_SIZE_DEFAULT 1024  // Initial size of buffer with output of a worker
+#define WORKER_PATH "./worker"    // Worker executable, relative to the directory fss_manager starts in
+#define TIMEOUT_MIN_RATE (1024 * 1024)   // Bytes per second a file is written at on the slowest device,
+                                         // which gives the time its size adds to the timeout
+#define WATCHDOG_CHECK_MS 1000    // Longest time between two checks of the progress of running workers
+
+#ifndef P_PIDFD
+#define P_PIDFD 3        // idtype of waitid for process file descriptors, missing in older headers
+#endif
+
+// Event data is the type of the event in the upper 32 bits and the slot or file descriptor
+// in the lower 32 bits
+#define EVENT_DATA(type, value) (((uint64_t) (type) << 32) | (uint32_t) (value))
+
+int worker_manager_epoll_add(struct worker_manager *manager, int fd, enum worker_event type, int value);
+void worker_manager_epoll_close(struct worker_manager *manager, int fd);
+void worker_manager_release_slot(struct worker_manager *manager, int slot);
+int worker_manager_free_throttle_slot(struct worker_manager *manager);
+void worker_manager_free_jobs(struct worker_slot *slot);
+void worker_manager_take_sizes(struct worker_slot *slot);
+long long worker_manager_now_ms(void);
+int worker_pool_take(struct worker_pool *pool, int wanted);
+void worker_pool_wake(struct worker_pool *pool);
+
+int worker_pool_init(struct worker_pool *pool, int min_limit, int worker_limit, int limit, int num_of_shards) {
+    pool->worker_limit = worker_limit;
+    pool->num_of_shards = num_of_shards;
+    pool->active = 0;
+    pool->running = 0;
+    pool->stalled = 0;
+    pool->waiting = 0;
+
+    pool->autoscaler = autoscaler_init(min_limit, worker_limit, limit);
+    pool->waiting_jobs = calloc(num_of_shards, sizeof(size_t));
+    pool->wake_fds = malloc(num_of_shards * sizeof(int));
+
+    if (pool->autoscaler == NULL || pool->waiting_jobs == NULL || pool->wake_fds == NULL) {
+        if (pool->autoscaler != NULL) autoscaler_destroy(pool->autoscaler);
+        free(pool->waiting_jobs); free(pool->wake_fds);
+        return -1;
+    }
 
-int worker_manager_init(struct worker_manager *manager, int worker_limit, int console_fd) {
+    for (int s = 0; s < num_of_shards; s++)
+        pool->wake_fds[s] = -1;
 
-    // Active workers are initially 0
-    manager->worker_limit = worker_limit;
-    manager->active_workers = 0;
+    // Every manager has a bucket and a progress counter for each of its worker slots
+    pool->throttle = throttle_init(worker_limit * num_of_shards);
 
-    // Allocate worker_jobs array
-    // This array normally only requires worker_limit positions, but the first two
-    // are unused to remain consistent with pfds array
-    manager->worker_jobs = malloc((2+manager->worker_limit) * sizeof(struct job_info));
-    if (manager->worker_jobs == NULL) return -1;
+    if (pool->throttle == NULL) {
+        autoscaler_destroy(pool->autoscaler);
+        free(pool->waiting_jobs); free(pool->wake_fds);
+        return -4;
+    }
 
-    // Allocate pfds array
-    manager->pfds_size = 2 + worker_limit;
-    manager->pfds = calloc(manager->pfds_size, sizeof(struct pollfd));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->limit = autoscaler_limit(pool->autoscaler);
 
-    if (manager->pfds == NULL) {
-        free(manager->worker_jobs); return -1;
-    }
+    return 0;
+}
 
-    // Set up file descriptors for poll
-    manager->pfds[CONSOLE_INDEX].fd = console_fd;
-    manager->pfds[INOTIFY_INDEX].fd = inotify_init();
+int worker_pool_limit(struct worker_pool *pool) {
+    return __atomic_load_n(&pool->limit, __ATOMIC_RELAXED);
+}
 
-    if (manager->pfds[INOTIFY_INDEX].fd < 0) {
-        free(manager->worker_jobs); free(manager->pfds);
-        return -2;
-    }
+int worker_pool_running(struct worker_pool *pool) {
+    return __atomic_load_n(&pool->running, __ATOMIC_RELAXED);
+}
+
+int worker_pool_stalled(struct worker_pool *pool) {
+    return __atomic_load_n(&pool->stalled, __ATOMIC_RELAXED);
+}
+
+int worker_pool_autoscale(struct worker_pool *pool, size_t *waiting_jobs) {
+    *waiting_jobs = 0;
+
+    for (int s = 0; s < pool->num_of_shards; s++)
+        *waiting_jobs += __atomic_load_n(&pool->waiting_jobs[s], __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&pool->lock);
+    int old_limit = autoscaler_limit(pool->autoscaler);
+    int changed = autoscaler_update(pool->autoscaler, *waiting_jobs, worker_pool_running(pool));
+    int limit = autoscaler_limit(pool->autoscaler);
+    __atomic_store_n(&pool->limit, limit, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (limit > old_limit)
+        worker_pool_wake(pool);
+
+    return changed;
+}
+
+int worker_pool_autoscale_timeout(struct worker_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    int timeout = autoscaler_timeout(pool->autoscaler);
+    pthread_mutex_unlock(&pool->lock);
+
+    return timeout;
+}
+
+int worker_pool_set_limit(struct worker_pool *pool, int limit) {
+    pthread_mutex_lock(&pool->lock);
+    int result = autoscaler_set_limit(pool->autoscaler, limit);
+    __atomic_store_n(&pool->limit, autoscaler_limit(pool->autoscaler), __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (result == 0)
+        worker_pool_wake(pool);
+
+    return result;
+}
+
+void worker_pool_set_auto(struct worker_pool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    autoscaler_set_auto(pool->autoscaler);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_status(struct worker_pool *pool, struct autoscaler_status *status) {
+    pthread_mutex_lock(&pool->lock);
+    autoscaler_get_status(pool->autoscaler, status);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+    autoscaler_destroy(pool->autoscaler);
+    throttle_destroy(pool->throttle);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->waiting_jobs);
+    free(pool->wake_fds);
+}
+
+int worker_manager_init(struct worker_manager *manager, struct worker_pool *pool, int shard, int console_fd) {
+    int worker_limit = pool->worker_limit;
+
+    // Active workers are initially 0
+    manager->worker_limit = worker_limit;
+    manager->active_workers = 0;
+    manager->console_fd = console_fd;
+    manager->pool = pool;
+    manager->shard = shard;
+    manager->slot_base = shard * worker_limit;
+    manager->taken = 0;
+
+    // Allocate arrays indexed by worker slot
+    manager->worker_jobs = malloc(manager->worker_limit * sizeof(struct job_info));
+    manager->slots = malloc(manager->worker_limit * sizeof(struct worker_slot));
+    manager->start_times = malloc(manager->worker_limit * sizeof(struct timespec));
+
+    // A wait can return an event for every worker pipe and process, the console socket,
+    // inotify, the mailbox, the eventfd and every console
+    manager->max_events = 2 * worker_limit + 4 + CONSOLE_MAX_CLIENTS;
+    manager->events = malloc(manager->max_events * sizeof(struct epoll_event));
 
-    manager->pfds[CONSOLE_INDEX].events = POLLIN;
-    manager->pfds[INOTIFY_INDEX].events = POLLIN;
-    
     // Initialize slot queue
     manager->slot_queue = int_queue_init();
 
-    if (manager->slot_queue == NULL) {
-        free(manager->worker_jobs); free(manager->pfds);
-        close(manager->pfds[INOTIFY_INDEX].fd);
+    if (manager->worker_jobs == NULL || manager->slots == NULL || manager->start_times == NULL || manager->events == NULL || manager->slot_queue == NULL) {
+        free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
+        if (manager->slot_queue != NULL) int_queue_destroy(manager->slot_queue);
         return -1;
     }
 
-    // Add all worker slots to queue
-    for (size_t i = 2; i < manager->pfds_size; i++) {
-        manager->pfds[i].fd = -1;
-        manager->worker_jobs[i-2].worker_pid = -1;
+    // All worker slots are initially empty
+    for (int i = 0; i < worker_limit; i++) {
+        manager->slots[i].pipe_fd = -1;
+        manager->slots[i].pid_fd = -1;
+        manager->slots[i].output = NULL;
+        manager->slots[i].jobs = NULL;
+        manager->slots[i].num_of_jobs = 0;
+        manager->worker_jobs[i].worker_pid = -1;
 
         if (int_queue_enqueue(manager->slot_queue, i) < 0) {
-            free(manager->worker_jobs); free(manager->pfds);
-            close(manager->pfds[INOTIFY_INDEX].fd);
+            free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
             int_queue_destroy(manager->slot_queue);
             return -1;
         }
     }
 
+    // Create inotify instance, epoll instance and the eventfd that wakes up the manager
+    manager->inotify_fd = inotify_init1(IN_CLOEXEC);
+    manager->epoll_fd = manager->inotify_fd < 0? -1: epoll_create1(EPOLL_CLOEXEC);
+    manager->wake_fd = manager->epoll_fd < 0? -1: eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (manager->inotify_fd < 0 || manager->epoll_fd < 0 || manager->wake_fd < 0) {
+        int err = manager->inotify_fd < 0? -2: manager->epoll_fd < 0? -3: -6;
+
+        if (manager->inotify_fd >= 0) close(manager->inotify_fd);
+        if (manager->epoll_fd >= 0) close(manager->epoll_fd);
+        free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
+        int_queue_destroy(manager->slot_queue);
+        return err;
+    }
+
+    // Wait for console connections, inotify events and workers of the pool becoming free
+    if ((console_fd >= 0 && worker_manager_epoll_add(manager, console_fd, WORKER_EVENT_CONSOLE, console_fd) < 0) || worker_manager_epoll_add(manager, manager->inotify_fd, WORKER_EVENT_INOTIFY, manager->inotify_fd) < 0 ||
+        worker_manager_epoll_add(manager, manager->wake_fd, WORKER_EVENT_WAKE, manager->wake_fd) < 0) {
+        close(manager->inotify_fd); close(manager->epoll_fd); close(manager->wake_fd);
+        free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
+        int_queue_destroy(manager->slot_queue);
+        return -3;
+    }
+
+    // Map token buckets of the pool, with rates measured by this manager
+    manager->throttle = throttle_share(pool->throttle);
+
+    if (manager->throttle == NULL) {
+        close(manager->inotify_fd); close(manager->epoll_fd); close(manager->wake_fd);
+        free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
+        int_queue_destroy(manager->slot_queue);
+        return -4;
+    }
+
+    // Open worker executable once, workers are executed through this file
+    manager->worker_fd = open(WORKER_PATH, O_RDONLY | O_CLOEXEC);
+    snprintf(manager->worker_path, sizeof(manager->worker_path), "/proc/self/fd/%d", manager->worker_fd);
+
+    if (manager->worker_fd < 0) {
+        int err = errno;
+        close(manager->inotify_fd); close(manager->epoll_fd); close(manager->wake_fd);
+        free(manager->worker_jobs); free(manager->slots); free(manager->start_times); free(manager->events);
+        int_queue_destroy(manager->slot_queue); throttle_destroy(manager->throttle);
+        errno = err;
+        return -5;
+    }
+
+    pool->wake_fds[shard] = manager->wake_fd;
     return 0;
 }
 
+int worker_manager_add_mailbox(struct worker_manager *manager, int fd) {
+    return worker_manager_epoll_add(manager, fd, WORKER_EVENT_MAILBOX, fd);
+}
+
+int worker_manager_take_workers(struct worker_manager *manager, size_t wanted) {
+    struct worker_pool *pool = manager->pool;
+    int free_slots = manager->worker_limit - manager->active_workers - manager->taken;
+
+    if (wanted > (size_t) free_slots) wanted = free_slots;
+    manager->taken += worker_pool_take(pool, wanted);
+
+    if ((size_t) manager->taken < wanted) {
+        // The bit is set before trying again, so a worker that exits in between either is taken
+        // now or sees the bit and wakes up the manager
+        unsigned long long bit = 1ULL << manager->shard;
+        __atomic_or_fetch(&pool->waiting, bit, __ATOMIC_SEQ_CST);
+        manager->taken += worker_pool_take(pool, wanted - manager->taken);
+
+        if ((size_t) manager->taken == wanted)
+            __atomic_and_fetch(&pool->waiting, ~bit, __ATOMIC_SEQ_CST);
+    }
+
+    return manager->taken;
+}
+
+void worker_manager_return_workers(struct worker_manager *manager, size_t waiting_jobs) {
+    struct worker_pool *pool = manager->pool;
+
+    // Workers that weren't started belong to jobs that wait for workers of this manager, which wake up
+    // the others when they exit, so returning them wakes up no one
+    __atomic_sub_fetch(&pool->active, manager->taken, __ATOMIC_SEQ_CST);
+    manager->taken = 0;
+
+    __atomic_store_n(&pool->waiting_jobs[manager->shard], waiting_jobs, __ATOMIC_RELAXED);
+}
+
+void worker_manager_clear_wake(struct worker_manager *manager) {
+    uint64_t count;
+    while (read(manager->wake_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+}
+
 int worker_manager_available_workers(struct worker_manager manager) {
-    return manager.worker_limit-manager.active_workers;
+    return manager.taken;
 }
 
 int worker_manager_active_workers(struct worker_manager manager) {
@@ -83,128 +301,597 @@ int worker_manager_active_workers(struct worker_manager manager) {
 }
 
 int worker_manager_add_watch(struct worker_manager *manager, char *dir) {
-    return inotify_add_watch(manager->pfds[INOTIFY_INDEX].fd, dir, IN_MODIFY | IN_CREATE | IN_DELETE);
+    return inotify_add_watch(manager->inotify_fd, dir, IN_MODIFY | IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MASK_ADD);
+}
+
+int worker_manager_watch_writes(struct worker_manager *manager, char *dir) {
+    return inotify_add_watch(manager->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MASK_ADD);
+}
+
+long worker_manager_watch_limit(void) {
+    FILE *limit_file = fopen("/proc/sys/fs/inotify/max_user_watches", "r");
+    if (limit_file == NULL) return -1;
+
+    long limit;
+    if (fscanf(limit_file, "%ld", &limit) != 1) limit = -1;
+
+    fclose(limit_file);
+    return limit;
+}
+
+int worker_manager_track_devices(struct worker_manager *manager, char *src_dir, char **tar_dirs, int num_of_targets) {
+    pthread_mutex_lock(&manager->pool->lock);
+    int result = autoscaler_add_device(manager->pool->autoscaler, src_dir);
+
+    for (int t = 0; t < num_of_targets; t++) {
+        if (autoscaler_add_device(manager->pool->autoscaler, tar_dirs[t]) < 0)
+            result = -1;
+    }
+
+    pthread_mutex_unlock(&manager->pool->lock);
+    return result;
 }
 
 int worker_manager_remove_watch(struct worker_manager *manager, int wd) {
-    return inotify_rm_watch(manager->pfds[INOTIFY_INDEX].fd, wd);
+    return inotify_rm_watch(manager->inotify_fd, wd);
 }
 
 
-pid_t worker_manager_setup_worker(struct worker_manager *manager, struct job_info job) {
+pid_t worker_manager_setup_worker(struct worker_manager *manager, struct job_info *jobs, int num_of_jobs, struct throttle_bucket *bucket, int *throttle_slot, struct worker_options options) {
+    struct job_info job = jobs[0];
 
-    if (worker_manager_available_workers(*manager) == 0)
+    if (manager->taken == 0)
         return -1;
 
     // Get available worker slot
     int slot = int_queue_dequeue(manager->slot_queue);
+    struct worker_slot *worker_slot = &manager->slots[slot];
+
+    // Allocate buffer for output of worker
+    worker_slot->output = malloc(OUTPUT_SIZE_DEFAULT * sizeof(char));
+
+    if (worker_slot->output == NULL) {
+        int_queue_enqueue(manager->slot_queue, slot);
+        return -1;
+    }
+
+    worker_slot->output_size = OUTPUT_SIZE_DEFAULT;
+    worker_slot->output_len = 0;
+    worker_slot->output_pos = 0;
+    worker_slot->output_scan = 0;
+
+    // Limits of the pair apply to the worker from its first write, the workers of a pair
+    // share one bucket so that together they stay within them
+    worker_slot->throttle_slot = *throttle_slot;
+
+    if (worker_slot->throttle_slot == -1) {
+        worker_slot->throttle_slot = worker_manager_free_throttle_slot(manager);
+        throttle_load_slot(manager->throttle, worker_slot->throttle_slot, bucket);
+    }
+
+    // Build arguments of worker, every target after the first is given with -t and every
+    // job after the first adds its file and operation
+    // Worker maps token buckets through the shared memory file, whose descriptor it gets with -r
+    char throttle_arg[32], snapshot_arg[16], bytes_arg[24];
+    int num_of_patterns = options.filter == NULL? 0: name_filter_size(options.filter);
+    char **worker_argv = malloc((2*MAX_TARGETS + 2*num_of_jobs + 2*num_of_patterns + 13) * sizeof(char *));
+    int argc = 0;
+
+    if (worker_argv == NULL) {
+        worker_manager_release_slot(manager, slot);
+        return -1;
+    }
+
+    int shared_fd = throttle_fd(manager->throttle);
+    snprintf(throttle_arg, sizeof(throttle_arg), "%d:%d:%d", shared_fd, worker_slot->throttle_slot, manager->slot_base + slot);
+
+    worker_argv[argc++] = WORKER_PATH;
+    worker_argv[argc++] = "-r";
+    worker_argv[argc++] = throttle_arg;
 
-    // Create pipe communication
+    if (options.snapshot_keep > 0) {
+        snprintf(snapshot_arg, sizeof(snapshot_arg), "%d", options.snapshot_keep);
+        worker_argv[argc++] = "-s";
+        worker_argv[argc++] = snapshot_arg;
+    }
+
+    if (options.atomic)
+        worker_argv[argc++] = "-a";
+
+    if (options.durability != DURABILITY_NONE) {
+        worker_argv[argc++] = "-d";
+        worker_argv[argc++] = durability_name(options.durability);
+    }
+
+    if (options.max_bytes > 0) {
+        snprintf(bytes_arg, sizeof(bytes_arg), "%lld", options.max_bytes);
+        worker_argv[argc++] = "-b";
+        worker_argv[argc++] = bytes_arg;
+    }
+
+    // Every pattern is given with -i if it includes files and -x if it excludes them
+    for (int p = 0; p < num_of_patterns; p++) {
+        int include;
+        char *pattern = name_filter_pattern(options.filter, p, &include);
+        worker_argv[argc++] = include? "-i": "-x";
+        worker_argv[argc++] = pattern;
+    }
+
+    for (int t = 1; t < job.num_of_targets; t++) {
+        worker_argv[argc++] = "-t";
+        worker_argv[argc++] = job.tar_dirs[t];
+    }
+
+    worker_argv[argc++] = job.src_dir;
+    worker_argv[argc++] = job.tar_dirs[0];
+
+    for (int j = 0; j < num_of_jobs; j++) {
+        worker_argv[argc++] = jobs[j].file;
+        worker_argv[argc++] = sync_operation_name(jobs[j].operation);
+    }
+
+    worker_argv[argc] = NULL;
+
+    // Create pipe communication, no end is inherited by other workers
     int pipefd[2];
 
-    if (pipe(pipefd) < 0)
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        free(worker_argv);
+        worker_manager_release_slot(manager, slot);
         return -2;
+    }
 
-    // Save read end
-    manager->pfds[slot].fd = pipefd[READ_END];
-    manager->pfds[slot].events = POLLIN;
+    // The child copies the write end to its stdout, and keeps the shared memory file, which is
+    // only inherited by workers, open across exec by duplicating it onto itself
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+    int err = posix_spawn_file_actions_init(&actions);
 
-    // Fork
-    pid_t pid = fork();
+    if (err == 0) {
+        err = posix_spawn_file_actions_adddup2(&actions, pipefd[WRITE_END], STDOUT_FILENO);
+        if (err == 0) err = posix_spawn_file_actions_adddup2(&actions, shared_fd, shared_fd);
 
-    if (pid < 0) {
-        close(pipefd[READ_END]); close(pipefd[WRITE_END]);
-        return -3;
+        // Spawn shares the memory of the manager until the child executes worker, so unlike fork it
+        // doesn't copy page tables and takes the same time however much memory the manager uses
+        // Worker is executed through the file opened at startup
+        if (err == 0) err = posix_spawn(&pid, manager->worker_path, &actions, NULL, worker_argv, environ);
+
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    free(worker_argv);
+    close(pipefd[WRITE_END]);
+
+    if (err != 0) {
+        close(pipefd[READ_END]);
+        worker_manager_release_slot(manager, slot);
+        errno = err;
+        return err == ENOMEM? -1: -3;
+    }
+
+    worker_slot->pipe_fd = pipefd[READ_END];
+
+    // Open process file descriptor, which becomes readable when the worker exits
+    // The worker can't be reaped by anyone else, so this works even if it has already exited
+    worker_slot->pid_fd = syscall(SYS_pidfd_open, pid, 0);
+
+    if (worker_slot->pid_fd < 0) {
+        err = errno;
+        kill(pid, SIGKILL); waitpid(pid, NULL, 0);
+        worker_manager_release_slot(manager, slot);
+        errno = err;
+        return -4;
+    }
+
+    // Reads from pipe must not block while other workers are waiting
+    fcntl(worker_slot->pipe_fd, F_SETFL, O_NONBLOCK);
+
+    if (worker_manager_epoll_add(manager, worker_slot->pipe_fd, WORKER_EVENT_OUTPUT, slot) < 0 || worker_manager_epoll_add(manager, worker_slot->pid_fd, WORKER_EVENT_EXIT, slot) < 0) {
+        err = errno;
+        kill(pid, SIGKILL); waitpid(pid, NULL, 0);
+        worker_manager_release_slot(manager, slot);
+        errno = err;
+        return -5;
+    }
+
+    // Place jobs into slot, their files now belong to it
+    for (int j = 0; j < num_of_jobs; j++)
+        jobs[j].worker_pid = pid;
+
+    worker_slot->jobs = jobs;
+    worker_slot->num_of_jobs = num_of_jobs;
+    manager->worker_jobs[slot] = jobs[0];
+    clock_gettime(CLOCK_MONOTONIC, &manager->start_times[slot]);
+    *throttle_slot = worker_slot->throttle_slot;
+
+    worker_slot->timeout_ms = options.timeout_ms;
+    worker_slot->progress_ms = manager->start_times[slot].tv_sec * 1000LL + manager->start_times[slot].tv_nsec / 1000000;
+    worker_slot->progress_count = throttle_worker_progress(manager->throttle, manager->slot_base + slot);
+    worker_slot->size_ms = 0;
+    worker_slot->killed_ms = 0;
+
+    manager->active_workers++;
+    manager->taken--;
+    __atomic_add_fetch(&manager->pool->running, 1, __ATOMIC_RELAXED);
+    return pid;
+}
+
+int worker_manager_watchdog(struct worker_manager *manager, int *killed, int *timeout) {
+    long long now = worker_manager_now_ms();
+    int num_killed = 0;
+
+    for (int i = 0; i < manager->worker_limit; i++) {
+        struct worker_slot *slot = &manager->slots[i];
+
+        if (manager->worker_jobs[i].worker_pid == -1 || slot->pid_fd == -1 || slot->timeout_ms == 0 || slot->killed_ms != 0)
+            continue;
+
+        // The counter of the worker is its own, so a worker that hangs is killed even while the
+        // others of its pair copy from the same bucket
+        long long count = throttle_worker_progress(manager->throttle, manager->slot_base + i);
+
+        if (count != slot->progress_count) {
+            slot->progress_count = count;
+            slot->progress_ms = now;
+        }
+
+        long long remaining = slot->progress_ms + slot->timeout_ms + slot->size_ms - now;
+
+        // Progress since this check is only seen by the next one, which mustn't be much later
+        if (remaining > 0) {
+            if (remaining > WATCHDOG_CHECK_MS) remaining = WATCHDOG_CHECK_MS;
+            if (*timeout < 0 || remaining < *timeout) *timeout = remaining;
+            continue;
+        }
+
+        // Signal through the pidfd, so that a reused pid can never be hit
+        // SIGKILL also ends waits of a hung mount that other signals can't interrupt, once the mount allows it
+        if (syscall(SYS_pidfd_send_signal, slot->pid_fd, SIGKILL, NULL, 0) == 0) {
+            slot->killed_ms = now;
+            killed[num_killed++] = i;
+            __atomic_add_fetch(&manager->pool->stalled, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return num_killed;
+}
+
+int worker_manager_find_worker(struct worker_manager *manager, pid_t pid) {
+    for (int i = 0; i < manager->worker_limit; i++) {
+        if (manager->worker_jobs[i].worker_pid == pid)
+            return i;
     }
 
-    // If this is the child
-    if (pid == 0) {
-        // Copy write end to stdout
-        while (dup2(pipefd[WRITE_END], STDOUT_FILENO) < 0) {
-            if (errno != EINTR) {
-                close(pipefd[READ_END]); close(pipefd[WRITE_END]);
-                return -4;
-            }
+    return -1;
+}
+
+int worker_manager_file_busy(struct worker_manager *manager, char *src_dir, char *file) {
+    for (int i = 0; i < manager->worker_limit; i++) {
+        if (manager->worker_jobs[i].worker_pid == -1 || strcmp(manager->worker_jobs[i].src_dir, src_dir)) continue;
+
+        for (int j = 0; j < manager->slots[i].num_of_jobs; j++) {
+            if (!strcmp(manager->slots[i].jobs[j].file, file))
+                return 1;
         }
+    }
 
-        // Close both previous ends
-        close(pipefd[READ_END]); close(pipefd[WRITE_END]);
+    return 0;
+}
 
-        // Call worker
-        if (execl("./worker", "./worker", job.src_dir, job.tar_dir, job.file, job.operation, NULL) < 0) {
-            return -5;
+int worker_manager_cancel_worker(struct worker_manager *manager, int index) {
+    if (index < 0 || index >= manager->worker_limit || manager->slots[index].pid_fd == -1)
+        return -2;
+
+    // Signal through the pidfd, so that a reused pid can never be hit
+    return syscall(SYS_pidfd_send_signal, manager->slots[index].pid_fd, SIGTERM, NULL, 0) < 0? -1: 0;
+}
+
+int worker_manager_wait(struct worker_manager *manager, int timeout) {
+    return epoll_wait(manager->epoll_fd, manager->events, manager->max_events, timeout);
+}
+
+enum worker_event worker_manager_event_type(struct worker_manager *manager, int e) {
+    return manager->events[e].data.u64 >> 32;
+}
+
+int worker_manager_event_value(struct worker_manager *manager, int e) {
+    return (int) (uint32_t) manager->events[e].data.u64;
+}
+
+int worker_manager_read_output(struct worker_manager *manager, int index) {
+    struct worker_slot *slot = &manager->slots[index];
+
+    // Event may refer to a worker that was freed earlier in the same wait
+    if (slot->pid_fd == -1 || slot->pipe_fd == -1)
+        return -2;
+
+    while (1) {
+        // Resize buffer if needed
+        if (slot->output_len == slot->output_size) {
+            char *new_output = realloc(slot->output, 2 * slot->output_size * sizeof(char));
+            if (new_output == NULL) return -1;
+
+            slot->output = new_output;
+            slot->output_size *= 2;
+        }
+
+        ssize_t bytes = read(slot->pipe_fd, slot->output + slot->output_len, slot->output_size - slot->output_len);
+
+        if (bytes > 0) {
+            slot->output_len += bytes;
+            slot->progress_ms = worker_manager_now_ms();
+            worker_manager_take_sizes(slot);
+            continue;
         }
+
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+
+        // Worker has closed its end of the pipe or the pipe failed, no more output will come
+        worker_manager_epoll_close(manager, slot->pipe_fd);
+        slot->pipe_fd = -1;
+        return 0;
     }
+}
 
-    // If this is the parent
+int worker_manager_reap_worker(struct worker_manager *manager, int index) {
+    struct worker_slot *slot = &manager->slots[index];
 
-    // Close write end
-    close(pipefd[WRITE_END]);
+    if (slot->pid_fd == -1)
+        return -2;
+
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+
+    while (waitid(P_PIDFD, slot->pid_fd, &info, WEXITED) < 0) {
+        if (errno != EINTR) return -1;
+    }
+
+    // Exit code or signal of worker, in the format of waitpid
+    if (info.si_code == CLD_EXITED)
+        slot->exit_status = (info.si_status & 0xff) << 8;
+    else
+        slot->exit_status = info.si_status & 0x7f;
+
+    // Get the rest of the output
+    int result = slot->pipe_fd != -1 && worker_manager_read_output(manager, index) == -1? -1: 0;
+
+    // Worker can't be waited for again
+    worker_manager_epoll_close(manager, slot->pid_fd);
+    slot->pid_fd = -1;
+
+    return result;
+}
 
-    // Place job into array
-    manager->worker_jobs[slot].src_dir = malloc((strlen(job.src_dir)+1) * sizeof(char));
-    manager->worker_jobs[slot].tar_dir = malloc((strlen(job.tar_dir)+1) * sizeof(char));
-    manager->worker_jobs[slot].file = malloc((strlen(job.file)+1) * sizeof(char));
-    manager->worker_jobs[slot].operation = malloc((strlen(job.operation)+1) * sizeof(char));
+ssize_t worker_manager_read_line(struct worker_manager *manager, int index, char *buf, size_t nbytes) {
+    struct worker_slot *slot = &manager->slots[index];
 
-    if (manager->worker_jobs[slot].src_dir == NULL || manager->worker_jobs[slot].tar_dir == NULL || manager->worker_jobs[slot].file == NULL || manager->worker_jobs[slot].operation == NULL) 
+    if (slot->output == NULL || slot->output_pos >= slot->output_len)
         return -1;
 
-    strcpy(manager->worker_jobs[slot].src_dir, job.src_dir);
-    strcpy(manager->worker_jobs[slot].tar_dir, job.tar_dir);
-    strcpy(manager->worker_jobs[slot].file, job.file);
-    strcpy(manager->worker_jobs[slot].operation, job.operation);
-    manager->worker_jobs[slot].worker_pid = pid;
-    manager->worker_jobs[slot].sync_job = job.sync_job;
+    // Find end of line
+    char *start = slot->output + slot->output_pos;
+    size_t remaining = slot->output_len - slot->output_pos;
+    char *newline = memchr(start, '\n', remaining);
 
-    manager->active_workers++;
-    return pid;
+    size_t line_len = newline == NULL? remaining: (size_t) (newline - start) + 1;
+    if (line_len > nbytes-1) line_len = nbytes-1;
+
+    memcpy(buf, start, line_len);
+    buf[line_len] = '\0';
+
+    slot->output_pos += line_len;
+    return line_len;
+}
+
+void worker_manager_job_done(struct worker_manager *manager, int index, long long bytes) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long busy_ms = (now.tv_sec - manager->start_times[index].tv_sec) * 1000LL + (now.tv_nsec - manager->start_times[index].tv_nsec) / 1000000;
+
+    pthread_mutex_lock(&manager->pool->lock);
+    autoscaler_job_done(manager->pool->autoscaler, bytes, busy_ms);
+    pthread_mutex_unlock(&manager->pool->lock);
 }
 
 int worker_manager_free_worker(struct worker_manager *manager, int index) {
-    // Close read end
-    if (close(manager->pfds[index].fd) < 0)
+    if (manager->worker_jobs[index].worker_pid == -1)
         return -1;
 
-    // Make worker available
-    manager->pfds[index].fd = -1;
-    int_queue_enqueue(manager->slot_queue, index);
+    struct worker_pool *pool = manager->pool;
+
+    // Close pipe and process file descriptor and make worker available
+    worker_manager_release_slot(manager, index);
 
     // Free resources
-    free(manager->worker_jobs[index].file);
-    free(manager->worker_jobs[index].src_dir);
-    free(manager->worker_jobs[index].tar_dir);
-    free(manager->worker_jobs[index].operation);
+    worker_manager_free_jobs(&manager->slots[index]);
     manager->worker_jobs[index].worker_pid = -1;
 
     manager->active_workers--;
 
+    if (manager->slots[index].killed_ms != 0)
+        __atomic_sub_fetch(&pool->stalled, 1, __ATOMIC_RELAXED);
+
+    // Return worker to the pool before the waiting managers are woken up
+    __atomic_sub_fetch(&pool->running, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pool->active, 1, __ATOMIC_SEQ_CST);
+    worker_pool_wake(pool);
+
     return 0;
 }
 
-int worker_manager_index_is_console(struct worker_manager manager, int index) {
-    return (index == CONSOLE_INDEX);
+size_t worker_manager_memory(struct worker_manager *manager) {
+    size_t memory = manager->worker_limit * (sizeof(struct job_info) + sizeof(struct worker_slot) + sizeof(struct timespec));
+
+    for (int i = 0; i < manager->worker_limit; i++) {
+        if (manager->worker_jobs[i].worker_pid == -1) continue;
+
+        memory += manager->slots[i].num_of_jobs * sizeof(struct job_info) + manager->slots[i].output_size;
+
+        for (int j = 0; j < manager->slots[i].num_of_jobs; j++)
+            memory += strlen(manager->slots[i].jobs[j].file) + 1;
+    }
+
+    return memory;
 }
 
-int worker_manager_index_is_inotify(struct worker_manager manager, int index) {
-    return (index == INOTIFY_INDEX);
+int worker_manager_add_console(struct worker_manager *manager, int fd) {
+
+    // Consoles are edge triggered, so a console with queued responses wakes up a wait only when
+    // its socket gets room for them, all available requests are read on every event
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u64 = EVENT_DATA(WORKER_EVENT_CONSOLE_CLIENT, fd);
+
+    return epoll_ctl(manager->epoll_fd, EPOLL_CTL_ADD, fd, &event);
 }
 
-int worker_manager_index_is_worker(struct worker_manager manager, int index) {
-    return (index >= 2 && index <= manager.worker_limit+1);
+void worker_manager_remove_console(struct worker_manager *manager, int fd) {
+    epoll_ctl(manager->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 }
 
 void worker_manager_destroy(struct worker_manager *manager) {
     int_queue_destroy(manager->slot_queue);
-    free(manager->pfds);
 
     for (int i = 0; i < manager->worker_limit; i++) {
-        if (manager->worker_jobs[i].worker_pid != -1) {
-            free(manager->worker_jobs[i].file);
-            free(manager->worker_jobs[i].src_dir);
-            free(manager->worker_jobs[i].tar_dir);
-            free(manager->worker_jobs[i].operation);
-        }
+        if (manager->worker_jobs[i].worker_pid != -1)
+            worker_manager_free_jobs(&manager->slots[i]);
+
+        if (manager->slots[i].pipe_fd != -1) close(manager->slots[i].pipe_fd);
+        if (manager->slots[i].pid_fd != -1) close(manager->slots[i].pid_fd);
+        free(manager->slots[i].output);
     }
+
+    close(manager->inotify_fd);
+    close(manager->epoll_fd);
+    close(manager->worker_fd);
+    close(manager->wake_fd);
+    __atomic_store_n(&manager->pool->wake_fds[manager->shard], -1, __ATOMIC_RELAXED);
+
     free(manager->worker_jobs);
+    free(manager->slots);
+    free(manager->start_times);
+    free(manager->events);
+    throttle_destroy(manager->throttle);
+}
+
+// Adds fd to epoll instance, with type and value returned with its events
+// Returns 0 on success, -1 on error
+int worker_manager_epoll_add(struct worker_manager *manager, int fd, enum worker_event type, int value) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_DATA(type, value);
+
+    return epoll_ctl(manager->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Removes fd from epoll instance and closes it
+// Epoll drops a file on close only once every descriptor of it is closed. Workers are started with
+// posix_spawn, which returns after the child has executed worker through /proc/self/fd, and the files
+// of a slot are close-on-exec, so no worker keeps a copy of them. The explicit removal keeps an exited
+// worker's process file descriptor from waking up the loop even if a copy of it is ever left open.
+void worker_manager_epoll_close(struct worker_manager *manager, int fd) {
+    epoll_ctl(manager->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+// Closes files of slot, frees its output and puts it back to slot queue
+void worker_manager_release_slot(struct worker_manager *manager, int slot) {
+    struct worker_slot *worker_slot = &manager->slots[slot];
+
+    if (worker_slot->pipe_fd != -1) worker_manager_epoll_close(manager, worker_slot->pipe_fd);
+    if (worker_slot->pid_fd != -1) worker_manager_epoll_close(manager, worker_slot->pid_fd);
+
+    worker_slot->pipe_fd = -1;
+    worker_slot->pid_fd = -1;
+
+    free(worker_slot->output);
+    worker_slot->output = NULL;
+
+    int_queue_enqueue(manager->slot_queue, slot);
+}
+
+// Returns a throttle slot of manager that no active worker takes from
+// There is always one, since the active workers are fewer than the slots while a worker is set up
+int worker_manager_free_throttle_slot(struct worker_manager *manager) {
+    for (int t = manager->slot_base; t < manager->slot_base + manager->worker_limit; t++) {
+        int used = 0;
+
+        for (int i = 0; i < manager->worker_limit && !used; i++)
+            used = manager->worker_jobs[i].worker_pid != -1 && manager->slots[i].throttle_slot == t;
+
+        if (!used) return t;
+    }
+
+    return -1;
+}
+
+// Frees the jobs of slot and their files
+void worker_manager_free_jobs(struct worker_slot *slot) {
+    for (int j = 0; j < slot->num_of_jobs; j++)
+        free(slot->jobs[j].file);
+
+    free(slot->jobs);
+    slot->jobs = NULL;
+    slot->num_of_jobs = 0;
+}
+
+// Takes the SIZE lines out of the complete lines of output of slot that haven't been checked, the
+// last one sets the time the file the worker copies adds to its timeout
+void worker_manager_take_sizes(struct worker_slot *slot) {
+    char *line = slot->output + slot->output_scan;
+    char *end = slot->output + slot->output_len;
+    char *newline;
+
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        if ((size_t) (newline - line) < 6 || strncmp(line, "SIZE: ", 6)) {
+            line = newline + 1;
+            continue;
+        }
+
+        // The line ends with a newline, which ends the number
+        long long size = strtoll(line + 6, NULL, 10);
+        slot->size_ms = size / (TIMEOUT_MIN_RATE / 1000);
+
+        memmove(line, newline + 1, end - newline - 1);
+        end -= newline + 1 - line;
+    }
+
+    slot->output_len = end - slot->output;
+    slot->output_scan = line - slot->output;
+}
+
+// Returns CLOCK_MONOTONIC time in milliseconds
+long long worker_manager_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Takes up to wanted workers from the budget of pool, as many as the limit allows
+// Returns number of workers taken
+int worker_pool_take(struct worker_pool *pool, int wanted) {
+    int active = __atomic_load_n(&pool->active, __ATOMIC_SEQ_CST);
+    int taken;
+
+    do {
+        // Limit may have been lowered below the number of active workers
+        taken = worker_pool_limit(pool) - active;
+        if (taken <= 0) return 0;
+        if (taken > wanted) taken = wanted;
+    } while (!__atomic_compare_exchange_n(&pool->active, &active, active + taken, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    return taken;
+}
+
+// Wakes up the managers that are waiting for workers to become free, which try to take them again
+void worker_pool_wake(struct worker_pool *pool) {
+    unsigned long long waiting = __atomic_exchange_n(&pool->waiting, 0, __ATOMIC_SEQ_CST);
+    uint64_t one = 1;
+
+    for (int s = 0; waiting != 0; s++, waiting >>= 1) {
+        int fd = waiting & 1? __atomic_load_n(&pool->wake_fds[s], __ATOMIC_RELAXED): -1;
+        if (fd >= 0) write_bytes(fd, (char *) &one, sizeof(one));
+    }
 }